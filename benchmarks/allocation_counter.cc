@@ -0,0 +1,82 @@
+/* allocation_counter.cc
+
+   Replaces the global operator new and delete with counting ones
+*/
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<uint64_t> allocationCount(0);
+std::atomic<uint64_t> allocationBytes(0);
+
+void *allocate(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocationBytes.fetch_add(size, std::memory_order_relaxed);
+
+  return std::malloc(size == 0 ? 1 : size);
+}
+} // namespace
+
+void *operator new(std::size_t size) {
+  void *ptr = allocate(size);
+  if (ptr == nullptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+namespace Pistache {
+namespace Benchmarks {
+
+uint64_t allocations() {
+  return allocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t allocatedBytes() {
+  return allocationBytes.load(std::memory_order_relaxed);
+}
+
+AllocationCounter::AllocationCounter(benchmark::State &state)
+    : state_(state), allocations_(allocations()), bytes_(allocatedBytes()) {}
+
+AllocationCounter::~AllocationCounter() {
+  if (state_.thread_index() != 0)
+    return;
+
+  const auto made = static_cast<double>(allocations() - allocations_);
+  const auto bytes = static_cast<double>(allocatedBytes() - bytes_);
+
+  state_.counters["allocs/iter"] =
+      benchmark::Counter(made, benchmark::Counter::kAvgIterations);
+  state_.counters["bytes/iter"] =
+      benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+}
+
+} // namespace Benchmarks
+} // namespace Pistache
@@ -0,0 +1,46 @@
+/* allocation_counter.h
+
+   Counts the heap allocations made while a benchmark runs, reported along
+   with its timings.
+*/
+
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+namespace Pistache {
+namespace Benchmarks {
+
+// Allocations made so far by every thread, through operator new
+uint64_t allocations();
+uint64_t allocatedBytes();
+
+/* Reports the allocations made between its construction and its
+ * destruction as allocs/iter and bytes/iter counters. Constructed right
+ * before the benchmark loop:
+ *
+ *   AllocationCounter counter(state);
+ *   for (auto _ : state) { ... }
+ *
+ * Allocations are counted for the whole process: in multi-threaded
+ * benchmarks, only the first thread reports them, per iteration of all
+ * threads.
+ */
+class AllocationCounter {
+public:
+  explicit AllocationCounter(benchmark::State &state);
+  ~AllocationCounter();
+
+  AllocationCounter(const AllocationCounter &) = delete;
+  AllocationCounter &operator=(const AllocationCounter &) = delete;
+
+private:
+  benchmark::State &state_;
+  uint64_t allocations_;
+  uint64_t bytes_;
+};
+
+} // namespace Benchmarks
+} // namespace Pistache
@@ -0,0 +1,98 @@
+#include <pistache/async.h>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+using namespace Pistache;
+using Pistache::Benchmarks::AllocationCounter;
+
+namespace {
+// A continuation attached to an already resolved promise runs right away
+void BM_ThenResolved(benchmark::State &state) {
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    int result = 0;
+    auto promise = Async::Promise<int>::resolved(42);
+    promise.then([&](int value) { result = value; }, Async::NoExcept);
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+// Chains of continuations attached first, run when the promise is resolved
+void BM_ThenChain(benchmark::State &state) {
+  const auto length = state.range(0);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    std::unique_ptr<Async::Resolver> resolver;
+    Async::Promise<int> root([&](Async::Resolver &resolve, Async::Rejection &) {
+      resolver.reset(new Async::Resolver(resolve.clone()));
+    });
+
+    auto promise =
+        root.then([](int value) { return value + 1; }, Async::NoExcept);
+    for (int64_t i = 1; i < length; ++i)
+      promise =
+          promise.then([](int value) { return value + 1; }, Async::NoExcept);
+
+    int result = 0;
+    promise.then([&](int value) { result = value; }, Async::NoExcept);
+
+    (*resolver)(0);
+    if (result != length)
+      state.SkipWithError("The chain did not run to its end");
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * length);
+}
+
+// A rejection going through continuations that only handle values
+void BM_RejectChain(benchmark::State &state) {
+  const auto length = state.range(0);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto promise = Async::Promise<int>::rejected(std::runtime_error("failed"));
+
+    auto chained =
+        promise.then([](int value) { return value + 1; }, Async::Throw);
+    for (int64_t i = 1; i < length; ++i)
+      chained =
+          chained.then([](int value) { return value + 1; }, Async::Throw);
+
+    bool rejected = false;
+    chained.then([](int) {}, [&](std::exception_ptr) { rejected = true; });
+    if (!rejected)
+      state.SkipWithError("The rejection was not propagated");
+  }
+}
+
+void BM_WhenAll(benchmark::State &state) {
+  const auto count = state.range(0);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    std::vector<Async::Promise<int>> promises;
+    promises.reserve(static_cast<size_t>(count));
+    for (int64_t i = 0; i < count; ++i)
+      promises.push_back(Async::Promise<int>::resolved(static_cast<int>(i)));
+
+    size_t results = 0;
+    Async::whenAll(promises.begin(), promises.end())
+        .then([&](const std::vector<int> &values) { results = values.size(); },
+              Async::NoExcept);
+    if (results != static_cast<size_t>(count))
+      state.SkipWithError("Not every promise was resolved");
+  }
+}
+} // namespace
+
+BENCHMARK(BM_ThenResolved);
+BENCHMARK(BM_ThenChain)->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_RejectChain)->Arg(1)->Arg(4)->Arg(16);
+BENCHMARK(BM_WhenAll)->Arg(2)->Arg(16);
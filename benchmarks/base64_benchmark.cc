@@ -0,0 +1,62 @@
+#include <pistache/base64.h>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+
+#include <string>
+#include <vector>
+
+using Pistache::Benchmarks::AllocationCounter;
+
+namespace {
+std::vector<std::byte> bytes(size_t size) {
+  std::vector<std::byte> data(size);
+  for (size_t i = 0; i < size; ++i)
+    data[i] = static_cast<std::byte>((i * 7 + 3) & 0xff);
+  return data;
+}
+
+void BM_Base64Encode(benchmark::State &state) {
+  const auto data = bytes(static_cast<size_t>(state.range(0)));
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    Base64Encoder encoder(data);
+    benchmark::DoNotOptimize(encoder.Encode());
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+}
+
+void BM_Base64Decode(benchmark::State &state) {
+  const auto data = bytes(static_cast<size_t>(state.range(0)));
+  Base64Encoder encoder(data);
+  const std::string encoded = encoder.Encode();
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    Base64Decoder decoder(encoded);
+    benchmark::DoNotOptimize(decoder.Decode());
+  }
+
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+}
+
+// Credentials of a Basic Authorization header
+void BM_Base64EncodeString(benchmark::State &state) {
+  const std::string credentials = "Aladdin:open sesame";
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto encoded = Base64Encoder::EncodeString(credentials);
+    benchmark::DoNotOptimize(encoded);
+  }
+}
+} // namespace
+
+BENCHMARK(BM_Base64Encode)->Arg(16)->Arg(1024)->Arg(64 * 1024);
+BENCHMARK(BM_Base64Decode)->Arg(16)->Arg(1024)->Arg(64 * 1024);
+BENCHMARK(BM_Base64EncodeString);
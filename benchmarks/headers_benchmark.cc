@@ -0,0 +1,98 @@
+#include <pistache/http_headers.h>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+
+#include <memory>
+#include <string>
+
+using namespace Pistache;
+using namespace Pistache::Http;
+using Pistache::Benchmarks::AllocationCounter;
+
+namespace {
+// Headers of a typical response, typed ones and raw ones
+void fill(Header::Collection &headers) {
+  headers.add<Header::ContentType>(MIME(Application, Json));
+  headers.add<Header::ContentLength>(1024);
+  headers.add<Header::Server>("pistache/0.0.2");
+  headers.add<Header::Connection>(ConnectionControl::KeepAlive);
+  headers.addRaw(Header::Raw("Cache-Control", "max-age=60"));
+  headers.addRaw(Header::Raw("X-Request-Id", "0b3f7a2c-9d4e"));
+  headers.addRaw(Header::Raw("ETag", "\"5f0c1a2b-3c4d\""));
+  headers.addRaw(Header::Raw("Vary", "Accept-Encoding"));
+}
+
+void BM_AddHeaders(benchmark::State &state) {
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    Header::Collection headers;
+    fill(headers);
+    benchmark::DoNotOptimize(headers);
+  }
+}
+
+void BM_GetTypedHeader(benchmark::State &state) {
+  Header::Collection headers;
+  fill(headers);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto length = headers.tryGet<Header::ContentLength>();
+    benchmark::DoNotOptimize(length);
+  }
+}
+
+void BM_GetTypedHeaderByName(benchmark::State &state) {
+  Header::Collection headers;
+  fill(headers);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    // Looked up regardless of the case
+    auto length = headers.tryGet("content-length");
+    benchmark::DoNotOptimize(length);
+  }
+}
+
+void BM_GetRawHeader(benchmark::State &state) {
+  Header::Collection headers;
+  fill(headers);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto id = headers.tryGetRaw("X-Request-Id");
+    benchmark::DoNotOptimize(id);
+  }
+}
+
+void BM_MissingHeader(benchmark::State &state) {
+  Header::Collection headers;
+  fill(headers);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto has = headers.has<Header::Authorization>();
+    benchmark::DoNotOptimize(has);
+  }
+}
+
+void BM_ListHeaders(benchmark::State &state) {
+  Header::Collection headers;
+  fill(headers);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    auto list = headers.list();
+    benchmark::DoNotOptimize(list);
+  }
+}
+} // namespace
+
+BENCHMARK(BM_AddHeaders);
+BENCHMARK(BM_GetTypedHeader);
+BENCHMARK(BM_GetTypedHeaderByName);
+BENCHMARK(BM_GetRawHeader);
+BENCHMARK(BM_MissingHeader);
+BENCHMARK(BM_ListHeaders);
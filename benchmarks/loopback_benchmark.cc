@@ -0,0 +1,725 @@
+/* loopback_benchmark.cc
+
+   End-to-end benchmark of an Http::Endpoint served in-process and driven
+   over loopback.
+
+   Every configuration of the matrix (handler variant, worker threads,
+   payload size, keep-alive, pipelining depth) gets an endpoint of its own.
+   Client threads talk to it over raw sockets, each one on its own
+   connection, so that the client side stays cheap and does not depend on
+   the code being measured. Latencies are recorded in an HdrHistogram once
+   the warmup is over; the CPU time of the process, minus the one of the
+   client threads, is the CPU time of the server.
+
+   The results are written as JSON, to be compared across commits.
+*/
+
+#include <pistache/endpoint.h>
+#include <pistache/hdr_histogram.h>
+#include <pistache/http.h>
+#include <pistache/router.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Pistache;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Size of the chunks the streaming variant writes its payload in
+constexpr size_t StreamChunkSize = 4096;
+
+// Routes registered along with the measured one in the rest variant
+constexpr int OtherRoutes = 50;
+
+struct Settings {
+  std::vector<std::string> variants = {"plain", "rest", "stream"};
+  std::vector<int> workers = {1, 4};
+  std::vector<size_t> payloads = {0, 1024, 64 * 1024};
+  std::vector<bool> keepAlive = {true, false};
+  std::vector<size_t> pipelines = {1, 8};
+  size_t clients = 4;
+  std::chrono::milliseconds duration = std::chrono::seconds(1);
+  std::chrono::milliseconds warmup = std::chrono::milliseconds(200);
+  bool noDelay = false;
+  std::string label;
+  std::string output = "-";
+};
+
+struct Config {
+  std::string variant;
+  int workers;
+  size_t payload;
+  bool keepAlive;
+  size_t pipeline;
+};
+
+struct Result {
+  Config config;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  double seconds = 0.0;
+  HdrHistogram latencies;
+  double cpuSeconds = 0.0;
+  double serverCpuSeconds = 0.0;
+};
+
+void usage(std::ostream &os) {
+  os << "Usage: run_loopback_benchmark [options]\n"
+        "\n"
+        "Lists are separated by commas.\n"
+        "\n"
+        "  --variants <list>    handlers: plain, rest, stream (all)\n"
+        "  --workers <list>     worker threads of the endpoint (1,4)\n"
+        "  --payloads <list>    sizes of the response bodies, in bytes "
+        "(0,1024,65536)\n"
+        "  --keepalive <list>   on, off (on,off)\n"
+        "  --pipeline <list>    requests sent ahead of the responses on "
+        "kept-alive\n"
+        "                       connections (1,8)\n"
+        "  --clients <N>        client threads, one connection each (4)\n"
+        "  --duration <T>       measured time per configuration, as 1s, "
+        "500ms (1s)\n"
+        "  --warmup <T>         time before the measure starts (200ms)\n"
+        "  --nodelay            disables Nagle's algorithm on the connections "
+        "of the\n"
+        "                       endpoint\n"
+        "  --label <text>       label of the run, such as a commit\n"
+        "  --output <file>      where to write the JSON results, - for the "
+        "standard\n"
+        "                       output (-)\n"
+        "  -h, --help           prints this help\n";
+}
+
+std::vector<std::string> split(const std::string &text) {
+  std::vector<std::string> items;
+  std::istringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ','))
+    if (!item.empty())
+      items.push_back(item);
+
+  if (items.empty())
+    throw std::invalid_argument("Empty list: " + text);
+  return items;
+}
+
+std::chrono::milliseconds parseDuration(const std::string &text) {
+  size_t end = 0;
+  const double value = std::stod(text, &end);
+  const auto unit = text.substr(end);
+
+  double ms;
+  if (unit.empty() || unit == "s")
+    ms = value * 1000.0;
+  else if (unit == "ms")
+    ms = value;
+  else
+    throw std::invalid_argument("Invalid duration: " + text);
+
+  return std::chrono::milliseconds(static_cast<int64_t>(ms));
+}
+
+size_t parseSize(const std::string &text, bool zeroAllowed) {
+  const auto value = std::stoll(text);
+  if (value < 0 || (value == 0 && !zeroAllowed))
+    throw std::invalid_argument("Invalid number: " + text);
+  return static_cast<size_t>(value);
+}
+
+Settings parseArguments(int argc, char *argv[]) {
+  enum Option {
+    Variants = 256,
+    Workers,
+    Payloads,
+    KeepAlive,
+    Pipeline,
+    Clients,
+    Duration,
+    Warmup,
+    NoDelay,
+    Label,
+    Output
+  };
+
+  static const struct option options[] = {
+      {"variants", required_argument, nullptr, Variants},
+      {"workers", required_argument, nullptr, Workers},
+      {"payloads", required_argument, nullptr, Payloads},
+      {"keepalive", required_argument, nullptr, KeepAlive},
+      {"pipeline", required_argument, nullptr, Pipeline},
+      {"clients", required_argument, nullptr, Clients},
+      {"duration", required_argument, nullptr, Duration},
+      {"warmup", required_argument, nullptr, Warmup},
+      {"nodelay", no_argument, nullptr, NoDelay},
+      {"label", required_argument, nullptr, Label},
+      {"output", required_argument, nullptr, Output},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+
+  Settings settings;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", options, nullptr)) != -1) {
+    const std::string arg = optarg ? optarg : "";
+    switch (opt) {
+    case Variants:
+      settings.variants = split(arg);
+      for (const auto &variant : settings.variants)
+        if (variant != "plain" && variant != "rest" && variant != "stream")
+          throw std::invalid_argument("Unknown variant: " + variant);
+      break;
+    case Workers:
+      settings.workers.clear();
+      for (const auto &item : split(arg))
+        settings.workers.push_back(static_cast<int>(parseSize(item, false)));
+      break;
+    case Payloads:
+      settings.payloads.clear();
+      for (const auto &item : split(arg))
+        settings.payloads.push_back(parseSize(item, true));
+      break;
+    case KeepAlive:
+      settings.keepAlive.clear();
+      for (const auto &item : split(arg)) {
+        if (item != "on" && item != "off")
+          throw std::invalid_argument("Invalid keep-alive: " + item);
+        settings.keepAlive.push_back(item == "on");
+      }
+      break;
+    case Pipeline:
+      settings.pipelines.clear();
+      for (const auto &item : split(arg))
+        settings.pipelines.push_back(parseSize(item, false));
+      break;
+    case Clients:
+      settings.clients = parseSize(arg, false);
+      break;
+    case Duration:
+      settings.duration = parseDuration(arg);
+      break;
+    case Warmup:
+      settings.warmup = parseDuration(arg);
+      break;
+    case NoDelay:
+      settings.noDelay = true;
+      break;
+    case Label:
+      settings.label = arg;
+      break;
+    case Output:
+      settings.output = arg;
+      break;
+    case 'h':
+      usage(std::cout);
+      std::exit(0);
+    default:
+      usage(std::cerr);
+      std::exit(1);
+    }
+  }
+
+  return settings;
+}
+
+class PlainHandler : public Http::Handler {
+public:
+  HTTP_PROTOTYPE(PlainHandler)
+
+  explicit PlainHandler(std::shared_ptr<const std::string> payload)
+      : payload_(std::move(payload)) {}
+
+  void onRequest(const Http::Request & /*request*/,
+                 Http::ResponseWriter writer) override {
+    writer.send(Http::Code::Ok, *payload_);
+  }
+
+private:
+  std::shared_ptr<const std::string> payload_;
+};
+
+// Chunked response, the payload being written a chunk at a time
+class StreamHandler : public Http::Handler {
+public:
+  HTTP_PROTOTYPE(StreamHandler)
+
+  explicit StreamHandler(std::shared_ptr<const std::string> payload)
+      : payload_(std::move(payload)) {}
+
+  void onRequest(const Http::Request & /*request*/,
+                 Http::ResponseWriter writer) override {
+    auto stream = writer.stream(Http::Code::Ok);
+    for (size_t offset = 0; offset < payload_->size();
+         offset += StreamChunkSize) {
+      const auto size = std::min(StreamChunkSize, payload_->size() - offset);
+      stream.write(payload_->data() + offset,
+                   static_cast<std::streamsize>(size));
+      stream.flush();
+    }
+    stream.ends();
+  }
+
+private:
+  std::shared_ptr<const std::string> payload_;
+};
+
+std::shared_ptr<Http::Handler>
+makeHandler(const std::string &variant,
+            std::shared_ptr<const std::string> payload) {
+  if (variant == "stream")
+    return Http::make_handler<StreamHandler>(payload);
+  if (variant == "plain")
+    return Http::make_handler<PlainHandler>(payload);
+
+  const auto unused = [](const Rest::Request &, Http::ResponseWriter writer) {
+    writer.send(Http::Code::Not_Found);
+    return Rest::Route::Result::Ok;
+  };
+
+  Rest::Router router;
+  for (int i = 0; i < OtherRoutes; ++i)
+    Rest::Routes::Get(router, "/api/v1/resource" + std::to_string(i) + "/:id",
+                      unused);
+  Rest::Routes::Get(
+      router, "/api/v1/items/:id",
+      [payload](const Rest::Request &, Http::ResponseWriter writer) {
+        writer.send(Http::Code::Ok, *payload);
+        return Rest::Route::Result::Ok;
+      });
+  return router.handler();
+}
+
+std::string pathOf(const std::string &variant) {
+  return variant == "rest" ? "/api/v1/items/42" : "/payload";
+}
+
+double threadCpuSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+double processCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  const auto seconds = [](const struct timeval &tv) {
+    return static_cast<double>(tv.tv_sec) +
+           static_cast<double>(tv.tv_usec) / 1e6;
+  };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+// Blocking connection reading the responses with a minimal parser
+class Connection {
+public:
+  explicit Connection(uint16_t port)
+      : port_(port), fd_(-1), buffer_(), begin_(0) {}
+
+  ~Connection() { close(); }
+
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  bool open() {
+    close();
+
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ == -1)
+      return false;
+
+    int one = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Reset rather than linger in TIME_WAIT, short-lived connections would
+    // run out of ports otherwise
+    struct linger lingering = {1, 0};
+    ::setsockopt(fd_, SOL_SOCKET, SO_LINGER, &lingering, sizeof(lingering));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port_);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof(addr)) == -1) {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void close() {
+    if (fd_ != -1)
+      ::close(fd_);
+    fd_ = -1;
+    buffer_.clear();
+    begin_ = 0;
+  }
+
+  bool send(const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      const auto bytes =
+          ::send(fd_, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      if (bytes == -1 && errno == EINTR)
+        continue;
+      if (bytes <= 0)
+        return false;
+      sent += static_cast<size_t>(bytes);
+    }
+    return true;
+  }
+
+  // Reads a whole response, false if it is not a 200 or could not be read
+  bool readResponse() {
+    size_t headersEnd;
+    while ((headersEnd = buffer_.find("\r\n\r\n", begin_)) ==
+           std::string::npos) {
+      if (!fill())
+        return false;
+    }
+
+    const std::string headers =
+        lowercase(buffer_.substr(begin_, headersEnd - begin_));
+    const bool ok = headers.compare(0, 12, "http/1.1 200") == 0;
+    begin_ = headersEnd + 4;
+
+    if (headers.find("\r\ntransfer-encoding: chunked") != std::string::npos)
+      return readChunks() && ok;
+
+    size_t length = 0;
+    const auto field = headers.find("\r\ncontent-length:");
+    if (field != std::string::npos)
+      length = std::strtoul(headers.c_str() + field + 17, nullptr, 10);
+
+    return skip(length) && ok;
+  }
+
+private:
+  static std::string lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(),
+                   [](char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+  }
+
+  bool readChunks() {
+    for (;;) {
+      size_t lineEnd;
+      while ((lineEnd = buffer_.find("\r\n", begin_)) == std::string::npos) {
+        if (!fill())
+          return false;
+      }
+
+      const auto size = std::strtoul(buffer_.c_str() + begin_, nullptr, 16);
+      begin_ = lineEnd + 2;
+
+      // Every chunk, the last empty one included, ends with a CRLF
+      if (!skip(size + 2))
+        return false;
+      if (size == 0)
+        return true;
+    }
+  }
+
+  bool skip(size_t size) {
+    while (buffer_.size() - begin_ < size) {
+      if (!fill())
+        return false;
+    }
+    begin_ += size;
+    return true;
+  }
+
+  bool fill() {
+    if (begin_ == buffer_.size()) {
+      buffer_.clear();
+      begin_ = 0;
+    } else if (begin_ > 64 * 1024) {
+      buffer_.erase(0, begin_);
+      begin_ = 0;
+    }
+
+    char data[64 * 1024];
+    for (;;) {
+      const auto bytes = ::recv(fd_, data, sizeof(data), 0);
+      if (bytes == -1 && errno == EINTR)
+        continue;
+      if (bytes <= 0)
+        return false;
+      buffer_.append(data, static_cast<size_t>(bytes));
+      return true;
+    }
+  }
+
+  uint16_t port_;
+  int fd_;
+  std::string buffer_;
+  size_t begin_;
+};
+
+struct ClientStats {
+  HdrHistogram latencies;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  double cpuSeconds = 0.0;
+};
+
+void runClient(const Config &config, uint16_t port, const std::string &path,
+               Clock::time_point measureFrom, Clock::time_point deadline,
+               ClientStats &stats) {
+  std::string request = "GET " + path +
+                        " HTTP/1.1\r\n"
+                        "Host: 127.0.0.1\r\n"
+                        "User-Agent: pistache-loopback\r\n";
+  request += config.keepAlive ? "Connection: keep-alive\r\n\r\n"
+                              : "Connection: close\r\n\r\n";
+
+  std::string batch;
+  for (size_t i = 0; i < config.pipeline; ++i)
+    batch += request;
+
+  Connection connection(port);
+  bool connected = false;
+  bool measuring = false;
+  double cpuStart = 0.0;
+
+  for (;;) {
+    const auto start = Clock::now();
+    if (start >= deadline)
+      break;
+
+    if (!measuring && start >= measureFrom) {
+      measuring = true;
+      cpuStart = threadCpuSeconds();
+    }
+
+    if (!connected && !connection.open()) {
+      if (measuring)
+        ++stats.errors;
+      continue;
+    }
+    connected = true;
+
+    bool failed = !connection.send(batch);
+    for (size_t i = 0; i < config.pipeline && !failed; ++i) {
+      failed = !connection.readResponse();
+      if (failed)
+        break;
+
+      if (measuring) {
+        const auto latency = std::chrono::duration_cast<
+            std::chrono::microseconds>(Clock::now() - start);
+        stats.latencies.record(
+            static_cast<uint64_t>(std::max<int64_t>(latency.count(), 1)));
+        ++stats.requests;
+      }
+    }
+
+    if (failed && measuring)
+      ++stats.errors;
+
+    if (failed || !config.keepAlive) {
+      connection.close();
+      connected = false;
+    }
+  }
+
+  if (measuring)
+    stats.cpuSeconds = threadCpuSeconds() - cpuStart;
+}
+
+Result run(const Settings &settings, const Config &config) {
+  auto payload = std::make_shared<const std::string>(config.payload, 'x');
+
+  auto server = std::make_shared<Http::Endpoint>(
+      Address("127.0.0.1", Port(0)));
+  Flags<Tcp::Options> flags(Tcp::Options::ReuseAddr);
+  if (settings.noDelay)
+    flags = flags | Tcp::Options::NoDelay;
+
+  server->init(Http::Endpoint::options()
+                   .threads(config.workers)
+                   .flags(flags)
+                   .maxRequestSize(64 * 1024));
+  server->setHandler(makeHandler(config.variant, payload));
+  server->serveThreaded();
+
+  const auto port = static_cast<uint16_t>(server->getPort());
+  const auto path = pathOf(config.variant);
+
+  const auto measureFrom = Clock::now() + settings.warmup;
+  const auto deadline = measureFrom + settings.duration;
+
+  std::vector<ClientStats> stats(settings.clients);
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < settings.clients; ++i)
+    clients.emplace_back(runClient, std::cref(config), port, std::cref(path),
+                         measureFrom, deadline, std::ref(stats[i]));
+
+  std::this_thread::sleep_until(measureFrom);
+  const auto cpuStart = processCpuSeconds();
+  std::this_thread::sleep_until(deadline);
+  const auto cpuEnd = processCpuSeconds();
+
+  for (auto &client : clients)
+    client.join();
+  server->shutdown();
+
+  Result result;
+  result.config = config;
+  result.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(
+                       settings.duration)
+                       .count();
+
+  double clientCpuSeconds = 0.0;
+  for (const auto &client : stats) {
+    result.latencies.add(client.latencies);
+    result.requests += client.requests;
+    result.errors += client.errors;
+    clientCpuSeconds += client.cpuSeconds;
+  }
+
+  result.cpuSeconds = cpuEnd - cpuStart;
+  result.serverCpuSeconds =
+      std::max(result.cpuSeconds - clientCpuSeconds, 0.0);
+  return result;
+}
+
+std::string quote(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+void writeJson(std::ostream &os, const Settings &settings,
+               const std::vector<Result> &results) {
+  const auto perRequest = [](double seconds, uint64_t requests) {
+    return requests == 0 ? 0.0 : seconds * 1e6 / static_cast<double>(requests);
+  };
+
+  os << "{\n"
+     << "  \"benchmark\": \"loopback\",\n"
+     << "  \"label\": " << quote(settings.label) << ",\n"
+     << "  \"clients\": " << settings.clients << ",\n"
+     << "  \"duration_ms\": " << settings.duration.count() << ",\n"
+     << "  \"warmup_ms\": " << settings.warmup.count() << ",\n"
+     << "  \"nodelay\": " << (settings.noDelay ? "true" : "false") << ",\n"
+     << "  \"results\": [";
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    const auto &config = result.config;
+    const auto &latencies = result.latencies;
+
+    os << (i == 0 ? "\n" : ",\n") << "    {\"variant\": "
+       << quote(config.variant) << ", \"workers\": " << config.workers
+       << ", \"payload\": " << config.payload << ", \"keepalive\": "
+       << (config.keepAlive ? "true" : "false")
+       << ", \"pipeline\": " << config.pipeline << ",\n"
+       << "     \"requests\": " << result.requests
+       << ", \"errors\": " << result.errors << ", \"requests_per_sec\": "
+       << static_cast<double>(result.requests) / result.seconds << ",\n"
+       << "     \"latency_us\": {\"p50\": "
+       << latencies.valueAtPercentile(50.0)
+       << ", \"p99\": " << latencies.valueAtPercentile(99.0)
+       << ", \"p99.9\": " << latencies.valueAtPercentile(99.9)
+       << ", \"max\": " << latencies.max()
+       << ", \"mean\": " << latencies.mean() << "},\n"
+       << "     \"cpu_us_per_request\": {\"server\": "
+       << perRequest(result.serverCpuSeconds, result.requests)
+       << ", \"total\": " << perRequest(result.cpuSeconds, result.requests)
+       << "}}";
+  }
+
+  os << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Settings settings;
+  try {
+    settings = parseArguments(argc, argv);
+  } catch (const std::exception &e) {
+    std::cerr << "run_loopback_benchmark: " << e.what() << std::endl;
+    return 1;
+  }
+
+  std::vector<Config> configs;
+  for (const auto &variant : settings.variants)
+    for (int workers : settings.workers)
+      for (size_t payload : settings.payloads)
+        for (bool keepAlive : settings.keepAlive)
+          for (size_t pipeline : settings.pipelines) {
+            // Requests are only pipelined on kept-alive connections
+            if (!keepAlive && pipeline > 1)
+              continue;
+            configs.push_back({variant, workers, payload, keepAlive, pipeline});
+          }
+
+  std::vector<Result> results;
+  for (const auto &config : configs) {
+    std::cerr << config.variant << ", " << config.workers << " workers, "
+              << config.payload << " bytes, keep-alive "
+              << (config.keepAlive ? "on" : "off") << ", pipeline "
+              << config.pipeline << ": " << std::flush;
+
+    results.push_back(run(settings, config));
+
+    const auto &result = results.back();
+    std::cerr << static_cast<uint64_t>(static_cast<double>(result.requests) /
+                                       result.seconds)
+              << " requests/s, p99 " << result.latencies.valueAtPercentile(99.0)
+              << "us";
+    if (result.errors > 0)
+      std::cerr << ", " << result.errors << " errors";
+    std::cerr << std::endl;
+  }
+
+  if (settings.output == "-") {
+    writeJson(std::cout, settings, results);
+  } else {
+    std::ofstream file(settings.output);
+    if (!file) {
+      std::cerr << "run_loopback_benchmark: could not write "
+                << settings.output << std::endl;
+      return 1;
+    }
+    writeJson(file, settings, results);
+  }
+
+  return 0;
+}
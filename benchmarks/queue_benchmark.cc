@@ -0,0 +1,136 @@
+#include <pistache/mailbox.h>
+#include <pistache/os.h>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Pistache;
+using Pistache::Benchmarks::AllocationCounter;
+
+namespace {
+constexpr size_t MPMCQueueSize = 1024;
+
+void BM_QueuePushPop(benchmark::State &state) {
+  Queue<int> queue;
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    queue.push(42);
+    auto value = queue.popSafe();
+    benchmark::DoNotOptimize(value);
+  }
+}
+
+// Every thread produces, the first one also consumes what was produced
+void BM_QueueProducers(benchmark::State &state) {
+  static Queue<int> *queue = nullptr;
+  if (state.thread_index() == 0)
+    queue = new Queue<int>;
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    queue->push(42);
+    if (state.thread_index() == 0) {
+      while (auto value = queue->popSafe())
+        benchmark::DoNotOptimize(value);
+    }
+  }
+
+  if (state.thread_index() == 0) {
+    delete queue;
+    queue = nullptr;
+  }
+}
+
+void BM_MPMCQueue(benchmark::State &state) {
+  static MPMCQueue<int, MPMCQueueSize> *queue = nullptr;
+  if (state.thread_index() == 0)
+    queue = new MPMCQueue<int, MPMCQueueSize>;
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    // Enqueueing fails while a dequeue of the previous round of the same
+    // cell is not done yet
+    while (!queue->enqueue(42)) {
+    }
+    int value = 0;
+    while (!queue->dequeue(value)) {
+    }
+    benchmark::DoNotOptimize(value);
+  }
+
+  if (state.thread_index() == 0) {
+    delete queue;
+    queue = nullptr;
+  }
+}
+
+// Pushing to a queue bound to a poller also notifies its eventfd
+void BM_PollableQueuePushPop(benchmark::State &state) {
+  Polling::Epoll poller;
+  PollableQueue<int> queue;
+  queue.bind(poller);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    queue.push(42);
+    auto value = queue.popSafe();
+    benchmark::DoNotOptimize(value);
+  }
+
+  queue.unbind(poller);
+}
+
+/* Items handed to a thread waiting on the poller the queue is bound to, as
+ * done with the transports of the reactor
+ */
+void BM_PollableQueueCrossThread(benchmark::State &state) {
+  Polling::Epoll poller;
+  PollableQueue<int> queue;
+  queue.bind(poller);
+
+  std::atomic<bool> running(true);
+  std::atomic<int64_t> consumed(0);
+
+  std::thread consumer([&] {
+    std::vector<Polling::Event> events;
+    while (running.load()) {
+      events.clear();
+      if (poller.poll(events, std::chrono::milliseconds(10)) <= 0)
+        continue;
+
+      while (auto value = queue.popSafe()) {
+        benchmark::DoNotOptimize(value);
+        consumed.fetch_add(1, std::memory_order_release);
+      }
+    }
+  });
+
+  AllocationCounter counter(state);
+  for (auto _ : state)
+    queue.push(42);
+
+  const auto produced = static_cast<int64_t>(state.iterations());
+  while (consumed.load(std::memory_order_acquire) < produced)
+    std::this_thread::yield();
+
+  running = false;
+  consumer.join();
+  queue.unbind(poller);
+
+  state.SetItemsProcessed(produced);
+}
+} // namespace
+
+BENCHMARK(BM_QueuePushPop);
+BENCHMARK(BM_QueueProducers)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_MPMCQueue)->ThreadRange(1, 4)->UseRealTime();
+BENCHMARK(BM_PollableQueuePushPop);
+BENCHMARK(BM_PollableQueueCrossThread)->UseRealTime();
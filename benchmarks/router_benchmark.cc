@@ -0,0 +1,106 @@
+#include <pistache/http.h>
+#include <pistache/peer.h>
+#include <pistache/router.h>
+#include <pistache/transport.h>
+
+#include <benchmark/benchmark.h>
+
+#include "allocation_counter.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+using namespace Pistache;
+using namespace Pistache::Rest;
+using Pistache::Benchmarks::AllocationCounter;
+
+namespace {
+Route::Result ignore(const Rest::Request &, Http::ResponseWriter) {
+  return Route::Result::Ok;
+}
+
+// Every third route is static, the others have one or two parameters
+std::string routeAt(int64_t i) {
+  const auto name = "/api/v1/resource" + std::to_string(i);
+  switch (i % 3) {
+  case 0:
+    return name + "/list";
+  case 1:
+    return name + "/:id";
+  default:
+    return name + "/:id/items/:item";
+  }
+}
+
+std::string requestFor(int64_t i) {
+  const auto name = "/api/v1/resource" + std::to_string(i);
+  switch (i % 3) {
+  case 0:
+    return name + "/list";
+  case 1:
+    return name + "/42";
+  default:
+    return name + "/42/items/7";
+  }
+}
+
+// Resolving the route of a path, as done by Router::route for every request
+void BM_FindRoute(benchmark::State &state) {
+  const auto count = state.range(0);
+
+  // The tree refers to the paths, kept alive the same way Router does
+  SegmentTreeNode routes;
+  for (int64_t i = 0; i < count; ++i) {
+    const auto sanitized = SegmentTreeNode::sanitizeResource(routeAt(i));
+    std::shared_ptr<char> ptr(new char[sanitized.size()],
+                              std::default_delete<char[]>());
+    std::memcpy(ptr.get(), sanitized.data(), sanitized.size());
+    routes.addRoute(std::string_view{ptr.get(), sanitized.size()}, ignore,
+                    ptr);
+  }
+
+  const auto request = requestFor(count / 2 + 1);
+
+  AllocationCounter counter(state);
+  for (auto _ : state) {
+    const auto path = SegmentTreeNode::sanitizeResource(request);
+    auto result = routes.findRoute({path.data(), path.size()});
+    if (std::get<0>(result) == nullptr)
+      state.SkipWithError("No route found");
+    benchmark::DoNotOptimize(result);
+  }
+}
+
+/* Requests going through the RouterHandler of an endpoint, from the bytes
+ * read on the connection to the route handler. The transport is not
+ * registered with a reactor, the route handler does not answer.
+ */
+void BM_RouteRequest(benchmark::State &state) {
+  const auto count = state.range(0);
+
+  Router router;
+  for (int64_t i = 0; i < count; ++i)
+    router.get(routeAt(i), ignore);
+
+  const auto request = "GET " + requestFor(count / 2 + 1) +
+                       " HTTP/1.1\r\n"
+                       "Host: localhost\r\n"
+                       "Connection: keep-alive\r\n"
+                       "\r\n";
+
+  auto handler = router.handler();
+  Tcp::Handler &tcpHandler = *handler;
+  Tcp::Transport transport(handler);
+
+  auto peer = Tcp::Peer::Create(-1, Address("127.0.0.1", Port(0)));
+  tcpHandler.onConnection(peer);
+
+  AllocationCounter counter(state);
+  for (auto _ : state)
+    tcpHandler.onInput(request.data(), request.size(), peer);
+}
+} // namespace
+
+BENCHMARK(BM_FindRoute)->RangeMultiplier(10)->Range(10, 1000);
+BENCHMARK(BM_RouteRequest)->RangeMultiplier(10)->Range(10, 1000);
@@ -0,0 +1,205 @@
+/* access_log.h
+
+   Access log of an endpoint.
+
+   The entry of a response is prepared when the response is queued, with
+   the request line, the status, the address of the peer and a selection of
+   request headers. Once its last byte is written, the entry, along with
+   the size and latency of the response, is copied into a ring of the
+   worker. No lock is contended, unless responses are sent from other
+   threads, and once the slots of the ring have grown to the size of the
+   entries, no memory is allocated to record them. A thread of the log
+   drains the rings periodically, formats the entries as JSON lines and
+   appends them to a file, or to the standard output, with a single write
+   per batch.
+
+   When the file grows past a size, it is rotated: path becomes path.1,
+   path.1 becomes path.2 and so on. When a ring is full, the entry is
+   dropped and counted rather than delaying the worker.
+*/
+
+#pragma once
+
+#include <pistache/http.h>
+#include <pistache/log.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Pistache {
+
+namespace Tcp {
+class Listener;
+}
+
+namespace Http {
+
+struct AccessLogEntry {
+  AccessLogEntry();
+
+  std::chrono::system_clock::time_point time;
+  Method method;
+  Version version;
+  std::string resource;
+  Code code;
+  // Of the status line, headers and body, chunks included
+  ssize_t bytes;
+  // From the request being parsed to the last byte of its response being
+  // written
+  std::chrono::microseconds latency;
+  std::string peer;
+  // Values of the logged headers, in the order of the options. Empty when
+  // the request did not have the header
+  std::vector<std::string> headers;
+};
+
+// Entries of a worker, popped by the thread of the log. Pushed by the worker,
+// or by the threads a response is sent from, one at a time
+class AccessLogRing {
+public:
+  AccessLogRing(size_t capacity, std::vector<std::string> headers);
+
+  AccessLogRing(const AccessLogRing &) = delete;
+  AccessLogRing &operator=(const AccessLogRing &) = delete;
+
+  // Fills the fields of an entry that come from its request
+  void prepare(AccessLogEntry &entry, const Request &request,
+               const std::shared_ptr<Tcp::Peer> &peer) const;
+  void record(const AccessLogEntry &entry);
+
+  // Entries not recorded because the ring was full
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+  friend class AccessLog;
+
+  template <typename Func> void drain(Func func) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    const auto head = head_.load(std::memory_order_acquire);
+    for (; tail != head; ++tail) {
+      func(slots_[tail % slots_.size()]);
+      tail_.store(tail + 1, std::memory_order_release);
+    }
+  }
+
+  const std::vector<std::string> headers_;
+  std::vector<AccessLogEntry> slots_;
+  // Held while an entry is pushed, uncontended unless responses are sent
+  // from other threads than the worker
+  std::atomic_flag pushing_ = ATOMIC_FLAG_INIT;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  std::atomic<uint64_t> dropped_;
+};
+
+/* Entry of a response on its way out. It is shared by the writer of the
+ * response, its clones and its stream, and by the writes of the response
+ * until they complete. The entry is recorded once the last of them lets go
+ * of it: by then the whole response was written.
+ */
+class PendingAccessLogEntry {
+public:
+  PendingAccessLogEntry(std::shared_ptr<AccessLogRing> ring,
+                        const Request &request, Code code,
+                        const std::shared_ptr<Tcp::Peer> &peer,
+                        std::chrono::steady_clock::time_point received);
+  ~PendingAccessLogEntry();
+
+  PendingAccessLogEntry(const PendingAccessLogEntry &) = delete;
+  PendingAccessLogEntry &operator=(const PendingAccessLogEntry &) = delete;
+
+  // Bytes of the response handed to the transport
+  void addBytes(ssize_t bytes) { entry_.bytes += bytes; }
+
+private:
+  std::shared_ptr<AccessLogRing> ring_;
+  AccessLogEntry entry_;
+  std::chrono::steady_clock::time_point received_;
+};
+
+class AccessLog {
+public:
+  class Options {
+  public:
+    friend class AccessLog;
+
+    // File the entries are appended to, the standard output when empty
+    Options &path(std::string val);
+    // Size from which the file is rotated, 0 to never rotate it
+    Options &maxFileSize(size_t val);
+    // Rotated files kept, from path.1, the newest, to path.<val>
+    Options &maxFiles(size_t val);
+    // Request headers logged with every entry
+    Options &headers(std::vector<std::string> val);
+    // Entries a worker can record before they are written
+    Options &ringCapacity(size_t val);
+    // How often the entries are written
+    Options &flushInterval(std::chrono::milliseconds val);
+
+    Options();
+
+  private:
+    std::string path_;
+    size_t maxFileSize_;
+    size_t maxFiles_;
+    std::vector<std::string> headers_;
+    size_t ringCapacity_;
+    std::chrono::milliseconds flushInterval_;
+  };
+
+  static constexpr size_t DefaultMaxFiles = 5;
+  static constexpr size_t DefaultRingCapacity = 4096;
+  static constexpr std::chrono::milliseconds DefaultFlushInterval =
+      std::chrono::milliseconds(100);
+
+  // Opens the file, throws if it can not be
+  explicit AccessLog(const Options &options = Options());
+  // Writes the last entries
+  ~AccessLog();
+
+  AccessLog(const AccessLog &) = delete;
+  AccessLog &operator=(const AccessLog &) = delete;
+
+  static Options options();
+
+  // Writes the entries recorded so far, from the calling thread
+  void flush();
+
+  // Entries dropped because the ring of their worker was full
+  uint64_t dropped() const;
+  // Entries written
+  uint64_t written() const;
+
+private:
+  friend class Tcp::Listener;
+
+  // Rings for the workers of a listener, which can be shared by several
+  std::vector<std::shared_ptr<AccessLogRing>> addWorkers(size_t count);
+
+  void drainLocked();
+  void format(const AccessLogEntry &entry);
+  void writeLocked();
+  void open();
+  void rotate();
+
+  const Options options_;
+
+  mutable std::mutex mutex_;
+
+  std::vector<std::shared_ptr<AccessLogRing>> rings_;
+  int fd_;
+  size_t fileSize_;
+  std::string buffer_;
+  std::atomic<uint64_t> written_;
+
+  Log::DrainThread drainThread_;
+};
+
+} // namespace Http
+} // namespace Pistache
@@ -0,0 +1,113 @@
+/* admission.h
+
+   Per-route admission control (bulkheads) for the Rest router.
+
+   An AdmissionController bounds the number of requests that are concurrently
+   being handled for a route (or a whole subtree of routes) and sheds load as
+   soon as either the in-flight limit or the latency target is exceeded, so
+   that one slow route can not tie up every worker of the endpoint.
+*/
+
+#pragma once
+
+#include <pistache/mailbox.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Pistache {
+namespace Rest {
+
+class AdmissionController
+    : public std::enable_shared_from_this<AdmissionController> {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    friend class AdmissionController;
+
+    Options();
+
+    // Maximum number of requests handled concurrently, 0 means unbounded
+    Options &maxInFlight(size_t val);
+
+    // Requests are shed while the smoothed time it takes to complete an
+    // admitted request stays above this target, 0 disables the check
+    Options &latencyTarget(std::chrono::milliseconds val);
+
+    // Value of the Retry-After header sent along with rejections
+    Options &retryAfter(std::chrono::seconds val);
+
+  private:
+    size_t maxInFlight_;
+    std::chrono::milliseconds latencyTarget_;
+    std::chrono::seconds retryAfter_;
+  };
+
+  /* An admitted request. The slot is given back to the controller when the
+   * ticket is destroyed.
+   */
+  class Ticket {
+  public:
+    friend class AdmissionController;
+
+    Ticket(const Ticket &) = delete;
+    Ticket &operator=(const Ticket &) = delete;
+
+    ~Ticket();
+
+  private:
+    Ticket(std::shared_ptr<AdmissionController> controller, size_t shard);
+
+    std::shared_ptr<AdmissionController> controller_;
+    size_t shard_;
+    Clock::time_point admittedAt_;
+  };
+
+  explicit AdmissionController(const Options &options = Options());
+
+  static std::shared_ptr<AdmissionController>
+  create(const Options &options = Options());
+
+  /* Tries to admit a new request. Returns a null pointer if the request
+   * should be rejected.
+   * The controller must be owned by a std::shared_ptr.
+   */
+  std::shared_ptr<Ticket> tryAdmit();
+
+  size_t inFlight() const;
+  uint64_t admitted() const;
+  uint64_t rejected() const;
+  std::chrono::microseconds latency() const;
+
+  std::chrono::seconds retryAfter() const { return options_.retryAfter_; }
+
+private:
+  static constexpr size_t ShardsCount = 16;
+
+  // Counters are spread over shards that are picked per thread and padded
+  // to a cache line so that workers do not contend on the same cache line
+  struct Shard {
+    Shard() : inFlight(0), admitted(0), rejected(0), latencyUs(0), pad() {}
+
+    std::atomic<int64_t> inFlight;
+    std::atomic<uint64_t> admitted;
+    std::atomic<uint64_t> rejected;
+    std::atomic<int64_t> latencyUs;
+    char pad[CachelineSize - 4 * sizeof(int64_t)];
+  };
+
+  static size_t shardIndex();
+
+  void release(size_t shard, Clock::time_point admittedAt);
+
+  Options options_;
+  std::array<Shard, ShardsCount> shards_;
+};
+
+} // namespace Rest
+} // namespace Pistache
@@ -8,18 +8,25 @@
 
 #include <pistache/async.h>
 #include <pistache/http.h>
+#include <pistache/latency_histogram.h>
+#include <pistache/mailbox.h>
 #include <pistache/os.h>
 #include <pistache/reactor.h>
+#include <pistache/resolver.h>
 #include <pistache/timer_pool.h>
 #include <pistache/view.h>
 
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace Pistache {
 namespace Http {
@@ -29,22 +36,103 @@ constexpr int Threads = 1;
 constexpr int MaxConnectionsPerHost = 8;
 constexpr bool KeepAlive = true;
 constexpr size_t MaxResponseSize = std::numeric_limits<uint32_t>::max();
+constexpr size_t PipelineDepth = 1;
+constexpr bool TlsVerifyPeer = true;
+constexpr bool TlsVerifyHost = true;
+constexpr bool TlsSessionCache = true;
+constexpr double RetryBudgetRatio = 0.1;
+constexpr size_t RetryBudgetCap = 10;
+constexpr double HedgePercentile = 0.95;
+// Hedging only starts once the latency of a host is known well enough
+constexpr uint64_t HedgeMinSamples = 20;
+// Latencies of a host are halved away every so many responses
+constexpr uint64_t HedgeDecayWindow = 4096;
+constexpr size_t EjectAfter = 5;
+constexpr std::chrono::milliseconds EjectionTime(30000);
+constexpr size_t MaxEjectionPercent = 50;
+constexpr size_t MinIdleConnections = 0;
+constexpr size_t MaxIdleConnections = std::numeric_limits<size_t>::max();
+constexpr std::chrono::milliseconds IdleTimeout(30000);
+// Longest interval between two rounds of maintenance of the pool
+constexpr std::chrono::milliseconds PoolMaintenanceInterval(1000);
+// How long shutting down waits for the workers of a shared reactor
+constexpr std::chrono::milliseconds DetachTimeout(1000);
 } // namespace Default
 
 class Transport;
+struct Connection;
+// TLS configuration and session cache of a client, only available when
+// built with PISTACHE_USE_SSL
+class TlsContext;
+class RequestRace;
+
+/* Receives the body of a response piece by piece, as it comes in, instead of
+ * it being buffered in the response. Meant for bodies too large to be held in
+ * memory: only the data that has not been handed over yet is buffered, the
+ * maximum response size thus no longer bounds the body.
+ *
+ * The callbacks run on the thread of the transport and the data is only valid
+ * for the duration of the call. A stream receives the body of a single
+ * response.
+ */
+class BodyStream {
+public:
+  friend struct Connection;
+
+  using OnHeaders = std::function<void(const Response &response)>;
+  using OnData = std::function<void(const char *data, size_t size)>;
+  using OnSpliced = std::function<void(size_t size)>;
+
+  explicit BodyStream(OnData onData, OnHeaders onHeaders = nullptr);
+
+  static std::shared_ptr<BodyStream> create(OnData onData,
+                                            OnHeaders onHeaders = nullptr);
+
+  // Stops reading from the connection once the data received so far has
+  // been handed over, the server is then held back by TCP flow control.
+  // Can be called from any thread, including from the callbacks.
+  void pause();
+  void resume();
+  bool isPaused() const;
+
+  /* Moves the body straight from the socket to the write end of a pipe with
+   * splice(), without copying it to user space, when the response has a
+   * Content-Length and comes over plain TCP. The stream is paused before
+   * the callback is told how many bytes were moved, it is to be resumed
+   * once the pipe has been drained. What came in along with the headers,
+   * and the bodies that can not be spliced, still go to the data callback.
+   * Must be called before the request is sent.
+   */
+  void spliceTo(Fd pipe, OnSpliced onSpliced);
+
+private:
+  OnData onData_;
+  OnHeaders onHeaders_;
+  std::atomic<bool> paused_;
+
+  Fd splicePipe_;
+  OnSpliced onSpliced_;
+
+  // Set once the response starts coming in
+  mutable std::mutex lock_;
+  std::weak_ptr<Connection> connection_;
+};
 
 struct Connection : public std::enable_shared_from_this<Connection> {
+  friend class Transport;
 
   using OnDone = std::function<void()>;
+  using Reconnect = std::function<void(const std::shared_ptr<Connection> &)>;
 
   explicit Connection(size_t maxResponseSize);
+  ~Connection();
 
   struct RequestData {
 
     RequestData(Async::Resolver resolve, Async::Rejection reject,
-                const Http::Request &request, OnDone onDone)
+                Http::Request request, OnDone onDone)
         : resolve(std::move(resolve)), reject(std::move(reject)),
-          request(request), onDone(std::move(onDone)) {}
+          request(std::move(request)), onDone(std::move(onDone)) {}
     Async::Resolver resolve;
     Async::Rejection reject;
 
@@ -57,65 +145,396 @@ struct Connection : public std::enable_shared_from_this<Connection> {
   enum ConnectionState { NotConnected, Connecting, Connected };
 
   void connect(const Address &addr);
+  void connect(const DnsResolver::Answer &answer);
   void close();
+
+  // Speaks TLS to the server once connected. The server name is sent for SNI
+  // and checked against the certificate, sessions are resumed across
+  // connections sharing the same key.
+  void useTls(std::shared_ptr<TlsContext> context, std::string serverName,
+              std::string sessionKey);
+  bool usesTls() const;
+  // Protocol the server picked through ALPN, empty if none
+  const std::string &alpnProtocol() const;
+
+  // Returns false if the connection is already being established
+  bool startConnecting();
   bool isIdle() const;
   bool tryUse();
   void setAsIdle();
   bool isConnected() const;
+  bool isConnecting() const;
   bool hasTransport() const;
   void associateTransport(const std::shared_ptr<Transport> &transport);
 
+  // Establishes the connection again when the server turns out to have
+  // closed it right before a request was written
+  void setReconnect(Reconnect reconnect);
+
+  // Slots of the pool handed out for the connection and not released yet
+  void addUser();
+  void removeUser();
+  size_t users() const;
+  // Time since the last slot of the connection was released
+  std::chrono::steady_clock::duration idleTime() const;
+
+  // Closes the connection from its transport, unless it was used again in
+  // the meantime or has not been idle for that long
+  void closeIfIdle(std::chrono::milliseconds idleTime);
+  // Whether the server already closed its side of the connection
+  bool peerClosed() const;
+
   Async::Promise<Response> perform(const Http::Request &request, OnDone onDone);
 
   Async::Promise<Response> asyncPerform(const Http::Request &request,
                                         OnDone onDone);
 
-  void performImpl(const Http::Request &request, Async::Resolver resolve,
+  void performImpl(Http::Request request, Async::Resolver resolve,
                    Async::Rejection reject, OnDone onDone);
 
+  // Queues the request until the connection is established
+  void asyncPerformImpl(Http::Request request, Async::Resolver resolve,
+                        Async::Rejection reject, OnDone onDone);
+
   Fd fd() const;
   void handleResponsePacket(const char *buffer, size_t totalBytes);
   void handleError(const char *error);
-  void handleTimeout();
+  void handleTimeout(Fd timerFd);
+  // Rejects the requests waiting for the connection to be established
+  void abortRequests(const char *error);
 
   std::string dump() const;
 
+  // Number of requests written to the connection and waiting for a response
+  size_t pendingResponses() const;
+
+  // Whether the response being received is streamed to a consumer that
+  // asked to pause
+  bool readsPaused() const;
+  // Called when reads are to be resumed
+  void resumeReads();
+
+  // Bytes of the body being streamed that can be spliced to the pipe of its
+  // stream, zero if the body can not be spliced
+  size_t spliceableBytes() const;
+  Fd splicePipe() const;
+  // Called once bytes of the body were spliced to the pipe
+  void handleSplicedBody(size_t size);
+
 private:
   void processRequestQueue();
 
   struct RequestEntry {
     RequestEntry(Async::Resolver resolve, Async::Rejection reject,
-                 std::shared_ptr<TimerPool::Entry> timer, OnDone onDone)
+                 std::shared_ptr<TimerPool::Entry> timer, OnDone onDone,
+                 std::shared_ptr<BodyStream> stream)
         : resolve(std::move(resolve)), reject(std::move(reject)),
-          timer(std::move(timer)), onDone(std::move(onDone)) {}
+          timer(std::move(timer)), onDone(std::move(onDone)),
+          stream(std::move(stream)) {}
 
     Async::Resolver resolve;
     Async::Rejection reject;
     std::shared_ptr<TimerPool::Entry> timer;
     OnDone onDone;
+    std::shared_ptr<BodyStream> stream;
   };
 
+  // Called by the transport right before the request is written, responses
+  // then come back in the same order
+  void expectResponse(std::unique_ptr<RequestEntry> entry);
+
+  /* A request that did not fit in the socket at once. Its parts are the head
+   * serialized beforehand, if any, the rest of the head and the body, the
+   * next byte to write being at offset in the part of that index. Written
+   * on once the socket is writable again, before the requests after it.
+   */
+  struct PendingWrite {
+    PendingWrite(Http::Request request, std::string head,
+                 Async::Resolver resolve,
+                 std::shared_ptr<TimerPool::Entry> timer)
+        : request(std::move(request)), head(std::move(head)), part(0),
+          offset(0), written(0), resolve(std::move(resolve)),
+          timer(std::move(timer)) {}
+
+    Http::Request request;
+    std::string head;
+    int part;
+    size_t offset;
+    ssize_t written;
+    Async::Resolver resolve;
+    std::shared_ptr<TimerPool::Entry> timer;
+  };
+  void failAll(const char *error);
+  void releaseTimer(RequestEntry &entry);
+
+  // Forwards the body of the response at the front of the queue to its stream
+  void streamData(const char *data, size_t size);
+  void deliverHeaders(RequestEntry &entry);
+
   Fd fd_;
 
   struct sockaddr_in saddr;
-  std::unique_ptr<RequestEntry> requestEntry;
+  // Only ever touched from the thread of the transport
+  std::deque<std::unique_ptr<RequestEntry>> inflight_;
+  std::atomic<size_t> inflightCount_;
+  // Only ever touched from the thread of the transport
+  std::deque<PendingWrite> pendingWrites_;
   std::atomic<uint32_t> state_;
   std::atomic<ConnectionState> connectionState_;
   std::shared_ptr<Transport> transport_;
   Queue<RequestData> requestsQueue;
+  std::mutex requestsQueueLock_;
 
   TimerPool timerPool_;
   ResponseParser parser;
+
+  // Whether the headers of the response being streamed were handed over yet
+  bool headersDelivered_;
+  // Set by the transport when it stopped reading for a paused stream
+  bool readsStopped_;
+
+  std::shared_ptr<TlsContext> tls_;
+  std::string serverName_;
+  std::string sessionKey_;
+  // Handle of the TLS session (SSL *), only touched from the transport
+  void *ssl_;
+  bool handshaking_;
+  std::string alpnProtocol_;
+
+  std::atomic<size_t> users_;
+  std::atomic<std::chrono::steady_clock::rep> lastUsed_;
+  Reconnect reconnect_;
+};
+
+/* Caps the retries and hedges sent to a host to a fraction of its requests,
+ * so that they can not pile up on a host that is already struggling. Every
+ * request deposits a fraction of a token, every retry withdraws a whole one.
+ */
+class RetryBudget {
+public:
+  RetryBudget(double ratio, size_t maxTokens);
+
+  void deposit();
+  bool withdraw();
+
+  double tokens() const;
+
+private:
+  // Tokens are counted in thousandths to keep the arithmetic integral
+  static constexpr int64_t Unit = 1000;
+
+  const int64_t deposit_;
+  const int64_t max_;
+  std::atomic<int64_t> tokens_;
+};
+
+/* A named group of backends serving the same content, which the requests to
+ * http://<name>/ are balanced across. Backends that keep failing are ejected
+ * for a while, and optionally probed to find out whether they are healthy.
+ */
+class Upstream {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Balancing { RoundRobin, LeastOutstanding, PowerOfTwoChoices };
+
+  class Backend {
+  public:
+    friend class Upstream;
+
+    explicit Backend(std::string address);
+
+    // Host and port, with the https:// scheme for TLS backends
+    const std::string &address() const { return address_; }
+
+    // Requests sent to the backend that did not complete yet
+    size_t outstanding() const;
+    bool isEjected(Clock::time_point now = Clock::now()) const;
+    // Whether it passed its last health check, always true without them
+    bool isHealthy() const;
+
+  private:
+    std::string address_;
+    std::atomic<size_t> outstanding_;
+    std::atomic<size_t> consecutiveFailures_;
+    std::atomic<size_t> ejections_;
+    std::atomic<Clock::rep> ejectedUntil_;
+    std::atomic<bool> healthy_;
+  };
+
+  // Picks one of the backends a request can be sent to
+  class Balancer {
+  public:
+    virtual ~Balancer() = default;
+
+    // Called with at least one candidate, returns the index of the chosen one
+    virtual size_t pick(const std::vector<Backend *> &candidates) = 0;
+
+    static std::shared_ptr<Balancer> create(Balancing balancing);
+  };
+
+  struct Options {
+    friend class Upstream;
+
+    Options();
+
+    Options &balancing(Balancing val);
+    // Replaces the built-in balancing strategies
+    Options &balancer(std::shared_ptr<Balancer> val);
+
+    // Ejects a backend after that many errors, timeouts or 5xx responses in
+    // a row, 0 never ejects
+    Options &ejectAfter(size_t failures);
+    // Duration of the first ejection, which grows with each ejection that
+    // follows without a success in between
+    Options &ejectionTime(std::chrono::milliseconds val);
+    // Share of the backends that can be ejected at the same time
+    Options &maxEjectionPercent(size_t val);
+
+    // Sends a GET of the path to every backend at the given interval, the
+    // backends that do not answer with a 2xx are left out until they do
+    Options &healthCheck(std::string path, std::chrono::milliseconds interval);
+
+    // Fraction of the requests to the group that can be retried or hedged
+    Options &retryBudget(double ratio);
+
+  private:
+    std::shared_ptr<Balancer> balancer_;
+    size_t ejectAfter_;
+    std::chrono::milliseconds ejectionTime_;
+    size_t maxEjectionPercent_;
+    std::string healthCheckPath_;
+    std::chrono::milliseconds healthCheckInterval_;
+    double retryBudgetRatio_;
+  };
+
+  Upstream(std::string name, const std::vector<std::string> &backends,
+           const Options &options = Options());
+
+  const std::string &name() const { return name_; }
+  const std::vector<std::shared_ptr<Backend>> &backends() const {
+    return backends_;
+  }
+
+  const std::string &healthCheckPath() const {
+    return options_.healthCheckPath_;
+  }
+  std::chrono::milliseconds healthCheckInterval() const {
+    return options_.healthCheckInterval_;
+  }
+
+  /* Picks the backend of the next request, among the ones neither ejected
+   * nor unhealthy. When none is left, all of them are candidates again
+   * rather than failing every request. Returns nullptr if the group is empty.
+   */
+  std::shared_ptr<Backend> pick();
+
+  // Outcome of a request picked through pick()
+  void succeeded(Backend &backend);
+  void failed(Backend &backend);
+  // Request that was dropped before it could tell anything about the backend
+  void abandoned(Backend &backend);
+
+  void healthChecked(Backend &backend, bool healthy);
+
+  Metrics::LatencyHistogram &latency() { return latency_; }
+  RetryBudget &retryBudget() { return retryBudget_; }
+
+private:
+  void eject(Backend &backend);
+
+  std::string name_;
+  std::vector<std::shared_ptr<Backend>> backends_;
+  Options options_;
+
+  Metrics::LatencyHistogram latency_;
+  RetryBudget retryBudget_;
 };
 
 class ConnectionPool {
 public:
+  /* The connections to a single host. They are all created when the host is
+   * first seen. Each of them offers as many slots as requests that can be
+   * pipelined on it, free slots are kept on a lock-free stack so that picking
+   * and releasing one is O(1) and never takes a lock. Slots of the first
+   * connections are handed out first, busy hosts thus fill the pipeline of a
+   * connection before opening the next one. Requests that find no free slot
+   * wait in a queue of the host and are handed the next slot released for
+   * that host.
+   */
+  class Host {
+  public:
+    using Slot = uint32_t;
+
+    Host(std::string domain, size_t maxConnections, size_t pipelineDepth,
+         size_t maxResponseSize,
+         double retryBudgetRatio = Default::RetryBudgetRatio);
+
+    Host(const Host &) = delete;
+    Host &operator=(const Host &) = delete;
+
+    const std::string &domain() const { return domain_; }
+
+    // Returns nullptr if every slot is used, the slot must then be given
+    // back with release()
+    std::shared_ptr<Connection> acquire(Slot &slot);
+    void release(Slot slot);
+
+    // Returns false when too many requests are already waiting
+    bool wait(const std::shared_ptr<Connection::RequestData> &data);
+    bool nextWaiting(std::shared_ptr<Connection::RequestData> &data);
+    bool hasWaiting() const;
+
+    size_t usedConnections() const;
+    // Free slots, which is the number of idle connections without pipelining
+    size_t idleConnections() const;
+
+    Metrics::LatencyHistogram &latency() { return latency_; }
+    RetryBudget &retryBudget() { return retryBudget_; }
+
+    const std::vector<std::shared_ptr<Connection>> &connections() const {
+      return connections_;
+    }
+
+    // At least minIdle connections are established ahead of the requests,
+    // and no more than maxIdle are left open while unused
+    void setIdleLimits(size_t minIdle, size_t maxIdle);
+    size_t minIdle() const;
+    size_t maxIdle() const;
+
+  private:
+    static constexpr Slot NoSlot = std::numeric_limits<Slot>::max();
+
+    const std::string domain_;
+    const std::vector<std::shared_ptr<Connection>> connections_;
+    const size_t pipelineDepth_;
+    std::unique_ptr<std::atomic<uint32_t>[]> next_;
+
+    // Top of the idle stack, the slot lives in the low 32 bits and the high
+    // ones hold a tag bumped on every change to rule out ABA
+    std::atomic<uint64_t> head_;
+    std::atomic<size_t> idle_;
+    cacheline_pad_t pad0_;
+
+    MPMCQueue<std::shared_ptr<Connection::RequestData>, 2048> waiting_;
+    std::atomic<size_t> waitingCount_;
+
+    Metrics::LatencyHistogram latency_;
+    RetryBudget retryBudget_;
+
+    std::atomic<size_t> minIdle_;
+    std::atomic<size_t> maxIdle_;
+  };
+
   ConnectionPool() = default;
 
-  void init(size_t maxConnsPerHost, size_t maxResponseSize);
+  void init(size_t maxConnsPerHost, size_t maxResponseSize,
+            size_t pipelineDepth = Default::PipelineDepth,
+            std::shared_ptr<DnsResolver> resolver = nullptr,
+            double retryBudgetRatio = Default::RetryBudgetRatio);
 
-  std::shared_ptr<Connection> pickConnection(const std::string &domain);
-  static void releaseConnection(const std::shared_ptr<Connection> &connection);
+  // Hosts live as long as the pool, the pointer can be kept around
+  Host *host(const std::string &domain);
 
   size_t usedConnections(const std::string &domain) const;
   size_t idleConnections(const std::string &domain) const;
@@ -124,18 +543,44 @@ public:
 
   void closeIdleConnections(const std::string &domain);
 
+  // Idle limits of the hosts seen from now on
+  void setIdleLimits(size_t minIdle, size_t maxIdle);
+
+  void forEachHost(const std::function<void(Host &host)> &func);
+
+  // Resolver shared by every connection of the pool
+  const std::shared_ptr<DnsResolver> &resolver() const { return resolver_; }
+
 private:
-  using Connections = std::vector<std::shared_ptr<Connection>>;
   using Lock = std::mutex;
   using Guard = std::lock_guard<Lock>;
 
-  mutable Lock connsLock;
-  std::unordered_map<std::string, Connections> conns;
+  static constexpr size_t ShardsCount = 16;
+
+  // Hosts are spread over shards so that looking one up does not contend
+  // on a single lock
+  struct Shard {
+    Shard() : lock(), hosts() {}
+
+    mutable Lock lock;
+    std::unordered_map<std::string, std::unique_ptr<Host>> hosts;
+  };
+
+  Shard &shardFor(const std::string &domain) const;
+  const Host *findHost(const std::string &domain) const;
+
+  mutable std::array<Shard, ShardsCount> shards_;
   size_t maxConnectionsPerHost;
   size_t maxResponseSize;
+  size_t pipelineDepth;
+  std::shared_ptr<DnsResolver> resolver_;
+  double retryBudgetRatio;
+  size_t minIdle = Default::MinIdleConnections;
+  size_t maxIdle = Default::MaxIdleConnections;
 };
 
 class Client;
+class RequestTemplate;
 
 class RequestBuilder {
 public:
@@ -145,6 +590,8 @@ public:
   RequestBuilder &resource(const std::string &val);
   RequestBuilder &params(const Uri::Query &query);
   RequestBuilder &header(const std::shared_ptr<Header::Header> &header);
+  // Header without a type of its own, sent as is
+  RequestBuilder &header(const Header::Raw &header);
 
   template <typename H, typename... Args>
   typename std::enable_if<Header::IsHeader<H>::value, RequestBuilder &>::type
@@ -157,8 +604,32 @@ public:
   RequestBuilder &body(std::string &&val);
   RequestBuilder &timeout(std::chrono::milliseconds val);
 
+  /* Streams the body of the response instead of buffering it. The promise
+   * is resolved with the response, without its body, once the whole body
+   * was handed to the stream. The timeout then only covers the wait for the
+   * headers.
+   */
+  RequestBuilder &stream(std::shared_ptr<BodyStream> stream);
+
+  /* Sends the request again when it fails, as long as its method is
+   * idempotent and the retry budget of the host allows it
+   */
+  RequestBuilder &retries(size_t count);
+
+  /* Sends a duplicate of the request if no response came back once the given
+   * percentile of the latency of the host has elapsed, and goes with
+   * whichever answers first. Duplicates are paid for out of the retry budget.
+   */
+  RequestBuilder &hedge(double percentile = Default::HedgePercentile);
+
   Async::Promise<Response> send();
 
+  /* Freezes the request into a template that can be sent many times with
+   * different bodies. Its request line, cookies and headers are serialized
+   * once and for all.
+   */
+  RequestTemplate makeTemplate() const;
+
 private:
   explicit RequestBuilder(Client *const client) : client_(client), request_() {}
 
@@ -167,9 +638,28 @@ private:
   Request request_;
 };
 
+class RequestTemplate {
+public:
+  friend class RequestBuilder;
+
+  Async::Promise<Response> send() const;
+  Async::Promise<Response> send(std::string body) const;
+
+private:
+  RequestTemplate(Client *const client, Request request)
+      : client_(client), request_(std::move(request)) {}
+
+  Client *client_;
+
+  // Only carries the resource, the timeout and the serialized head
+  Request request_;
+};
+
 class Client {
 public:
   friend class RequestBuilder;
+  friend class RequestTemplate;
+  friend class RequestRace;
 
   struct Options {
     friend class Client;
@@ -178,18 +668,93 @@ public:
         : threads_(Default::Threads),
           maxConnectionsPerHost_(Default::MaxConnectionsPerHost),
           keepAlive_(Default::KeepAlive),
-          maxResponseSize_(Default::MaxResponseSize) {}
+          maxResponseSize_(Default::MaxResponseSize),
+          pipelineDepth_(Default::PipelineDepth), resolver_(), caFile_(),
+          verifyPeer_(Default::TlsVerifyPeer),
+          verifyHost_(Default::TlsVerifyHost), certFile_(), keyFile_(),
+          alpn_(), tlsSessionCache_(Default::TlsSessionCache),
+          retryBudgetRatio_(Default::RetryBudgetRatio),
+          minIdle_(Default::MinIdleConnections),
+          maxIdle_(Default::MaxIdleConnections),
+          idleTimeout_(Default::IdleTimeout), reactor_() {}
 
     Options &threads(int val);
     Options &keepAlive(bool val);
     Options &maxConnectionsPerHost(int val);
     Options &maxResponseSize(size_t val);
 
+    // Number of requests that can be written on a connection before the
+    // first response comes back. Responses are matched to requests in order,
+    // so the server must answer pipelined requests in order as well.
+    Options &pipelining(size_t depth);
+
+    // Resolver used to look up hosts, a private one with the default
+    // options is created if none is given
+    Options &resolver(std::shared_ptr<DnsResolver> val);
+
+    /* TLS settings of https:// requests, which are only supported when built
+     * with PISTACHE_USE_SSL.
+     */
+
+    // Certificates of the authorities servers are verified against, the
+    // default ones of the system are used if none is given
+    Options &caFile(std::string path);
+    Options &verifyPeer(bool val);
+    // Whether the name of the host must match the certificate of the server
+    Options &verifyHost(bool val);
+    Options &clientCertificate(std::string certFile, std::string keyFile);
+    // Protocols offered to the server through ALPN, in order of preference
+    Options &alpn(std::vector<std::string> protocols);
+    // Keeps the sessions of every host so that reconnecting to it resumes
+    // the session instead of going through a full handshake
+    Options &tlsSessionCache(bool val);
+
+    // Fraction of the requests of a host that can be retried or hedged
+    Options &retryBudget(double ratio);
+
+    // Connections of every host established ahead of the requests
+    Options &minIdle(size_t val);
+    // Unused connections of every host left open
+    Options &maxIdle(size_t val);
+    // How long a connection is left open unused, beyond the minimum
+    Options &idleTimeout(std::chrono::milliseconds val);
+
+    /* Runs the client on the workers of a reactor that is already running,
+     * such as the one of an Http::Endpoint once it is bound, instead of
+     * threads of its own. The connections established from a worker are
+     * polled by that worker, and the responses to the requests sent on them
+     * are resolved from it: a handler calling out to another service does
+     * not hop from one thread to another. The number of threads is then
+     * ignored, and the client must be shut down before the reactor is.
+     */
+    Options &reactor(std::shared_ptr<Aio::Reactor> val);
+
   private:
     int threads_;
     int maxConnectionsPerHost_;
     bool keepAlive_;
     size_t maxResponseSize_;
+    size_t pipelineDepth_;
+    std::shared_ptr<DnsResolver> resolver_;
+
+    std::string caFile_;
+    bool verifyPeer_;
+    bool verifyHost_;
+    std::string certFile_;
+    std::string keyFile_;
+    std::vector<std::string> alpn_;
+    bool tlsSessionCache_;
+    double retryBudgetRatio_;
+    size_t minIdle_;
+    size_t maxIdle_;
+    std::chrono::milliseconds idleTimeout_;
+    std::shared_ptr<Aio::Reactor> reactor_;
+  };
+
+  struct TlsStats {
+    uint64_t fullHandshakes = 0;
+    // Handshakes that resumed an earlier session of the same host
+    uint64_t resumedHandshakes = 0;
   };
 
   Client();
@@ -204,32 +769,99 @@ public:
   RequestBuilder patch(const std::string &resource);
   RequestBuilder del(const std::string &resource);
 
+  /* Sends every request at once, spread over the connections of the pool.
+   * The promise is resolved with the responses in the order of the requests
+   * once all of them arrived, or rejected as soon as one of them fails.
+   */
+  Async::Promise<std::vector<Response>>
+  sendBatch(const std::vector<RequestBuilder> &requests);
+
   void shutdown();
 
+  TlsStats tlsStats() const;
+
+  /* Registers a group of backends, the requests to http://<name>/ are then
+   * sent to one of them. Health checks, when enabled, start once the client
+   * is initialized.
+   */
+  std::shared_ptr<Upstream>
+  addUpstream(std::string name, const std::vector<std::string> &backends,
+              const Upstream::Options &options = Upstream::Options());
+  std::shared_ptr<Upstream> upstream(const std::string &name) const;
+
+  /* Establishes connections to the host ahead of the first requests, and
+   * keeps that many of them open from then on. Returns right away, the
+   * connections are established in the background.
+   */
+  void warmUp(const std::string &host, size_t connections);
+  // Connections to the host that are currently established
+  size_t openConnections(const std::string &host) const;
+
 private:
   std::shared_ptr<Aio::Reactor> reactor_;
+  // The reactor belongs to someone else, it is left running on shutdown
+  bool sharedReactor_;
 
   ConnectionPool pool;
   Aio::Reactor::Key transportKey;
 
   std::atomic<uint64_t> ioIndex;
 
-  using Lock = std::mutex;
-  using Guard = std::lock_guard<Lock>;
+  std::atomic<bool> stopProcessPequestsQueues;
+
+  std::shared_ptr<TlsContext> tls_;
 
-  Lock queuesLock;
-  std::unordered_map<std::string,
-                     MPMCQueue<std::shared_ptr<Connection::RequestData>, 2048>>
-      requestsQueues;
-  bool stopProcessPequestsQueues;
+  mutable std::mutex upstreamsLock_;
+  std::unordered_map<std::string, std::shared_ptr<Upstream>> upstreams_;
+  // Spares the lookup of upstreams to the clients without any
+  std::atomic<size_t> upstreamsCount_;
+  bool initialized_;
+
+  std::mutex transportsLock_;
+  std::chrono::milliseconds idleTimeout_;
 
 private:
   RequestBuilder prepareRequest(const std::string &resource,
                                 Http::Method method);
 
   Async::Promise<Response> doRequest(Http::Request request);
-
-  void processRequestQueue();
+  // Retries and hedges the request as asked by the builder
+  Async::Promise<Response> doResilientRequest(Http::Request request);
+  // Sends the request to one of the backends of the upstream
+  Async::Promise<Response>
+  doUpstreamRequest(const std::shared_ptr<Upstream> &upstream,
+                    Http::Request request);
+  std::shared_ptr<Upstream> findUpstream(const StringView &name) const;
+
+  void checkHealth(std::weak_ptr<Upstream> upstream);
+
+  // The transport of the calling thread when it is a worker of a shared
+  // reactor, the next one in turn otherwise
+  std::shared_ptr<Transport> pickTransport();
+  // Stops the transports of a shared reactor from using the client
+  void detachTransports();
+
+  // Runs the callback from one of the transports once the delay has elapsed
+  void schedule(std::chrono::milliseconds delay,
+                std::function<void()> callback);
+
+  void dispatch(ConnectionPool::Host *host, ConnectionPool::Host::Slot slot,
+                const std::shared_ptr<Connection> &connection,
+                Http::Request request, Async::Resolver resolve,
+                Async::Rejection reject);
+
+  void connect(const std::shared_ptr<Connection> &connection,
+               const std::string &domain);
+  // Hands the connection to one of the transports, once
+  void associateTransport(const std::shared_ptr<Connection> &connection,
+                          const std::string &domain);
+
+  // Closes the connections idle for too long and establishes the missing
+  // ones, then schedules the next round
+  void maintainPool();
+  void preconnect(ConnectionPool::Host &host);
+
+  void processRequestQueue(ConnectionPool::Host *host);
 };
 
 } // namespace Http
@@ -0,0 +1,102 @@
+/* coalescer.h
+
+   Request coalescing (single-flight) for the Rest router.
+
+   While a cacheable request is being handled, identical requests do not
+   invoke the handler again: they wait on a promise that is resolved with
+   the serialized response of the first one, the leader of the flight.
+*/
+
+#pragma once
+
+#include <pistache/async.h>
+#include <pistache/http.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Pistache {
+namespace Rest {
+
+class RequestCoalescer
+    : public std::enable_shared_from_this<RequestCoalescer> {
+public:
+  // The response of a leader, as handed to its followers
+  struct SharedResponse {
+    SharedResponse(Http::Code code, RawBuffer wire,
+                   std::vector<std::string> varyFields, std::string variant)
+        : code(code), wire(std::move(wire)), varyFields(std::move(varyFields)),
+          variant(std::move(variant)) {}
+
+    // Whether the response can be sent back for a request, according to
+    // the Vary header of the response
+    bool matches(const Http::Request &request) const;
+
+    Http::Code code;
+    RawBuffer wire;
+    std::vector<std::string> varyFields;
+    std::string variant;
+  };
+
+  // A null result means that the response of the leader can not be shared,
+  // followers must then handle the request themselves
+  using Result = std::shared_ptr<const SharedResponse>;
+
+  /* Held by the leader of a flight. Followers are released with a null
+   * result if the flight is destroyed without having been completed.
+   */
+  class Flight {
+  public:
+    friend class RequestCoalescer;
+
+    Flight(const Flight &) = delete;
+    Flight &operator=(const Flight &) = delete;
+
+    ~Flight();
+
+    void complete(const Http::Request &request, const Http::Response &response,
+                  const RawBuffer &wire);
+
+  private:
+    Flight(std::shared_ptr<RequestCoalescer> coalescer, std::string key);
+
+    std::shared_ptr<RequestCoalescer> coalescer_;
+    std::string key_;
+    std::vector<Async::Deferred<Result>> followers_;
+    bool done_;
+  };
+
+  RequestCoalescer();
+
+  static std::shared_ptr<RequestCoalescer> create();
+
+  /* Starts a new flight for a key. Returns a null pointer if a flight is
+   * already in progress for that key.
+   * The coalescer must be owned by a std::shared_ptr.
+   */
+  std::shared_ptr<Flight> lead(const std::string &key);
+
+  /* Waits for the flight in progress for a key. The promise is immediately
+   * resolved with a null result if there is none.
+   */
+  Async::Promise<Result> follow(const std::string &key);
+
+  size_t inFlight() const;
+  uint64_t coalesced() const;
+
+private:
+  void finish(Flight *flight, const Result &result);
+
+  mutable std::mutex lock_;
+  std::unordered_map<std::string, Flight *> flights_;
+
+  std::atomic<uint64_t> coalesced_;
+};
+
+} // namespace Rest
+} // namespace Pistache
@@ -21,5 +21,6 @@ static constexpr size_t DefaultMaxResponseSize =
 static constexpr size_t ChunkSize = 1024;
 
 static constexpr uint16_t HTTP_STANDARD_PORT = 80;
+static constexpr uint16_t HTTPS_STANDARD_PORT = 443;
 } // namespace Const
 } // namespace Pistache
@@ -28,6 +28,16 @@ public:
     Options &backlog(int val);
     Options &maxRequestSize(size_t val);
     Options &maxResponseSize(size_t val);
+    // Logs requests taking longer than val from their first byte to the
+    // last of their response, with the breakdown of their phases. Zero,
+    // the default, disables it
+    Options &slowRequestThreshold(std::chrono::milliseconds val);
+    // Same, for requests spending longer than val in any single phase
+    Options &slowPhaseThreshold(std::chrono::milliseconds val);
+    // Samples the TCP_INFO of up to peers connections of every worker each
+    // interval, see Tcp::Listener::setTcpInfoSampling(). Disabled by default
+    Options &tcpInfoSampling(std::chrono::milliseconds interval,
+                             size_t peers = 64);
 
     [[deprecated("Replaced by maxRequestSize(val)")]] Options &
     maxPayload(size_t val);
@@ -39,6 +49,10 @@ public:
     int backlog_;
     size_t maxRequestSize_;
     size_t maxResponseSize_;
+    std::chrono::milliseconds slowRequestThreshold_;
+    std::chrono::milliseconds slowPhaseThreshold_;
+    std::chrono::milliseconds tcpInfoInterval_;
+    size_t tcpInfoPeers_;
     Options();
   };
   Endpoint();
@@ -132,6 +146,22 @@ public:
   Async::Promise<Tcp::Listener::Load>
   requestLoad(const Tcp::Listener::Load &old);
 
+  // Reactor of the workers, once bound. An Http::Client can run on it, see
+  // Http::Client::Options::reactor().
+  std::shared_ptr<Aio::Reactor> reactor() const { return listener.reactor(); }
+
+  // Requests, connections and bytes counted by the workers, see metrics.h
+  std::shared_ptr<Metrics::ServerMetrics> metrics() const {
+    return listener.metrics();
+  }
+
+  // Access log of the responses, see access_log.h. To be set before the
+  // endpoint is bound
+  void setAccessLog(std::shared_ptr<AccessLog> accessLog) {
+    listener.setAccessLog(std::move(accessLog));
+  }
+  std::shared_ptr<AccessLog> accessLog() const { return listener.accessLog(); }
+
   static Options options();
 
 private:
@@ -151,6 +181,8 @@ private:
   Tcp::Listener listener;
   size_t maxRequestSize_ = Const::DefaultMaxRequestSize;
   size_t maxResponseSize_ = Const::DefaultMaxResponseSize;
+  std::chrono::milliseconds slowRequestThreshold_{0};
+  std::chrono::milliseconds slowPhaseThreshold_{0};
 };
 
 template <typename Handler>
@@ -52,13 +52,10 @@ inline EventId event_init(unsigned int initval, int flags) {
     int ret = kevent(kq, &event, 1, NULL, 0, NULL);
     assert(ret == 0 && "Invalid kevent ret code");
     
-    std::cout << "event_init kq=" << kq << std::endl;
-    
     return kq;
 }
 
 inline int event_notify(EventId eid, EventValue value) {
-    std::cout << "event_notify, kq=" << eid << ", value = " << value << std::endl;
     struct timespec timeout = { 0, 0 };  // wait-free
     struct kevent event;
     EV_SET(&event, 1, EVFILT_USER, 0, NOTE_TRIGGER, 0, reinterpret_cast<void*>(value));
@@ -66,12 +63,10 @@ inline int event_notify(EventId eid, EventValue value) {
 }
 
 inline int event_test(EventId eid, EventValue* value) {
-    std::cout << "event_test, kq=" << eid << std::endl;
     struct timespec timeout = { 0, 0 }; // wait-free
     struct kevent event;
     int count = kevent(eid, NULL, 0, &event, 1, &timeout);
     if (count == 1) *value = reinterpret_cast<EventValue>(event.udata);
-    std::cout << " count=" << count << ", value=" << (*value) << std::endl;
     return count;
 }
 
@@ -88,11 +83,11 @@ inline EventId event_init(unsigned int initval, int flags) {
 }
 
 inline int event_notify(EventId eid, EventValue value) {
-    eventfd_write(eid, value);
+    return eventfd_write(eid, value);
 }
 
 inline int event_test(EventId eid, EventValue* value) {
-    eventfd_read(eid, value);
+    return eventfd_read(eid, value);
 }
 
 //    inline int event_notify()
@@ -0,0 +1,97 @@
+/* hdr_histogram.h
+
+   High Dynamic Range histogram of integer values, such as latencies.
+
+   Values are kept to a fixed number of significant decimal digits over the
+   whole range, in buckets of a power of two each split in linear
+   sub-buckets, so that recording a value is a few shifts and an increment.
+   The layout, and the percentile distribution it writes, are the ones of
+   HdrHistogram: the output can be plotted with its tools.
+
+   Recording is not synchronized, every thread records in a histogram of its
+   own and the histograms are added up for the report.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace Pistache {
+
+class HdrHistogram {
+public:
+  /* Tracks the values from lowest, at least 1, to highest with as many
+   * significant digits, from 1 to 5. Values beyond highest are not recorded.
+   */
+  HdrHistogram(uint64_t lowest, uint64_t highest, int significantDigits);
+
+  // Microseconds up to an hour, to three significant digits
+  HdrHistogram();
+
+  bool record(uint64_t value, uint64_t count = 1);
+
+  /* Records the value along with the ones that would have been measured had
+   * the recording not stalled for that long. Corrects the coordinated
+   * omission of a load generator that waits for every response before
+   * sending the next request, which was due every expectedInterval.
+   */
+  bool recordCorrected(uint64_t value, uint64_t expectedInterval);
+
+  // Adds the values of a histogram tracking the same range
+  void add(const HdrHistogram &other);
+  void reset();
+
+  uint64_t count() const;
+  uint64_t min() const;
+  uint64_t max() const;
+  double mean() const;
+  double stddev() const;
+
+  // Highest value equivalent to the one at the percentile, from 0 to 100
+  uint64_t valueAtPercentile(double percentile) const;
+
+  // Whether both values share the same bucket, and can not be told apart
+  bool equivalent(uint64_t lhs, uint64_t rhs) const;
+
+  /* Writes the percentile distribution as the .hgrm files of HdrHistogram,
+   * values being divided by the scale: 1000 writes microseconds as
+   * milliseconds.
+   */
+  void writePercentiles(std::ostream &os, double scale = 1.0,
+                        int ticksPerHalfDistance = 5) const;
+
+private:
+  size_t bucketIndex(uint64_t value) const;
+  size_t subBucketIndex(uint64_t value, size_t bucket) const;
+  size_t countsIndex(size_t bucket, size_t subBucket) const;
+  size_t countsIndexOf(uint64_t value) const;
+
+  uint64_t valueFromIndex(size_t bucket, size_t subBucket) const;
+  uint64_t valueAtIndex(size_t index) const;
+
+  uint64_t lowestEquivalent(uint64_t value) const;
+  uint64_t highestEquivalent(uint64_t value) const;
+  uint64_t medianEquivalent(uint64_t value) const;
+  uint64_t equivalentRange(uint64_t value) const;
+
+  uint64_t lowest_;
+  uint64_t highest_;
+  int significantDigits_;
+
+  size_t unitMagnitude_;
+  size_t subBucketHalfCountMagnitude_;
+  size_t subBucketCount_;
+  size_t subBucketHalfCount_;
+  uint64_t subBucketMask_;
+  size_t bucketCount_;
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+} // namespace Pistache
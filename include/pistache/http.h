@@ -8,6 +8,8 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <stdexcept>
@@ -53,8 +55,15 @@ class RequestLineStep;
 class ResponseLineStep;
 class HeadersStep;
 class BodyStep;
+template <typename Message> class ParserImpl;
 } // namespace Private
 
+class BodyStream;
+class Client;
+class PendingAccessLogEntry;
+struct Connection;
+class RequestRace;
+
 template <class CharT, class Traits>
 std::basic_ostream<CharT, Traits> &crlf(std::basic_ostream<CharT, Traits> &os) {
   static constexpr char CRLF[] = {0xD, 0xA};
@@ -82,7 +91,7 @@ public:
   Version version() const;
   Code code() const;
 
-  std::string body() const;
+  const std::string &body() const;
 
   const CookieJar &cookies() const;
   CookieJar &cookies();
@@ -99,6 +108,37 @@ protected:
   Header::Collection headers_;
 };
 
+// Monotonic timestamps of the phases of a request on the server, left to
+// the epoch of the clock until the phase is reached
+struct RequestTimings {
+  using Clock = std::chrono::steady_clock;
+
+  enum class Phase {
+    Headers,  // From the first byte received to the end of the headers
+    Body,     // From the end of the headers to the end of the body
+    Dispatch, // From the end of the body to the call of the handler
+    Handler,  // From the call of the handler to the response being queued
+    Write,    // From the response being queued to its last byte written
+  };
+  static constexpr size_t PhasesCount = 5;
+
+  static const char *phaseName(Phase phase);
+
+  // Zero if the phase was not reached
+  std::chrono::microseconds duration(Phase phase) const;
+  // From the first byte received to the last phase reached
+  std::chrono::microseconds total() const;
+
+  Clock::time_point firstByte;
+  Clock::time_point headersParsed;
+  Clock::time_point bodyComplete;
+  Clock::time_point handlerStart;
+  Clock::time_point responseQueued;
+  // Once the response was handed to the transport, only known to the
+  // slow-request log
+  Clock::time_point responseFlushed;
+};
+
 namespace Uri {
 
 class Query {
@@ -147,8 +187,16 @@ private:
 class Request : public Message {
 public:
   friend class Private::RequestLineStep;
+  friend class Private::ParserImpl<Http::Request>;
 
+  friend class Handler;
+  friend class ResponseWriter;
   friend class RequestBuilder;
+  friend class RequestTemplate;
+  friend class Transport;
+  friend struct Connection;
+  friend class Client;
+  friend class RequestRace;
 
   Request() = default;
 
@@ -181,6 +229,9 @@ public:
 
   std::chrono::milliseconds timeout() const;
 
+  // Of the phases the request went through so far, on the server
+  const RequestTimings &timings() const { return timings_; }
+
 private:
 #ifdef LIBSTDCPP_SMARTPTR_LOCK_FIXME
   void associatePeer(const std::shared_ptr<Tcp::Peer> &peer) {
@@ -200,6 +251,21 @@ private:
 #endif
   Address address_;
   std::chrono::milliseconds timeout_ = std::chrono::milliseconds(0);
+
+  // Request line and headers, serialized once by a RequestTemplate
+  std::shared_ptr<const std::string> head_;
+
+  // Receives the body of the response when it is streamed
+  std::shared_ptr<BodyStream> stream_;
+
+  // Retries and hedging asked for through the RequestBuilder
+  size_t retries_ = 0;
+  double hedgePercentile_ = 0;
+
+  // Set when another copy of the request already got its response
+  std::shared_ptr<std::atomic<bool>> cancelled_;
+
+  RequestTimings timings_;
 };
 
 class Handler;
@@ -295,6 +361,9 @@ private:
   DynamicStreamBuf buf_;
   Tcp::Transport *transport_;
   Timeout timeout_;
+  // Of the writer, released once the stream ends
+  std::vector<std::shared_ptr<void>> attachments_;
+  std::shared_ptr<PendingAccessLogEntry> logEntry_;
 };
 
 inline ResponseStream &ends(ResponseStream &stream) {
@@ -407,8 +476,32 @@ public:
   // Returns HTTP result code that was sent with the response.
   Code getResponseCode() const { return response_.code(); }
 
+  // Timings of the request, with the response queued once it was sent
+  const RequestTimings &timings() const { return timeout_.request.timings(); }
+
+  // Keeps an arbitrary object alive for as long as this writer (or any of
+  // its clones, or the stream it started) is alive. Useful to be notified,
+  // through the object's destructor, that a request has been fully handled.
+  void attach(std::shared_ptr<void> object);
+
+  // Called with the response and its serialized form (status line, headers
+  // and body) right before it is handed to the transport. Observers are
+  // shared with the clones of this writer. Streamed responses are not
+  // observed.
+  using WireObserver =
+      std::function<void(const Response &response, const RawBuffer &wire)>;
+  void observeWire(WireObserver observer);
+
   // Unsafe API
 
+  // Sends an already serialized response (status line, headers and body)
+  // as is, bypassing the headers and cookies of this writer
+  Async::Promise<ssize_t> sendSerialized(Code code, const RawBuffer &wire);
+
+  // Moves bytes waiting in a pipe to the socket with splice(), right after
+  // what was sent before. The pipe is left open. Not supported for TLS peers.
+  Async::Promise<ssize_t> sendPipe(Fd pipe, size_t size);
+
   DynamicStreamBuf *rdbuf();
 
   DynamicStreamBuf *rdbuf(DynamicStreamBuf *other);
@@ -427,12 +520,31 @@ private:
 
   Async::Promise<ssize_t> putOnWire(const char *data, size_t len);
 
+  // Counts the response in the metrics of the worker and prepares its entry
+  // in the access log, once
+  void recordResponse(Code code);
+  // Bytes of the response handed to the transport
+  void countSent(ssize_t bytes);
+  // Keeps the access log entry of the response pending until the write
+  // completes
+  Async::Promise<ssize_t> holdLogEntry(Async::Promise<ssize_t> write) const;
+
+  // Checks the timings of the request against the slow-request thresholds
+  // of the handler once the write of its response completes
+  Async::Promise<ssize_t> trackFlush(Async::Promise<ssize_t> write);
+
   Response response_;
   std::weak_ptr<Tcp::Peer> peer_;
   DynamicStreamBuf buf_;
   Tcp::Transport *transport_;
   Timeout timeout_;
   ssize_t sent_bytes_;
+  std::vector<std::shared_ptr<void>> attachments_;
+  std::vector<WireObserver> wireObservers_;
+  std::shared_ptr<PendingAccessLogEntry> logEntry_;
+  // When the request was parsed, latencies are measured from there
+  std::chrono::steady_clock::time_point received_;
+  bool recorded_;
 };
 
 Async::Promise<ssize_t>
@@ -477,19 +589,28 @@ public:
   State apply(StreamCursor &cursor) override;
 };
 
+// Receives the body of a message piece by piece instead of the message
+using BodySink = std::function<void(const char *data, size_t size)>;
+
 class BodyStep : public Step {
 public:
   explicit BodyStep(Message *message_)
-      : Step(message_), chunk(message_), bytesRead(0) {}
+      : Step(message_), chunk(this), bytesRead(0), sink() {}
 
   State apply(StreamCursor &cursor) override;
 
+  void setSink(BodySink val) { sink = std::move(val); }
+
+  // Bytes of a Content-Length body still to come, -1 for other bodies
+  ssize_t remaining() const;
+  // Accounts for bytes of the body that did not go through the parser
+  void skip(size_t size) { bytesRead += size; }
+
 private:
   struct Chunk {
     enum Result { Complete, Incomplete, Final };
 
-    explicit Chunk(Message *message_)
-        : message(message_), bytesRead(0), size(-1) {}
+    explicit Chunk(BodyStep *step_) : step(step_), bytesRead(0), size(-1) {}
 
     Result parse(StreamCursor &cursor);
 
@@ -499,11 +620,13 @@ private:
     }
 
   private:
-    Message *message;
+    BodyStep *step;
     size_t bytesRead;
     ssize_t size;
   };
 
+  void consume(const char *data, size_t size);
+
   State parseContentLength(StreamCursor &cursor,
                            const std::shared_ptr<Header::ContentLength> &cl);
   State
@@ -512,6 +635,7 @@ private:
 
   Chunk chunk;
   size_t bytesRead;
+  BodySink sink;
 };
 
 class ParserBase {
@@ -529,9 +653,35 @@ public:
   virtual void reset();
   State parse();
 
+  // Resets the parser once a message has been parsed, keeping the bytes that
+  // were received past its end (pipelined messages). Returns true if there
+  // were some.
+  bool resetToNext();
+
+  // Hands the body of the message being parsed to a sink instead of storing
+  // it in the message, an empty sink restores the default
+  void streamBody(BodySink sink);
+
+  // Drops the bytes that were already parsed so that the buffer only holds
+  // what is left of the message. Meant for streamed bodies, which would
+  // otherwise pile up in the buffer.
+  void compact();
+
+  // Bytes of the body being parsed that are still to come, -1 if the parser
+  // is not at the body or its length is not known ahead
+  ssize_t bodyRemaining() const;
+  // Accounts for bytes of the body that were taken off the socket without
+  // going through the parser, spliced to a pipe for instance. They must
+  // directly follow the bytes fed so far, which must all have been parsed.
+  void skipBody(size_t size);
+
 protected:
   static constexpr size_t StepsCount = 3;
 
+  // Called once a step, the request line, the headers or the body, is
+  // complete
+  virtual void onStepDone(size_t /*step*/) {}
+
   std::array<std::unique_ptr<Step>, StepsCount> allSteps;
   size_t currentStep = 0;
 
@@ -550,6 +700,18 @@ public:
   void reset() override;
 
   Request request;
+  // Of the connection the request comes from, for the tracepoints
+  Fd peerFd;
+  // A request was handed to the handler and was not answered yet: the next
+  // ones wait in the buffer, so that responses go out in the order of the
+  // requests
+  bool answering;
+  // Requests are being handed to the handler, which may answer them before
+  // it returns
+  bool dispatching;
+
+protected:
+  void onStepDone(size_t step) override;
 };
 
 template <> class ParserImpl<Http::Response> : public ParserBase {
@@ -576,6 +738,13 @@ public:
   void setMaxResponseSize(size_t value);
   size_t getMaxResponseSize() const;
 
+  // Requests taking longer in total, or in any single phase, are logged
+  // with the breakdown of their phases. Zero disables the threshold
+  void setSlowRequestThreshold(std::chrono::milliseconds value);
+  std::chrono::milliseconds getSlowRequestThreshold() const;
+  void setSlowPhaseThreshold(std::chrono::milliseconds value);
+  std::chrono::milliseconds getSlowPhaseThreshold() const;
+
   virtual ~Handler() override {}
 
 private:
@@ -583,11 +752,19 @@ private:
   void onDisconnection(const std::shared_ptr<Tcp::Peer> &peer) override;
   void onInput(const char *buffer, size_t len,
                const std::shared_ptr<Tcp::Peer> &peer) override;
+  void onResume(const std::shared_ptr<Tcp::Peer> &peer) override;
+  // Hands the requests of the buffer to onRequest(), one at a time
+  void dispatchRequests(RequestParser &parser,
+                        const std::shared_ptr<Tcp::Peer> &peer,
+                        RequestTimings::Clock::time_point received);
   RequestParser &getParser(const std::shared_ptr<Tcp::Peer> &peer) const;
+  void countParseError();
 
 private:
   size_t maxRequestSize_ = Const::DefaultMaxRequestSize;
   size_t maxResponseSize_ = Const::DefaultMaxResponseSize;
+  std::chrono::milliseconds slowRequestThreshold_{0};
+  std::chrono::milliseconds slowPhaseThreshold_{0};
 };
 
 template <typename H, typename... Args>
@@ -6,6 +6,8 @@
 
 #pragma once
 
+#include <chrono>
+#include <initializer_list>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -258,17 +260,23 @@ class Connection : public Header {
 public:
   NAME("Connection")
 
-  Connection() : control_(ConnectionControl::KeepAlive) {}
+  Connection() : control_(ConnectionControl::KeepAlive), options_() {}
 
-  explicit Connection(ConnectionControl control) : control_(control) {}
+  explicit Connection(ConnectionControl control)
+      : control_(control), options_() {}
 
   void parseRaw(const char *str, size_t len) override;
   void write(std::ostream &os) const override;
 
   ConnectionControl control() const { return control_; }
 
+  // Every option of the header as received, including the names of the
+  // headers that only concern the connection
+  const std::vector<std::string> &options() const { return options_; }
+
 private:
   ConnectionControl control_;
+  std::vector<std::string> options_;
 };
 
 class EncodingHeader : public Header {
@@ -456,6 +464,25 @@ private:
   std::string location_;
 };
 
+class RetryAfter : public Header {
+public:
+  NAME("Retry-After")
+
+  RetryAfter() : delay_(0) {}
+
+  explicit RetryAfter(std::chrono::seconds delay) : delay_(delay) {}
+
+  // Only the delay-seconds form is understood, an HTTP-date yields a delay
+  // of zero.
+  void parse(const std::string &data) override;
+  void write(std::ostream &os) const override;
+
+  std::chrono::seconds delay() const { return delay_; }
+
+private:
+  std::chrono::seconds delay_;
+};
+
 class Server : public Header {
 public:
   NAME("Server")
@@ -496,6 +523,29 @@ private:
   std::string ua_;
 };
 
+class Vary : public Header {
+public:
+  NAME("Vary")
+
+  Vary() : fields_() {}
+
+  explicit Vary(const std::vector<std::string> &fields) : fields_(fields) {}
+  explicit Vary(std::initializer_list<std::string> fields) : fields_(fields) {}
+
+  void parse(const std::string &data) override;
+  void write(std::ostream &os) const override;
+
+  void addField(std::string field) { fields_.push_back(std::move(field)); }
+
+  std::vector<std::string> fields() const { return fields_; }
+
+  // "Vary: *", the response can not be reused for subsequent requests
+  bool varyOnAll() const;
+
+private:
+  std::vector<std::string> fields_;
+};
+
 #define CUSTOM_HEADER(header_name)                                             \
   class header_name : public Pistache::Http::Header::Header {                  \
   public:                                                                      \
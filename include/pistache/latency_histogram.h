@@ -0,0 +1,93 @@
+/* latency_histogram.h
+
+   Log-linear histogram that can be recorded from several threads, as the
+   metrics of the workers and of their event loops do.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pistache {
+namespace Metrics {
+
+/* Log-linear histogram of latencies in microseconds, which can be recorded
+ * concurrently. Every power of ten is split in 9 linear buckets, the upper
+ * bounds being 1, 2, ..., 9, 10, 20, ..., 90, 100, 200... microseconds up to
+ * 100 seconds, and a last bucket holds what lies beyond. Other values, such
+ * as counts of events, can be recorded all the same.
+ */
+class LatencyHistogram {
+public:
+  static constexpr size_t Decades = 8;
+  static constexpr size_t Buckets = Decades * 9 + 2;
+
+  struct Counts {
+    Counts();
+
+    Counts &operator+=(const Counts &other);
+
+    // Upper bound of the bucket holding the percentile, from 0 to 100
+    uint64_t valueAtPercentile(double percentile) const;
+
+    std::array<uint64_t, Buckets> buckets;
+    uint64_t count;
+    // Of the recorded latencies, in microseconds
+    uint64_t sum;
+  };
+
+  LatencyHistogram();
+  // Decays every decayWindow records, so that it follows what it measures
+  // rather than its whole history
+  explicit LatencyHistogram(uint64_t decayWindow);
+
+  void record(uint64_t micros) {
+    buckets_[bucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(micros, std::memory_order_relaxed);
+
+    if (decayWindow_ != 0 &&
+        (records_.fetch_add(1, std::memory_order_relaxed) + 1) %
+                decayWindow_ ==
+            0)
+      decay();
+  }
+
+  // Halves every bucket and the sum. The proportions stay, while the values
+  // recorded next outweigh the older ones
+  void decay();
+
+  Counts counts() const;
+
+  static size_t bucketOf(uint64_t micros) {
+    if (micros <= 1)
+      return 0;
+
+    // Values up to 10^(decade + 1) included belong to the decade
+    const uint64_t value = micros - 1;
+    uint64_t scale = 1;
+    size_t decade = 0;
+    while (value >= scale * 10) {
+      scale *= 10;
+      if (++decade == Decades)
+        return Buckets - 1;
+    }
+
+    return decade * 9 + static_cast<size_t>(value / scale);
+  }
+
+  // Highest value of a bucket, the last one has no bound
+  static uint64_t upperBound(size_t bucket);
+
+private:
+  std::array<std::atomic<uint64_t>, Buckets> buckets_;
+  std::atomic<uint64_t> sum_;
+
+  const uint64_t decayWindow_;
+  std::atomic<uint64_t> records_;
+};
+
+} // namespace Metrics
+} // namespace Pistache
@@ -15,8 +15,7 @@
 #include <pistache/ssl_wrappers.h>
 #include <pistache/tcp.h>
 
-#include <sys/resource.h>
-
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <vector>
@@ -26,6 +25,15 @@
 #endif /* PISTACHE_USE_SSL */
 
 namespace Pistache {
+
+namespace Http {
+class AccessLog;
+}
+
+namespace Metrics {
+class ServerMetrics;
+}
+
 namespace Tcp {
 
 class Peer;
@@ -35,12 +43,15 @@ void setSocketOptions(Fd fd, Flags<Options> options);
 
 class Listener {
 public:
+  /* Share of the time the workers spent handling events rather than
+   * waiting for them, in percent, since the load given to requestLoad()
+   */
   struct Load {
     using TimePoint = std::chrono::system_clock::time_point;
     double global;
     std::vector<double> workers;
 
-    std::vector<rusage> raw;
+    std::vector<Aio::LoopStats::Snapshot> raw;
     TimePoint tick;
   };
 
@@ -67,6 +78,22 @@ public:
 
   Async::Promise<Load> requestLoad(const Load &old);
 
+  // Reactor of the workers, which can run other handlers once it is bound
+  std::shared_ptr<Aio::Reactor> reactor() const;
+
+  // Counts of the workers, which start counting once the listener is bound
+  std::shared_ptr<Metrics::ServerMetrics> metrics() const;
+
+  // Access log the workers record their responses in, once the listener is
+  // bound. None by default
+  void setAccessLog(std::shared_ptr<Http::AccessLog> accessLog);
+  std::shared_ptr<Http::AccessLog> accessLog() const;
+
+  // Has the workers sample the TCP_INFO of up to peers of their connections
+  // every interval, once the listener is bound: the values are kept on the
+  // peers and added to the metrics. Disabled by default. Linux only
+  void setTcpInfoSampling(std::chrono::milliseconds interval, size_t peers);
+
   Options options() const;
   Address address() const;
 
@@ -91,8 +118,12 @@ private:
   std::string workersName_;
   std::shared_ptr<Handler> handler_;
 
-  Aio::Reactor reactor_;
+  std::shared_ptr<Aio::Reactor> reactor_;
   Aio::Reactor::Key transportKey;
+  std::shared_ptr<Metrics::ServerMetrics> metrics_;
+  std::shared_ptr<Http::AccessLog> accessLog_;
+  std::chrono::milliseconds tcpInfoInterval_{0};
+  size_t tcpInfoPeers_ = 0;
 
   void handleNewConnection();
   int acceptConnection(struct sockaddr_in &peer_addr) const;
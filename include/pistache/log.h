@@ -0,0 +1,213 @@
+/* log.h
+
+   Logging of the library.
+
+   Records are written with the PISTACHE_LOG_* macros, in the style of
+   printf. Levels below PISTACHE_LOG_LEVEL, Info unless defined otherwise
+   when compiling, expand to nothing: their arguments are not even
+   evaluated. Levels compiled in can still be filtered at runtime with
+   Log::setLevel().
+
+   A record is formatted in place in a ring of the thread that writes it,
+   which only that thread writes and the logging thread reads: no lock is
+   taken and no memory allocated. The logging thread drains the rings in
+   batches to the sink, standard error by default. When a ring is full,
+   records are dropped and counted rather than blocking the thread.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define PISTACHE_LOG_LEVEL_TRACE 0
+#define PISTACHE_LOG_LEVEL_DEBUG 1
+#define PISTACHE_LOG_LEVEL_INFO 2
+#define PISTACHE_LOG_LEVEL_WARN 3
+#define PISTACHE_LOG_LEVEL_ERROR 4
+#define PISTACHE_LOG_LEVEL_OFF 5
+
+#ifndef PISTACHE_LOG_LEVEL
+#define PISTACHE_LOG_LEVEL PISTACHE_LOG_LEVEL_INFO
+#endif
+
+namespace Pistache {
+namespace Log {
+
+enum class Level : int {
+  Trace = PISTACHE_LOG_LEVEL_TRACE,
+  Debug = PISTACHE_LOG_LEVEL_DEBUG,
+  Info = PISTACHE_LOG_LEVEL_INFO,
+  Warn = PISTACHE_LOG_LEVEL_WARN,
+  Error = PISTACHE_LOG_LEVEL_ERROR,
+  Off = PISTACHE_LOG_LEVEL_OFF
+};
+
+const char *levelName(Level level);
+
+struct Record {
+  static constexpr size_t MaxMessage = 224;
+
+  Level level;
+  std::chrono::system_clock::time_point time;
+  // Of the thread that wrote the record, numbered from 1
+  uint32_t thread;
+  const char *file;
+  int line;
+  // Truncated if longer, always null-terminated
+  char message[MaxMessage];
+};
+
+// Receives the records from the logging thread, in batches
+class Sink {
+public:
+  virtual ~Sink() = default;
+
+  virtual void write(const Record &record) = 0;
+  // Called after every batch
+  virtual void flush() {}
+};
+
+// Writes records as lines to a file descriptor, a batch at a time
+class FdSink : public Sink {
+public:
+  explicit FdSink(int fd);
+
+  void write(const Record &record) override;
+  void flush() override;
+
+private:
+  int fd_;
+  std::string buffer_;
+};
+
+// Records written by a thread before they are drained; the next ones are
+// dropped
+constexpr size_t RingCapacity = 256;
+
+// Records are only formatted from that level, the level the library was
+// compiled with by default
+void setLevel(Level level);
+Level level();
+
+// Standard error by default
+void setSink(std::shared_ptr<Sink> sink);
+
+// Drains the rings of every thread to the sink, from the calling thread
+void flush();
+
+// Records dropped because the ring of their thread was full
+uint64_t dropped();
+
+void write(Level level, const char *file, int line, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+// Appends the time in UTC to the microsecond, 2024-01-31T12:34:56.789012Z,
+// as the records of the log and of the access log are stamped
+void appendTime(std::string &out, std::chrono::system_clock::time_point time);
+
+/* Thread draining rings of entries in the background, those of the log or of
+ * an access log, every interval and whenever woken. It drains with the mutex
+ * of its owner held, the one that guards the rings and where they go.
+ */
+class DrainThread {
+public:
+  DrainThread(std::mutex &mutex, std::chrono::milliseconds interval,
+              std::function<void()> drainLocked);
+  // Stops it
+  ~DrainThread();
+
+  DrainThread(const DrainThread &) = delete;
+  DrainThread &operator=(const DrainThread &) = delete;
+
+  // With the mutex held. False if it already ran, or was stopped
+  bool start();
+  void wake() { wake_.notify_one(); }
+  // Without the mutex held. Entries recorded since the last drain are left
+  // to the owner
+  void stop();
+  bool stopped() const { return stopping_.load(std::memory_order_relaxed); }
+
+private:
+  void run();
+
+  std::mutex &mutex_;
+  const std::chrono::milliseconds interval_;
+  const std::function<void()> drainLocked_;
+
+  std::condition_variable wake_;
+  std::atomic<bool> stopping_;
+  bool started_;
+  std::thread thread_;
+};
+
+namespace detail {
+extern std::atomic<int> runtimeLevel;
+}
+
+inline bool enabled(Level level) {
+  return static_cast<int>(level) >=
+         detail::runtimeLevel.load(std::memory_order_relaxed);
+}
+
+} // namespace Log
+} // namespace Pistache
+
+#define PISTACHE_LOG(level, ...)                                               \
+  do {                                                                         \
+    if (::Pistache::Log::enabled(level))                                       \
+      ::Pistache::Log::write(level, __FILE__, __LINE__, __VA_ARGS__);          \
+  } while (0)
+
+#if PISTACHE_LOG_LEVEL <= PISTACHE_LOG_LEVEL_TRACE
+#define PISTACHE_LOG_TRACE(...)                                                \
+  PISTACHE_LOG(::Pistache::Log::Level::Trace, __VA_ARGS__)
+#else
+#define PISTACHE_LOG_TRACE(...)                                                \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if PISTACHE_LOG_LEVEL <= PISTACHE_LOG_LEVEL_DEBUG
+#define PISTACHE_LOG_DEBUG(...)                                                \
+  PISTACHE_LOG(::Pistache::Log::Level::Debug, __VA_ARGS__)
+#else
+#define PISTACHE_LOG_DEBUG(...)                                                \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if PISTACHE_LOG_LEVEL <= PISTACHE_LOG_LEVEL_INFO
+#define PISTACHE_LOG_INFO(...)                                                 \
+  PISTACHE_LOG(::Pistache::Log::Level::Info, __VA_ARGS__)
+#else
+#define PISTACHE_LOG_INFO(...)                                                 \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if PISTACHE_LOG_LEVEL <= PISTACHE_LOG_LEVEL_WARN
+#define PISTACHE_LOG_WARN(...)                                                 \
+  PISTACHE_LOG(::Pistache::Log::Level::Warn, __VA_ARGS__)
+#else
+#define PISTACHE_LOG_WARN(...)                                                 \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if PISTACHE_LOG_LEVEL <= PISTACHE_LOG_LEVEL_ERROR
+#define PISTACHE_LOG_ERROR(...)                                                \
+  PISTACHE_LOG(::Pistache::Log::Level::Error, __VA_ARGS__)
+#else
+#define PISTACHE_LOG_ERROR(...)                                                \
+  do {                                                                         \
+  } while (0)
+#endif
@@ -0,0 +1,140 @@
+/* loop_stats.h
+
+   Activity of the event loop of a reactor worker.
+
+   The worker records how long it waits in the poller and how long it spends
+   handling what the poller returned, the events of every wakeup, the
+   duration of every handler callback and how long the entries of its
+   cross-thread queues wait before being popped. Everything is a relaxed
+   atomic written by the worker alone, a snapshot can be taken from any
+   thread.
+
+   A worker stuck in a callback shows in the snapshot before the callback
+   returns: currentBusy keeps growing while nothing else moves.
+*/
+
+#pragma once
+
+#include <pistache/latency_histogram.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace Pistache {
+namespace Aio {
+
+class LoopStats {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Snapshot {
+    Snapshot();
+
+    // Share of the time spent handling events, from 0 to 1
+    double utilization() const;
+    // The same, between an older snapshot of the same loop and this one
+    double utilizationSince(const Snapshot &older) const;
+
+    // Times include the wait or the wakeup in progress
+    std::chrono::microseconds busy;
+    std::chrono::microseconds idle;
+    // How long the wakeup in progress has been handled for, 0 when polling
+    std::chrono::microseconds currentBusy;
+
+    uint64_t wakeups;
+    uint64_t events;
+    std::chrono::microseconds longestCallback;
+
+    Metrics::LatencyHistogram::Counts eventsPerWakeup;
+    // Of the callbacks of the handlers, in microseconds
+    Metrics::LatencyHistogram::Counts callbacks;
+    // Of the entries of the cross-thread queues, in microseconds
+    Metrics::LatencyHistogram::Counts queueLag;
+  };
+
+  LoopStats();
+
+  LoopStats(const LoopStats &) = delete;
+  LoopStats &operator=(const LoopStats &) = delete;
+
+  // The worker starts waiting in the poller
+  void polling(Clock::time_point now) {
+    const auto previous = enter(now, false);
+    if (previous.busy)
+      busy_.fetch_add(elapsed(previous.since, now), std::memory_order_relaxed);
+  }
+
+  // The poller returned events, which the worker handles
+  void woken(Clock::time_point now, size_t events) {
+    const auto previous = enter(now, true);
+    if (!previous.busy && previous.since != 0)
+      idle_.fetch_add(elapsed(previous.since, now), std::memory_order_relaxed);
+
+    wakeups_.fetch_add(1, std::memory_order_relaxed);
+    events_.fetch_add(events, std::memory_order_relaxed);
+    eventsPerWakeup_.record(events);
+  }
+
+  // A callback of a handler returned
+  void callback(std::chrono::microseconds duration) {
+    const auto micros = static_cast<uint64_t>(duration.count());
+    callbacks_.record(micros);
+    if (micros > longestCallback_.load(std::memory_order_relaxed))
+      longestCallback_.store(micros, std::memory_order_relaxed);
+  }
+
+  // An entry of a cross-thread queue was popped, after waiting that long
+  void queueLag(std::chrono::microseconds lag) {
+    queueLag_.record(static_cast<uint64_t>(std::max<int64_t>(lag.count(), 0)));
+  }
+
+  Snapshot snapshot() const;
+
+private:
+  struct Phase {
+    bool busy;
+    // Nanoseconds of the steady clock, 0 before the first poll
+    int64_t since;
+  };
+
+  static int64_t nanos(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               time.time_since_epoch())
+        .count();
+  }
+
+  static uint64_t elapsed(int64_t since, Clock::time_point now) {
+    return static_cast<uint64_t>(std::max<int64_t>(nanos(now) - since, 0));
+  }
+
+  // The phase and its start are packed in a single word, read at once. Only
+  // the worker writes it, no read-modify-write is needed
+  Phase enter(Clock::time_point now, bool busy) {
+    const auto previous = unpack(phase_.load(std::memory_order_relaxed));
+    phase_.store((nanos(now) << 1) | (busy ? 1 : 0), std::memory_order_relaxed);
+    return previous;
+  }
+
+  static Phase unpack(int64_t packed) {
+    return Phase{(packed & 1) != 0, packed >> 1};
+  }
+
+  std::atomic<int64_t> phase_;
+  // Nanoseconds
+  std::atomic<uint64_t> busy_;
+  std::atomic<uint64_t> idle_;
+  std::atomic<uint64_t> wakeups_;
+  std::atomic<uint64_t> events_;
+  // Microseconds
+  std::atomic<uint64_t> longestCallback_;
+
+  Metrics::LatencyHistogram eventsPerWakeup_;
+  Metrics::LatencyHistogram callbacks_;
+  Metrics::LatencyHistogram queueLag_;
+};
+
+} // namespace Aio
+} // namespace Pistache
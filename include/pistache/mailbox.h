@@ -16,6 +16,7 @@
 #include <pistache/event.h>
 
 #include <pistache/common.h>
+#include <pistache/log.h>
 #include <pistache/os.h>
 
 namespace Pistache {
@@ -85,7 +86,6 @@ public:
       uint64_t val = 1;
 #ifdef __MACH__
       TRY(event_notify(event_id, val));
-      std::cout << "> event_notify from post()" << std::endl;
 #else
       TRY(write(event_id, &val, sizeof val));
 #endif // __MACH__
@@ -103,14 +103,14 @@ public:
 #ifdef __MACH__
         // kqueue event will simply return 0 if event was not triggered.
         int bytes = event_test(event_id, &val);
-        std::cout << "> event_test from clear()" << std::endl;
         if (bytes <= 1) break;
         
         if (bytes <= 0) {
           if (errno == EAGAIN || errno == EWOULDBLOCK || bytes == 0) {
             break;
           } else {
-            std::cout << "warn" << std::endl;
+            PISTACHE_LOG_WARN("Could not read event %d: %s", event_id,
+                              strerror(errno));
           }
         }
 #else
@@ -142,7 +142,7 @@ public:
       throw std::runtime_error("The mailbox is not bound");
     }
 
-    poller.removeFd(event_id, Flags<Polling::NotifyOn>(Polling::NotifyOn::Read));
+    poller.removeFd(event_id);
     close(event_id), event_id = -1;
   }
 
@@ -271,7 +271,6 @@ public:
         // write to kqueue not allowed!!! Either use pipe or other call
 #ifdef __MACH__
       TRY(event_notify(event_id, val));
-      std::cout << "> event_notify from push()" << std::endl; // YOSHI
 #else
       TRY(write(event_id, &val, sizeof val));
 #endif // __MACH__
@@ -287,14 +286,14 @@ public:
 #ifdef __MACH__
         // kqueue event poll will simply return 0, if there is no data
         int bytes = event_test(event_id, &val);
-        std::cout << "> event_test from pop(), bytes = " << bytes << std::endl; // YOSHI
         if (bytes == 1) break;
         
         if (bytes <= 0) {
           if (errno == EAGAIN || errno == EWOULDBLOCK || bytes == 0) {
             break;
           } else {
-            std::cout << "warn" << std::endl;
+            PISTACHE_LOG_WARN("Could not read event %d: %s", event_id,
+                              strerror(errno));
           }
         }
 #else
@@ -0,0 +1,226 @@
+/* metrics.h
+
+   Built-in instrumentation of the workers of an endpoint.
+
+   Every worker counts in a Metrics::Worker of its own: requests and their
+   latencies by status class, bytes in and out, connections and the depth of
+   its write queue, and the TCP_INFO sampled from its peers when sampling is
+   enabled on the listener. Counters are relaxed atomics, recording one is a
+   single uncontended increment and never takes a lock. A snapshot adds the
+   workers up from any thread, while they keep counting.
+
+   The counts can be rendered in the text format of Prometheus, by an
+   Http::MetricsHandler or the route() of the metrics.
+*/
+
+#pragma once
+
+#include <pistache/http.h>
+#include <pistache/latency_histogram.h>
+#include <pistache/mailbox.h>
+#include <pistache/reactor.h>
+#include <pistache/router.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace Pistache {
+
+namespace Tcp {
+class Listener;
+}
+
+namespace Metrics {
+
+// Requests are counted by status class, 1xx to 5xx
+constexpr size_t StatusClasses = 5;
+
+struct Snapshot {
+  Snapshot();
+
+  Snapshot &operator+=(const Snapshot &other);
+
+  uint64_t requests() const;
+
+  std::array<uint64_t, StatusClasses> requestsByClass;
+  std::array<LatencyHistogram::Counts, StatusClasses> latencies;
+  uint64_t parseErrors;
+  uint64_t bytesReceived;
+  uint64_t bytesSent;
+  uint64_t connectionsAccepted;
+  int64_t activeConnections;
+  int64_t writeQueueDepth;
+
+  // Of the TCP_INFO samples of the peers, the round-trip times in
+  // microseconds, the congestion windows and unacknowledged segments
+  LatencyHistogram::Counts tcpRtt;
+  LatencyHistogram::Counts tcpRttVariance;
+  LatencyHistogram::Counts tcpCwnd;
+  LatencyHistogram::Counts tcpUnacked;
+  uint64_t tcpRetransmits;
+};
+
+/* Counts of a single worker. Recorded from the thread of the worker, except
+ * for the responses, which are recorded by the thread sending them.
+ */
+class Worker {
+public:
+  Worker();
+
+  Worker(const Worker &) = delete;
+  Worker &operator=(const Worker &) = delete;
+
+  // Latency from the request being parsed to its response being handed to
+  // the transport
+  void requestHandled(int code, std::chrono::microseconds latency) {
+    const size_t index = classOf(code);
+    requests_[index].fetch_add(1, std::memory_order_relaxed);
+    latencies_[index].record(static_cast<uint64_t>(
+        std::max<int64_t>(latency.count(), 0)));
+  }
+
+  void parseError() { parseErrors_.fetch_add(1, std::memory_order_relaxed); }
+
+  void bytesReceived(size_t bytes) {
+    bytesReceived_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void bytesSent(size_t bytes) {
+    bytesSent_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void connectionOpened() {
+    connectionsAccepted_.fetch_add(1, std::memory_order_relaxed);
+    activeConnections_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void connectionClosed() {
+    activeConnections_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Writes waiting for the socket of their peer to be writable
+  void writesQueued(size_t count) {
+    writeQueueDepth_.fetch_add(static_cast<int64_t>(count),
+                               std::memory_order_relaxed);
+  }
+
+  void writesDone(size_t count) {
+    writeQueueDepth_.fetch_sub(static_cast<int64_t>(count),
+                               std::memory_order_relaxed);
+  }
+
+  // A TCP_INFO sample of a peer, with the segments it retransmitted since
+  // the previous one
+  void tcpInfoSampled(std::chrono::microseconds rtt,
+                      std::chrono::microseconds rttVariance, uint32_t cwnd,
+                      uint32_t unacked, uint32_t retransmits) {
+    tcpRtt_.record(static_cast<uint64_t>(std::max<int64_t>(rtt.count(), 0)));
+    tcpRttVariance_.record(
+        static_cast<uint64_t>(std::max<int64_t>(rttVariance.count(), 0)));
+    tcpCwnd_.record(cwnd);
+    tcpUnacked_.record(unacked);
+    tcpRetransmits_.fetch_add(retransmits, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot() const;
+
+  // Status classes out of the 1xx to 5xx range are counted as 5xx
+  static size_t classOf(int code) {
+    const int index = code / 100 - 1;
+    if (index < 0 || index >= static_cast<int>(StatusClasses))
+      return StatusClasses - 1;
+    return static_cast<size_t>(index);
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, StatusClasses> requests_;
+  std::array<LatencyHistogram, StatusClasses> latencies_;
+  std::atomic<uint64_t> parseErrors_;
+  std::atomic<uint64_t> bytesReceived_;
+  std::atomic<uint64_t> bytesSent_;
+  std::atomic<uint64_t> connectionsAccepted_;
+  std::atomic<int64_t> activeConnections_;
+  std::atomic<int64_t> writeQueueDepth_;
+  LatencyHistogram tcpRtt_;
+  LatencyHistogram tcpRttVariance_;
+  LatencyHistogram tcpCwnd_;
+  LatencyHistogram tcpUnacked_;
+  std::atomic<uint64_t> tcpRetransmits_;
+
+  // Keeps the counters of the next worker out of the last cache line
+  cacheline_pad_t pad_;
+};
+
+// Metrics of the workers of a listener
+class ServerMetrics : public std::enable_shared_from_this<ServerMetrics> {
+public:
+  ServerMetrics();
+
+  ServerMetrics(const ServerMetrics &) = delete;
+  ServerMetrics &operator=(const ServerMetrics &) = delete;
+
+  // Workers are set up once the listener is bound
+  size_t workers() const;
+  Worker &worker(size_t index);
+
+  // Every worker added up
+  Snapshot snapshot() const;
+  Snapshot snapshot(size_t worker) const;
+
+  /* Writes the metrics in the text exposition format of Prometheus.
+   * Requests, latencies and TCP_INFO samples are added up over the workers,
+   * connections, bytes, retransmits, write queues and event loops are given
+   * per worker.
+   */
+  void writePrometheus(std::ostream &os) const;
+
+  // Handler of a Rest route that serves the metrics
+  Rest::Route::Handler route();
+
+  // Content type of the text exposition format
+  static Http::Mime::MediaType contentType();
+
+private:
+  friend class Tcp::Listener;
+
+  void setWorkers(size_t count);
+  void setReactor(const std::shared_ptr<Aio::Reactor> &reactor);
+
+  static void writeLoops(std::ostream &os,
+                         const std::vector<Aio::LoopStats::Snapshot> &loops);
+
+  // For the transports, which can outlive the listener
+  std::shared_ptr<Worker> sharedWorker(size_t index);
+
+  std::vector<std::shared_ptr<Worker>> workers_;
+  // Of the workers, whose event loops are exposed along
+  std::weak_ptr<Aio::Reactor> reactor_;
+};
+
+} // namespace Metrics
+
+namespace Http {
+
+// Serves the metrics of an endpoint, whatever the request
+class MetricsHandler : public Handler {
+public:
+  HTTP_PROTOTYPE(MetricsHandler)
+
+  explicit MetricsHandler(
+      std::shared_ptr<const Metrics::ServerMetrics> metrics);
+
+  void onRequest(const Request &request, ResponseWriter response) override;
+
+private:
+  std::shared_ptr<const Metrics::ServerMetrics> metrics_;
+};
+
+} // namespace Http
+} // namespace Pistache
@@ -119,6 +119,9 @@ public:
   int poll(std::vector<Event> &events, const std::chrono::milliseconds timeout =
                                            std::chrono::milliseconds(-1)) const;
 
+  // The poller is itself a fd, readable when some of its fds are ready
+  Fd fd() const { return poll_id; }
+
 private:
   static int toEpollEvents(const Flags<NotifyOn> &interest);
   static Flags<NotifyOn> toNotifyOn(int events);
@@ -6,8 +6,11 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -28,6 +31,21 @@ namespace Tcp {
 
 class Transport;
 
+// State of the TCP connection as given by the kernel (TCP_INFO)
+struct TcpInfo {
+  // Smoothed round-trip time, and its mean deviation
+  std::chrono::microseconds rtt{0};
+  std::chrono::microseconds rttVariance{0};
+  // Segments retransmitted since the connection opened
+  uint32_t retransmits = 0;
+  // Congestion window, in segments
+  uint32_t cwnd = 0;
+  // Segments sent and not yet acknowledged
+  uint32_t unacked = 0;
+  // When it was sampled, the epoch if it never was
+  std::chrono::steady_clock::time_point sampled;
+};
+
 class Peer {
 public:
   friend class Transport;
@@ -49,6 +67,13 @@ public:
 
   Async::Promise<ssize_t> send(const RawBuffer &buffer, int flags = 0);
 
+  // Last sample, taken by the transport when sampling is enabled on the
+  // listener, or by sampleTcpInfo(). Safe to call from any thread
+  TcpInfo tcpInfo() const;
+  // Samples the connection now. False when the kernel does not provide
+  // TCP_INFO or the socket is no longer open
+  bool sampleTcpInfo();
+
 protected:
   Peer(Fd fd, const Address &addr, void *ssl);
 
@@ -64,6 +89,9 @@ private:
   std::unordered_map<std::string, std::shared_ptr<Http::Parser>> data_;
 
   void *ssl_ = nullptr;
+
+  mutable std::mutex tcpInfoMutex_;
+  TcpInfo tcpInfo_;
 };
 
 std::ostream &operator<<(std::ostream &os, Peer &peer);
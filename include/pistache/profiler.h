@@ -0,0 +1,116 @@
+/* profiler.h
+
+   Sampling CPU profiler of the threads of the process.
+
+   While a profile runs, every sampled thread has a timer on its own CPU
+   clock, which sends it SIGPROF at the sampling frequency: threads are only
+   sampled while they run. The handler of the signal walks the stack of the
+   thread with backtrace() into a buffer allocated beforehand, without
+   taking any lock. Once the duration elapsed, the frames are named and the
+   stacks counted, ready to be written as the folded stacks flamegraph.pl
+   and speedscope take.
+
+   Frames are named after the dynamic symbols: those of shared libraries,
+   libpistache.so among them, and those of executables linked with
+   -rdynamic. Other frames are given as module+offset, for addr2line.
+
+   The profiler handles SIGPROF from the first profile on, and runs one
+   profile at a time. Linux only.
+*/
+
+#pragma once
+
+#include <pistache/http.h>
+#include <pistache/router.h>
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace Pistache {
+namespace Profiler {
+
+struct Profile;
+
+class Options {
+public:
+  friend Profile profile(const Options &options);
+
+  // For how long the threads are sampled
+  Options &duration(std::chrono::milliseconds val);
+  // Samples per second of CPU time of every thread
+  Options &frequency(unsigned int val);
+  // Only samples the threads of that name, as given by pthread_setname_np()
+  // or Http::Endpoint::Options::threadsName(). Every thread when empty
+  Options &threadsName(std::string val);
+  // Samples kept, the next ones are dropped
+  Options &maxSamples(size_t val);
+
+  Options();
+
+private:
+  std::chrono::milliseconds duration_;
+  unsigned int frequency_;
+  std::string threadsName_;
+  size_t maxSamples_;
+};
+
+struct Profile {
+  Profile();
+
+  // Writes a line per stack: the name of the thread, then its frames from
+  // the outermost, separated by semicolons, and the samples of the stack
+  void writeFolded(std::ostream &os) const;
+
+  // Samples by folded stack
+  std::map<std::string, size_t> stacks;
+  size_t samples;
+  // Samples not kept, past the maximum
+  size_t dropped;
+  // Threads sampled
+  size_t threads;
+};
+
+Options options();
+
+// Samples the threads for the duration of the options, blocking the calling
+// thread, which is not sampled. Throws if a profile is already running or
+// if the timers could not be set up
+Profile profile(const Options &options = Options());
+
+// Handler of a Rest route that serves the folded stacks of a profile, see
+// Http::ProfilerHandler
+Rest::Route::Handler route(std::string threadsName = "");
+
+} // namespace Profiler
+
+namespace Http {
+
+/* Serves the folded stacks of a profile of the threads, whatever the path.
+ * The query can set the duration in seconds, the frequency in hertz and the
+ * name of the threads to sample, those given to the handler by default:
+ *
+ *     GET /debug/profile?seconds=30&hz=99&threads=api-worker
+ *
+ * The profile runs on a thread of its own, the response is sent from there
+ * once it is complete. Another profile already running is a 409.
+ */
+class ProfilerHandler : public Handler {
+public:
+  HTTP_PROTOTYPE(ProfilerHandler)
+
+  static constexpr std::chrono::seconds DefaultDuration{10};
+  static constexpr std::chrono::seconds MaxDuration{300};
+
+  explicit ProfilerHandler(std::string threadsName = "");
+
+  void onRequest(const Request &request, ResponseWriter response) override;
+
+private:
+  std::string threadsName_;
+};
+
+} // namespace Http
+} // namespace Pistache
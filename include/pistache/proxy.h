@@ -0,0 +1,114 @@
+/* proxy.h
+
+   Reverse proxy, forwarding requests to an upstream through the pool of an
+   Http::Client and streaming the responses back.
+
+   Headers that only concern a single connection (hop-by-hop) are dropped on
+   the way, the proxy adds X-Forwarded-* and Via headers of its own. Bodies of
+   responses are moved from the upstream socket to the downstream one through
+   a pipe with splice(), so that they never enter user space, unless one of
+   the sides speaks TLS: they are then copied.
+*/
+
+#pragma once
+
+#include <pistache/client.h>
+#include <pistache/http.h>
+#include <pistache/router.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace Pistache {
+namespace Http {
+
+class ReverseProxy : public std::enable_shared_from_this<ReverseProxy> {
+public:
+  class Options {
+  public:
+    friend class ReverseProxy;
+
+    Options();
+
+    // Moves the bodies of the responses with splice() whenever possible
+    Options &splice(bool val);
+    // Name of the proxy in the Via header
+    Options &via(std::string name);
+    // Whether the address of the client is appended to X-Forwarded-For
+    Options &forwardedFor(bool val);
+    // Removed from the beginning of the path before it is forwarded
+    Options &stripPrefix(std::string prefix);
+    // How long the upstream can take to send the head of its response
+    Options &timeout(std::chrono::milliseconds val);
+
+  private:
+    bool splice_;
+    std::string via_;
+    bool forwardedFor_;
+    std::string stripPrefix_;
+    std::chrono::milliseconds timeout_;
+  };
+
+  struct Stats {
+    uint64_t forwarded = 0;
+    // Requests answered by the proxy itself, the upstream having failed
+    uint64_t failed = 0;
+    uint64_t splicedBytes = 0;
+    uint64_t copiedBytes = 0;
+  };
+
+  /* The upstream is a base URL, such as http://127.0.0.1:8080, or the name
+   * of an upstream group registered on the client, as http://<name>. The
+   * client must outlive the requests being forwarded.
+   */
+  ReverseProxy(std::shared_ptr<Client> client, std::string upstream,
+               const Options &options = Options());
+
+  static std::shared_ptr<ReverseProxy>
+  create(std::shared_ptr<Client> client, std::string upstream,
+         const Options &options = Options());
+
+  // Answers with 502 Bad Gateway, or 504 Gateway Timeout, when the upstream
+  // fails before the head of its response came back
+  void forward(const Request &request, ResponseWriter response);
+
+  // Handler of a Rest route that forwards its requests
+  Rest::Route::Handler route();
+
+  Stats stats() const;
+
+  // Whether the header only concerns a single connection. The ones listed by
+  // the Connection header of a message are hop-by-hop as well.
+  static bool isHopByHop(const std::string &name);
+
+private:
+  friend struct ProxyExchange;
+
+  std::shared_ptr<Client> client_;
+  std::string upstream_;
+  Options options_;
+
+  std::atomic<uint64_t> forwarded_;
+  std::atomic<uint64_t> failed_;
+  std::atomic<uint64_t> splicedBytes_;
+  std::atomic<uint64_t> copiedBytes_;
+};
+
+// Forwards every request it gets
+class ProxyHandler : public Handler {
+public:
+  HTTP_PROTOTYPE(ProxyHandler)
+
+  explicit ProxyHandler(std::shared_ptr<ReverseProxy> proxy);
+
+  void onRequest(const Request &request, ResponseWriter response) override;
+
+private:
+  std::shared_ptr<ReverseProxy> proxy_;
+};
+
+} // namespace Http
+} // namespace Pistache
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <pistache/flags.h>
+#include <pistache/loop_stats.h>
 #include <pistache/net.h>
 #include <pistache/os.h>
 #include <pistache/prototype.h>
@@ -123,6 +124,9 @@ public:
   void runOnce();
   void run();
 
+  // Activity of the event loop of every worker
+  std::vector<LoopStats::Snapshot> loopStats() const;
+
   void shutdown();
 
 private:
@@ -164,7 +168,7 @@ public:
   friend class SyncImpl;
   friend class AsyncImpl;
 
-  Handler() : reactor_(nullptr), context_(), key_() {}
+  Handler() : reactor_(nullptr), context_(), key_(), loopStats_(nullptr) {}
 
   struct Context {
     friend class SyncImpl;
@@ -186,12 +190,16 @@ public:
 
   Reactor::Key key() const { return key_; };
 
+  // Statistics of the event loop running the handler, once it is added
+  LoopStats *loopStats() const { return loopStats_; }
+
   virtual ~Handler() {}
 
 private:
   Reactor *reactor_;
   Context context_;
   Reactor::Key key_;
+  LoopStats *loopStats_;
 };
 
 } // namespace Aio
@@ -0,0 +1,151 @@
+/* resolver.h
+
+   Asynchronous host name resolution with caching.
+
+   Lookups run on a small pool of dedicated threads so that a slow resolver
+   never stalls the caller, and their answers are cached for the duration of
+   their time-to-live. Concurrent lookups of the same name are merged.
+*/
+
+#pragma once
+
+#include <pistache/async.h>
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Pistache {
+
+class DnsResolver {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // An address, ready to be handed to connect(2)
+  struct ResolvedAddress {
+    ResolvedAddress();
+    ResolvedAddress(const struct sockaddr *addr, socklen_t len);
+
+    const struct sockaddr *get() const {
+      return reinterpret_cast<const struct sockaddr *>(&addr);
+    }
+
+    int family() const { return addr.ss_family; }
+
+    sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  struct Answer {
+    std::vector<ResolvedAddress> addresses;
+
+    // How long the answer can be cached. Lookup functions that do not know
+    // (getaddrinfo does not expose it) leave it negative, in which case the
+    // default time-to-live of the resolver applies.
+    std::chrono::seconds ttl = std::chrono::seconds(-1);
+  };
+
+  /* Resolves a host name and a port for an address family (AF_UNSPEC for
+   * any). Must return an answer without address or throw when the name does
+   * not exist.
+   */
+  using Lookup = std::function<Answer(
+      const std::string &host, const std::string &port, int family)>;
+
+  struct Options {
+    friend class DnsResolver;
+
+    Options();
+
+    // Number of threads running the lookups
+    Options &threads(size_t val);
+
+    // How long answers are cached when the lookup does not tell
+    Options &defaultTtl(std::chrono::seconds val);
+
+    // How long failed lookups are cached
+    Options &negativeTtl(std::chrono::seconds val);
+
+    // Replaces the system resolver, mostly useful for tests
+    Options &lookup(Lookup val);
+
+  private:
+    size_t threads_;
+    std::chrono::seconds defaultTtl_;
+    std::chrono::seconds negativeTtl_;
+    Lookup lookup_;
+  };
+
+  explicit DnsResolver(const Options &options = Options());
+  ~DnsResolver();
+
+  DnsResolver(const DnsResolver &) = delete;
+  DnsResolver &operator=(const DnsResolver &) = delete;
+
+  static std::shared_ptr<DnsResolver> create(const Options &options = Options());
+
+  /* Resolves a host name. The promise is resolved right away for numeric
+   * addresses and cached answers, and from one of the resolver threads
+   * otherwise. It is rejected when the name can not be resolved.
+   */
+  Async::Promise<std::shared_ptr<const Answer>>
+  resolve(const std::string &host, const std::string &port,
+          int family = AF_UNSPEC);
+
+  // Drops every cached answer
+  void clear();
+
+  size_t cachedEntries() const;
+  uint64_t lookups() const;
+
+  // Blocking lookup through getaddrinfo(3)
+  static Answer systemLookup(const std::string &host, const std::string &port,
+                             int family);
+
+private:
+  using Result = std::shared_ptr<const Answer>;
+
+  struct Entry {
+    Entry() : answer(), error(), expires(), pending() {}
+
+    Result answer;
+    std::string error;
+    Clock::time_point expires;
+    std::vector<Async::Deferred<Result>> pending;
+  };
+
+  struct Job {
+    std::string key;
+    std::string host;
+    std::string port;
+    int family;
+  };
+
+  void run();
+  void complete(const Job &job, Result answer, std::string error);
+  void prune(Clock::time_point now);
+
+  Options options_;
+
+  mutable std::mutex lock_;
+  std::condition_variable jobsCv_;
+  std::deque<Job> jobs_;
+  std::unordered_map<std::string, Entry> cache_;
+  uint64_t lookups_;
+  bool stop_;
+
+  std::vector<std::thread> threads_;
+};
+
+} // namespace Pistache
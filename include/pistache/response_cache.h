@@ -0,0 +1,152 @@
+/* response_cache.h
+
+   In-memory HTTP response cache for the Rest router.
+
+   Responses are kept in their serialized form so that a hit is written to
+   the wire as is, without invoking the handler. Entries are spread over
+   shards, each one holding an LRU list bounded by its share of the byte
+   budget of the cache.
+*/
+
+#pragma once
+
+#include <pistache/http.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Pistache {
+namespace Rest {
+
+class ResponseCache {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    friend class ResponseCache;
+
+    Options();
+
+    // Upper bound of the memory used by the cached responses, in bytes
+    Options &maxBytes(size_t val);
+
+    // Number of independently locked shards
+    Options &shards(size_t val);
+
+    // Query parameters that take part in the key, the whole query is used
+    // when none is given
+    Options &queryParameters(std::vector<std::string> val);
+
+  private:
+    size_t maxBytes_;
+    size_t shards_;
+    std::vector<std::string> queryParameters_;
+  };
+
+  struct CachedResponse {
+    CachedResponse(Http::Code code, RawBuffer wire, Clock::time_point expires)
+        : code(code), wire(std::move(wire)), expires(expires) {}
+
+    Http::Code code;
+    RawBuffer wire;
+    Clock::time_point expires;
+  };
+
+  explicit ResponseCache(const Options &options = Options());
+
+  static std::shared_ptr<ResponseCache>
+  create(const Options &options = Options());
+
+  // Only GET and HEAD requests are looked up and stored
+  static bool isCacheable(const Http::Request &request);
+
+  /* Whether a response may be reused for other clients: its status code is
+   * cacheable by default, it does not set cookies and its Cache-Control
+   * header does not forbid it (no-store or private).
+   */
+  static bool isShareable(const Http::Response &response);
+
+  /* Builds the key of a request from its method, its path and the selected
+   * query parameters. The path must already be normalized (see
+   * SegmentTreeNode::sanitizeResource).
+   */
+  std::string requestKey(const Http::Request &request,
+                         const std::string &path) const;
+
+  // Same as above, the whole query is used when queryParameters is empty
+  // and queryParameters must be sorted otherwise
+  static std::string
+  requestKey(const Http::Request &request, const std::string &path,
+             const std::vector<std::string> &queryParameters);
+
+  // Extends a request key with the values of the given request headers
+  static std::string variantKey(const std::string &key,
+                                const std::vector<std::string> &fields,
+                                const Http::Request &request);
+
+  /* Returns the fresh response stored for the request, or a null pointer.
+   * The headers listed by the Vary header of the stored response are taken
+   * into account.
+   */
+  std::shared_ptr<const CachedResponse> lookup(const std::string &key,
+                                               const Http::Request &request);
+
+  /* Stores a response if its Cache-Control header allows it (s-maxage or
+   * max-age, without no-store, no-cache or private). Returns whether the
+   * response has been stored.
+   */
+  bool store(const std::string &key, const Http::Request &request,
+             const Http::Response &response, const RawBuffer &wire);
+
+  void clear();
+
+  size_t bytes() const;
+  size_t entries() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+private:
+  struct Entry {
+    std::string key;
+    std::string baseKey;
+    std::shared_ptr<const CachedResponse> response;
+    size_t bytes;
+  };
+
+  // The Vary fields of the responses stored under a request key
+  struct Variants {
+    std::vector<std::string> fields;
+    size_t entries;
+  };
+
+  struct Shard {
+    Shard() : lock(), lru(), index(), variants(), bytes(0) {}
+
+    std::mutex lock;
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::unordered_map<std::string, Variants> variants;
+    size_t bytes;
+  };
+
+  Shard &shardFor(const std::string &key) const;
+  void evict(Shard &shard, std::list<Entry>::iterator it);
+
+  Options options_;
+  size_t shardBudget_;
+  std::unique_ptr<Shard[]> shards_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+} // namespace Rest
+} // namespace Pistache
@@ -13,9 +13,12 @@
 #include <unordered_map>
 #include <vector>
 
+#include <pistache/admission.h>
+#include <pistache/coalescer.h>
 #include <pistache/flags.h>
 #include <pistache/http.h>
 #include <pistache/http_defs.h>
+#include <pistache/response_cache.h>
 
 #include "pistache/string_view.h"
 
@@ -61,7 +64,7 @@ class Request;
 struct Route {
   enum class Result { Ok, Failure };
 
-  enum class Status { Match, NotFound, NotAllowed };
+  enum class Status { Match, NotFound, NotAllowed, Rejected };
 
   typedef std::function<Result(const Request, Http::ResponseWriter)> Handler;
 
@@ -219,6 +222,44 @@ public:
 
   void addCustomHandler(Route::Handler handler);
 
+  /**
+   * Guards a resource and every resource below it with an admission
+   * controller. Matching requests that exceed the limits of the controller
+   * are rejected with a 503 and a Retry-After header. A resource ending with
+   * a splat, "/reports/" followed by one, is accepted and equivalent to
+   * "/reports". When several controllers apply to the same resource, the
+   * most specific one is used.
+   * \param[in] resource Root of the guarded subtree, "/" guards every route.
+   * \param[in] controller Controller to use, can be shared between subtrees.
+   */
+  void addAdmissionController(const std::string &resource,
+                              std::shared_ptr<AdmissionController> controller);
+
+  /**
+   * Serves GET and HEAD requests for a resource and every resource below it
+   * from a response cache. Responses are stored according to the
+   * Cache-Control and Vary headers set by the handler, and hits are written
+   * back without invoking the handler. Resources are matched the same way
+   * as for addAdmissionController().
+   * \param[in] resource Root of the cached subtree, "/" caches every route.
+   * \param[in] cache Cache to use, can be shared between subtrees.
+   */
+  void addResponseCache(const std::string &resource,
+                        std::shared_ptr<ResponseCache> cache);
+
+  /**
+   * Coalesces identical GET and HEAD requests for a resource and every
+   * resource below it: while a request is being handled, identical requests
+   * wait for its response instead of invoking the handler. They get a copy
+   * of the serialized response if it can be shared (see
+   * ResponseCache::isShareable) and are handled as usual otherwise. When a
+   * response cache also applies, requests are identified by its key.
+   * \param[in] resource Root of the coalesced subtree, "/" for every route.
+   * \param[in] coalescer Coalescer to use, can be shared between subtrees.
+   */
+  void addRequestCoalescer(const std::string &resource,
+                           std::shared_ptr<RequestCoalescer> coalescer);
+
   void addNotFoundHandler(Route::Handler handler);
   inline bool hasNotFoundHandler() { return notFoundHandler != nullptr; }
   void invokeNotFoundHandler(const Http::Request &req,
@@ -227,14 +268,44 @@ public:
   Route::Status route(const Http::Request &request,
                       Http::ResponseWriter response);
 
-  Router() : routes(), customHandlers(), notFoundHandler() {}
+  Router()
+      : routes(), customHandlers(), notFoundHandler(), admissionControllers(),
+        responseCaches(), requestCoalescers() {}
 
 private:
+  Route::Status invokeRoute(const std::shared_ptr<Route> &route,
+                            const Http::Request &req, const std::string &path,
+                            std::vector<TypedParam> params,
+                            std::vector<TypedParam> splats,
+                            Http::ResponseWriter response, bool coalesce);
+
+  // Objects bound to a subtree of resources, stored along with the sanitized
+  // resource prefix, the longest prefixes first
+  template <typename T>
+  using ResourcePrefixes =
+      std::vector<std::pair<std::string, std::shared_ptr<T>>>;
+
+  template <typename T>
+  static void addResourcePrefix(ResourcePrefixes<T> &prefixes,
+                                const std::string &resource,
+                                std::shared_ptr<T> value);
+
+  template <typename T>
+  static std::shared_ptr<T>
+  findResourcePrefix(const ResourcePrefixes<T> &prefixes,
+                     const std::string &path);
+
   std::unordered_map<Http::Method, SegmentTreeNode> routes;
 
   std::vector<Route::Handler> customHandlers;
 
   Route::Handler notFoundHandler;
+
+  ResourcePrefixes<AdmissionController> admissionControllers;
+
+  ResourcePrefixes<ResponseCache> responseCaches;
+
+  ResourcePrefixes<RequestCoalescer> requestCoalescers;
 };
 
 namespace Private {
@@ -98,6 +98,14 @@ public:
     Base::setg(bytes.data(), bytes.data(), bytes.data() + bytes.size());
   }
 
+  // Drops the bytes that were already read, keeping the storage around
+  void compact() {
+    const size_t readOffset =
+        static_cast<size_t>(this->gptr() - this->eback());
+    bytes.erase(bytes.begin(), bytes.begin() + readOffset);
+    Base::setg(bytes.data(), bytes.data(), bytes.data() + bytes.size());
+  }
+
 private:
   std::vector<CharT> bytes;
   size_t maxSize = Const::MaxBuffer;
@@ -131,6 +139,19 @@ private:
   size_t size_;
 };
 
+// Bytes waiting in a pipe, moved to the socket with splice() without going
+// through user space. The pipe is owned by the caller and left open.
+struct PipeBuffer {
+  PipeBuffer(Fd fd, size_t size);
+
+  Fd fd() const;
+  size_t size() const;
+
+private:
+  Fd fd_;
+  size_t size_;
+};
+
 class DynamicStreamBuf : public StreamBuf<char> {
 public:
   using Base = StreamBuf<char>;
@@ -147,6 +168,10 @@ public:
 
   RawBuffer buffer() const;
 
+  // The bytes written so far, valid until the next write or clear()
+  const char *data() const;
+  size_t size() const;
+
   void clear();
 
   size_t maxSize() const;
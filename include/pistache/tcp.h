@@ -43,6 +43,9 @@ public:
 
   virtual void onConnection(const std::shared_ptr<Tcp::Peer> &peer);
   virtual void onDisconnection(const std::shared_ptr<Tcp::Peer> &peer);
+  // Called from the worker of the peer after Transport::resumeInput(), for
+  // the handler to go on with the input it held back
+  virtual void onResume(const std::shared_ptr<Tcp::Peer> &peer);
 
 private:
   void associateTransport(Transport *transport);
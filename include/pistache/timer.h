@@ -18,7 +18,6 @@
 typedef int TimerStore; // kq
 typedef size_t TimerId;
 
-// YOSHI REMOVE
 #include <execinfo.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -33,14 +32,12 @@ inline void printStacktrace() {
 
 inline TimerStore timer_store() {
     TimerStore kq = kqueue();
-    std::cout << "timer_store() kq=" << kq << std::endl; // YOSHI
     return kq;
 }
 
 inline TimerId timer_init(unsigned int initval, int flags, TimerId tid = 1) {
     // Do nothing, except returning the timerid. Timer will be added with timer_set.
     // On Linux, a filedescriptor will be created using timerfd_create.
-    std::cout << "timer_init() kq=" << tid << std::endl; // YOSHI
     (void)(initval);
     (void)(flags);
     return tid;
@@ -48,14 +45,12 @@ inline TimerId timer_init(unsigned int initval, int flags, TimerId tid = 1) {
 
 inline int timer_disarm(TimerStore store, TimerId tid) {
     struct kevent event;
-    std::cout << "timer_init() kq=" << store << ", timer=" << tid << std::endl; // YOSHI
     EV_SET(&event, (uintptr_t) tid, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
     return kevent(store, &event, 1, NULL, 0, NULL);
 }
 
 inline int timer_set(TimerStore store, TimerId tid, std::chrono::milliseconds value) {
     struct kevent event;
-    std::cout << "timer_init() kq=" << store << ", timer=" << tid << std::endl; // YOSHI
     EV_SET(&event, (uintptr_t) tid, EVFILT_TIMER, EV_ADD | EV_ENABLE, 0, value.count(), NULL);
     return kevent(store, &event, 1, NULL, 0, NULL);
 }
@@ -0,0 +1,147 @@
+/* trace.h
+
+   Tracepoints of the lifecycle of connections and requests.
+
+   Every point is a static USDT probe of the "pistache" provider when
+   <sys/sdt.h> is available, a single nop until perf or bpftrace attach to
+   it:
+
+       bpftrace -e 'usdt:./libpistache.so:pistache:handler_invoked { ... }'
+
+   The same points can be observed in process through Trace::Hooks. With no
+   hooks set, a point costs an atomic load and a branch.
+
+   Points are fired by the thread handling the connection: the listener for
+   connection_accepted, the thread writing the response for write_queued,
+   its worker for the others. The fd identifies the connection across the
+   points of a request.
+*/
+
+#pragma once
+
+#include <pistache/http_defs.h>
+#include <pistache/os.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(PISTACHE_NO_SDT)
+#include <sys/sdt.h>
+#define PISTACHE_HAS_SDT 1
+#endif
+#endif
+
+#ifdef PISTACHE_HAS_SDT
+#define PISTACHE_PROBE1(name, a1) DTRACE_PROBE1(pistache, name, a1)
+#define PISTACHE_PROBE2(name, a1, a2) DTRACE_PROBE2(pistache, name, a1, a2)
+#define PISTACHE_PROBE3(name, a1, a2, a3)                                      \
+  DTRACE_PROBE3(pistache, name, a1, a2, a3)
+#else
+#define PISTACHE_PROBE1(name, a1)                                              \
+  do {                                                                         \
+  } while (0)
+#define PISTACHE_PROBE2(name, a1, a2)                                          \
+  do {                                                                         \
+  } while (0)
+#define PISTACHE_PROBE3(name, a1, a2, a3)                                      \
+  do {                                                                         \
+  } while (0)
+#endif
+
+namespace Pistache {
+namespace Trace {
+
+// Called by the threads firing the points, concurrently. Implementations
+// must be thread-safe and quick, they run on the event loops
+class Hooks {
+public:
+  virtual ~Hooks() = default;
+
+  virtual void connectionAccepted(Fd /*fd*/) {}
+  virtual void requestLineParsed(Fd /*fd*/, Http::Method /*method*/,
+                                 const std::string & /*resource*/) {}
+  virtual void headersComplete(Fd /*fd*/) {}
+  virtual void handlerInvoked(Fd /*fd*/) {}
+  virtual void handlerReturned(Fd /*fd*/) {}
+  // Fired for every buffer handed to the transport of the connection: once
+  // for a response sent whole, once per flush for a streamed one
+  virtual void writeQueued(Fd /*fd*/, size_t /*bytes*/) {}
+  // First and last byte of a buffer queued written to the socket
+  virtual void writeStarted(Fd /*fd*/) {}
+  virtual void writeDone(Fd /*fd*/, size_t /*bytes*/) {}
+  virtual void connectionClosed(Fd /*fd*/) {}
+};
+
+// Hooks are kept alive until the process exits, once set: a point may still
+// be calling them when they are replaced. nullptr removes them
+void setHooks(std::shared_ptr<Hooks> hooks);
+
+namespace detail {
+extern std::atomic<Hooks *> hooks;
+}
+
+inline Hooks *hooks() {
+  return detail::hooks.load(std::memory_order_acquire);
+}
+
+inline void connectionAccepted(Fd fd) {
+  PISTACHE_PROBE1(connection_accepted, fd);
+  if (auto *h = hooks())
+    h->connectionAccepted(fd);
+}
+
+inline void requestLineParsed(Fd fd, Http::Method method,
+                              const std::string &resource) {
+  PISTACHE_PROBE3(request_line_parsed, fd, static_cast<int>(method),
+                  resource.c_str());
+  if (auto *h = hooks())
+    h->requestLineParsed(fd, method, resource);
+}
+
+inline void headersComplete(Fd fd) {
+  PISTACHE_PROBE1(headers_complete, fd);
+  if (auto *h = hooks())
+    h->headersComplete(fd);
+}
+
+inline void handlerInvoked(Fd fd) {
+  PISTACHE_PROBE1(handler_invoked, fd);
+  if (auto *h = hooks())
+    h->handlerInvoked(fd);
+}
+
+inline void handlerReturned(Fd fd) {
+  PISTACHE_PROBE1(handler_returned, fd);
+  if (auto *h = hooks())
+    h->handlerReturned(fd);
+}
+
+inline void writeQueued(Fd fd, size_t bytes) {
+  PISTACHE_PROBE2(write_queued, fd, bytes);
+  if (auto *h = hooks())
+    h->writeQueued(fd, bytes);
+}
+
+inline void writeStarted(Fd fd) {
+  PISTACHE_PROBE1(write_started, fd);
+  if (auto *h = hooks())
+    h->writeStarted(fd);
+}
+
+inline void writeDone(Fd fd, size_t bytes) {
+  PISTACHE_PROBE2(write_done, fd, bytes);
+  if (auto *h = hooks())
+    h->writeDone(fd, bytes);
+}
+
+inline void connectionClosed(Fd fd) {
+  PISTACHE_PROBE1(connection_closed, fd);
+  if (auto *h = hooks())
+    h->connectionClosed(fd);
+}
+
+} // namespace Trace
+} // namespace Pistache
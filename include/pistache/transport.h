@@ -11,6 +11,7 @@
 #include <pistache/optional.h>
 #include <pistache/reactor.h>
 #include <pistache/stream.h>
+#include <pistache/trace.h>
 
 #include <chrono>
 #include <deque>
@@ -19,6 +20,15 @@
 #include <unordered_map>
 
 namespace Pistache {
+
+namespace Metrics {
+class Worker;
+}
+
+namespace Http {
+class AccessLogRing;
+}
+
 namespace Tcp {
 
 class Peer;
@@ -29,16 +39,17 @@ public:
   explicit Transport(const std::shared_ptr<Tcp::Handler> &handler);
   Transport(const Transport &) = delete;
   Transport &operator=(const Transport &) = delete;
-    
-#ifdef __MACH__
-  ~Transport() { close(kq); }
-#endif
+
+  ~Transport();
     
   void init(const std::shared_ptr<Tcp::Handler> &handler);
 
   void registerPoller(Polling::Epoll &poller) override;
 
   void handleNewPeer(const std::shared_ptr<Peer> &peer);
+  // Has the handler resume the input of the peer from the worker, see
+  // Tcp::Handler::onResume(). Can be called from any thread
+  void resumeInput(const std::shared_ptr<Peer> &peer);
   void onReady(const Aio::FdSet &fds) override;
 
   template <typename Buf>
@@ -48,20 +59,15 @@ public:
     return Async::Promise<ssize_t>(
         [=](Async::Deferred<ssize_t> deferred) mutable {
           BufferHolder holder(buffer);
+          Trace::writeQueued(fd, holder.size());
           auto detached = holder.detach();
           WriteEntry write(std::move(deferred), detached, flags);
           write.peerFd = fd;
+          write.queued = std::chrono::steady_clock::now();
           writesQueue.push(std::move(write));
         });
   }
 
-  Async::Promise<rusage> load() {
-    return Async::Promise<rusage>([=](Async::Deferred<rusage> deferred) {
-      loadRequest_ = std::move(deferred);
-      notifier.notify();
-    });
-  }
-
   template <typename Duration>
   void armTimer(Fd fd, Duration timeout, Async::Deferred<uint64_t> deferred) {
     armTimerMs(fd,
@@ -71,6 +77,29 @@ public:
 
   void disarmTimer(Fd fd);
 
+  // Counts of the worker running the transport, none by default. Shared, as
+  // the transport can outlive the listener that set it up
+  void setMetrics(std::shared_ptr<Metrics::Worker> metrics) {
+    metrics_ = std::move(metrics);
+  }
+  Metrics::Worker *metrics() const { return metrics_.get(); }
+
+  // Access log entries of the worker, none by default
+  void setAccessLog(std::shared_ptr<Http::AccessLogRing> accessLog) {
+    accessLog_ = std::move(accessLog);
+  }
+  // Shared, the entries of responses outlive their writers
+  const std::shared_ptr<Http::AccessLogRing> &accessLog() const {
+    return accessLog_;
+  }
+
+  /* Samples the TCP_INFO of the peers every interval, up to the given count
+   * of peers per tick, taking turns when there are more. Samples are kept on
+   * the peers and recorded in the metrics. Once registered on the reactor,
+   * before it runs; a zero interval disables it. Linux only
+   */
+  void setTcpInfoSampling(std::chrono::milliseconds interval, size_t peers);
+
   std::shared_ptr<Aio::Handler> clone() const override;
     
 #ifdef __MACH__
@@ -81,7 +110,7 @@ private:
   enum WriteStatus { FirstTry, Retry };
 
   struct BufferHolder {
-    enum Type { Raw, File };
+    enum Type { Raw, File, Pipe };
 
     explicit BufferHolder(const RawBuffer &buffer, off_t offset = 0)
         : _raw(buffer), size_(buffer.size()), offset_(offset), type(Raw) {}
@@ -89,13 +118,17 @@ private:
     explicit BufferHolder(const FileBuffer &buffer, off_t offset = 0)
         : _fd(buffer.fd()), size_(buffer.size()), offset_(offset), type(File) {}
 
+    explicit BufferHolder(const PipeBuffer &buffer, off_t offset = 0)
+        : _fd(buffer.fd()), size_(buffer.size()), offset_(offset), type(Pipe) {}
+
     bool isFile() const { return type == File; }
     bool isRaw() const { return type == Raw; }
+    bool isPipe() const { return type == Pipe; }
     size_t size() const { return size_; }
     size_t offset() const { return offset_; }
 
     Fd fd() const {
-      if (!isFile())
+      if (isRaw())
         throw std::runtime_error("Tried to retrieve fd of a non-filebuffer");
       return _fd;
     }
@@ -108,7 +141,7 @@ private:
 
     BufferHolder detach(size_t offset = 0) {
       if (!isRaw())
-        return BufferHolder(_fd, size_, offset);
+        return BufferHolder(_fd, size_, offset, type);
 
       if (_raw.isDetached())
         return BufferHolder(_raw, offset);
@@ -118,8 +151,8 @@ private:
     }
 
   private:
-    BufferHolder(Fd fd, size_t size, off_t offset = 0)
-        : _fd(fd), size_(size), offset_(offset), type(File) {}
+    BufferHolder(Fd fd, size_t size, off_t offset, Type type_)
+        : _fd(fd), size_(size), offset_(offset), type(type_) {}
 
     RawBuffer _raw;
     Fd _fd;
@@ -139,6 +172,8 @@ private:
     BufferHolder buffer;
     int flags;
     Fd peerFd;
+    // When it was pushed to the queue of the worker
+    std::chrono::steady_clock::time_point queued;
   };
 
   struct TimerEntry {
@@ -163,9 +198,11 @@ private:
   };
 
   struct PeerEntry {
-    explicit PeerEntry(std::shared_ptr<Peer> peer_) : peer(std::move(peer_)) {}
+    explicit PeerEntry(std::shared_ptr<Peer> peer_)
+        : peer(std::move(peer_)), queued(std::chrono::steady_clock::now()) {}
 
     std::shared_ptr<Peer> peer;
+    std::chrono::steady_clock::time_point queued;
   };
   using Lock = std::mutex;
   using Guard = std::lock_guard<Lock>;
@@ -178,12 +215,18 @@ private:
   std::unordered_map<Fd, TimerEntry> timers;
 
   PollableQueue<PeerEntry> peersQueue;
+  PollableQueue<PeerEntry> resumesQueue;
   std::unordered_map<Fd, std::shared_ptr<Peer>> peers;
 
-  Async::Deferred<rusage> loadRequest_;
-  NotifyFd notifier;
 
   std::shared_ptr<Tcp::Handler> handler_;
+  std::shared_ptr<Metrics::Worker> metrics_;
+  std::shared_ptr<Http::AccessLogRing> accessLog_;
+
+  Fd tcpInfoTimer_ = -1;
+  size_t tcpInfoPeers_ = 0;
+  // Peer the next tick starts from
+  Fd tcpInfoNext_ = -1;
 
   bool isPeerFd(Fd fd) const;
   bool isTimerFd(Fd fd) const;
@@ -200,15 +243,21 @@ private:
 
   // This will attempt to drain the write queue for the fd
   void asyncWriteImpl(Fd fd);
+  // Moves bytes from a pipe to the socket of a peer, like send() would
+  ssize_t splicePipe(Fd fd, Fd pipe, size_t len, int flags);
 
   void handlePeerDisconnection(const std::shared_ptr<Peer> &peer);
   void handleIncoming(const std::shared_ptr<Peer> &peer);
   void handleWriteQueue();
   void handleTimerQueue();
   void handlePeerQueue();
-  void handleNotify();
+  void handleResumeQueue();
   void handleTimer(TimerEntry entry);
+  // Time an entry of a queue waited for the worker
+  void recordQueueLag(std::chrono::steady_clock::time_point queued);
   void handlePeer(const std::shared_ptr<Peer> &entry);
+  void handleTcpInfoTimer();
+  void sampleTcpInfo(Peer &peer);
 };
 
 } // namespace Tcp
@@ -8,17 +8,34 @@
 #include <pistache/common.h>
 #include <pistache/http.h>
 #include <pistache/net.h>
+#include <pistache/ssl_wrappers.h>
 #include <pistache/stream.h>
 
+#ifdef PISTACHE_USE_SSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif /* PISTACHE_USE_SSL */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
 //#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <algorithm>
+#include <future>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <random>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 namespace Pistache {
 
@@ -33,7 +50,8 @@ std::pair<StringView, StringView> splitUrl(const std::string &url) {
   RawStreamBuf<char> buf(const_cast<char *>(url.data()), url.size());
   StreamCursor cursor(&buf);
 
-  match_string("http://", cursor);
+  if (!match_string("https://", cursor))
+    match_string("http://", cursor);
   match_string("www", cursor);
   match_literal('.', cursor);
 
@@ -45,94 +63,332 @@ std::pair<StringView, StringView> splitUrl(const std::string &url) {
 
   return std::make_pair(std::move(host), std::move(page));
 }
-} // namespace
-
-namespace {
-template <typename H, typename... Args>
-void writeHeader(std::stringstream &streamBuf, Args &&... args) {
-  using Http::crlf;
 
-  H header(std::forward<Args>(args)...);
+bool isHttps(const std::string &url) {
+  static constexpr char Scheme[] = "https://";
+  return url.size() >= sizeof(Scheme) - 1 &&
+         strncasecmp(url.c_str(), Scheme, sizeof(Scheme) - 1) == 0;
+}
 
-  streamBuf << H::Name << ": ";
-  header.write(streamBuf);
+// Connections of a host speak TLS or not, https hosts are kept apart in the
+// pool
+std::string hostKey(const std::string &url, const StringView &host) {
+  if (isHttps(url))
+    return "https://" + host.toString();
 
-  streamBuf << crlf;
+  return host.toString();
 }
+} // namespace
+
+namespace {
+// Initial size of the buffer the head of requests is serialized into
+constexpr size_t HeadBufferSize = 4096;
+// Bytes spliced to the pipe of a stream at once, a pipe holds that much
+constexpr size_t MaxSpliceSize = 64 * 1024;
 
-void writeHeaders(std::stringstream &streamBuf,
-                  const Http::Header::Collection &headers) {
+void writeHeaders(std::ostream &os, const Http::Header::Collection &headers) {
   using Http::crlf;
 
   for (const auto &header : headers.list()) {
-    streamBuf << header->name() << ": ";
-    header->write(streamBuf);
-    streamBuf << crlf;
+    os << header->name() << ": ";
+    header->write(os);
+    os << crlf;
   }
+
+  for (const auto &raw : headers.rawList())
+    os << raw.second.name() << ": " << raw.second.value() << crlf;
 }
 
-void writeCookies(std::stringstream &streamBuf,
-                  const Http::CookieJar &cookies) {
+void writeCookies(std::ostream &os, const Http::CookieJar &cookies) {
   using Http::crlf;
 
-  streamBuf << "Cookie: ";
   bool first = true;
   for (const auto &cookie : cookies) {
-    if (!first) {
-      streamBuf << "; ";
-    } else {
-      first = false;
-    }
-    streamBuf << cookie.name << "=" << cookie.value;
+    os << (first ? "Cookie: " : "; ");
+    os << cookie.name << "=" << cookie.value;
+    first = false;
   }
 
-  streamBuf << crlf;
+  if (!first)
+    os << crlf;
 }
 
-void writeRequest(std::stringstream &streamBuf, const Http::Request &request) {
+// Writes the host the way Header::Host does, which always spells out the port
+void writeHost(std::ostream &os, const StringView &host, uint16_t defaultPort) {
   using Http::crlf;
 
-  auto res = request.resource();
-  auto s = splitUrl(res);
-  auto body = request.body();
-  auto query = request.query();
+  os << Http::Header::Host::Name << ": ";
+  os.write(host.data(), host.size());
 
-  auto host = s.first;
-  auto path = s.second;
+  const auto begin = host.data();
+  const auto end = begin + host.size();
+  const auto colon = std::find(std::reverse_iterator<const char *>(end),
+                               std::reverse_iterator<const char *>(begin), ':');
+  const auto bracket = std::find(std::reverse_iterator<const char *>(end),
+                                 std::reverse_iterator<const char *>(begin), ']');
+  if (colon.base() == begin || colon.base() < bracket.base())
+    os << ":" << defaultPort;
 
-  auto pathStr = path.toString();
+  os << crlf;
+}
+
+/* Writes the request line and the headers, everything but the Content-Length
+ * header and the empty line that ends the head, which depend on the body
+ */
+void writeHead(std::ostream &os, const Http::Request &request) {
+  using Http::crlf;
 
-  streamBuf << request.method() << " ";
-  if (pathStr[0] != '/')
-    streamBuf << '/';
+  auto s = splitUrl(request.resource());
+  const auto &host = s.first;
+  const auto &path = s.second;
+
+  os << request.method() << " ";
+  if (path.size() == 0 || path[0] != '/')
+    os << '/';
+  os.write(path.data(), path.size());
+
+  const auto &query = request.query();
+  char separator = '?';
+  for (auto it = query.parameters_begin(); it != query.parameters_end();
+       ++it) {
+    os << separator << it->first << "=" << it->second;
+    separator = '&';
+  }
+  os << " HTTP/1.1" << crlf;
+
+  writeCookies(os, request.cookies());
+  writeHeaders(os, request.headers());
+
+  // Requests forwarded by a proxy keep the agent of the original client
+  const auto &headers = request.headers();
+  if (!headers.has<Http::Header::UserAgent>() &&
+      headers.rawList().count(Http::Header::UserAgent::Name) == 0)
+    os << Http::Header::UserAgent::Name << ": " << UA << crlf;
+  writeHost(os, host,
+            isHttps(request.resource()) ? Const::HTTPS_STANDARD_PORT
+                                        : Const::HTTP_STANDARD_PORT);
+}
+} // namespace
 
-  streamBuf << pathStr << query.as_str();
-  streamBuf << " HTTP/1.1" << crlf;
+#ifdef PISTACHE_USE_SSL
+namespace {
+bool isIpAddress(const std::string &host) {
+  unsigned char buf[sizeof(struct in6_addr)];
+  return inet_pton(AF_INET, host.c_str(), buf) == 1 ||
+         inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
 
-  writeCookies(streamBuf, request.cookies());
-  writeHeaders(streamBuf, request.headers());
+std::string lastTlsError(const char *what) {
+  std::string error(what);
 
-  writeHeader<Http::Header::UserAgent>(streamBuf, UA);
-  writeHeader<Http::Header::Host>(streamBuf, host.toString());
-  if (!body.empty()) {
-    writeHeader<Http::Header::ContentLength>(streamBuf, body.size());
+  const auto code = ERR_get_error();
+  if (code != 0) {
+    char buf[256];
+    ERR_error_string_n(code, buf, sizeof(buf));
+    error += ": ";
+    error += buf;
   }
-  streamBuf << crlf;
 
-  if (!body.empty()) {
-    streamBuf << body;
+  ERR_clear_error();
+  return error;
+}
+
+// Maps the outcome of SSL_read and SSL_write to the one of recv and send
+ssize_t tlsResult(SSL *ssl, int res) {
+  if (res > 0)
+    return res;
+
+  switch (SSL_get_error(ssl, res)) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    errno = EAGAIN;
+    return -1;
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+  case SSL_ERROR_SYSCALL:
+    if (errno == 0)
+      return 0;
+    return -1;
+  default:
+    ERR_clear_error();
+    errno = EIO;
+    return -1;
   }
 }
 } // namespace
 
+/* The TLS configuration shared by the connections of a client, along with the
+ * last session of every host. Sessions are handed over by OpenSSL through a
+ * callback, which is the only way to get hold of TLS 1.3 tickets: they are
+ * sent by the server after the handshake.
+ */
+class TlsContext {
+public:
+  TlsContext(const std::string &caFile, bool verifyPeer, bool verifyHost,
+             const std::string &certFile, const std::string &keyFile,
+             const std::vector<std::string> &alpn, bool sessionCache)
+      : ctx_(nullptr), verifyHost_(verifyHost), sessionCache_(sessionCache),
+        lock_(), sessions_(), fullHandshakes_(0), resumedHandshakes_(0) {
+    ctx_.reset(SSL_CTX_new(TLS_client_method()));
+    if (!ctx_)
+      throw std::runtime_error(lastTlsError("Cannot setup SSL context"));
+
+    auto *ctx = ssl::GetSSLContext(ctx_);
+    SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+    if (verifyPeer) {
+      const int res = caFile.empty()
+                          ? SSL_CTX_set_default_verify_paths(ctx)
+                          : SSL_CTX_load_verify_locations(ctx, caFile.c_str(),
+                                                          nullptr);
+      if (res != 1)
+        throw std::runtime_error(lastTlsError("Cannot load CA certificates"));
+
+      SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    } else {
+      SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    }
+
+    if (!certFile.empty()) {
+      if (SSL_CTX_use_certificate_file(ctx, certFile.c_str(),
+                                       SSL_FILETYPE_PEM) <= 0)
+        throw std::runtime_error(lastTlsError("Cannot load SSL certificate"));
+      if (SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(),
+                                      SSL_FILETYPE_PEM) <= 0)
+        throw std::runtime_error(lastTlsError("Cannot load SSL private key"));
+      if (!SSL_CTX_check_private_key(ctx))
+        throw std::runtime_error(lastTlsError("Private key does not match"));
+    }
+
+    if (!alpn.empty()) {
+      // Wire format: every protocol prefixed by its length
+      std::string protos;
+      for (const auto &proto : alpn) {
+        if (proto.empty() || proto.size() > 255)
+          throw std::invalid_argument("Invalid ALPN protocol");
+        protos += static_cast<char>(proto.size());
+        protos += proto;
+      }
+
+      // Unlike the rest of OpenSSL, returns 0 on success
+      if (SSL_CTX_set_alpn_protos(
+              ctx, reinterpret_cast<const unsigned char *>(protos.data()),
+              static_cast<unsigned int>(protos.size())) != 0)
+        throw std::runtime_error(lastTlsError("Cannot set ALPN protocols"));
+    }
+
+    if (sessionCache_) {
+      SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT |
+                                              SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ctx, &TlsContext::onNewSession);
+      SSL_CTX_set_app_data(ctx, this);
+    }
+  }
+
+  ~TlsContext() {
+    for (auto &session : sessions_)
+      SSL_SESSION_free(session.second);
+  }
+
+  TlsContext(const TlsContext &) = delete;
+  TlsContext &operator=(const TlsContext &) = delete;
+
+  /* Creates the TLS session of a connection, resuming the last session of
+   * the host when there is one. The key must outlive the session.
+   */
+  SSL *open(Fd fd, const std::string &serverName,
+            const std::string *sessionKey) {
+    SSL *ssl = SSL_new(ssl::GetSSLContext(ctx_));
+    if (ssl == nullptr)
+      throw std::runtime_error(lastTlsError("Cannot create SSL connection"));
+
+    SSL_set_fd(ssl, fd);
+    SSL_set_connect_state(ssl);
+    // A write the socket could not take is retried from the copy of the
+    // request kept by the connection
+    SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    const bool ip = isIpAddress(serverName);
+    // Server Name Indication does not allow addresses
+    if (!ip)
+      SSL_set_tlsext_host_name(ssl, serverName.c_str());
+
+    if (verifyHost_) {
+      auto *param = SSL_get0_param(ssl);
+      const int res =
+          ip ? X509_VERIFY_PARAM_set1_ip_asc(param, serverName.c_str())
+             : X509_VERIFY_PARAM_set1_host(param, serverName.c_str(), 0);
+      if (res != 1) {
+        SSL_free(ssl);
+        throw std::runtime_error(lastTlsError("Cannot verify the host"));
+      }
+    }
+
+    if (sessionCache_) {
+      SSL_set_app_data(ssl, const_cast<std::string *>(sessionKey));
+
+      std::lock_guard<std::mutex> guard(lock_);
+      auto it = sessions_.find(*sessionKey);
+      if (it != sessions_.end())
+        SSL_set_session(ssl, it->second);
+    }
+
+    return ssl;
+  }
+
+  void handshakeDone(SSL *ssl) {
+    if (SSL_session_reused(ssl))
+      resumedHandshakes_.fetch_add(1, std::memory_order_relaxed);
+    else
+      fullHandshakes_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t fullHandshakes() const { return fullHandshakes_.load(); }
+  uint64_t resumedHandshakes() const { return resumedHandshakes_.load(); }
+
+private:
+  static int onNewSession(SSL *ssl, SSL_SESSION *session) {
+    auto *self =
+        static_cast<TlsContext *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    auto *key = static_cast<const std::string *>(SSL_get_app_data(ssl));
+    if (self == nullptr || key == nullptr)
+      return 0;
+
+    std::lock_guard<std::mutex> guard(self->lock_);
+    auto &slot = self->sessions_[*key];
+    if (slot != nullptr)
+      SSL_SESSION_free(slot);
+    slot = session;
+
+    // We keep the reference
+    return 1;
+  }
+
+  ssl::SSLCtxPtr ctx_;
+  bool verifyHost_;
+  bool sessionCache_;
+
+  std::mutex lock_;
+  std::unordered_map<std::string, SSL_SESSION *> sessions_;
+
+  std::atomic<uint64_t> fullHandshakes_;
+  std::atomic<uint64_t> resumedHandshakes_;
+};
+#endif /* PISTACHE_USE_SSL */
+
 class Transport : public Aio::Handler {
 public:
   PROTOTYPE_OF(Aio::Handler, Transport)
 
-  Transport() = default;
-  Transport(const Transport &)
-      : requestsQueue(), connectionsQueue(), connections(), timeouts(),
-        timeoutsLock() {}
+  Transport()
+      : requestsQueue(), connectionsQueue(), resumesQueue(), schedulesQueue(),
+        connections(), timeouts(), timeoutsLock(), timerPool_(), scheduled(),
+        headBuffer(HeadBufferSize, MaxHeadSize), headStream(&headBuffer),
+        detached_(false) {}
+  Transport(const Transport &) : Transport() {}
 
   void onReady(const Aio::FdSet &fds) override;
   void registerPoller(Polling::Epoll &poller) override;
@@ -143,11 +399,26 @@ public:
 
   Async::Promise<ssize_t>
   asyncSendRequest(std::shared_ptr<Connection> connection,
-                   std::shared_ptr<TimerPool::Entry> timer, std::string buffer);
+                   std::unique_ptr<Connection::RequestEntry> entry,
+                   Http::Request request);
 
-private:
-  enum WriteStatus { FirstTry, Retry };
+  void closeConnection(const std::shared_ptr<Connection> &connection);
 
+  // Starts reading again from a connection whose stream was paused
+  void resumeReads(const std::shared_ptr<Connection> &connection);
+
+  // Runs the callback from the thread of the transport once the delay has
+  // elapsed, or as soon as possible without delay. Delayed callbacks are
+  // dropped when no timer is left.
+  void schedule(std::chrono::milliseconds delay,
+                std::function<void()> callback);
+
+  // Closes the connections and drops the callbacks of a client that is shut
+  // down while the reactor of the transport keeps running. Called from the
+  // thread of the transport, which ignores its events from then on.
+  void detach();
+
+private:
   struct ConnectionEntry {
     ConnectionEntry(Async::Resolver resolve, Async::Rejection reject,
                     std::shared_ptr<Connection> connection,
@@ -171,19 +442,29 @@ private:
   struct RequestEntry {
     RequestEntry(Async::Resolver resolve, Async::Rejection reject,
                  std::shared_ptr<Connection> connection,
-                 std::shared_ptr<TimerPool::Entry> timer, std::string buf)
+                 std::unique_ptr<Connection::RequestEntry> entry,
+                 Http::Request request)
         : resolve(std::move(resolve)), reject(std::move(reject)),
-          connection(connection), timer(timer), buffer(std::move(buf)) {}
+          connection(connection), timer(entry->timer),
+          entry(std::move(entry)), request(std::move(request)) {}
 
     Async::Resolver resolve;
     Async::Rejection reject;
     std::weak_ptr<Connection> connection;
     std::shared_ptr<TimerPool::Entry> timer;
-    std::string buffer;
+    std::unique_ptr<Connection::RequestEntry> entry;
+    Http::Request request;
+  };
+
+  struct ScheduledEntry {
+    std::chrono::milliseconds delay;
+    std::function<void()> callback;
   };
 
   PollableQueue<RequestEntry> requestsQueue;
   PollableQueue<ConnectionEntry> connectionsQueue;
+  PollableQueue<std::shared_ptr<Connection>> resumesQueue;
+  PollableQueue<ScheduledEntry> schedulesQueue;
 
   std::unordered_map<Fd, ConnectionEntry> connections;
   std::unordered_map<Fd, std::weak_ptr<Connection>> timeouts;
@@ -192,26 +473,83 @@ private:
   using Guard = std::lock_guard<Lock>;
   Lock timeoutsLock;
 
+  // Timers of the scheduled callbacks, only touched from the transport thread
+  TimerPool timerPool_;
+  std::unordered_map<Fd, std::pair<std::shared_ptr<TimerPool::Entry>,
+                                   std::function<void()>>>
+      scheduled;
+
+  // Requests are serialized from the thread of the transport, in a buffer
+  // that is reused from one request to the next
+  static constexpr size_t MaxHeadSize = std::numeric_limits<uint32_t>::max();
+  DynamicStreamBuf headBuffer;
+  std::ostream headStream;
+
+  std::atomic<bool> detached_;
+
 private:
-  void asyncSendRequestImpl(const RequestEntry &req,
-                            WriteStatus status = FirstTry);
+  void asyncSendRequestImpl(RequestEntry &req);
+
+  // The parts of a request: its head serialized beforehand, if any, the rest
+  // of its head and its body
+  static void requestParts(struct iovec *iov, const Http::Request &request,
+                           const char *head, size_t headSize);
+  // Moves past bytes written from the parts, first being the part and offset
+  // the position in it of the next byte to write
+  static void skipWritten(struct iovec *iov, int &first, size_t &offset,
+                          size_t written);
+  // Arms the timeout of a request written in full
+  void requestWritten(const std::shared_ptr<Connection> &connection,
+                      const std::shared_ptr<TimerPool::Entry> &timer);
+  // Goes on with the requests the socket of the connection could not take
+  void writePending(const std::shared_ptr<Connection> &connection);
+  // Same, from the fd of the connection. False if it has none
+  bool resumeWrites(Fd fd);
+  // Polls the connection for reads, unless its stream paused them, and for
+  // writes while requests are pending
+  void pollConnection(const Connection &connection);
 
   void handleRequestsQueue();
   void handleConnectionQueue();
+  void handleResumesQueue();
+  void handleSchedulesQueue();
   void handleReadableEntry(const Aio::FdSet::Entry &entry);
   void handleWritableEntry(const Aio::FdSet::Entry &entry);
   void handleHangupEntry(const Aio::FdSet::Entry &entry);
+  // Drains the queues and stops polling the fds of a detached transport
+  void ignoreEntry(const Aio::FdSet::Entry &entry);
   void handleIncoming(std::shared_ptr<Connection> connection);
+
+  // Drives the TLS handshake of a connection, resolves its entry once done
+  void handleHandshake(const std::shared_ptr<Connection> &connection,
+                       ConnectionEntry &entry);
+  void failHandshake(const std::shared_ptr<Connection> &connection,
+                     ConnectionEntry &entry, const std::string &error);
+
+  // recv and writev, through TLS for the connections that speak it
+  ssize_t receive(Connection &connection, char *buffer, size_t len);
+  // Moves bytes of the body being received to the pipe of its stream
+  ssize_t spliceBody(Connection &connection, size_t len);
+  ssize_t send(Connection &connection, const struct iovec *iov, int count);
 };
 
 void Transport::onReady(const Aio::FdSet &fds) {
   for (const auto &entry : fds) {
-    if (entry.getTag() == connectionsQueue.tag()) {
+    if (detached_.load()) {
+      ignoreEntry(entry);
+    } else if (entry.getTag() == connectionsQueue.tag()) {
       handleConnectionQueue();
     } else if (entry.getTag() == requestsQueue.tag()) {
       handleRequestsQueue();
+    } else if (entry.getTag() == resumesQueue.tag()) {
+      handleResumesQueue();
+    } else if (entry.getTag() == schedulesQueue.tag()) {
+      handleSchedulesQueue();
     } else if (entry.isReadable()) {
       handleReadableEntry(entry);
+      // Writing a request while its response starts coming in
+      if (entry.isWritable())
+        resumeWrites(static_cast<Fd>(entry.getTag().value()));
     } else if (entry.isWritable()) {
       handleWritableEntry(entry);
     } else if (entry.isHangup()) {
@@ -225,6 +563,8 @@ void Transport::onReady(const Aio::FdSet &fds) {
 void Transport::registerPoller(Polling::Epoll &poller) {
   requestsQueue.bind(poller);
   connectionsQueue.bind(poller);
+  resumesQueue.bind(poller);
+  schedulesQueue.bind(poller);
 }
 
 Async::Promise<void>
@@ -240,14 +580,14 @@ Transport::asyncConnect(std::shared_ptr<Connection> connection,
 
 Async::Promise<ssize_t>
 Transport::asyncSendRequest(std::shared_ptr<Connection> connection,
-                            std::shared_ptr<TimerPool::Entry> timer,
-                            std::string buffer) {
+                            std::unique_ptr<Connection::RequestEntry> entry,
+                            Http::Request request) {
 
   return Async::Promise<ssize_t>(
       [&](Async::Resolver &resolve, Async::Rejection &reject) {
         auto ctx = context();
         RequestEntry req(std::move(resolve), std::move(reject), connection,
-                         timer, std::move(buffer));
+                         std::move(entry), std::move(request));
         if (std::this_thread::get_id() != ctx.thread()) {
           requestsQueue.push(std::move(req));
         } else {
@@ -256,41 +596,277 @@ Transport::asyncSendRequest(std::shared_ptr<Connection> connection,
       });
 }
 
-void Transport::asyncSendRequestImpl(const RequestEntry &req,
-                                     WriteStatus status) {
-  const auto &buffer = req.buffer;
+void Transport::asyncSendRequestImpl(RequestEntry &req) {
+  const auto &request = req.request;
   auto conn = req.connection.lock();
   if (!conn)
     throw std::runtime_error("Send request error");
 
-  auto fd = conn->fd();
+  // Another copy of the request got its response while this one was queued,
+  // there is no point in sending it anymore
+  if (request.cancelled_ && request.cancelled_->load() && req.entry) {
+    auto entry = std::move(req.entry);
+    conn->releaseTimer(*entry);
+
+    if (entry->onDone)
+      entry->onDone();
+
+    entry->reject(std::runtime_error("Request cancelled"));
+    return;
+  }
+
+  // The connection might have been closed after it was picked for the
+  // request, by the server or for being idle for too long. It is established
+  // again rather than failing the request.
+  if (req.entry && (!conn->isConnected() || (conn->pendingResponses() == 0 &&
+                                             conn->peerClosed()))) {
+    if (conn->isConnected())
+      closeConnection(conn);
+
+    auto entry = std::move(req.entry);
+    conn->releaseTimer(*entry);
+
+    auto retried = std::move(req.request);
+    retried.stream_ = std::move(entry->stream);
+    conn->asyncPerformImpl(std::move(retried), std::move(entry->resolve),
+                           std::move(entry->reject), std::move(entry->onDone));
+
+    if (conn->reconnect_ && conn->startConnecting())
+      conn->reconnect_(conn);
+    return;
+  }
+
+  // Requests are written in the order they are queued, which is the order
+  // their responses will come back in
+  if (req.entry)
+    conn->expectResponse(std::move(req.entry));
+
+  // Only the part of the head that was not serialized beforehand is written
+  // to the buffer, the body is sent from where it lies
+  headBuffer.clear();
+  headStream.clear();
+  if (!request.head_)
+    writeHead(headStream, request);
+
+  const auto &body = request.body();
+  if (!body.empty())
+    headStream << Header::ContentLength::Name << ": " << body.size() << crlf;
+  headStream << crlf;
+
+  if (!headStream) {
+    conn->handleError("Could not write request");
+    return;
+  }
+
+  const char *head = headBuffer.data();
+  const size_t headSize = headBuffer.size();
+
+  // Waits for the requests before it, which are being written
+  if (!conn->pendingWrites_.empty()) {
+    conn->pendingWrites_.emplace_back(std::move(req.request),
+                                      std::string(head, headSize),
+                                      std::move(req.resolve),
+                                      std::move(req.timer));
+    return;
+  }
+
+  struct iovec iov[3];
+  requestParts(iov, request, head, headSize);
+
+  ssize_t total = 0;
+  for (const auto &part : iov)
+    total += part.iov_len;
 
   ssize_t totalWritten = 0;
+  int first = 0;
+  size_t offset = 0;
   for (;;) {
-    const char *data = buffer.data() + totalWritten;
-    const ssize_t len = buffer.size() - totalWritten;
-    const ssize_t bytesWritten = ::send(fd, data, len, 0);
+    const ssize_t bytesWritten = send(*conn, iov + first, 3 - first);
     if (bytesWritten < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        if (status == FirstTry) {
-          throw std::runtime_error("Unimplemented, fix me!");
-        }
-        reactor()->modifyFd(key(), fd, NotifyOn::Write, Polling::Mode::Edge);
+        // The rest is written once the socket is writable again, from a copy
+        // of the head since the buffer is reused by the next request
+        conn->pendingWrites_.emplace_back(
+            std::move(req.request), std::string(head, headSize),
+            std::move(req.resolve), std::move(req.timer));
+        auto &pending = conn->pendingWrites_.back();
+        pending.part = first;
+        pending.offset = offset;
+        pending.written = totalWritten;
+        pollConnection(*conn);
       } else {
+        closeConnection(conn);
         conn->handleError("Could not send request");
       }
       break;
     } else {
       totalWritten += bytesWritten;
-      if (totalWritten == len) {
-        if (req.timer) {
-          Guard guard(timeoutsLock);
-          timeouts.insert(std::make_pair(req.timer->fd(), conn));
-          req.timer->registerReactor(key(), reactor());
-        }
+      if (totalWritten == total) {
+        requestWritten(conn, req.timer);
         req.resolve(totalWritten);
         break;
       }
+
+      skipWritten(iov, first, offset, static_cast<size_t>(bytesWritten));
+    }
+  }
+}
+
+void Transport::requestParts(struct iovec *iov, const Http::Request &request,
+                             const char *head, size_t headSize) {
+  iov[0].iov_base =
+      request.head_ ? const_cast<char *>(request.head_->data()) : nullptr;
+  iov[0].iov_len = request.head_ ? request.head_->size() : 0;
+  iov[1].iov_base = const_cast<char *>(head);
+  iov[1].iov_len = headSize;
+  const auto &body = request.body();
+  iov[2].iov_base = const_cast<char *>(body.data());
+  iov[2].iov_len = body.size();
+}
+
+void Transport::skipWritten(struct iovec *iov, int &first, size_t &offset,
+                            size_t written) {
+  while (first < 3 && written >= iov[first].iov_len) {
+    written -= iov[first++].iov_len;
+    offset = 0;
+  }
+  if (first < 3) {
+    iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + written;
+    iov[first].iov_len -= written;
+    offset += written;
+  }
+}
+
+void Transport::requestWritten(const std::shared_ptr<Connection> &connection,
+                               const std::shared_ptr<TimerPool::Entry> &timer) {
+  if (timer) {
+    Guard guard(timeoutsLock);
+    timeouts.insert(std::make_pair(timer->fd(), connection));
+    timer->registerReactor(key(), reactor());
+  }
+}
+
+void Transport::writePending(const std::shared_ptr<Connection> &connection) {
+  auto &pending = connection->pendingWrites_;
+  while (!pending.empty()) {
+    auto &write = pending.front();
+
+    struct iovec iov[3];
+    requestParts(iov, write.request, write.head.data(), write.head.size());
+
+    // Back to where the previous attempt stopped
+    int first = 0;
+    size_t offset = 0;
+    size_t skipped = write.offset;
+    for (int part = 0; part < write.part; ++part)
+      skipped += iov[part].iov_len;
+    skipWritten(iov, first, offset, skipped);
+
+    for (;;) {
+      const ssize_t bytesWritten = send(*connection, iov + first, 3 - first);
+      if (bytesWritten < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          write.part = first;
+          write.offset = offset;
+          return;
+        }
+
+        closeConnection(connection);
+        connection->handleError("Could not send request");
+        return;
+      }
+
+      write.written += bytesWritten;
+      skipWritten(iov, first, offset, static_cast<size_t>(bytesWritten));
+      if (first == 3)
+        break;
+    }
+
+    requestWritten(connection, write.timer);
+    write.resolve(write.written);
+    pending.pop_front();
+  }
+
+  pollConnection(*connection);
+}
+
+void Transport::pollConnection(const Connection &connection) {
+  auto interest = NotifyOn::None;
+  if (!connection.readsStopped_)
+    interest = interest | NotifyOn::Read;
+  if (!connection.pendingWrites_.empty())
+    interest = interest | NotifyOn::Write;
+  reactor()->modifyFd(key(), connection.fd(), interest);
+}
+
+bool Transport::resumeWrites(Fd fd) {
+  auto it = connections.find(fd);
+  if (it == std::end(connections))
+    return false;
+
+  auto connection = it->second.connection.lock();
+  if (!connection || connection->pendingWrites_.empty())
+    return false;
+
+  writePending(connection);
+  return true;
+}
+
+void Transport::closeConnection(const std::shared_ptr<Connection> &connection) {
+  connections.erase(connection->fd());
+  connection->close();
+}
+
+void Transport::resumeReads(const std::shared_ptr<Connection> &connection) {
+  resumesQueue.push(connection);
+}
+
+void Transport::schedule(std::chrono::milliseconds delay,
+                         std::function<void()> callback) {
+  schedulesQueue.push(ScheduledEntry{delay, std::move(callback)});
+}
+
+void Transport::detach() {
+  detached_.store(true);
+
+  for (auto &entry : connections) {
+    auto connection = entry.second.connection.lock();
+    if (connection &&
+        (connection->isConnected() || connection->isConnecting()))
+      connection->close();
+  }
+  connections.clear();
+
+  for (auto &entry : scheduled) {
+    entry.second.first->disarm();
+    timerPool_.releaseTimer(entry.second.first);
+  }
+  scheduled.clear();
+
+  Guard guard(timeoutsLock);
+  timeouts.clear();
+}
+
+void Transport::ignoreEntry(const Aio::FdSet::Entry &entry) {
+  const auto tag = entry.getTag();
+  if (tag == connectionsQueue.tag()) {
+    while (connectionsQueue.popSafe())
+      ;
+  } else if (tag == requestsQueue.tag()) {
+    while (requestsQueue.popSafe())
+      ;
+  } else if (tag == resumesQueue.tag()) {
+    while (resumesQueue.popSafe())
+      ;
+  } else if (tag == schedulesQueue.tag()) {
+    while (schedulesQueue.popSafe())
+      ;
+  } else {
+    // Timers of requests still armed, the fd is open since it is ready
+    try {
+      reactor()->modifyFd(key(), static_cast<Fd>(tag.value()),
+                          NotifyOn::None);
+    } catch (const std::exception &) {
     }
   }
 }
@@ -298,7 +874,6 @@ void Transport::asyncSendRequestImpl(const RequestEntry &req,
 void Transport::handleRequestsQueue() {
   // Let's drain the queue
   for (;;) {
-      std::cout << "requestsQueue.popSafe()" << std::endl; // YOSHI
     auto req = requestsQueue.popSafe();
     if (!req)
       break;
@@ -309,7 +884,6 @@ void Transport::handleRequestsQueue() {
 
 void Transport::handleConnectionQueue() {
   for (;;) {
-      std::cout << "connectionsQueue.popSafe()" << std::endl; // YOSHI
     auto data = connectionsQueue.popSafe();
     if (!data)
       break;
@@ -335,6 +909,54 @@ void Transport::handleConnectionQueue() {
   }
 }
 
+void Transport::handleResumesQueue() {
+  for (;;) {
+    auto connection = resumesQueue.popSafe();
+    if (!connection)
+      break;
+
+    auto &conn = *connection;
+    // The stream might have been paused again, or the connection closed, in
+    // the meantime
+    if (!conn->readsStopped_ || conn->readsPaused() || !conn->isConnected())
+      continue;
+
+    conn->readsStopped_ = false;
+    pollConnection(*conn);
+
+#ifdef PISTACHE_USE_SSL
+    // Data already taken off the socket by OpenSSL does not wake the poller
+    if (conn->ssl_ && SSL_has_pending(static_cast<SSL *>(conn->ssl_)))
+      handleIncoming(conn);
+#endif /* PISTACHE_USE_SSL */
+  }
+}
+
+void Transport::handleSchedulesQueue() {
+  for (;;) {
+    auto entry = schedulesQueue.popSafe();
+    if (!entry)
+      break;
+
+    // One of the callbacks detached the transport
+    if (detached_.load())
+      continue;
+
+    if (entry->delay.count() <= 0) {
+      entry->callback();
+      continue;
+    }
+
+    auto timer = timerPool_.pickTimer();
+    if (!timer)
+      continue;
+
+    timer->arm(entry->delay);
+    timer->registerReactor(key(), reactor());
+    scheduled[timer->fd()] = std::make_pair(timer, std::move(entry->callback));
+  }
+}
+
 void Transport::handleReadableEntry(const Aio::FdSet::Entry &entry) {
   assert(entry.isReadable() && "Entry must be readable");
 
@@ -344,37 +966,79 @@ void Transport::handleReadableEntry(const Aio::FdSet::Entry &entry) {
   if (connIt != std::end(connections)) {
     auto connection = connIt->second.connection.lock();
     if (connection) {
-      handleIncoming(connection);
+      if (connection->handshaking_)
+        handleHandshake(connection, connIt->second);
+      else
+        handleIncoming(connection);
     } else {
       throw std::runtime_error(
           "Connection error: problem with reading data from server");
     }
+  } else if (scheduled.count(fd)) {
+    auto it = scheduled.find(fd);
+    auto timer = std::move(it->second.first);
+    auto callback = std::move(it->second.second);
+    scheduled.erase(it);
+
+    timer->disarm();
+    timerPool_.releaseTimer(timer);
+    callback();
   } else {
-    Guard guard(timeoutsLock);
-    auto timerIt = timeouts.find(fd);
-    if (timerIt != std::end(timeouts)) {
-      auto connection = timerIt->second.lock();
-      if (connection) {
-        connection->handleTimeout();
-        timeouts.erase(fd);
+    std::shared_ptr<Connection> connection;
+    {
+      Guard guard(timeoutsLock);
+      auto timerIt = timeouts.find(fd);
+      if (timerIt != std::end(timeouts)) {
+        connection = timerIt->second.lock();
+        timeouts.erase(timerIt);
       }
     }
+
+    if (connection)
+      connection->handleTimeout(fd);
   }
 }
 
+namespace {
+// Leaves the reason in errno when the connection could not be established
+bool connectSucceeded(Fd fd) {
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+    return false;
+
+  errno = error;
+  return error == 0;
+}
+} // namespace
+
 void Transport::handleWritableEntry(const Aio::FdSet::Entry &entry) {
   assert(entry.isWritable() && "Entry must be writable");
 
   auto tag = entry.getTag();
   auto fd = static_cast<const Fd>(tag.value());
+  if (resumeWrites(fd))
+    return;
+
   auto connIt = connections.find(fd);
   if (connIt != std::end(connections)) {
     auto &connectionEntry = connIt->second;
     auto connection = connIt->second.connection.lock();
-    if (connection) {
+    if (connection && connection->usesTls() &&
+        (connection->ssl_ == nullptr || connection->handshaking_)) {
+      handleHandshake(connection, connectionEntry);
+    } else if (connection && !connectSucceeded(fd)) {
+      // A refused connection shows up as writable as well
+      auto reject = std::move(connectionEntry.reject);
+      const int error = errno;
+      closeConnection(connection);
+      errno = error;
+      reject(Error::system("Could not connect"));
+    } else if (connection) {
       connectionEntry.resolve();
-      // We are connected, we can start reading data now
-      reactor()->modifyFd(key(), connection->fd(), NotifyOn::Read);
+      // We are connected, we can start reading data now. The first request
+      // may have been sent, and left pending, while resolving
+      pollConnection(*connection);
     } else {
       connectionEntry.reject(Error::system("Connection lost"));
     }
@@ -404,52 +1068,231 @@ void Transport::handleIncoming(std::shared_ptr<Connection> connection) {
     char buffer[Const::MaxBuffer] = {
         0,
     };
-    const ssize_t bytes = recv(connection->fd(), buffer, Const::MaxBuffer, 0);
+    const size_t spliceable = connection->spliceableBytes();
+    const ssize_t bytes =
+        spliceable > 0 ? spliceBody(*connection, spliceable)
+                       : receive(*connection, buffer, Const::MaxBuffer);
     if (bytes == -1) {
       if (errno != EAGAIN && errno != EWOULDBLOCK) {
         connection->handleError(strerror(errno));
       }
       break;
     } else if (bytes == 0) {
-      if (totalBytes == 0) {
-        connection->handleError("Remote closed connection");
-      }
+      // Close first so that requests sent from the callbacks of the failed
+      // ones go to a new connection
       connections.erase(connection->fd());
       connection->close();
+      connection->handleError("Remote closed connection");
       break;
     } else {
       totalBytes += bytes;
-      connection->handleResponsePacket(buffer, bytes);
+      if (spliceable > 0)
+        connection->handleSplicedBody(static_cast<size_t>(bytes));
+      else
+        connection->handleResponsePacket(buffer, bytes);
+
+      // Leave the rest in the socket until the consumer catches up
+      if (connection->readsPaused()) {
+        connection->readsStopped_ = true;
+        pollConnection(*connection);
+        break;
+      }
+    }
+  }
+}
+
+BodyStream::BodyStream(OnData onData, OnHeaders onHeaders)
+    : onData_(std::move(onData)), onHeaders_(std::move(onHeaders)),
+      paused_(false), splicePipe_(-1), onSpliced_(), lock_(), connection_() {
+  if (!onData_)
+    throw std::invalid_argument("Invalid data callback");
+}
+
+std::shared_ptr<BodyStream> BodyStream::create(OnData onData,
+                                               OnHeaders onHeaders) {
+  return std::make_shared<BodyStream>(std::move(onData), std::move(onHeaders));
+}
+
+void BodyStream::pause() { paused_.store(true); }
+
+void BodyStream::resume() {
+  if (!paused_.exchange(false))
+    return;
+
+  std::shared_ptr<Connection> connection;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    connection = connection_.lock();
+  }
+
+  if (connection)
+    connection->resumeReads();
+}
+
+bool BodyStream::isPaused() const { return paused_.load(); }
+
+void BodyStream::spliceTo(Fd pipe, OnSpliced onSpliced) {
+  if (pipe == -1)
+    throw std::invalid_argument("Invalid pipe");
+  if (!onSpliced)
+    throw std::invalid_argument("Invalid splice callback");
+
+  splicePipe_ = pipe;
+  onSpliced_ = std::move(onSpliced);
+}
+
+void Transport::handleHandshake(const std::shared_ptr<Connection> &connection,
+                                ConnectionEntry &entry) {
+#ifdef PISTACHE_USE_SSL
+  const auto fd = connection->fd();
+
+  if (connection->ssl_ == nullptr) {
+    try {
+      connection->ssl_ = connection->tls_->open(fd, connection->serverName_,
+                                                &connection->sessionKey_);
+    } catch (const std::exception &e) {
+      failHandshake(connection, entry, e.what());
+      return;
+    }
+    connection->handshaking_ = true;
+  }
+
+  auto *ssl = static_cast<SSL *>(connection->ssl_);
+  ERR_clear_error();
+  const int res = SSL_do_handshake(ssl);
+  if (res == 1) {
+    connection->handshaking_ = false;
+
+    const unsigned char *proto = nullptr;
+    unsigned int len = 0;
+    SSL_get0_alpn_selected(ssl, &proto, &len);
+    if (proto != nullptr)
+      connection->alpnProtocol_.assign(reinterpret_cast<const char *>(proto),
+                                       len);
+
+    connection->tls_->handshakeDone(ssl);
+
+    entry.resolve();
+    pollConnection(*connection);
+    return;
+  }
+
+  switch (SSL_get_error(ssl, res)) {
+  case SSL_ERROR_WANT_READ:
+    reactor()->modifyFd(key(), fd, NotifyOn::Read);
+    break;
+  case SSL_ERROR_WANT_WRITE:
+    reactor()->modifyFd(key(), fd, NotifyOn::Write);
+    break;
+  default: {
+    const long verify = SSL_get_verify_result(ssl);
+    if (verify != X509_V_OK) {
+      ERR_clear_error();
+      failHandshake(connection, entry,
+                    std::string("TLS handshake failed: ") +
+                        X509_verify_cert_error_string(verify));
+    } else {
+      failHandshake(connection, entry, lastTlsError("TLS handshake failed"));
+    }
+  }
+  }
+#else
+  failHandshake(connection, entry, "Built without TLS support");
+#endif /* PISTACHE_USE_SSL */
+}
+
+void Transport::failHandshake(const std::shared_ptr<Connection> &connection,
+                              ConnectionEntry &entry,
+                              const std::string &error) {
+  // The entry goes away along with the connection
+  auto reject = std::move(entry.reject);
+  closeConnection(connection);
+  reject(Error(error));
+}
+
+ssize_t Transport::receive(Connection &connection, char *buffer, size_t len) {
+#ifdef PISTACHE_USE_SSL
+  if (connection.ssl_ != nullptr) {
+    auto *ssl = static_cast<SSL *>(connection.ssl_);
+    ERR_clear_error();
+    errno = 0;
+    return tlsResult(ssl, SSL_read(ssl, buffer, static_cast<int>(len)));
+  }
+#endif /* PISTACHE_USE_SSL */
+
+  return ::recv(connection.fd(), buffer, len, 0);
+}
+
+ssize_t Transport::spliceBody(Connection &connection, size_t len) {
+#ifdef __MACH__
+  UNUSED(connection)
+  UNUSED(len)
+  errno = ENOTSUP;
+  return -1;
+#else
+  return ::splice(connection.fd(), nullptr, connection.splicePipe(), nullptr,
+                  std::min(len, MaxSpliceSize),
+                  SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#endif // __MACH__
+}
+
+ssize_t Transport::send(Connection &connection, const struct iovec *iov,
+                        int count) {
+#ifdef PISTACHE_USE_SSL
+  if (connection.ssl_ != nullptr) {
+    // Without partial writes, SSL_write either writes a whole buffer or
+    // nothing at all
+    auto *ssl = static_cast<SSL *>(connection.ssl_);
+    ssize_t total = 0;
+    for (int i = 0; i < count; ++i) {
+      if (iov[i].iov_len == 0)
+        continue;
+      ERR_clear_error();
+      errno = 0;
+      const int res = SSL_write(ssl, iov[i].iov_base,
+                                static_cast<int>(iov[i].iov_len));
+      if (res <= 0)
+        return total > 0 ? total : tlsResult(ssl, res);
+
+      total += res;
     }
+
+    return total;
   }
+#endif /* PISTACHE_USE_SSL */
+
+  return ::writev(connection.fd(), iov, count);
 }
 
 Connection::Connection(size_t maxResponseSize)
-    : fd_(-1), requestEntry(nullptr), parser(maxResponseSize) {
+    : fd_(-1), inflight_(), inflightCount_(0), requestsQueueLock_(),
+      parser(maxResponseSize), headersDelivered_(false), readsStopped_(false),
+      tls_(), serverName_(), sessionKey_(), ssl_(nullptr),
+      handshaking_(false), alpnProtocol_(), users_(0), lastUsed_(0),
+      reconnect_() {
   state_.store(static_cast<uint32_t>(State::Idle));
   connectionState_.store(NotConnected);
 }
 
-void Connection::connect(const Address &addr) {
-  struct addrinfo hints;
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = addr.family();
-  hints.ai_socktype = SOCK_STREAM; /* Stream socket */
-  hints.ai_flags = 0;
-  hints.ai_protocol = 0;
+Connection::~Connection() {
+#ifdef PISTACHE_USE_SSL
+  if (ssl_ != nullptr)
+    SSL_free(static_cast<SSL *>(ssl_));
+#endif /* PISTACHE_USE_SSL */
+}
 
+void Connection::connect(const Address &addr) {
   const auto &host = addr.host();
   const auto &port = addr.port().toString();
 
-  AddrInfo addressInfo;
-
-  TRY(addressInfo.invoke(host.c_str(), port.c_str(), &hints));
-  const addrinfo *addrs = addressInfo.get_info_ptr();
+  connect(DnsResolver::systemLookup(host, port, addr.family()));
+}
 
+void Connection::connect(const DnsResolver::Answer &answer) {
   int sfd = -1;
 
-  for (const addrinfo *addr = addrs; addr; addr = addr->ai_next) {
-    sfd = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  for (const auto &addr : answer.addresses) {
+    sfd = ::socket(addr.family(), SOCK_STREAM, 0);
     if (sfd < 0)
       continue;
 
@@ -458,16 +1301,23 @@ void Connection::connect(const Address &addr) {
     connectionState_.store(Connecting);
     fd_ = sfd;
 
-    transport_
-        ->asyncConnect(shared_from_this(), addr->ai_addr, addr->ai_addrlen)
+    transport_->asyncConnect(shared_from_this(), addr.get(), addr.len)
         .then(
             [=]() {
               socklen_t len = sizeof(saddr);
               getsockname(sfd, (struct sockaddr *)&saddr, &len);
               connectionState_.store(Connected);
+              lastUsed_.store(
+                  std::chrono::steady_clock::now().time_since_epoch().count());
               processRequestQueue();
             },
-            PrintException());
+            [=](std::exception_ptr exc) {
+              try {
+                std::rethrow_exception(exc);
+              } catch (const std::exception &e) {
+                abortRequests(e.what());
+              }
+            });
     break;
   }
 
@@ -503,9 +1353,36 @@ bool Connection::isConnected() const {
 
 void Connection::close() {
   connectionState_.store(NotConnected);
+
+#ifdef PISTACHE_USE_SSL
+  if (ssl_ != nullptr) {
+    SSL_free(static_cast<SSL *>(ssl_));
+    ssl_ = nullptr;
+  }
+#endif /* PISTACHE_USE_SSL */
+  handshaking_ = false;
+  alpnProtocol_.clear();
+  pendingWrites_.clear();
+
   ::close(fd_);
 }
 
+void Connection::useTls(std::shared_ptr<TlsContext> context,
+                        std::string serverName, std::string sessionKey) {
+  tls_ = std::move(context);
+  serverName_ = std::move(serverName);
+  sessionKey_ = std::move(sessionKey);
+}
+
+bool Connection::usesTls() const { return tls_ != nullptr; }
+
+const std::string &Connection::alpnProtocol() const { return alpnProtocol_; }
+
+bool Connection::startConnecting() {
+  auto state = NotConnected;
+  return connectionState_.compare_exchange_strong(state, Connecting);
+}
+
 void Connection::associateTransport(
     const std::shared_ptr<Transport> &transport) {
   if (transport_)
@@ -517,6 +1394,56 @@ void Connection::associateTransport(
 
 bool Connection::hasTransport() const { return transport_ != nullptr; }
 
+bool Connection::isConnecting() const {
+  return connectionState_.load() == Connecting;
+}
+
+void Connection::setReconnect(Reconnect reconnect) {
+  reconnect_ = std::move(reconnect);
+}
+
+void Connection::addUser() { users_.fetch_add(1, std::memory_order_relaxed); }
+
+void Connection::removeUser() {
+  lastUsed_.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                  std::memory_order_relaxed);
+  users_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t Connection::users() const {
+  return users_.load(std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::duration Connection::idleTime() const {
+  const auto lastUsed = std::chrono::steady_clock::time_point(
+      std::chrono::steady_clock::duration(
+          lastUsed_.load(std::memory_order_relaxed)));
+  return std::chrono::steady_clock::now() - lastUsed;
+}
+
+void Connection::closeIfIdle(std::chrono::milliseconds idleTime) {
+  if (!transport_)
+    return;
+
+  // Checked again from the transport, which is the only one to write to the
+  // connection. A request picking it up in the meantime reconnects it.
+  std::weak_ptr<Connection> weakSelf = shared_from_this();
+  auto transport = transport_.get();
+  transport_->schedule(std::chrono::milliseconds(0), [weakSelf, transport,
+                                                      idleTime]() {
+    auto self = weakSelf.lock();
+    if (self && self->isConnected() && self->users() == 0 &&
+        self->pendingResponses() == 0 && self->idleTime() >= idleTime)
+      transport->closeConnection(self);
+  });
+}
+
+bool Connection::peerClosed() const {
+  char byte;
+  const ssize_t res = ::recv(fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return res == 0 || (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
 Fd Connection::fd() const {
   assert(fd_ != -1);
   return fd_;
@@ -529,23 +1456,46 @@ void Connection::handleResponsePacket(const char *buffer, size_t totalBytes) {
       handleError("Client: Too long packet");
       return;
     }
-    if (parser.parse() == Private::State::Done) {
-      if (requestEntry) {
-        if (requestEntry->timer) {
-          requestEntry->timer->disarm();
-          timerPool_.releaseTimer(requestEntry->timer);
-        }
 
-        requestEntry->resolve(std::move(parser.response));
-        parser.reset();
+    // A packet might hold the responses of several pipelined requests
+    for (;;) {
+      const bool streamed = !inflight_.empty() && inflight_.front()->stream;
+      if (streamed)
+        parser.streamBody([this](const char *data, size_t size) {
+          streamData(data, size);
+        });
+      else
+        parser.streamBody(nullptr);
+
+      if (parser.parse() != Private::State::Done) {
+        // What was handed over to the stream does not need to be kept
+        if (streamed)
+          parser.compact();
+        break;
+      }
+
+      if (!inflight_.empty()) {
+        auto entry = std::move(inflight_.front());
+        inflight_.pop_front();
+        inflightCount_.fetch_sub(1, std::memory_order_relaxed);
+
+        // Responses without a body still get their headers streamed
+        if (entry->stream && !headersDelivered_)
+          deliverHeaders(*entry);
+        headersDelivered_ = false;
 
-        auto onDone = requestEntry->onDone;
+        releaseTimer(*entry);
 
-        requestEntry.reset(nullptr);
+        // Hand the connection back first, the client might be gone as soon
+        // as the caller learns about the response
+        if (entry->onDone)
+          entry->onDone();
 
-        if (onDone)
-          onDone();
+        entry->resolve(std::move(parser.response));
       }
+
+      if (!parser.resetToNext())
+        break;
     }
   } catch (const std::exception &ex) {
     handleError(ex.what());
@@ -553,37 +1503,154 @@ void Connection::handleResponsePacket(const char *buffer, size_t totalBytes) {
 }
 
 void Connection::handleError(const char *error) {
-  if (requestEntry) {
-    if (requestEntry->timer) {
-      requestEntry->timer->disarm();
-      timerPool_.releaseTimer(requestEntry->timer);
-    }
+  // There is no telling which request the error belongs to once several of
+  // them have been written, fail them all
+  failAll(error);
+}
+
+void Connection::handleTimeout(Fd timerFd) {
+  auto it = std::find_if(inflight_.begin(), inflight_.end(),
+                         [timerFd](const std::unique_ptr<RequestEntry> &entry) {
+                           return entry->timer && entry->timer->fd() == timerFd;
+                         });
+  if (it == inflight_.end())
+    return;
+
+  auto entry = std::move(*it);
+  inflight_.erase(it);
+  inflightCount_.fetch_sub(1, std::memory_order_relaxed);
+
+  // The response might still show up and be mistaken for the one of the next
+  // request, give up on the connection instead
+  transport_->closeConnection(shared_from_this());
+
+  releaseTimer(*entry);
 
-    auto onDone = requestEntry->onDone;
+  if (entry->onDone)
+    entry->onDone();
 
-    requestEntry->reject(Error(error));
+  /* @API: create a TimeoutException */
+  entry->reject(std::runtime_error("Timeout"));
 
-    requestEntry.reset(nullptr);
+  failAll("Connection closed after a timeout");
+}
+
+void Connection::failAll(const char *error) {
+  std::deque<std::unique_ptr<RequestEntry>> entries;
+  entries.swap(inflight_);
+  inflightCount_.fetch_sub(entries.size(), std::memory_order_relaxed);
+  parser.reset();
+  headersDelivered_ = false;
+  readsStopped_ = false;
+
+  for (auto &entry : entries) {
+    releaseTimer(*entry);
+
+    if (entry->onDone)
+      entry->onDone();
 
-    if (onDone)
-      onDone();
+    entry->reject(Error(error));
   }
 }
 
-void Connection::handleTimeout() {
-  if (requestEntry) {
-    requestEntry->timer->disarm();
-    timerPool_.releaseTimer(requestEntry->timer);
+void Connection::releaseTimer(RequestEntry &entry) {
+  if (!entry.timer)
+    return;
+
+  entry.timer->disarm();
+  timerPool_.releaseTimer(entry.timer);
+  entry.timer.reset();
+}
 
-    auto onDone = requestEntry->onDone;
+void Connection::streamData(const char *data, size_t size) {
+  auto &entry = *inflight_.front();
+  if (!headersDelivered_)
+    deliverHeaders(entry);
 
-    /* @API: create a TimeoutException */
-    requestEntry->reject(std::runtime_error("Timeout"));
+  entry.stream->onData_(data, size);
+}
 
-    requestEntry.reset(nullptr);
+void Connection::deliverHeaders(RequestEntry &entry) {
+  headersDelivered_ = true;
 
-    if (onDone)
-      onDone();
+  // The body can take as long as the consumer needs to get through it
+  releaseTimer(entry);
+
+  if (entry.stream->onHeaders_)
+    entry.stream->onHeaders_(parser.response);
+}
+
+bool Connection::readsPaused() const {
+  return !inflight_.empty() && inflight_.front()->stream &&
+         inflight_.front()->stream->isPaused();
+}
+
+void Connection::resumeReads() {
+  if (transport_)
+    transport_->resumeReads(shared_from_this());
+}
+
+size_t Connection::spliceableBytes() const {
+  // The headers go to the stream first, TLS records have to be decrypted
+  if (inflight_.empty() || !headersDelivered_ || tls_)
+    return 0;
+
+  const auto &stream = inflight_.front()->stream;
+  if (!stream || stream->splicePipe_ == -1 || stream->isPaused())
+    return 0;
+
+  const ssize_t remaining = parser.bodyRemaining();
+  return remaining > 0 ? static_cast<size_t>(remaining) : 0;
+}
+
+Fd Connection::splicePipe() const {
+  return inflight_.front()->stream->splicePipe_;
+}
+
+void Connection::handleSplicedBody(size_t size) {
+  parser.skipBody(size);
+
+  // The consumer resumes the stream once it drained the pipe, which can then
+  // take the next bytes
+  auto stream = inflight_.front()->stream;
+  stream->pause();
+  stream->onSpliced_(size);
+
+  // Completes the response
+  if (parser.bodyRemaining() == 0)
+    handleResponsePacket(nullptr, 0);
+}
+
+void Connection::expectResponse(std::unique_ptr<RequestEntry> entry) {
+  if (entry->stream) {
+    std::lock_guard<std::mutex> guard(entry->stream->lock_);
+    entry->stream->connection_ = shared_from_this();
+  }
+
+  inflight_.push_back(std::move(entry));
+  inflightCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t Connection::pendingResponses() const {
+  return inflightCount_.load(std::memory_order_relaxed);
+}
+
+void Connection::abortRequests(const char *error) {
+  // Requests queued from now on will establish the connection again
+  connectionState_.store(NotConnected);
+
+  std::lock_guard<std::mutex> guard(requestsQueueLock_);
+  for (;;) {
+    auto req = requestsQueue.popSafe();
+    if (!req)
+      break;
+
+    // This runs on a resolver thread, which is not stopped along with the
+    // client
+    if (req->onDone)
+      req->onDone();
+
+    req->reject(Error(error));
   }
 }
 
@@ -600,21 +1667,27 @@ Async::Promise<Response> Connection::asyncPerform(const Http::Request &request,
                                                   Connection::OnDone onDone) {
   return Async::Promise<Response>(
       [=](Async::Resolver &resolve, Async::Rejection &reject) {
-        requestsQueue.push(RequestData(std::move(resolve), std::move(reject),
-                                       request, std::move(onDone)));
+        asyncPerformImpl(request, std::move(resolve), std::move(reject),
+                         std::move(onDone));
       });
 }
 
-void Connection::performImpl(const Http::Request &request,
-                             Async::Resolver resolve, Async::Rejection reject,
-                             Connection::OnDone onDone) {
-
-  std::stringstream streamBuf;
-  writeRequest(streamBuf, request);
-  if (!streamBuf)
-    reject(std::runtime_error("Could not write request"));
-  std::string buffer = streamBuf.str();
+void Connection::asyncPerformImpl(Http::Request request,
+                                  Async::Resolver resolve,
+                                  Async::Rejection reject,
+                                  Connection::OnDone onDone) {
+  requestsQueue.push(RequestData(std::move(resolve), std::move(reject),
+                                 std::move(request), std::move(onDone)));
+
+  // The connection might have been established while the request was being
+  // queued, in which case nobody else will send it
+  if (isConnected())
+    processRequestQueue();
+}
 
+void Connection::performImpl(Http::Request request, Async::Resolver resolve,
+                             Async::Rejection reject,
+                             Connection::OnDone onDone) {
   std::shared_ptr<TimerPool::Entry> timer(nullptr);
   auto timeout = request.timeout();
   if (timeout.count() > 0) {
@@ -622,93 +1695,447 @@ void Connection::performImpl(const Http::Request &request,
     timer->arm(timeout);
   }
 
-  requestEntry.reset(new RequestEntry(std::move(resolve), std::move(reject),
-                                      timer, std::move(onDone)));
-  transport_->asyncSendRequest(shared_from_this(), timer, std::move(buffer));
+  std::unique_ptr<RequestEntry> entry(
+      new RequestEntry(std::move(resolve), std::move(reject), timer,
+                       std::move(onDone), std::move(request.stream_)));
+  transport_->asyncSendRequest(shared_from_this(), std::move(entry),
+                               std::move(request));
 }
 
 void Connection::processRequestQueue() {
+  std::lock_guard<std::mutex> guard(requestsQueueLock_);
   for (;;) {
-      std::cout << "requestsQueue.popSafe()" << std::endl; // YOSHI
     auto req = requestsQueue.popSafe();
     if (!req)
       break;
 
-    performImpl(req->request, std::move(req->resolve), std::move(req->reject),
-                std::move(req->onDone));
+    performImpl(std::move(req->request), std::move(req->resolve),
+                std::move(req->reject), std::move(req->onDone));
   }
 }
 
-void ConnectionPool::init(size_t maxConnectionsPerHost,
-                          size_t maxResponseSize) {
-  this->maxConnectionsPerHost = maxConnectionsPerHost;
-  this->maxResponseSize = maxResponseSize;
+RetryBudget::RetryBudget(double ratio, size_t maxTokens)
+    : deposit_(static_cast<int64_t>(std::max(ratio, 0.0) * Unit)),
+      max_(static_cast<int64_t>(maxTokens) * Unit), tokens_(max_) {}
+
+void RetryBudget::deposit() {
+  auto tokens = tokens_.load(std::memory_order_relaxed);
+  while (tokens < max_ &&
+         !tokens_.compare_exchange_weak(tokens,
+                                        std::min(tokens + deposit_, max_),
+                                        std::memory_order_relaxed)) {
+  }
 }
 
-std::shared_ptr<Connection>
-ConnectionPool::pickConnection(const std::string &domain) {
-  Connections pool;
+bool RetryBudget::withdraw() {
+  auto tokens = tokens_.load(std::memory_order_relaxed);
+  for (;;) {
+    if (tokens < Unit)
+      return false;
+    if (tokens_.compare_exchange_weak(tokens, tokens - Unit,
+                                      std::memory_order_relaxed))
+      return true;
+  }
+}
 
-  {
-    Guard guard(connsLock);
-    auto poolIt = conns.find(domain);
-    if (poolIt == std::end(conns)) {
-      Connections connections;
-      for (size_t i = 0; i < maxConnectionsPerHost; ++i) {
-        connections.push_back(std::make_shared<Connection>(maxResponseSize));
-      }
+double RetryBudget::tokens() const {
+  return static_cast<double>(tokens_.load(std::memory_order_relaxed)) / Unit;
+}
 
-      poolIt =
-          conns.insert(std::make_pair(domain, std::move(connections))).first;
-    }
-    pool = poolIt->second;
+Upstream::Backend::Backend(std::string address)
+    : address_(std::move(address)), outstanding_(0), consecutiveFailures_(0),
+      ejections_(0), ejectedUntil_(0), healthy_(true) {}
+
+size_t Upstream::Backend::outstanding() const {
+  return outstanding_.load(std::memory_order_relaxed);
+}
+
+bool Upstream::Backend::isEjected(Clock::time_point now) const {
+  return ejectedUntil_.load(std::memory_order_relaxed) >
+         now.time_since_epoch().count();
+}
+
+bool Upstream::Backend::isHealthy() const {
+  return healthy_.load(std::memory_order_relaxed);
+}
+
+namespace {
+class RoundRobinBalancer : public Upstream::Balancer {
+public:
+  size_t pick(const std::vector<Upstream::Backend *> &candidates) override {
+    return next_.fetch_add(1, std::memory_order_relaxed) % candidates.size();
   }
 
-  for (auto &conn : pool) {
-    if (conn->tryUse()) {
-      return conn;
+private:
+  std::atomic<size_t> next_{0};
+};
+
+class LeastOutstandingBalancer : public Upstream::Balancer {
+public:
+  size_t pick(const std::vector<Upstream::Backend *> &candidates) override {
+    // Starting from a different backend every time spreads the ties
+    const auto count = candidates.size();
+    const auto start = next_.fetch_add(1, std::memory_order_relaxed) % count;
+
+    auto best = start;
+    for (size_t i = 1; i < count; ++i) {
+      const auto index = (start + i) % count;
+      if (candidates[index]->outstanding() < candidates[best]->outstanding())
+        best = index;
     }
+
+    return best;
   }
 
-  return nullptr;
+private:
+  std::atomic<size_t> next_{0};
+};
+
+// Compares two backends drawn at random, which is nearly as good as looking
+// at all of them without herding every client onto the same one
+class PowerOfTwoChoicesBalancer : public Upstream::Balancer {
+public:
+  size_t pick(const std::vector<Upstream::Backend *> &candidates) override {
+    const auto count = candidates.size();
+    if (count == 1)
+      return 0;
+
+    thread_local std::minstd_rand random(std::random_device{}());
+    const size_t first = random() % count;
+    size_t second = random() % (count - 1);
+    if (second >= first)
+      ++second;
+
+    return candidates[first]->outstanding() <=
+                   candidates[second]->outstanding()
+               ? first
+               : second;
+  }
+};
+} // namespace
+
+std::shared_ptr<Upstream::Balancer>
+Upstream::Balancer::create(Balancing balancing) {
+  switch (balancing) {
+  case Balancing::RoundRobin:
+    return std::make_shared<RoundRobinBalancer>();
+  case Balancing::LeastOutstanding:
+    return std::make_shared<LeastOutstandingBalancer>();
+  case Balancing::PowerOfTwoChoices:
+    return std::make_shared<PowerOfTwoChoicesBalancer>();
+  }
+
+  throw std::invalid_argument("Unknown balancing");
 }
 
-void ConnectionPool::releaseConnection(
-    const std::shared_ptr<Connection> &connection) {
-  connection->setAsIdle();
+Upstream::Options::Options()
+    : balancer_(Balancer::create(Balancing::RoundRobin)),
+      ejectAfter_(Default::EjectAfter), ejectionTime_(Default::EjectionTime),
+      maxEjectionPercent_(Default::MaxEjectionPercent), healthCheckPath_(),
+      healthCheckInterval_(0), retryBudgetRatio_(Default::RetryBudgetRatio) {}
+
+Upstream::Options &Upstream::Options::balancing(Balancing val) {
+  balancer_ = Balancer::create(val);
+  return *this;
 }
 
-size_t ConnectionPool::usedConnections(const std::string &domain) const {
-  Connections pool;
-  {
-    Guard guard(connsLock);
-    auto it = conns.find(domain);
-    if (it == std::end(conns)) {
-      return 0;
+Upstream::Options &Upstream::Options::balancer(std::shared_ptr<Balancer> val) {
+  if (!val)
+    throw std::invalid_argument("Invalid balancer");
+
+  balancer_ = std::move(val);
+  return *this;
+}
+
+Upstream::Options &Upstream::Options::ejectAfter(size_t failures) {
+  ejectAfter_ = failures;
+  return *this;
+}
+
+Upstream::Options &
+Upstream::Options::ejectionTime(std::chrono::milliseconds val) {
+  ejectionTime_ = val;
+  return *this;
+}
+
+Upstream::Options &Upstream::Options::maxEjectionPercent(size_t val) {
+  maxEjectionPercent_ = std::min<size_t>(val, 100);
+  return *this;
+}
+
+Upstream::Options &
+Upstream::Options::healthCheck(std::string path,
+                               std::chrono::milliseconds interval) {
+  if (interval.count() <= 0)
+    throw std::invalid_argument("Invalid health check interval");
+
+  healthCheckPath_ = std::move(path);
+  healthCheckInterval_ = interval;
+  return *this;
+}
+
+Upstream::Options &Upstream::Options::retryBudget(double ratio) {
+  retryBudgetRatio_ = ratio;
+  return *this;
+}
+
+Upstream::Upstream(std::string name, const std::vector<std::string> &backends,
+                   const Options &options)
+    : name_(std::move(name)), backends_(), options_(options),
+      latency_(Default::HedgeDecayWindow),
+      retryBudget_(options.retryBudgetRatio_, Default::RetryBudgetCap) {
+  for (const auto &address : backends)
+    backends_.push_back(std::make_shared<Backend>(address));
+}
+
+std::shared_ptr<Upstream::Backend> Upstream::pick() {
+  if (backends_.empty())
+    return nullptr;
+
+  // Reused from one request to the next, the balancer only sees pointers
+  thread_local std::vector<Backend *> candidates;
+  thread_local std::vector<size_t> positions;
+  candidates.clear();
+  positions.clear();
+
+  const auto now = Clock::now();
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    auto &backend = *backends_[i];
+    if (backend.isHealthy() && !backend.isEjected(now)) {
+      candidates.push_back(&backend);
+      positions.push_back(i);
     }
-    pool = it->second;
   }
 
-  return std::count_if(pool.begin(), pool.end(),
+  // Better to try our luck with every backend than to fail them all
+  if (candidates.empty()) {
+    for (size_t i = 0; i < backends_.size(); ++i) {
+      candidates.push_back(backends_[i].get());
+      positions.push_back(i);
+    }
+  }
+
+  const auto index = options_.balancer_->pick(candidates);
+  auto backend = backends_[positions[index % positions.size()]];
+  backend->outstanding_.fetch_add(1, std::memory_order_relaxed);
+  return backend;
+}
+
+void Upstream::succeeded(Backend &backend) {
+  backend.outstanding_.fetch_sub(1, std::memory_order_relaxed);
+  backend.consecutiveFailures_.store(0, std::memory_order_relaxed);
+  backend.ejections_.store(0, std::memory_order_relaxed);
+}
+
+void Upstream::failed(Backend &backend) {
+  backend.outstanding_.fetch_sub(1, std::memory_order_relaxed);
+
+  if (options_.ejectAfter_ == 0)
+    return;
+
+  const auto failures =
+      backend.consecutiveFailures_.fetch_add(1, std::memory_order_relaxed) +
+      1;
+  if (failures >= options_.ejectAfter_ && !backend.isEjected())
+    eject(backend);
+}
+
+void Upstream::abandoned(Backend &backend) {
+  backend.outstanding_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Upstream::healthChecked(Backend &backend, bool healthy) {
+  backend.healthy_.store(healthy, std::memory_order_relaxed);
+}
+
+void Upstream::eject(Backend &backend) {
+  const auto now = Clock::now();
+  const auto ejected =
+      std::count_if(backends_.begin(), backends_.end(),
+                    [now](const std::shared_ptr<Backend> &other) {
+                      return other->isEjected(now);
+                    });
+  if (static_cast<size_t>(ejected + 1) * 100 >
+      options_.maxEjectionPercent_ * backends_.size())
+    return;
+
+  // Backends that fail again as soon as they come back stay out longer
+  static constexpr size_t MaxEjectionFactor = 10;
+  const auto ejections =
+      backend.ejections_.fetch_add(1, std::memory_order_relaxed) + 1;
+  const auto duration =
+      options_.ejectionTime_ * static_cast<std::chrono::milliseconds::rep>(
+                                   std::min(ejections, MaxEjectionFactor));
+
+  backend.consecutiveFailures_.store(0, std::memory_order_relaxed);
+  backend.ejectedUntil_.store(
+      (now + duration).time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+ConnectionPool::Host::Host(std::string domain, size_t maxConnections,
+                           size_t pipelineDepth, size_t maxResponseSize,
+                           double retryBudgetRatio)
+    : domain_(std::move(domain)), connections_([=]() {
+        std::vector<std::shared_ptr<Connection>> connections;
+        for (size_t i = 0; i < maxConnections; ++i) {
+          connections.push_back(std::make_shared<Connection>(maxResponseSize));
+        }
+        return connections;
+      }()),
+      pipelineDepth_(pipelineDepth),
+      next_(new std::atomic<Slot>[maxConnections * pipelineDepth]),
+      head_(NoSlot), idle_(maxConnections * pipelineDepth), pad0_(),
+      waiting_(), waitingCount_(0),
+      latency_(Default::HedgeDecayWindow),
+      retryBudget_(retryBudgetRatio, Default::RetryBudgetCap),
+      minIdle_(Default::MinIdleConnections),
+      maxIdle_(Default::MaxIdleConnections) {
+  const size_t slots = maxConnections * pipelineDepth;
+  if (pipelineDepth == 0 || slots >= NoSlot)
+    throw std::invalid_argument("Invalid number of connections");
+
+  // Every slot starts free, stacked in order
+  for (size_t i = 0; i < slots; ++i) {
+    const auto next = i + 1 < slots ? static_cast<Slot>(i + 1) : NoSlot;
+    next_[i].store(next, std::memory_order_relaxed);
+  }
+
+  if (slots > 0)
+    head_.store(0);
+}
+
+std::shared_ptr<Connection> ConnectionPool::Host::acquire(Slot &slot) {
+  auto head = head_.load(std::memory_order_acquire);
+
+  for (;;) {
+    slot = static_cast<Slot>(head);
+    if (slot == NoSlot)
+      return nullptr;
+
+    const uint64_t next = next_[slot].load(std::memory_order_relaxed);
+    const uint64_t tag = (head >> 32) + 1;
+    if (head_.compare_exchange_weak(head, (tag << 32) | next,
+                                    std::memory_order_seq_cst,
+                                    std::memory_order_acquire))
+      break;
+  }
+
+  idle_.fetch_sub(1, std::memory_order_relaxed);
+
+  const auto &connection = connections_[slot / pipelineDepth_];
+  connection->addUser();
+  return connection;
+}
+
+void ConnectionPool::Host::release(Slot slot) {
+  connections_[slot / pipelineDepth_]->removeUser();
+  idle_.fetch_add(1, std::memory_order_relaxed);
+
+  auto head = head_.load(std::memory_order_relaxed);
+  for (;;) {
+    next_[slot].store(static_cast<Slot>(head), std::memory_order_relaxed);
+    const uint64_t tag = (head >> 32) + 1;
+    if (head_.compare_exchange_weak(head, (tag << 32) | slot,
+                                    std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+      break;
+  }
+}
+
+bool ConnectionPool::Host::wait(
+    const std::shared_ptr<Connection::RequestData> &data) {
+  if (!waiting_.enqueue(data))
+    return false;
+
+  // Counted only once queued, a non-zero count means there is something to
+  // dequeue unless another thread is about to take it
+  waitingCount_.fetch_add(1);
+  return true;
+}
+
+bool ConnectionPool::Host::nextWaiting(
+    std::shared_ptr<Connection::RequestData> &data) {
+  if (!waiting_.dequeue(data))
+    return false;
+
+  waitingCount_.fetch_sub(1);
+  return true;
+}
+
+bool ConnectionPool::Host::hasWaiting() const {
+  return waitingCount_.load() > 0;
+}
+
+size_t ConnectionPool::Host::usedConnections() const {
+  return std::count_if(connections_.begin(), connections_.end(),
                        [](const std::shared_ptr<Connection> &conn) {
                          return conn->isConnected();
                        });
 }
 
-size_t ConnectionPool::idleConnections(const std::string &domain) const {
-  Connections pool;
-  {
-    Guard guard(connsLock);
-    auto it = conns.find(domain);
-    if (it == std::end(conns)) {
-      return 0;
-    }
-    pool = it->second;
+size_t ConnectionPool::Host::idleConnections() const {
+  return idle_.load(std::memory_order_relaxed);
+}
+
+void ConnectionPool::Host::setIdleLimits(size_t minIdle, size_t maxIdle) {
+  minIdle_.store(std::min(minIdle, connections_.size()));
+  maxIdle_.store(std::max(minIdle, maxIdle));
+}
+
+size_t ConnectionPool::Host::minIdle() const { return minIdle_.load(); }
+
+size_t ConnectionPool::Host::maxIdle() const { return maxIdle_.load(); }
+
+void ConnectionPool::init(size_t maxConnectionsPerHost,
+                          size_t maxResponseSize, size_t pipelineDepth,
+                          std::shared_ptr<DnsResolver> resolver,
+                          double retryBudgetRatio) {
+  this->maxConnectionsPerHost = maxConnectionsPerHost;
+  this->maxResponseSize = maxResponseSize;
+  this->pipelineDepth = pipelineDepth;
+  this->resolver_ = resolver ? std::move(resolver) : DnsResolver::create();
+  this->retryBudgetRatio = retryBudgetRatio;
+}
+
+ConnectionPool::Host *ConnectionPool::host(const std::string &domain) {
+  auto &shard = shardFor(domain);
+  Guard guard(shard.lock);
+
+  auto &host = shard.hosts[domain];
+  if (!host) {
+    host.reset(new Host(domain, maxConnectionsPerHost, pipelineDepth,
+                        maxResponseSize, retryBudgetRatio));
+    host->setIdleLimits(minIdle, maxIdle);
   }
 
-  return std::count_if(
-      pool.begin(), pool.end(),
-      [](const std::shared_ptr<Connection> &conn) { return conn->isIdle(); });
+  return host.get();
+}
+
+size_t ConnectionPool::usedConnections(const std::string &domain) const {
+  auto host = findHost(domain);
+  return host ? host->usedConnections() : 0;
+}
+
+size_t ConnectionPool::idleConnections(const std::string &domain) const {
+  auto host = findHost(domain);
+  return host ? host->idleConnections() : 0;
+}
+
+ConnectionPool::Shard &
+ConnectionPool::shardFor(const std::string &domain) const {
+  return shards_[std::hash<std::string>()(domain) % ShardsCount];
+}
+
+const ConnectionPool::Host *
+ConnectionPool::findHost(const std::string &domain) const {
+  auto &shard = shardFor(domain);
+  Guard guard(shard.lock);
+
+  auto it = shard.hosts.find(domain);
+  if (it == std::end(shard.hosts))
+    return nullptr;
+
+  return it->second.get();
 }
 
 size_t ConnectionPool::availableConnections(const std::string &domain) const {
@@ -716,8 +2143,43 @@ size_t ConnectionPool::availableConnections(const std::string &domain) const {
   return 0;
 }
 
-void ConnectionPool::closeIdleConnections(const std::string &domain){
-    UNUSED(domain)}
+void ConnectionPool::closeIdleConnections(const std::string &domain) {
+  auto &shard = shardFor(domain);
+  Host *host = nullptr;
+  {
+    Guard guard(shard.lock);
+    auto it = shard.hosts.find(domain);
+    if (it != std::end(shard.hosts))
+      host = it->second.get();
+  }
+
+  if (!host)
+    return;
+
+  for (const auto &connection : host->connections()) {
+    if (connection->isConnected() && connection->users() == 0)
+      connection->closeIfIdle(std::chrono::milliseconds(0));
+  }
+}
+
+void ConnectionPool::setIdleLimits(size_t minIdle, size_t maxIdle) {
+  this->minIdle = minIdle;
+  this->maxIdle = maxIdle;
+}
+
+void ConnectionPool::forEachHost(const std::function<void(Host &host)> &func) {
+  // Hosts live as long as the pool, the locks need not be held while the
+  // function runs
+  std::vector<Host *> hosts;
+  for (auto &shard : shards_) {
+    Guard guard(shard.lock);
+    for (auto &host : shard.hosts)
+      hosts.push_back(host.second.get());
+  }
+
+  for (auto host : hosts)
+    func(*host);
+}
 
 RequestBuilder &RequestBuilder::method(Method method) {
   request_.method_ = method;
@@ -740,6 +2202,11 @@ RequestBuilder::header(const std::shared_ptr<Header::Header> &header) {
   return *this;
 }
 
+RequestBuilder &RequestBuilder::header(const Header::Raw &header) {
+  request_.headers_.addRaw(header);
+  return *this;
+}
+
 RequestBuilder &RequestBuilder::cookie(const Cookie &cookie) {
   request_.cookies_.add(cookie);
   return *this;
@@ -760,10 +2227,56 @@ RequestBuilder &RequestBuilder::timeout(std::chrono::milliseconds val) {
   return *this;
 }
 
+RequestBuilder &RequestBuilder::stream(std::shared_ptr<BodyStream> stream) {
+  request_.stream_ = std::move(stream);
+  return *this;
+}
+
+RequestBuilder &RequestBuilder::retries(size_t count) {
+  request_.retries_ = count;
+  return *this;
+}
+
+RequestBuilder &RequestBuilder::hedge(double percentile) {
+  if (percentile <= 0 || percentile >= 1)
+    throw std::invalid_argument("Hedging percentile must be within (0, 1)");
+
+  request_.hedgePercentile_ = percentile;
+  return *this;
+}
+
 Async::Promise<Response> RequestBuilder::send() {
+  return client_->doResilientRequest(request_);
+}
+
+RequestTemplate RequestBuilder::makeTemplate() const {
+  // Same as what doRequest() does to every request
+  Request fixed(request_);
+  fixed.headers().remove<Header::UserAgent>();
+
+  std::ostringstream head;
+  writeHead(head, fixed);
+
+  Request request;
+  request.resource_ = request_.resource_;
+  request.method_ = request_.method_;
+  request.timeout_ = request_.timeout_;
+  request.head_ = std::make_shared<const std::string>(head.str());
+
+  return RequestTemplate(client_, std::move(request));
+}
+
+Async::Promise<Response> RequestTemplate::send() const {
   return client_->doRequest(request_);
 }
 
+Async::Promise<Response> RequestTemplate::send(std::string body) const {
+  Request request(request_);
+  request.body_ = std::move(body);
+
+  return client_->doRequest(std::move(request));
+}
+
 Client::Options &Client::Options::threads(int val) {
   threads_ = val;
   return *this;
@@ -784,9 +2297,80 @@ Client::Options &Client::Options::maxResponseSize(size_t val) {
   return *this;
 }
 
+Client::Options &Client::Options::pipelining(size_t depth) {
+  pipelineDepth_ = depth;
+  return *this;
+}
+
+Client::Options &
+Client::Options::resolver(std::shared_ptr<DnsResolver> val) {
+  resolver_ = std::move(val);
+  return *this;
+}
+
+Client::Options &Client::Options::caFile(std::string path) {
+  caFile_ = std::move(path);
+  return *this;
+}
+
+Client::Options &Client::Options::verifyPeer(bool val) {
+  verifyPeer_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::verifyHost(bool val) {
+  verifyHost_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::clientCertificate(std::string certFile,
+                                                    std::string keyFile) {
+  certFile_ = std::move(certFile);
+  keyFile_ = std::move(keyFile);
+  return *this;
+}
+
+Client::Options &Client::Options::alpn(std::vector<std::string> protocols) {
+  alpn_ = std::move(protocols);
+  return *this;
+}
+
+Client::Options &Client::Options::tlsSessionCache(bool val) {
+  tlsSessionCache_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::retryBudget(double ratio) {
+  retryBudgetRatio_ = ratio;
+  return *this;
+}
+
+Client::Options &Client::Options::minIdle(size_t val) {
+  minIdle_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::maxIdle(size_t val) {
+  maxIdle_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::idleTimeout(std::chrono::milliseconds val) {
+  idleTimeout_ = val;
+  return *this;
+}
+
+Client::Options &Client::Options::reactor(std::shared_ptr<Aio::Reactor> val) {
+  reactor_ = std::move(val);
+  return *this;
+}
+
 Client::Client()
-    : reactor_(Aio::Reactor::create()), pool(), transportKey(), ioIndex(0),
-      queuesLock(), requestsQueues(), stopProcessPequestsQueues(false) {}
+    : reactor_(Aio::Reactor::create()), sharedReactor_(false), pool(),
+      transportKey(), ioIndex(0),
+      stopProcessPequestsQueues(false), tls_(), upstreamsLock_(), upstreams_(),
+      upstreamsCount_(0), initialized_(false), transportsLock_(),
+      idleTimeout_(Default::IdleTimeout) {}
 
 Client::~Client() {
   assert(stopProcessPequestsQueues == true &&
@@ -796,18 +2380,90 @@ Client::~Client() {
 Client::Options Client::options() { return Client::Options(); }
 
 void Client::init(const Client::Options &options) {
-  pool.init(options.maxConnectionsPerHost_, options.maxResponseSize_);
-  reactor_->init(Aio::AsyncContext(options.threads_));
-  transportKey = reactor_->addHandler(std::make_shared<Transport>());
-  reactor_->run();
+  pool.init(options.maxConnectionsPerHost_, options.maxResponseSize_,
+            options.pipelineDepth_, options.resolver_,
+            options.retryBudgetRatio_);
+  pool.setIdleLimits(options.minIdle_, options.maxIdle_);
+  idleTimeout_ = options.idleTimeout_;
+#ifdef PISTACHE_USE_SSL
+  tls_ = std::make_shared<TlsContext>(
+      options.caFile_, options.verifyPeer_, options.verifyHost_,
+      options.certFile_, options.keyFile_, options.alpn_,
+      options.tlsSessionCache_);
+#endif /* PISTACHE_USE_SSL */
+  if (options.reactor_) {
+    reactor_ = options.reactor_;
+    sharedReactor_ = true;
+    transportKey = reactor_->addHandler(std::make_shared<Transport>());
+  } else {
+    reactor_->init(Aio::AsyncContext(options.threads_));
+    transportKey = reactor_->addHandler(std::make_shared<Transport>());
+    reactor_->run();
+  }
+
+  std::vector<std::shared_ptr<Upstream>> upstreams;
+  {
+    std::lock_guard<std::mutex> guard(upstreamsLock_);
+    initialized_ = true;
+    for (const auto &upstream : upstreams_)
+      upstreams.push_back(upstream.second);
+  }
+
+  for (const auto &upstream : upstreams) {
+    if (upstream->healthCheckInterval().count() > 0)
+      checkHealth(upstream);
+  }
+
+  maintainPool();
 }
 
 void Client::shutdown() {
+  if (sharedReactor_) {
+    stopProcessPequestsQueues = true;
+    detachTransports();
+    return;
+  }
+
   reactor_->shutdown();
-  Guard guard(queuesLock);
   stopProcessPequestsQueues = true;
 }
 
+void Client::detachTransports() {
+  std::vector<std::future<void>> detached;
+
+  for (const auto &handler : reactor_->handlers(transportKey)) {
+    auto transport = static_cast<Transport *>(handler.get());
+    if (handler->context().thread() == std::this_thread::get_id()) {
+      transport->detach();
+      continue;
+    }
+
+    auto done = std::make_shared<std::promise<void>>();
+    detached.push_back(done->get_future());
+    transport->schedule(std::chrono::milliseconds(0), [transport, done]() {
+      transport->detach();
+      done->set_value();
+    });
+  }
+
+  // The workers are gone already if the reactor was shut down first
+  const auto deadline =
+      std::chrono::steady_clock::now() + Default::DetachTimeout;
+  for (auto &future : detached)
+    future.wait_until(deadline);
+}
+
+Client::TlsStats Client::tlsStats() const {
+  TlsStats stats;
+#ifdef PISTACHE_USE_SSL
+  if (tls_) {
+    stats.fullHandshakes = tls_->fullHandshakes();
+    stats.resumedHandshakes = tls_->resumedHandshakes();
+  }
+#endif /* PISTACHE_USE_SSL */
+  return stats;
+}
+
 RequestBuilder Client::get(const std::string &resource) {
   return prepareRequest(resource, Http::Method::Get);
 }
@@ -828,6 +2484,17 @@ RequestBuilder Client::del(const std::string &resource) {
   return prepareRequest(resource, Http::Method::Delete);
 }
 
+Async::Promise<std::vector<Response>>
+Client::sendBatch(const std::vector<RequestBuilder> &requests) {
+  std::vector<Async::Promise<Response>> responses;
+  responses.reserve(requests.size());
+
+  for (const auto &request : requests)
+    responses.push_back(doResilientRequest(request.request_));
+
+  return Async::whenAll(responses.begin(), responses.end());
+}
+
 RequestBuilder Client::prepareRequest(const std::string &resource,
                                       Http::Method method) {
   RequestBuilder builder(this);
@@ -836,88 +2503,600 @@ RequestBuilder Client::prepareRequest(const std::string &resource,
   return builder;
 }
 
-Async::Promise<Response> Client::doRequest(Http::Request request) {
-  // request.headers_.add<Header::Connection>(ConnectionControl::KeepAlive);
-  request.headers().remove<Header::UserAgent>();
-  auto resourceData = request.resource();
+/* Copies of the same request racing each other: the retries of the attempts
+ * that failed and the duplicate sent when the first one is slow to answer.
+ * The first response wins and cancels the copies that are still queued.
+ * Copies already written can not be taken back, their responses are dropped
+ * once they come back, or once their own timeout expires.
+ *
+ * Async::whenAny() would reject as soon as one of the copies fails, which is
+ * exactly what retrying is meant to hide, hence the bookkeeping below.
+ */
+class RequestRace : public std::enable_shared_from_this<RequestRace> {
+public:
+  RequestRace(Client *client, Metrics::LatencyHistogram &latency,
+              RetryBudget &budget, Http::Request request,
+              Async::Resolver resolve, Async::Rejection reject)
+      : client_(client), latency_(latency), budget_(budget),
+        request_(std::move(request)),
+        resolve_(std::move(resolve)), reject_(std::move(reject)),
+        retriesLeft_(isIdempotent(request_.method()) ? request_.retries_ : 0) {
+    hedgePercentile_ = request_.hedgePercentile_;
+    request_.retries_ = 0;
+    request_.hedgePercentile_ = 0;
+  }
 
-  auto resource = splitUrl(resourceData);
-  auto conn = pool.pickConnection(resource.first);
+  void start() {
+    send(prepare());
 
-  if (conn == nullptr) {
-    return Async::Promise<Response>([this, resource = std::move(resource),
-                                     request](Async::Resolver &resolve,
-                                              Async::Rejection &reject) {
-      Guard guard(queuesLock);
-
-      auto data = std::make_shared<Connection::RequestData>(
-          std::move(resolve), std::move(reject), std::move(request), nullptr);
-      auto &queue = requestsQueues[resource.first];
-      if (!queue.enqueue(data))
-        data->reject(std::runtime_error("Queue is full"));
+    if (hedgePercentile_ > 0)
+      scheduleHedge();
+  }
+
+private:
+  using Lock = std::mutex;
+  using Guard = std::lock_guard<Lock>;
+  using Token = std::shared_ptr<std::atomic<bool>>;
+
+  static bool isIdempotent(Method method) {
+    switch (method) {
+    case Method::Get:
+    case Method::Head:
+    case Method::Put:
+    case Method::Delete:
+    case Method::Options:
+    case Method::Trace:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // Must be called with the lock held, or before the race starts
+  Token prepare() {
+    auto token = std::make_shared<std::atomic<bool>>(false);
+    tokens_.push_back(token);
+    ++outstanding_;
+    return token;
+  }
+
+  void send(Token token) {
+    Http::Request request(request_);
+    request.cancelled_ = std::move(token);
+
+    auto self = shared_from_this();
+    client_->doRequest(std::move(request))
+        .then(
+            [self](Response response) { self->onResponse(std::move(response)); },
+            [self](std::exception_ptr exc) { self->onError(exc); });
+  }
+
+  void scheduleHedge() {
+    const auto counts = latency_.counts();
+    if (counts.count < Default::HedgeMinSamples)
+      return;
+
+    // Slower than the last bound, the hedge would come after the timeout
+    const auto micros = counts.valueAtPercentile(hedgePercentile_ * 100);
+    if (micros == std::numeric_limits<uint64_t>::max())
+      return;
+
+    // Timers only have a millisecond resolution
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::microseconds(static_cast<int64_t>(micros) + 999));
+    if (delay.count() == 0)
+      delay = std::chrono::milliseconds(1);
+
+    std::weak_ptr<RequestRace> weakSelf = shared_from_this();
+    client_->schedule(delay, [weakSelf]() {
+      if (auto self = weakSelf.lock())
+        self->onHedge();
     });
-  } else {
+  }
 
-    if (!conn->hasTransport()) {
-      auto transports = reactor_->handlers(transportKey);
-      auto index = ioIndex.fetch_add(1) % transports.size();
+  void onHedge() {
+    Token token;
+    {
+      Guard guard(lock_);
+      if (done_ || !budget_.withdraw())
+        return;
+      token = prepare();
+    }
 
-      auto transport = std::static_pointer_cast<Transport>(transports[index]);
-      conn->associateTransport(transport);
+    send(std::move(token));
+  }
+
+  void onResponse(Response response) {
+    {
+      Guard guard(lock_);
+      --outstanding_;
+      if (done_)
+        return;
+
+      done_ = true;
+      for (auto &token : tokens_)
+        token->store(true);
     }
 
-    if (!conn->isConnected()) {
-      std::weak_ptr<Connection> weakConn = conn;
-      auto res = conn->asyncPerform(request, [this, weakConn]() {
-        auto conn = weakConn.lock();
-        if (conn) {
-          pool.releaseConnection(conn);
-          processRequestQueue();
-        }
+    resolve_(std::move(response));
+  }
+
+  void onError(std::exception_ptr exc) {
+    Token token;
+    {
+      Guard guard(lock_);
+      --outstanding_;
+      if (done_)
+        return;
+
+      if (retriesLeft_ > 0 && budget_.withdraw()) {
+        --retriesLeft_;
+        token = prepare();
+      } else if (outstanding_ > 0) {
+        // A hedge is still running, it might succeed
+        return;
+      } else {
+        done_ = true;
+      }
+    }
+
+    if (token) {
+      send(std::move(token));
+      return;
+    }
+
+    reject_(exc);
+  }
+
+  Client *client_;
+  Metrics::LatencyHistogram &latency_;
+  RetryBudget &budget_;
+  Http::Request request_;
+  Async::Resolver resolve_;
+  Async::Rejection reject_;
+
+  double hedgePercentile_ = 0;
+
+  Lock lock_;
+  bool done_ = false;
+  size_t outstanding_ = 0;
+  size_t retriesLeft_;
+  std::vector<Token> tokens_;
+};
+
+Async::Promise<Response> Client::doResilientRequest(Http::Request request) {
+  if (request.retries_ == 0 && request.hedgePercentile_ <= 0)
+    return doRequest(std::move(request));
+
+  // Upstreams keep the latency and the budget of the whole group, copies of
+  // the request can go to different backends
+  auto resource = splitUrl(request.resource());
+  Metrics::LatencyHistogram *latency;
+  RetryBudget *budget;
+  if (auto upstream = findUpstream(resource.first)) {
+    latency = &upstream->latency();
+    budget = &upstream->retryBudget();
+  } else {
+    auto host = pool.host(hostKey(request.resource(), resource.first));
+    latency = &host->latency();
+    budget = &host->retryBudget();
+  }
+
+  return Async::Promise<Response>(
+      [&](Async::Resolver &resolve, Async::Rejection &reject) {
+        auto race = std::make_shared<RequestRace>(
+            this, *latency, *budget, std::move(request), std::move(resolve),
+            std::move(reject));
+        race->start();
+      });
+}
+
+namespace {
+// Settles the promise of a request once the one it was forwarded as is
+struct Forward {
+  Forward(Async::Resolver resolve, Async::Rejection reject)
+      : resolve(std::move(resolve)), reject(std::move(reject)) {}
+
+  Async::Resolver resolve;
+  Async::Rejection reject;
+};
+} // namespace
+
+Async::Promise<Response>
+Client::doUpstreamRequest(const std::shared_ptr<Upstream> &upstream,
+                          Http::Request request) {
+  auto backend = upstream->pick();
+  if (!backend)
+    return Async::Promise<Response>::rejected(
+        std::runtime_error("Upstream has no backend"));
+
+  upstream->retryBudget().deposit();
+
+  // The host of the URL is the name of the upstream, the backend takes its
+  // place
+  auto path = splitUrl(request.resource()).second.toString();
+  request.resource_ = backend->address() + path;
+
+  auto cancelled = request.cancelled_;
+  auto start = std::chrono::steady_clock::now();
+
+  return Async::Promise<Response>(
+      [&](Async::Resolver &resolve, Async::Rejection &reject) {
+        auto forward =
+            std::make_shared<Forward>(std::move(resolve), std::move(reject));
+        auto elapsed = [start]() {
+          return static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count());
+        };
+
+        doRequest(std::move(request))
+            .then(
+                [upstream, backend, forward, elapsed](Response response) {
+                  upstream->latency().record(elapsed());
+                  if (response.code() >= Code::Internal_Server_Error)
+                    upstream->failed(*backend);
+                  else
+                    upstream->succeeded(*backend);
+
+                  forward->resolve(std::move(response));
+                },
+                [upstream, backend, forward, elapsed,
+                 cancelled](std::exception_ptr exc) {
+                  if (cancelled && cancelled->load()) {
+                    upstream->abandoned(*backend);
+                  } else {
+                    upstream->latency().record(elapsed());
+                    upstream->failed(*backend);
+                  }
+
+                  forward->reject(exc);
+                });
       });
-      conn->connect(helpers::httpAddr(resource.first));
-      return res;
+}
+
+std::shared_ptr<Upstream> Client::findUpstream(const StringView &name) const {
+  if (upstreamsCount_.load(std::memory_order_relaxed) == 0)
+    return nullptr;
+
+  std::lock_guard<std::mutex> guard(upstreamsLock_);
+  auto it = upstreams_.find(name.toString());
+  if (it == std::end(upstreams_))
+    return nullptr;
+
+  return it->second;
+}
+
+std::shared_ptr<Upstream>
+Client::addUpstream(std::string name, const std::vector<std::string> &backends,
+                    const Upstream::Options &options) {
+  auto upstream = std::make_shared<Upstream>(name, backends, options);
+
+  bool startChecks;
+  {
+    std::lock_guard<std::mutex> guard(upstreamsLock_);
+    if (!upstreams_.emplace(std::move(name), upstream).second)
+      throw std::invalid_argument("Upstream already exists");
+
+    upstreamsCount_.fetch_add(1);
+    startChecks = initialized_;
+  }
+
+  if (startChecks && upstream->healthCheckInterval().count() > 0)
+    checkHealth(upstream);
+
+  return upstream;
+}
+
+std::shared_ptr<Upstream> Client::upstream(const std::string &name) const {
+  std::lock_guard<std::mutex> guard(upstreamsLock_);
+  auto it = upstreams_.find(name);
+  if (it == std::end(upstreams_))
+    return nullptr;
+
+  return it->second;
+}
+
+void Client::checkHealth(std::weak_ptr<Upstream> weakUpstream) {
+  auto upstream = weakUpstream.lock();
+  if (!upstream || stopProcessPequestsQueues)
+    return;
+
+  const auto interval = upstream->healthCheckInterval();
+  for (const auto &backend : upstream->backends()) {
+    Http::Request probe;
+    probe.method_ = Method::Get;
+    probe.resource_ = backend->address() + upstream->healthCheckPath();
+    probe.timeout_ = interval;
+
+    // The probe goes straight to the backend, it is not balanced
+    doRequest(std::move(probe))
+        .then(
+            [upstream, backend](Response response) {
+              const auto code = static_cast<int>(response.code());
+              upstream->healthChecked(*backend, code >= 200 && code < 300);
+            },
+            [upstream, backend](std::exception_ptr) {
+              upstream->healthChecked(*backend, false);
+            });
+  }
+
+  schedule(interval, [this, weakUpstream]() { checkHealth(weakUpstream); });
+}
+
+std::shared_ptr<Transport> Client::pickTransport() {
+  auto transports = reactor_->handlers(transportKey);
+
+  if (sharedReactor_) {
+    const auto self = std::this_thread::get_id();
+    for (const auto &transport : transports) {
+      if (transport->context().thread() == self)
+        return std::static_pointer_cast<Transport>(transport);
     }
+  }
 
-    std::weak_ptr<Connection> weakConn = conn;
-    return conn->perform(request, [this, weakConn]() {
-      auto conn = weakConn.lock();
-      if (conn) {
-        pool.releaseConnection(conn);
-        processRequestQueue();
-      }
-    });
+  auto index = ioIndex.fetch_add(1) % transports.size();
+  return std::static_pointer_cast<Transport>(transports[index]);
+}
+
+void Client::schedule(std::chrono::milliseconds delay,
+                      std::function<void()> callback) {
+  pickTransport()->schedule(delay, std::move(callback));
+}
+
+Async::Promise<Response> Client::doRequest(Http::Request request) {
+  // request.headers_.add<Header::Connection>(ConnectionControl::KeepAlive);
+  request.headers().remove<Header::UserAgent>();
+
+  auto resource = splitUrl(request.resource());
+  if (auto upstream = findUpstream(resource.first))
+    return doUpstreamRequest(upstream, std::move(request));
+
+  auto host = pool.host(hostKey(request.resource(), resource.first));
+  host->retryBudget().deposit();
+
+  ConnectionPool::Host::Slot slot;
+  auto conn = host->acquire(slot);
+
+  if (conn == nullptr) {
+    return Async::Promise<Response>(
+        [&](Async::Resolver &resolve, Async::Rejection &reject) {
+          auto data = std::make_shared<Connection::RequestData>(
+              std::move(resolve), std::move(reject), std::move(request),
+              nullptr);
+          if (!host->wait(data)) {
+            data->reject(std::runtime_error("Queue is full"));
+            return;
+          }
+
+          // A connection might have been released before the request made
+          // it to the queue
+          processRequestQueue(host);
+        });
   }
+
+  return Async::Promise<Response>(
+      [&](Async::Resolver &resolve, Async::Rejection &reject) {
+        dispatch(host, slot, conn, std::move(request), std::move(resolve),
+                 std::move(reject));
+      });
 }
 
-void Client::processRequestQueue() {
-  Guard guard(queuesLock);
+void Client::dispatch(ConnectionPool::Host *host,
+                      ConnectionPool::Host::Slot slot,
+                      const std::shared_ptr<Connection> &conn,
+                      Http::Request request, Async::Resolver resolve,
+                      Async::Rejection reject) {
+  associateTransport(conn, host->domain());
+
+  // Cancelled requests never made it to the wire, they say nothing about
+  // the latency of the host
+  auto start = std::chrono::steady_clock::now();
+  auto cancelled = request.cancelled_;
+  auto onDone = [this, host, slot, start, cancelled]() {
+    if (!cancelled || !cancelled->load())
+      host->latency().record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count()));
+
+    host->release(slot);
+    processRequestQueue(host);
+  };
+
+  if (!conn->isConnected()) {
+    conn->asyncPerformImpl(std::move(request), std::move(resolve),
+                           std::move(reject), std::move(onDone));
+
+    // With pipelining, other requests might be waiting for the same
+    // connection to be established
+    if (conn->startConnecting())
+      connect(conn, host->domain());
+    return;
+  }
+
+  conn->performImpl(std::move(request), std::move(resolve), std::move(reject),
+                    std::move(onDone));
+}
+
+void Client::associateTransport(const std::shared_ptr<Connection> &connection,
+                                const std::string &domain) {
+  if (connection->hasTransport())
+    return;
+
+  // Requests and the maintenance of the pool can race for a new connection
+  std::lock_guard<std::mutex> guard(transportsLock_);
+  if (connection->hasTransport())
+    return;
 
+  // Established from a worker of a shared reactor, the connection stays with
+  // that worker
+  auto transport = pickTransport();
+  connection->setReconnect(
+      [this, domain](const std::shared_ptr<Connection> &conn) {
+        connect(conn, domain);
+      });
+  connection->associateTransport(transport);
+}
+
+void Client::warmUp(const std::string &host, size_t connections) {
+  auto resource = splitUrl(host);
+  auto poolHost = pool.host(hostKey(host, resource.first));
+  poolHost->setIdleLimits(connections,
+                          std::max(connections, poolHost->maxIdle()));
+
+  preconnect(*poolHost);
+}
+
+size_t Client::openConnections(const std::string &host) const {
+  auto resource = splitUrl(host);
+  return pool.usedConnections(hostKey(host, resource.first));
+}
+
+void Client::maintainPool() {
   if (stopProcessPequestsQueues)
     return;
 
-  for (auto &queues : requestsQueues) {
-    for (;;) {
-      const auto &domain = queues.first;
-      auto conn = pool.pickConnection(domain);
-      if (!conn)
+  pool.forEachHost([this](ConnectionPool::Host &host) {
+    std::vector<std::shared_ptr<Connection>> idle;
+    for (const auto &connection : host.connections()) {
+      if (connection->isConnected() && connection->users() == 0 &&
+          connection->pendingResponses() == 0)
+        idle.push_back(connection);
+    }
+
+    // The connections unused for the longest are closed first
+    std::sort(idle.begin(), idle.end(),
+              [](const std::shared_ptr<Connection> &lhs,
+                 const std::shared_ptr<Connection> &rhs) {
+                return lhs->idleTime() > rhs->idleTime();
+              });
+
+    size_t open = idle.size();
+    for (const auto &connection : idle) {
+      if (open <= host.minIdle())
         break;
 
-      auto &queue = queues.second;
-      std::shared_ptr<Connection::RequestData> data;
-      if (!queue.dequeue(data)) {
-        pool.releaseConnection(conn);
+      if (open > host.maxIdle())
+        connection->closeIfIdle(std::chrono::milliseconds(0));
+      else if (idleTimeout_.count() > 0 &&
+               connection->idleTime() >= idleTimeout_)
+        connection->closeIfIdle(idleTimeout_);
+      else
         break;
-      }
 
-      conn->performImpl(data->request, std::move(data->resolve),
-                        std::move(data->reject), [this, conn]() {
-                          pool.releaseConnection(conn);
-                          processRequestQueue();
-                        });
+      --open;
+    }
+
+    preconnect(host);
+  });
+
+  auto interval = Default::PoolMaintenanceInterval;
+  if (idleTimeout_.count() > 0)
+    interval = std::min(
+        interval, std::max(idleTimeout_ / 2, std::chrono::milliseconds(10)));
+
+  schedule(interval, [this]() { maintainPool(); });
+}
+
+void Client::preconnect(ConnectionPool::Host &host) {
+  const auto minIdle = host.minIdle();
+  if (minIdle == 0)
+    return;
+
+  size_t ready = 0;
+  for (const auto &connection : host.connections()) {
+    if ((connection->isConnected() || connection->isConnecting()) &&
+        connection->users() == 0)
+      ++ready;
+  }
+
+  for (const auto &connection : host.connections()) {
+    if (ready >= minIdle)
+      break;
+
+    associateTransport(connection, host.domain());
+    if (connection->startConnecting()) {
+      connect(connection, host.domain());
+      ++ready;
     }
   }
 }
 
+void Client::connect(const std::shared_ptr<Connection> &connection,
+                     const std::string &domain) {
+  const bool secure = isHttps(domain);
+  AddressParser parser(secure ? domain.substr(sizeof("https://") - 1) : domain);
+
+  auto host = parser.rawHost();
+  if (parser.family() == AF_INET6 && host.size() > 2)
+    host = host.substr(1, host.size() - 2);
+
+  auto port = parser.rawPort();
+  if (port.empty())
+    port = std::to_string(secure ? Const::HTTPS_STANDARD_PORT
+                                 : Const::HTTP_STANDARD_PORT);
+
+  if (secure) {
+    if (!tls_) {
+      connection->abortRequests("HTTPS requires a build with PISTACHE_USE_SSL");
+      return;
+    }
+
+    // Sessions are resumed across the connections of the same host and port
+    connection->useTls(tls_, host, domain);
+  }
+
+  // The lookup runs off the calling thread, the connection is established
+  // from the resolver thread once the host is known
+  std::weak_ptr<Connection> weakConn = connection;
+  pool.resolver()
+      ->resolve(host, port, parser.family())
+      .then(
+          [weakConn](const std::shared_ptr<const DnsResolver::Answer> &answer) {
+            auto conn = weakConn.lock();
+            if (!conn)
+              return;
+
+            try {
+              conn->connect(*answer);
+            } catch (const std::exception &e) {
+              conn->abortRequests(e.what());
+            }
+          },
+          [weakConn](std::exception_ptr exc) {
+            auto conn = weakConn.lock();
+            if (!conn)
+              return;
+
+            try {
+              std::rethrow_exception(exc);
+            } catch (const std::exception &e) {
+              conn->abortRequests(e.what());
+            }
+          });
+}
+
+void Client::processRequestQueue(ConnectionPool::Host *host) {
+  // Only the host that just got a connection back is looked at, requests of
+  // other hosts are woken up by their own releases
+  while (!stopProcessPequestsQueues && host->hasWaiting()) {
+    ConnectionPool::Host::Slot slot;
+    auto conn = host->acquire(slot);
+    if (!conn)
+      break;
+
+    std::shared_ptr<Connection::RequestData> data;
+    if (!host->nextWaiting(data)) {
+      host->release(slot);
+      continue;
+    }
+
+    dispatch(host, slot, conn, std::move(data->request),
+             std::move(data->resolve), std::move(data->reject));
+  }
+}
+
 } // namespace Http
 } // namespace Pistache
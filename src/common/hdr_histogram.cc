@@ -0,0 +1,305 @@
+/* hdr_histogram.cc
+
+   Implementation of the High Dynamic Range histogram
+*/
+
+#include <pistache/hdr_histogram.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+
+namespace Pistache {
+
+namespace {
+constexpr uint64_t HourInMicroseconds = 3600ULL * 1000 * 1000;
+
+size_t log2Floor(uint64_t value) { return 63 - __builtin_clzll(value); }
+} // namespace
+
+HdrHistogram::HdrHistogram(uint64_t lowest, uint64_t highest,
+                           int significantDigits)
+    : lowest_(lowest), highest_(highest),
+      significantDigits_(significantDigits), unitMagnitude_(0),
+      subBucketHalfCountMagnitude_(0), subBucketCount_(0),
+      subBucketHalfCount_(0), subBucketMask_(0), bucketCount_(0), counts_(),
+      total_(0), min_(std::numeric_limits<uint64_t>::max()), max_(0) {
+  if (lowest < 1)
+    throw std::invalid_argument("The lowest value must be at least 1");
+  if (highest < 2 * lowest)
+    throw std::invalid_argument(
+        "The highest value must be at least twice the lowest one");
+  if (significantDigits < 1 || significantDigits > 5)
+    throw std::invalid_argument("Significant digits must be from 1 to 5");
+
+  // Every value up to that one is tracked to a single unit
+  uint64_t singleUnitResolution = 2;
+  for (int i = 0; i < significantDigits; ++i)
+    singleUnitResolution *= 10;
+
+  const size_t subBucketCountMagnitude =
+      static_cast<size_t>(std::ceil(std::log2(singleUnitResolution)));
+  subBucketHalfCountMagnitude_ =
+      std::max<size_t>(subBucketCountMagnitude, 1) - 1;
+  unitMagnitude_ = log2Floor(lowest);
+  subBucketCount_ = size_t(1) << (subBucketHalfCountMagnitude_ + 1);
+  subBucketHalfCount_ = subBucketCount_ / 2;
+  subBucketMask_ = static_cast<uint64_t>(subBucketCount_ - 1)
+                   << unitMagnitude_;
+
+  uint64_t smallestUntrackable = static_cast<uint64_t>(subBucketCount_)
+                                 << unitMagnitude_;
+  bucketCount_ = 1;
+  while (smallestUntrackable <= highest) {
+    if (smallestUntrackable > std::numeric_limits<uint64_t>::max() / 2) {
+      ++bucketCount_;
+      break;
+    }
+    smallestUntrackable <<= 1;
+    ++bucketCount_;
+  }
+
+  counts_.assign((bucketCount_ + 1) * subBucketHalfCount_, 0);
+}
+
+HdrHistogram::HdrHistogram() : HdrHistogram(1, HourInMicroseconds, 3) {}
+
+bool HdrHistogram::record(uint64_t value, uint64_t count) {
+  const size_t index = countsIndexOf(value);
+  if (index >= counts_.size())
+    return false;
+
+  counts_[index] += count;
+  total_ += count;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  return true;
+}
+
+bool HdrHistogram::recordCorrected(uint64_t value, uint64_t expectedInterval) {
+  if (!record(value))
+    return false;
+
+  if (expectedInterval == 0 || value <= expectedInterval)
+    return true;
+
+  for (uint64_t missing = value - expectedInterval;
+       missing >= expectedInterval; missing -= expectedInterval) {
+    if (!record(missing))
+      return false;
+  }
+
+  return true;
+}
+
+void HdrHistogram::add(const HdrHistogram &other) {
+  if (other.counts_.size() != counts_.size() ||
+      other.unitMagnitude_ != unitMagnitude_ ||
+      other.subBucketCount_ != subBucketCount_)
+    throw std::invalid_argument("Histograms do not track the same values");
+
+  for (size_t i = 0; i < counts_.size(); ++i)
+    counts_[i] += other.counts_[i];
+
+  total_ += other.total_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void HdrHistogram::reset() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  total_ = 0;
+  min_ = std::numeric_limits<uint64_t>::max();
+  max_ = 0;
+}
+
+uint64_t HdrHistogram::count() const { return total_; }
+
+uint64_t HdrHistogram::min() const {
+  return total_ == 0 ? 0 : lowestEquivalent(min_);
+}
+
+uint64_t HdrHistogram::max() const {
+  return total_ == 0 ? 0 : highestEquivalent(max_);
+}
+
+double HdrHistogram::mean() const {
+  if (total_ == 0)
+    return 0.0;
+
+  double sum = 0.0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    if (counts_[i] > 0)
+      sum += static_cast<double>(medianEquivalent(valueAtIndex(i))) *
+             static_cast<double>(counts_[i]);
+  }
+
+  return sum / static_cast<double>(total_);
+}
+
+double HdrHistogram::stddev() const {
+  if (total_ == 0)
+    return 0.0;
+
+  const double average = mean();
+  double sum = 0.0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    if (counts_[i] == 0)
+      continue;
+
+    const double deviation =
+        static_cast<double>(medianEquivalent(valueAtIndex(i))) - average;
+    sum += deviation * deviation * static_cast<double>(counts_[i]);
+  }
+
+  return std::sqrt(sum / static_cast<double>(total_));
+}
+
+uint64_t HdrHistogram::valueAtPercentile(double percentile) const {
+  if (total_ == 0)
+    return 0;
+
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  const auto target = std::max<uint64_t>(
+      static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total_) +
+                            0.5),
+      1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= target)
+      return highestEquivalent(valueAtIndex(i));
+  }
+
+  return max();
+}
+
+bool HdrHistogram::equivalent(uint64_t lhs, uint64_t rhs) const {
+  return lowestEquivalent(lhs) == lowestEquivalent(rhs);
+}
+
+void HdrHistogram::writePercentiles(std::ostream &os, double scale,
+                                    int ticksPerHalfDistance) const {
+  char line[256];
+  const int digits = significantDigits_;
+
+  std::snprintf(line, sizeof(line), "%12s %14s %10s %14s\n\n", "Value",
+                "Percentile", "TotalCount", "1/(1-Percentile)");
+  os << line;
+
+  if (total_ > 0) {
+    // Reported levels get closer as they near 100%, halving the distance
+    // that remains every ticksPerHalfDistance lines
+    double level = 0.0;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts_.size() && seen < total_; ++i) {
+      if (counts_[i] == 0)
+        continue;
+
+      seen += counts_[i];
+      const double reached =
+          100.0 * static_cast<double>(seen) / static_cast<double>(total_);
+      const double value =
+          static_cast<double>(highestEquivalent(valueAtIndex(i))) / scale;
+
+      while (level < 100.0 && reached >= level) {
+        std::snprintf(line, sizeof(line), "%12.*f %2.12f %10llu %14.2f\n",
+                      digits, value, level / 100.0,
+                      static_cast<unsigned long long>(seen),
+                      1.0 / (1.0 - level / 100.0));
+        os << line;
+
+        const double ticks =
+            ticksPerHalfDistance *
+            std::pow(2.0, std::floor(std::log2(100.0 / (100.0 - level))) + 1);
+        level += 100.0 / ticks;
+
+        // Only once for the last value, which closes the distribution
+        if (seen == total_)
+          break;
+      }
+    }
+
+    std::snprintf(line, sizeof(line), "%12.*f %2.12f %10llu\n", digits,
+                  static_cast<double>(max()) / scale, 1.0,
+                  static_cast<unsigned long long>(total_));
+    os << line;
+  }
+
+  std::snprintf(line, sizeof(line),
+                "#[Mean    = %12.*f, StdDeviation   = %12.*f]\n", digits,
+                mean() / scale, digits, stddev() / scale);
+  os << line;
+  std::snprintf(line, sizeof(line),
+                "#[Max     = %12.*f, Total count    = %12llu]\n", digits,
+                static_cast<double>(max()) / scale,
+                static_cast<unsigned long long>(total_));
+  os << line;
+  std::snprintf(line, sizeof(line),
+                "#[Buckets = %12zu, SubBuckets     = %12zu]\n", bucketCount_,
+                subBucketCount_);
+  os << line;
+}
+
+size_t HdrHistogram::bucketIndex(uint64_t value) const {
+  // Smallest power of two containing the value
+  const size_t pow2Ceiling = 64 - __builtin_clzll(value | subBucketMask_);
+  return pow2Ceiling - unitMagnitude_ - (subBucketHalfCountMagnitude_ + 1);
+}
+
+size_t HdrHistogram::subBucketIndex(uint64_t value, size_t bucket) const {
+  return static_cast<size_t>(value >> (bucket + unitMagnitude_));
+}
+
+size_t HdrHistogram::countsIndex(size_t bucket, size_t subBucket) const {
+  // The lower half of the sub-buckets of a bucket overlaps the previous
+  // bucket, only the first bucket has them
+  const size_t base = (bucket + 1) << subBucketHalfCountMagnitude_;
+  return base - subBucketHalfCount_ + subBucket;
+}
+
+size_t HdrHistogram::countsIndexOf(uint64_t value) const {
+  const size_t bucket = bucketIndex(value);
+  return countsIndex(bucket, subBucketIndex(value, bucket));
+}
+
+uint64_t HdrHistogram::valueFromIndex(size_t bucket, size_t subBucket) const {
+  return static_cast<uint64_t>(subBucket) << (bucket + unitMagnitude_);
+}
+
+uint64_t HdrHistogram::valueAtIndex(size_t index) const {
+  size_t bucket = index >> subBucketHalfCountMagnitude_;
+  size_t subBucket = (index & (subBucketHalfCount_ - 1)) + subBucketHalfCount_;
+  if (bucket == 0) {
+    subBucket -= subBucketHalfCount_;
+  } else {
+    --bucket;
+  }
+
+  return valueFromIndex(bucket, subBucket);
+}
+
+uint64_t HdrHistogram::lowestEquivalent(uint64_t value) const {
+  const size_t bucket = bucketIndex(value);
+  return valueFromIndex(bucket, subBucketIndex(value, bucket));
+}
+
+uint64_t HdrHistogram::highestEquivalent(uint64_t value) const {
+  return lowestEquivalent(value) + equivalentRange(value) - 1;
+}
+
+uint64_t HdrHistogram::medianEquivalent(uint64_t value) const {
+  return lowestEquivalent(value) + (equivalentRange(value) >> 1);
+}
+
+uint64_t HdrHistogram::equivalentRange(uint64_t value) const {
+  const size_t bucket = bucketIndex(value);
+  const size_t subBucket = subBucketIndex(value, bucket);
+  const size_t adjusted = subBucket >= subBucketCount_ ? bucket + 1 : bucket;
+  return uint64_t(1) << (unitMagnitude_ + adjusted);
+}
+
+} // namespace Pistache
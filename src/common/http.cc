@@ -4,12 +4,18 @@
    Http layer implementation
 */
 
+#include <pistache/access_log.h>
 #include <pistache/config.h>
 #include <pistache/http.h>
+#include <pistache/log.h>
+#include <pistache/metrics.h>
 #include <pistache/net.h>
 #include <pistache/peer.h>
+#include <pistache/trace.h>
 #include <pistache/transport.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <iomanip>
@@ -80,6 +86,9 @@ bool writeHeaders(const Header::Collection &headers, DynamicStreamBuf &buf) {
     OUT(os << crlf);
   }
 
+  for (const auto &raw : headers.rawList())
+    OUT(os << raw.second.name() << ": " << raw.second.value() << crlf);
+
   return true;
 
 #undef OUT
@@ -113,6 +122,25 @@ const HttpMethods httpMethods = {
 #undef METHOD
 };
 
+// Attached to the writer of a request: once every copy of the writer and
+// its stream are gone, the request is answered and the next one of the peer
+// can be handed to the handler
+class Answering {
+public:
+  Answering(Tcp::Transport *transport, std::weak_ptr<Tcp::Peer> peer)
+      : transport_(transport), peer_(std::move(peer)) {}
+
+  ~Answering() {
+    auto peer = peer_.lock();
+    if (peer)
+      transport_->resumeInput(peer);
+  }
+
+private:
+  Tcp::Transport *transport_;
+  std::weak_ptr<Tcp::Peer> peer_;
+};
+
 } // namespace
 
 static constexpr const char *ParserData = "__Parser";
@@ -364,7 +392,7 @@ State BodyStep::parseContentLength(
     // We have an incomplete body, read what we can
     if (available < size) {
       cursor.advance(available);
-      message->body_.append(token.rawText(), token.size());
+      consume(token.rawText(), token.size());
 
       bytesRead += available;
 
@@ -372,7 +400,7 @@ State BodyStep::parseContentLength(
     }
 
     cursor.advance(size);
-    message->body_.append(token.rawText(), token.size());
+    consume(token.rawText(), token.size());
     return true;
   };
 
@@ -385,7 +413,8 @@ State BodyStep::parseContentLength(
   }
   // This is the first time we are reading the payload
   else {
-    message->body_.reserve(contentLength);
+    if (!sink)
+      message->body_.reserve(contentLength);
     if (!readBody(contentLength))
       return State::Again;
   }
@@ -394,6 +423,14 @@ State BodyStep::parseContentLength(
   return State::Done;
 }
 
+ssize_t BodyStep::remaining() const {
+  auto cl = message->headers_.tryGet<Header::ContentLength>();
+  if (!cl || message->headers_.has<Header::TransferEncoding>())
+    return -1;
+
+  return static_cast<ssize_t>(cl->value() - bytesRead);
+}
+
 BodyStep::Chunk::Result BodyStep::Chunk::parse(StreamCursor &cursor) {
   if (size == -1) {
     StreamCursor::Revert revert(cursor);
@@ -418,25 +455,30 @@ BodyStep::Chunk::Result BodyStep::Chunk::parse(StreamCursor &cursor) {
     size = sz;
   }
 
+  // Trailers are not supported, the last chunk is followed by an empty line
   if (size == 0)
-    return Final;
+    return cursor.advance(2) ? Final : Incomplete;
 
-  message->body_.reserve(size);
-  StreamCursor::Token chunkData(cursor);
-  const ssize_t available = cursor.remaining();
+  // Chunks are handed over as they arrive, a part of the chunk might have
+  // been consumed by a previous call already
+  const size_t missing = static_cast<size_t>(size) - bytesRead;
+  if (missing > 0) {
+    StreamCursor::Token chunkData(cursor);
+    const size_t available = cursor.remaining();
+    const size_t count = std::min(available, missing);
 
-  if (static_cast<ssize_t>(available + message->body_.size()) < size) {
-    cursor.advance(available);
-    message->body_.append(chunkData.rawText(), available);
-    return Incomplete;
+    cursor.advance(count);
+    step->consume(chunkData.rawText(), count);
+    bytesRead += count;
+
+    if (count < missing)
+      return Incomplete;
   }
-  cursor.advance(size - message->body_.size());
 
+  // CRLF
   if (!cursor.advance(2))
     return Incomplete;
 
-  message->body_.append(chunkData.rawText(), size - message->body_.size());
-
   return Complete;
 }
 
@@ -468,6 +510,14 @@ State BodyStep::parseTransferEncoding(
   return State::Done;
 }
 
+void BodyStep::consume(const char *data, size_t size) {
+  if (sink) {
+    if (size > 0)
+      sink(data, size);
+  } else
+    message->body_.append(data, size);
+}
+
 ParserBase::ParserBase(size_t maxDataSize)
     : buffer(maxDataSize), cursor(&buffer) {}
 
@@ -476,6 +526,8 @@ State ParserBase::parse() {
   do {
     Step *step = allSteps[currentStep].get();
     state = step->apply(cursor);
+    if (state != State::Again)
+      onStepDone(currentStep);
     if (state == State::Next) {
       ++currentStep;
     }
@@ -496,6 +548,41 @@ void ParserBase::reset() {
   currentStep = 0;
 }
 
+bool ParserBase::resetToNext() {
+  const size_t remaining = cursor.remaining();
+  if (remaining == 0) {
+    reset();
+    return false;
+  }
+
+  const std::string pending(cursor.offset(), remaining);
+  reset();
+
+  buffer.feed(pending.data(), pending.size());
+  return true;
+}
+
+void ParserBase::streamBody(BodySink sink) {
+  // The body is always the last step
+  auto *body = static_cast<BodyStep *>(allSteps[StepsCount - 1].get());
+  body->setSink(std::move(sink));
+}
+
+void ParserBase::compact() { buffer.compact(); }
+
+ssize_t ParserBase::bodyRemaining() const {
+  if (currentStep != StepsCount - 1)
+    return -1;
+
+  const auto *body = static_cast<const BodyStep *>(allSteps[currentStep].get());
+  return body->remaining();
+}
+
+void ParserBase::skipBody(size_t size) {
+  auto *body = static_cast<BodyStep *>(allSteps[StepsCount - 1].get());
+  body->skip(size);
+}
+
 } // namespace Private
 
 namespace Uri {
@@ -541,7 +628,7 @@ Version Message::version() const { return version_; }
 
 Code Message::code() const { return code_; }
 
-std::string Message::body() const { return body_; }
+const std::string &Message::body() const { return body_; }
 
 const Header::Collection &Message::headers() const { return headers_; }
 
@@ -551,6 +638,48 @@ const CookieJar &Message::cookies() const { return cookies_; }
 
 CookieJar &Message::cookies() { return cookies_; }
 
+constexpr size_t RequestTimings::PhasesCount;
+
+const char *RequestTimings::phaseName(Phase phase) {
+  switch (phase) {
+  case Phase::Headers:
+    return "headers";
+  case Phase::Body:
+    return "body";
+  case Phase::Dispatch:
+    return "dispatch";
+  case Phase::Handler:
+    return "handler";
+  case Phase::Write:
+    return "write";
+  }
+  return "unknown";
+}
+
+std::chrono::microseconds RequestTimings::duration(Phase phase) const {
+  const Clock::time_point *bounds[PhasesCount + 1] = {
+      &firstByte,    &headersParsed,  &bodyComplete,
+      &handlerStart, &responseQueued, &responseFlushed};
+  const auto &start = *bounds[static_cast<size_t>(phase)];
+  const auto &end = *bounds[static_cast<size_t>(phase) + 1];
+  if (start == Clock::time_point() || end == Clock::time_point())
+    return std::chrono::microseconds(0);
+  return std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+}
+
+std::chrono::microseconds RequestTimings::total() const {
+  if (firstByte == Clock::time_point())
+    return std::chrono::microseconds(0);
+
+  const Clock::time_point last =
+      std::max({headersParsed, bodyComplete, handlerStart, responseQueued,
+                responseFlushed});
+  if (last < firstByte)
+    return std::chrono::microseconds(0);
+  return std::chrono::duration_cast<std::chrono::microseconds>(last -
+                                                               firstByte);
+}
+
 Method Request::method() const { return method_; }
 
 const std::string &Request::resource() const { return resource_; }
@@ -577,7 +706,9 @@ std::shared_ptr<Tcp::Peer> Request::peer() const {
 ResponseStream::ResponseStream(ResponseStream &&other)
     : response_(std::move(other.response_)), peer_(std::move(other.peer_)),
       buf_(std::move(other.buf_)), transport_(other.transport_),
-      timeout_(std::move(other.timeout_)) {}
+      timeout_(std::move(other.timeout_)),
+      attachments_(std::move(other.attachments_)),
+      logEntry_(std::move(other.logEntry_)) {}
 
 ResponseStream::ResponseStream(Message &&other, std::weak_ptr<Tcp::Peer> peer,
                                Tcp::Transport *transport, Timeout timeout,
@@ -614,6 +745,8 @@ ResponseStream &ResponseStream::operator=(ResponseStream &&other) {
   buf_ = std::move(other.buf_);
   transport_ = other.transport_;
   timeout_ = std::move(other.timeout_);
+  attachments_ = std::move(other.attachments_);
+  logEntry_ = std::move(other.logEntry_);
 
   return *this;
 }
@@ -639,7 +772,12 @@ void ResponseStream::flush() {
   auto buf = buf_.buffer();
 
   auto fd = peer()->fd();
-  transport_->asyncWrite(fd, buf);
+  auto write = transport_->asyncWrite(fd, buf);
+  if (logEntry_) {
+    logEntry_->addBytes(static_cast<ssize_t>(buf.size()));
+    auto entry = logEntry_;
+    write.then([entry](ssize_t) {}, [entry](std::exception_ptr) {});
+  }
 
   buf_.clear();
 }
@@ -654,24 +792,35 @@ void ResponseStream::ends() {
   }
 
   flush();
+  attachments_.clear();
+  // Recorded once the last chunk is written
+  logEntry_.reset();
 }
 
 ResponseWriter::ResponseWriter(ResponseWriter &&other)
     : response_(std::move(other.response_)), peer_(other.peer_),
       buf_(std::move(other.buf_)), transport_(other.transport_),
-      timeout_(std::move(other.timeout_)), sent_bytes_(0) {}
+      timeout_(std::move(other.timeout_)), sent_bytes_(0),
+      attachments_(std::move(other.attachments_)),
+      wireObservers_(std::move(other.wireObservers_)),
+      logEntry_(std::move(other.logEntry_)), received_(other.received_),
+      recorded_(other.recorded_) {}
 
 ResponseWriter::ResponseWriter(Tcp::Transport *transport, Request request,
                                Handler *handler, std::weak_ptr<Tcp::Peer> peer)
     : response_(request.version()), peer_(peer),
       buf_(DefaultStreamSize, handler->getMaxResponseSize()),
       transport_(transport),
-      timeout_(transport, handler, std::move(request), peer), sent_bytes_(0) {}
+      timeout_(transport, handler, std::move(request), peer), sent_bytes_(0),
+      received_(std::chrono::steady_clock::now()), recorded_(false) {}
 
 ResponseWriter::ResponseWriter(const ResponseWriter &other)
     : response_(other.response_), peer_(other.peer_),
       buf_(DefaultStreamSize, other.buf_.maxSize()),
-      transport_(other.transport_), timeout_(other.timeout_), sent_bytes_(0) {}
+      transport_(other.transport_), timeout_(other.timeout_), sent_bytes_(0),
+      attachments_(other.attachments_), wireObservers_(other.wireObservers_),
+      logEntry_(other.logEntry_), received_(other.received_),
+      recorded_(other.recorded_) {}
 
 void ResponseWriter::setMime(const Mime::MediaType &mime) {
   auto ct = response_.headers().tryGet<Header::ContentType>();
@@ -722,9 +871,13 @@ Async::Promise<ssize_t> ResponseWriter::sendImpl(Code code, const char *data,
 
 ResponseStream ResponseWriter::stream(Code code, size_t streamSize) {
   response_.code_ = code;
+  recordResponse(code);
 
-  return ResponseStream(std::move(response_), peer_, transport_,
+  ResponseStream stream(std::move(response_), peer_, transport_,
                         std::move(timeout_), streamSize, buf_.maxSize());
+  stream.attachments_ = std::move(attachments_);
+  stream.logEntry_ = std::move(logEntry_);
+  return stream;
 }
 
 const CookieJar &ResponseWriter::cookies() const { return response_.cookies(); }
@@ -756,6 +909,141 @@ DynamicStreamBuf *ResponseWriter::rdbuf(DynamicStreamBuf *other) {
 
 ResponseWriter ResponseWriter::clone() const { return ResponseWriter(*this); }
 
+void ResponseWriter::attach(std::shared_ptr<void> object) {
+  attachments_.push_back(std::move(object));
+}
+
+void ResponseWriter::observeWire(WireObserver observer) {
+  wireObservers_.push_back(std::move(observer));
+}
+
+Async::Promise<ssize_t> ResponseWriter::sendSerialized(Code code,
+                                                       const RawBuffer &wire) {
+  try {
+    response_.code_ = code;
+    countSent(static_cast<ssize_t>(wire.size()));
+
+    timeout_.disarm();
+    recordResponse(code);
+
+    auto fd = peer()->fd();
+    return trackFlush(transport_->asyncWrite(fd, wire));
+  } catch (const std::runtime_error &e) {
+    return Async::Promise<ssize_t>::rejected(e);
+  }
+}
+
+Async::Promise<ssize_t> ResponseWriter::sendPipe(Fd pipe, size_t size) {
+  try {
+    countSent(static_cast<ssize_t>(size));
+
+    auto fd = peer()->fd();
+    return holdLogEntry(transport_->asyncWrite(fd, PipeBuffer(pipe, size)));
+  } catch (const std::runtime_error &e) {
+    return Async::Promise<ssize_t>::rejected(e);
+  }
+}
+
+void ResponseWriter::recordResponse(Code code) {
+  if (recorded_ || !transport_)
+    return;
+  recorded_ = true;
+  timeout_.request.timings_.responseQueued = RequestTimings::Clock::now();
+
+  if (auto *metrics = transport_->metrics())
+    metrics->requestHandled(
+        static_cast<int>(code),
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - received_));
+
+  // Recorded once the response is written, see holdLogEntry()
+  if (const auto &accessLog = transport_->accessLog()) {
+    logEntry_ = std::make_shared<PendingAccessLogEntry>(
+        accessLog, timeout_.request, code, peer_.lock(), received_);
+    logEntry_->addBytes(sent_bytes_);
+  }
+}
+
+void ResponseWriter::countSent(ssize_t bytes) {
+  sent_bytes_ += bytes;
+  if (logEntry_)
+    logEntry_->addBytes(bytes);
+}
+
+Async::Promise<ssize_t>
+ResponseWriter::holdLogEntry(Async::Promise<ssize_t> write) const {
+  if (!logEntry_)
+    return write;
+
+  auto entry = logEntry_;
+  return write.then([entry](ssize_t bytes) { return bytes; }, Async::Throw);
+}
+
+namespace {
+
+void logSlowRequest(const RequestTimings &timings, Method method,
+                    const std::string &resource, const std::string &peer,
+                    std::chrono::milliseconds totalThreshold,
+                    std::chrono::milliseconds phaseThreshold) {
+  const auto total = timings.total();
+  bool slow = totalThreshold.count() > 0 && total >= totalThreshold;
+
+  char breakdown[128];
+  size_t len = 0;
+  for (size_t i = 0; i < RequestTimings::PhasesCount; ++i) {
+    const auto phase = static_cast<RequestTimings::Phase>(i);
+    const auto duration = timings.duration(phase);
+    if (phaseThreshold.count() > 0 && duration >= phaseThreshold)
+      slow = true;
+
+    const int res = std::snprintf(
+        breakdown + len, sizeof(breakdown) - len, "%s%s=%.3fms",
+        i == 0 ? "" : " ", RequestTimings::phaseName(phase),
+        static_cast<double>(duration.count()) / 1000.0);
+    if (res > 0)
+      len = std::min(sizeof(breakdown) - 1, len + static_cast<size_t>(res));
+  }
+
+  if (slow)
+    PISTACHE_LOG_WARN("Slow request %s %s from %s: %.3fms (%s)",
+                      methodString(method), resource.c_str(), peer.c_str(),
+                      static_cast<double>(total.count()) / 1000.0, breakdown);
+}
+
+} // namespace
+
+Async::Promise<ssize_t>
+ResponseWriter::trackFlush(Async::Promise<ssize_t> write) {
+  write = holdLogEntry(std::move(write));
+
+  const auto *handler = timeout_.handler;
+  if (!handler)
+    return write;
+
+  const auto totalThreshold = handler->getSlowRequestThreshold();
+  const auto phaseThreshold = handler->getSlowPhaseThreshold();
+  if (totalThreshold.count() == 0 && phaseThreshold.count() == 0)
+    return write;
+
+  // Copied, the writer is usually gone by the time the write completes
+  const auto &request = timeout_.request;
+  const auto queued = request.timings();
+  const auto method = request.method();
+  const auto resource = request.resource();
+  const auto peer = peer_.lock();
+  const auto host = peer ? peer->address().host() : std::string();
+
+  return write.then(
+      [=](ssize_t bytes) {
+        auto timings = queued;
+        timings.responseFlushed = RequestTimings::Clock::now();
+        logSlowRequest(timings, method, resource, host, totalThreshold,
+                       phaseThreshold);
+        return bytes;
+      },
+      Async::Throw);
+}
+
 Async::Promise<ssize_t> ResponseWriter::putOnWire(const char *data,
                                                   size_t len) {
   try {
@@ -789,17 +1077,23 @@ Async::Promise<ssize_t> ResponseWriter::putOnWire(const char *data,
     }
 
     auto buffer = buf_.buffer();
-    sent_bytes_ += buffer.size();
+    countSent(static_cast<ssize_t>(buffer.size()));
 
     timeout_.disarm();
+    recordResponse(response_.code());
+
+    for (const auto &observer : wireObservers_)
+      observer(response_, buffer);
 
 #undef OUT
 
     auto fd = peer()->fd();
+    auto write = trackFlush(transport_->asyncWrite(fd, buffer));
+    // The response is complete, its entry is left to the write
+    logEntry_.reset();
 
-    return transport_->asyncWrite(fd, buffer)
-        .then<std::function<Async::Promise<ssize_t>(int)>,
-              std::function<void(std::exception_ptr &)>>(
+    return write.then<std::function<Async::Promise<ssize_t>(int)>,
+                      std::function<void(std::exception_ptr &)>>(
             [=](int /*l*/) {
               return Async::Promise<ssize_t>([=](
                   Async::Deferred<ssize_t> /*deferred*/) mutable { return; });
@@ -884,18 +1178,25 @@ Async::Promise<ssize_t> serveFile(ResponseWriter &writer,
   auto sockFd = peer->fd();
 
   auto buffer = buf->buffer();
-  return transport->asyncWrite(sockFd, buffer, MSG_MORE)
-      .then(
-          [=](ssize_t) {
-            return transport->asyncWrite(sockFd, FileBuffer(fileName));
-          },
-          Async::Throw);
+  writer.countSent(static_cast<ssize_t>(buffer.size() + len));
+  writer.recordResponse(Http::Code::Ok);
+
+  auto write = writer.trackFlush(
+      transport->asyncWrite(sockFd, buffer, MSG_MORE)
+          .then(
+              [=](ssize_t) {
+                return transport->asyncWrite(sockFd, FileBuffer(fileName));
+              },
+              Async::Throw));
+  writer.logEntry_.reset();
+  return write;
 
 #undef OUT
 }
 
 Private::ParserImpl<Http::Request>::ParserImpl(size_t maxDataSize)
-    : ParserBase(maxDataSize), request() {
+    : ParserBase(maxDataSize), request(), peerFd(-1), answering(false),
+      dispatching(false) {
   allSteps[0].reset(new RequestLineStep(&request));
   allSteps[1].reset(new HeadersStep(&request));
   allSteps[2].reset(new BodyStep(&request));
@@ -907,6 +1208,17 @@ void Private::ParserImpl<Http::Request>::reset() {
   request = Request();
 }
 
+void Private::ParserImpl<Http::Request>::onStepDone(size_t step) {
+  if (step == 0) {
+    Trace::requestLineParsed(peerFd, request.method(), request.resource());
+  } else if (step == 1) {
+    request.timings_.headersParsed = RequestTimings::Clock::now();
+    Trace::headersComplete(peerFd);
+  } else {
+    request.timings_.bodyComplete = RequestTimings::Clock::now();
+  }
+}
+
 Private::ParserImpl<Http::Response>::ParserImpl(size_t maxDataSize)
     : ParserBase(maxDataSize), response() {
   allSteps[0].reset(new ResponseLineStep(&response));
@@ -917,17 +1229,50 @@ Private::ParserImpl<Http::Response>::ParserImpl(size_t maxDataSize)
 void Handler::onInput(const char *buffer, size_t len,
                       const std::shared_ptr<Tcp::Peer> &peer) {
   auto &parser = getParser(peer);
-  try {
-    if (!parser.feed(buffer, len)) {
-      parser.reset();
-      throw HttpError(Code::Request_Entity_Too_Large,
-                      "Request exceeded maximum buffer size");
-    }
+  const auto received = RequestTimings::Clock::now();
+  auto &firstByte = parser.request.timings_.firstByte;
+  if (firstByte == RequestTimings::Clock::time_point())
+    firstByte = received;
+
+  if (!parser.feed(buffer, len)) {
+    parser.reset();
+    countParseError();
+    ResponseWriter response(transport(), parser.request, this, peer);
+    response.send(Code::Request_Entity_Too_Large,
+                  "Request exceeded maximum buffer size");
+    return;
+  }
+
+  // Pipelined requests wait for the response to the previous one
+  if (!parser.answering)
+    dispatchRequests(parser, peer, received);
+}
+
+void Handler::onResume(const std::shared_ptr<Tcp::Peer> &peer) {
+  auto &parser = getParser(peer);
+  parser.answering = false;
+
+  // Answered before the handler returned, the loop goes on by itself
+  if (parser.dispatching)
+    return;
 
-    auto state = parser.parse();
-      
-    if (state == Private::State::Done) {
+  if (parser.request.timings_.firstByte != RequestTimings::Clock::time_point())
+    dispatchRequests(parser, peer, RequestTimings::Clock::now());
+}
+
+void Handler::dispatchRequests(RequestParser &parser,
+                               const std::shared_ptr<Tcp::Peer> &peer,
+                               RequestTimings::Clock::time_point received) {
+  // Failures of the parser, rather than of the handling of a request
+  bool parsing = true;
+  parser.dispatching = true;
+  try {
+    // Several requests might have been pipelined in the same packet
+    while (!parser.answering && parser.parse() == Private::State::Done) {
+      parser.request.timings_.handlerStart = RequestTimings::Clock::now();
       ResponseWriter response(transport(), parser.request, this, peer);
+      parser.answering = true;
+      response.attach(std::make_shared<Answering>(transport(), peer));
 
 #ifdef LIBSTDCPP_SMARTPTR_LOCK_FIXME
       parser.request.associatePeer(peer);
@@ -944,25 +1289,45 @@ void Handler::onInput(const char *buffer, size_t len,
         response.headers().add<Header::Connection>(ConnectionControl::Close);
       }
 
+      parsing = false;
+      Trace::handlerInvoked(peer->fd());
       onRequest(request, std::move(response));
-      parser.reset();
+      Trace::handlerReturned(peer->fd());
+      parsing = true;
+      if (!parser.resetToNext())
+        break;
+      // Pipelined, its first bytes came with those of the previous request
+      parser.request.timings_.firstByte = received;
     }
 
   } catch (const HttpError &err) {
+    if (parsing)
+      countParseError();
     ResponseWriter response(transport(), parser.request, this, peer);
     response.send(static_cast<Code>(err.code()), err.reason());
     parser.reset();
   }
 
   catch (const std::exception &e) {
+    if (parsing)
+      countParseError();
     ResponseWriter response(transport(), parser.request, this, peer);
     response.send(Code::Internal_Server_Error, e.what());
     parser.reset();
   }
+  parser.dispatching = false;
+}
+
+void Handler::countParseError() {
+  auto *metrics = transport()->metrics();
+  if (metrics)
+    metrics->parseError();
 }
 
 void Handler::onConnection(const std::shared_ptr<Tcp::Peer> &peer) {
-  peer->putData(ParserData, std::make_shared<RequestParser>(maxRequestSize_));
+  auto parser = std::make_shared<RequestParser>(maxRequestSize_);
+  parser->peerFd = peer->fd();
+  peer->putData(ParserData, std::move(parser));
 }
 
 void Handler::onDisconnection(const std::shared_ptr<Tcp::Peer> & /*peer*/) {}
@@ -1003,6 +1368,22 @@ void Handler::setMaxResponseSize(size_t value) { maxResponseSize_ = value; }
 
 size_t Handler::getMaxResponseSize() const { return maxResponseSize_; }
 
+void Handler::setSlowRequestThreshold(std::chrono::milliseconds value) {
+  slowRequestThreshold_ = value;
+}
+
+std::chrono::milliseconds Handler::getSlowRequestThreshold() const {
+  return slowRequestThreshold_;
+}
+
+void Handler::setSlowPhaseThreshold(std::chrono::milliseconds value) {
+  slowPhaseThreshold_ = value;
+}
+
+std::chrono::milliseconds Handler::getSlowPhaseThreshold() const {
+  return slowPhaseThreshold_;
+}
+
 RequestParser &
 Handler::getParser(const std::shared_ptr<Tcp::Peer> &peer) const {
   return static_cast<RequestParser &>(*peer->getData(ParserData));
@@ -11,6 +11,7 @@
 #include <pistache/http_header.h>
 #include <pistache/stream.h>
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <iterator>
@@ -253,6 +254,23 @@ void Connection::parseRaw(const char *str, size_t len) {
   } else {
     control_ = ConnectionControl::Ext;
   }
+
+  options_.clear();
+  const std::string value(str, len);
+  size_t begin = 0;
+  while (begin <= value.size()) {
+    auto end = value.find(',', begin);
+    if (end == std::string::npos)
+      end = value.size();
+
+    const auto first = value.find_first_not_of(" \t", begin);
+    if (first != std::string::npos && first < end) {
+      const auto last = value.find_last_not_of(" \t", end - 1);
+      options_.push_back(value.substr(first, last - first + 1));
+    }
+
+    begin = end + 1;
+  }
 }
 
 void Connection::write(std::ostream &os) const {
@@ -459,10 +477,54 @@ void Location::parse(const std::string &data) { location_ = data; }
 
 void Location::write(std::ostream &os) const { os << location_; }
 
+void RetryAfter::parse(const std::string &data) {
+  char *end;
+  const auto value = std::strtoll(data.c_str(), &end, 10);
+  if (end == data.c_str() || *end != '\0' || value < 0) {
+    delay_ = std::chrono::seconds(0);
+    return;
+  }
+
+  delay_ = std::chrono::seconds(value);
+}
+
+void RetryAfter::write(std::ostream &os) const { os << delay_.count(); }
+
 void UserAgent::parse(const std::string &data) { ua_ = data; }
 
 void UserAgent::write(std::ostream &os) const { os << ua_; }
 
+void Vary::parse(const std::string &data) {
+  fields_.clear();
+
+  size_t pos = 0;
+  while (pos <= data.size()) {
+    auto end = data.find(',', pos);
+    if (end == std::string::npos)
+      end = data.size();
+
+    auto first = data.find_first_not_of(" \t", pos);
+    if (first != std::string::npos && first < end) {
+      auto last = data.find_last_not_of(" \t", end - 1);
+      fields_.push_back(data.substr(first, last - first + 1));
+    }
+
+    pos = end + 1;
+  }
+}
+
+void Vary::write(std::ostream &os) const {
+  for (std::vector<std::string>::size_type i = 0; i < fields_.size(); ++i) {
+    os << fields_[i];
+    if (i < fields_.size() - 1)
+      os << ", ";
+  }
+}
+
+bool Vary::varyOnAll() const {
+  return std::find(fields_.begin(), fields_.end(), "*") != fields_.end();
+}
+
 void Accept::parseRaw(const char *str, size_t len) {
 
   RawStreamBuf<char> buf(const_cast<char *>(str), len);
@@ -32,8 +32,10 @@ RegisterHeader(Date);
 RegisterHeader(Expect);
 RegisterHeader(Host);
 RegisterHeader(Location);
+RegisterHeader(RetryAfter);
 RegisterHeader(Server);
 RegisterHeader(UserAgent);
+RegisterHeader(Vary);
 
 std::string toLowercase(std::string str) {
   std::transform(str.begin(), str.end(), str.begin(), ::tolower);
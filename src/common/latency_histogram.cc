@@ -0,0 +1,85 @@
+/* latency_histogram.cc
+
+   Implementation of the log-linear histogram
+*/
+
+#include <pistache/latency_histogram.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace Pistache {
+namespace Metrics {
+
+LatencyHistogram::Counts::Counts() : buckets(), count(0), sum(0) {}
+
+LatencyHistogram::Counts &LatencyHistogram::Counts::
+operator+=(const Counts &other) {
+  for (size_t i = 0; i < Buckets; ++i)
+    buckets[i] += other.buckets[i];
+  count += other.count;
+  sum += other.sum;
+  return *this;
+}
+
+uint64_t LatencyHistogram::Counts::valueAtPercentile(double percentile) const {
+  if (count == 0)
+    return 0;
+
+  percentile = std::min(std::max(percentile, 0.0), 100.0);
+  const auto target = std::max<uint64_t>(
+      static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count) +
+                            0.5),
+      1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < Buckets - 1; ++i) {
+    seen += buckets[i];
+    if (seen >= target)
+      return upperBound(i);
+  }
+
+  return upperBound(Buckets - 1);
+}
+
+LatencyHistogram::LatencyHistogram() : LatencyHistogram(0) {}
+
+LatencyHistogram::LatencyHistogram(uint64_t decayWindow)
+    : buckets_(), sum_(0), decayWindow_(decayWindow), records_(0) {
+  for (auto &bucket : buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::decay() {
+  // Records racing with it are merely halved along, or not
+  for (auto &bucket : buckets_)
+    bucket.fetch_sub(bucket.load(std::memory_order_relaxed) / 2,
+                     std::memory_order_relaxed);
+  sum_.fetch_sub(sum_.load(std::memory_order_relaxed) / 2,
+                 std::memory_order_relaxed);
+}
+
+LatencyHistogram::Counts LatencyHistogram::counts() const {
+  Counts res;
+  for (size_t i = 0; i < Buckets; ++i) {
+    res.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    res.count += res.buckets[i];
+  }
+  res.sum = sum_.load(std::memory_order_relaxed);
+  return res;
+}
+
+uint64_t LatencyHistogram::upperBound(size_t bucket) {
+  if (bucket == 0)
+    return 1;
+  if (bucket >= Buckets - 1)
+    return std::numeric_limits<uint64_t>::max();
+
+  uint64_t value = (bucket - 1) % 9 + 2;
+  for (size_t decade = (bucket - 1) / 9; decade > 0; --decade)
+    value *= 10;
+  return value;
+}
+
+} // namespace Metrics
+} // namespace Pistache
@@ -0,0 +1,297 @@
+/* log.cc
+
+   Implementation of the logging of the library
+*/
+
+#include <pistache/log.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace Pistache {
+namespace Log {
+
+namespace detail {
+std::atomic<int> runtimeLevel(PISTACHE_LOG_LEVEL);
+}
+
+namespace {
+
+// Written by a single thread, read by whoever drains it under the lock of
+// the logger
+struct Ring {
+  explicit Ring(uint32_t thread)
+      : thread(thread), head(0), tail(0), exited(false), slots() {}
+
+  const uint32_t thread;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+  std::atomic<bool> exited;
+  std::array<Record, RingCapacity> slots;
+};
+
+class Logger {
+public:
+  Logger()
+      : mutex_(), rings_(), sink_(std::make_shared<FdSink>(STDERR_FILENO)),
+        dropped_(0), nextThread_(1),
+        drainThread_(mutex_, std::chrono::milliseconds(10),
+                     [this] { drainLocked(); }) {}
+
+  std::shared_ptr<Ring> registerThread() {
+    auto ring = std::make_shared<Ring>(nextThread_.fetch_add(1));
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    rings_.push_back(ring);
+    if (drainThread_.start())
+      std::atexit([] { instance().stop(); });
+    return ring;
+  }
+
+  void setSink(std::shared_ptr<Sink> sink) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    drainLocked();
+    sink_ = std::move(sink);
+  }
+
+  void drain() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    drainLocked();
+  }
+
+  // The rings are drained every 10 milliseconds, or as soon as one of them
+  // is half full
+  void wake() { drainThread_.wake(); }
+
+  void drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  bool stopped() const { return drainThread_.stopped(); }
+
+  static Logger &instance() {
+    // Leaked: threads may still log while static objects are destroyed
+    static Logger *logger = new Logger();
+    return *logger;
+  }
+
+private:
+  void stop() {
+    drainThread_.stop();
+    drain();
+  }
+
+  void drainLocked() {
+    bool written = false;
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      auto &ring = **it;
+      const bool exited = ring.exited.load(std::memory_order_acquire);
+
+      auto tail = ring.tail.load(std::memory_order_relaxed);
+      const auto head = ring.head.load(std::memory_order_acquire);
+      for (; tail != head; ++tail) {
+        if (sink_)
+          sink_->write(ring.slots[tail % RingCapacity]);
+        ring.tail.store(tail + 1, std::memory_order_release);
+        written = true;
+      }
+
+      if (exited)
+        it = rings_.erase(it);
+      else
+        ++it;
+    }
+
+    if (written && sink_)
+      sink_->flush();
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<std::shared_ptr<Ring>> rings_;
+  std::shared_ptr<Sink> sink_;
+
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint32_t> nextThread_;
+
+  DrainThread drainThread_;
+};
+
+// Registers the ring of the thread on its first record, and lets the logger
+// forget it once the thread exited and its last records were drained
+struct ThreadRing {
+  ThreadRing() : ring(Logger::instance().registerThread()) {}
+  ~ThreadRing() { ring->exited.store(true, std::memory_order_release); }
+
+  std::shared_ptr<Ring> ring;
+};
+
+const char *baseName(const char *file) {
+  const char *slash = std::strrchr(file, '/');
+  return slash ? slash + 1 : file;
+}
+
+} // namespace
+
+const char *levelName(Level level) {
+  switch (level) {
+  case Level::Trace:
+    return "TRACE";
+  case Level::Debug:
+    return "DEBUG";
+  case Level::Info:
+    return "INFO";
+  case Level::Warn:
+    return "WARN";
+  case Level::Error:
+    return "ERROR";
+  case Level::Off:
+    return "OFF";
+  }
+  return "UNKNOWN";
+}
+
+FdSink::FdSink(int fd) : fd_(fd), buffer_() {}
+
+void FdSink::write(const Record &record) {
+  appendTime(buffer_, record.time);
+
+  char prefix[96];
+  std::snprintf(prefix, sizeof(prefix), " %s [%u] %s:%d ",
+                levelName(record.level), record.thread, baseName(record.file),
+                record.line);
+
+  buffer_ += prefix;
+  buffer_ += record.message;
+  buffer_ += '\n';
+}
+
+void FdSink::flush() {
+  const char *data = buffer_.data();
+  size_t remaining = buffer_.size();
+  while (remaining > 0) {
+    const ssize_t written = ::write(fd_, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    data += written;
+    remaining -= static_cast<size_t>(written);
+  }
+  buffer_.clear();
+}
+
+void appendTime(std::string &out, std::chrono::system_clock::time_point time) {
+  const auto seconds = std::chrono::system_clock::to_time_t(time);
+  const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                          time.time_since_epoch())
+                          .count() %
+                      1000000;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+
+  char buf[64];
+  const size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+  std::snprintf(buf + len, sizeof(buf) - len, ".%06lldZ",
+                static_cast<long long>(micros));
+  out += buf;
+}
+
+DrainThread::DrainThread(std::mutex &mutex, std::chrono::milliseconds interval,
+                         std::function<void()> drainLocked)
+    : mutex_(mutex), interval_(interval), drainLocked_(std::move(drainLocked)),
+      wake_(), stopping_(false), started_(false), thread_() {}
+
+DrainThread::~DrainThread() { stop(); }
+
+bool DrainThread::start() {
+  if (started_ || stopping_.load(std::memory_order_relaxed))
+    return false;
+
+  started_ = true;
+  thread_ = std::thread([this] { run(); });
+  return true;
+}
+
+void DrainThread::stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_.store(true, std::memory_order_relaxed);
+  }
+  wake_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void DrainThread::run() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  while (!stopping_.load(std::memory_order_relaxed)) {
+    wake_.wait_for(guard, interval_);
+    drainLocked_();
+  }
+}
+
+void setLevel(Level level) {
+  detail::runtimeLevel.store(static_cast<int>(level),
+                             std::memory_order_relaxed);
+}
+
+Level level() {
+  return static_cast<Level>(
+      detail::runtimeLevel.load(std::memory_order_relaxed));
+}
+
+void setSink(std::shared_ptr<Sink> sink) {
+  Logger::instance().setSink(std::move(sink));
+}
+
+void flush() { Logger::instance().drain(); }
+
+uint64_t dropped() { return Logger::instance().dropped(); }
+
+void write(Level level, const char *file, int line, const char *format, ...) {
+  thread_local ThreadRing local;
+  auto &ring = *local.ring;
+  auto &logger = Logger::instance();
+
+  const auto head = ring.head.load(std::memory_order_relaxed);
+  const auto used = head - ring.tail.load(std::memory_order_acquire);
+  if (used >= RingCapacity) {
+    logger.drop();
+    return;
+  }
+
+  auto &record = ring.slots[head % RingCapacity];
+  record.level = level;
+  record.time = std::chrono::system_clock::now();
+  record.thread = ring.thread;
+  record.file = file;
+  record.line = line;
+
+  va_list args;
+  va_start(args, format);
+  std::vsnprintf(record.message, sizeof(record.message), format, args);
+  va_end(args);
+
+  ring.head.store(head + 1, std::memory_order_release);
+
+  if (used + 1 == RingCapacity / 2)
+    logger.wake();
+  // Nothing drains the rings anymore once the process is exiting
+  if (logger.stopped())
+    logger.drain();
+}
+
+} // namespace Log
+} // namespace Pistache
@@ -0,0 +1,73 @@
+/* loop_stats.cc
+
+   Implementation of the statistics of an event loop
+*/
+
+#include <pistache/loop_stats.h>
+
+namespace Pistache {
+namespace Aio {
+
+namespace {
+std::chrono::microseconds micros(uint64_t nanos) {
+  return std::chrono::microseconds(static_cast<int64_t>(nanos / 1000));
+}
+} // namespace
+
+LoopStats::Snapshot::Snapshot()
+    : busy(0), idle(0), currentBusy(0), wakeups(0), events(0),
+      longestCallback(0), eventsPerWakeup(), callbacks(), queueLag() {}
+
+double LoopStats::Snapshot::utilization() const {
+  const auto total = busy + idle;
+  if (total.count() == 0)
+    return 0.0;
+  return static_cast<double>(busy.count()) /
+         static_cast<double>(total.count());
+}
+
+double LoopStats::Snapshot::utilizationSince(const Snapshot &older) const {
+  const auto busyDelta = busy - older.busy;
+  const auto total = busyDelta + (idle - older.idle);
+  if (total.count() <= 0)
+    return 0.0;
+  return static_cast<double>(busyDelta.count()) /
+         static_cast<double>(total.count());
+}
+
+LoopStats::LoopStats()
+    : phase_(0), busy_(0), idle_(0), wakeups_(0), events_(0),
+      longestCallback_(0), eventsPerWakeup_(), callbacks_(), queueLag_() {}
+
+LoopStats::Snapshot LoopStats::snapshot() const {
+  Snapshot res;
+
+  const auto phase = unpack(phase_.load(std::memory_order_relaxed));
+  uint64_t busy = busy_.load(std::memory_order_relaxed);
+  uint64_t idle = idle_.load(std::memory_order_relaxed);
+
+  // The phase in progress has not been accounted for yet
+  if (phase.since != 0) {
+    const auto current = elapsed(phase.since, Clock::now());
+    if (phase.busy) {
+      busy += current;
+      res.currentBusy = micros(current);
+    } else {
+      idle += current;
+    }
+  }
+
+  res.busy = micros(busy);
+  res.idle = micros(idle);
+  res.wakeups = wakeups_.load(std::memory_order_relaxed);
+  res.events = events_.load(std::memory_order_relaxed);
+  res.longestCallback = std::chrono::microseconds(
+      static_cast<int64_t>(longestCallback_.load(std::memory_order_relaxed)));
+  res.eventsPerWakeup = eventsPerWakeup_.counts();
+  res.callbacks = callbacks_.counts();
+  res.queueLag = queueLag_.counts();
+  return res;
+}
+
+} // namespace Aio
+} // namespace Pistache
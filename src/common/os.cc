@@ -126,7 +126,7 @@ cpu_set_t CpuSet::toPosix() const {
 
 #ifdef __MACH__
 //#include <pistache/polling_compat.h>
-    #include <stdio.h> // YOSHI REMOVE
+    #include <stdio.h>
     #include <sys/stat.h>
 namespace Polling {
         
@@ -135,8 +135,6 @@ namespace Polling {
         int rc = fstat(fd, &s);
         if (rc == -1) perror("fstat");
         
-        std::cout << "add " << (s.st_mode & S_IFSOCK ? 3 : 1) << " events" << std::endl;
-        
         return s.st_mode & S_IFSOCK ? 2 : 1;
     }
 
@@ -154,8 +152,6 @@ namespace Polling {
     }
     
     void Epoll::addFd(Fd fd, Flags<NotifyOn> interest, Tag tag, Mode mode, uint16_t initialFlags) {
-        std::cout << "addFd fd=" << fd << " to kq=" << poll_id << " with value = " << tag.value_ << std::endl;  // YOSHI
-        
         // event.filter does not contain bit fields.
         // They have numeric identifiers. (-1, -2, etc.)
         // Hence, we need to create one event for each flag that there is.
@@ -400,13 +396,10 @@ void NotifyFd::notify() const {
   if (!isBound())
     throw std::runtime_error("Can not notify an unbound fd");
   EventValue val = 1;
-    
-    std::cout << "notify() from os.cc" << std::endl; // YOSHI
   TRY(event_notify(event_id, val));
 }
 
 void NotifyFd::read() const {
-    std::cout << "read() from os.cc" << std::endl; // YOSHI
   if (!isBound())
     throw std::runtime_error("Can not read an unbound fd");
   EventValue val;
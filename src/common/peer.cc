@@ -8,6 +8,8 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -76,7 +78,6 @@ int Peer::fd() const {
 }
 
 void Peer::putData(std::string name, std::shared_ptr<Http::Parser> data) {
-    std::cout << "putData(name=" << name << ")" << std::endl; // YOSHI
   auto it = data_.find(name);
   if (it != std::end(data_)) {
     throw std::runtime_error("The data already exists");
@@ -106,6 +107,35 @@ Async::Promise<ssize_t> Peer::send(const RawBuffer &buffer, int flags) {
   return transport()->asyncWrite(fd_, buffer, flags);
 }
 
+TcpInfo Peer::tcpInfo() const {
+  std::lock_guard<std::mutex> guard(tcpInfoMutex_);
+  return tcpInfo_;
+}
+
+bool Peer::sampleTcpInfo() {
+#ifdef TCP_INFO
+  struct tcp_info info;
+  socklen_t len = sizeof(info);
+  if (fd_ == -1 ||
+      ::getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+    return false;
+
+  TcpInfo res;
+  res.rtt = std::chrono::microseconds(info.tcpi_rtt);
+  res.rttVariance = std::chrono::microseconds(info.tcpi_rttvar);
+  res.retransmits = info.tcpi_total_retrans;
+  res.cwnd = info.tcpi_snd_cwnd;
+  res.unacked = info.tcpi_unacked;
+  res.sampled = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> guard(tcpInfoMutex_);
+  tcpInfo_ = res;
+  return true;
+#else
+  return false;
+#endif /* TCP_INFO */
+}
+
 std::ostream &operator<<(std::ostream &os, Peer &peer) {
   const auto &addr = peer.address();
   os << "(" << addr.host() << ", " << addr.port() << ") [" << peer.hostname()
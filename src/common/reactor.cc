@@ -12,10 +12,11 @@
 
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <climits>
 #include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 using namespace std::string_literals;
@@ -50,6 +51,8 @@ public:
   virtual void runOnce() = 0;
   virtual void run() = 0;
 
+  virtual std::vector<LoopStats::Snapshot> loopStats() const = 0;
+
   virtual void shutdown() = 0;
 
   Reactor *reactor_;
@@ -57,26 +60,51 @@ public:
 
 /* Synchronous implementation of the reactor that polls in the context
  * of the same thread
+ *
+ * The first handler shares the poller of the reactor. Every other handler
+ * gets a poller of its own, which is itself registered on the one of the
+ * reactor: the fds the handlers bind themselves, such as their queues, are
+ * then told apart without the handlers having to know about the encoding of
+ * the tags. Handlers can be added while the reactor is running.
  */
 class SyncImpl : public Reactor::Impl {
 public:
   explicit SyncImpl(Reactor *reactor)
-      : Reactor::Impl(reactor), handlers_(), shutdown_(), shutdownFd(),
-        poller() {
+      : Reactor::Impl(reactor), handlers_(), pollers_(), handlersLock_(),
+        runner_(), shutdown_(), shutdownFd(), poller(), stats_() {
     shutdownFd.bind(poller);
   }
 
   Reactor::Key addHandler(const std::shared_ptr<Handler> &handler,
                           bool setKey = true) override {
+    std::lock_guard<std::mutex> guard(handlersLock_);
+
+    const size_t index = handlers_.size();
+    if (index == MaxHandlers())
+      throw std::runtime_error("Maximum handlers reached");
 
-    handler->registerPoller(poller);
+    if (index == 0) {
+      handler->registerPoller(poller);
+    } else {
+      pollers_.at(index) = std::make_unique<Polling::Epoll>();
+      handler->registerPoller(*pollers_.at(index));
+    }
 
     handler->reactor_ = reactor_;
+    handler->context_.tid = runner_;
+    handler->loopStats_ = &stats_;
 
     auto key = handlers_.add(handler);
     if (setKey)
       handler->key_ = key;
 
+    // Only once the handler can be found from the events of its poller
+    if (index > 0) {
+      const Fd fd = pollers_.at(index)->fd();
+      poller.addFd(fd, Flags<Polling::NotifyOn>(Polling::NotifyOn::Read),
+                   encodeTag(key, Polling::Tag(fd)));
+    }
+
     return key;
   }
 
@@ -96,24 +124,22 @@ public:
                   Polling::Tag tag,
                   Polling::Mode mode = Polling::Mode::Level) override {
 
-    auto pollTag = encodeTag(key, tag);
-    poller.addFd(fd, Flags<Polling::NotifyOn>(interest), pollTag, mode);
+    pollerOf(key).addFd(fd, Flags<Polling::NotifyOn>(interest), tag, mode);
   }
 
   void registerFdOneShot(const Reactor::Key &key, Fd fd,
                          Polling::NotifyOn interest, Polling::Tag tag,
                          Polling::Mode mode = Polling::Mode::Level) override {
 
-    auto pollTag = encodeTag(key, tag);
-    poller.addFdOneShot(fd, Flags<Polling::NotifyOn>(interest), pollTag, mode);
+    pollerOf(key).addFdOneShot(fd, Flags<Polling::NotifyOn>(interest), tag,
+                               mode);
   }
 
   void modifyFd(const Reactor::Key &key, Fd fd, Polling::NotifyOn interest,
                 Polling::Tag tag,
                 Polling::Mode mode = Polling::Mode::Level) override {
 
-    auto pollTag = encodeTag(key, tag);
-    poller.rearmFd(fd, Flags<Polling::NotifyOn>(interest), pollTag, mode);
+    pollerOf(key).rearmFd(fd, Flags<Polling::NotifyOn>(interest), tag, mode);
   }
 
   void runOnce() override {
@@ -122,6 +148,7 @@ public:
 
     for (;;) {
       std::vector<Polling::Event> events;
+      stats_.polling(LoopStats::Clock::now());
       int ready_fds = poller.poll(events);
       switch (ready_fds) {
       case -1:
@@ -132,15 +159,20 @@ public:
         if (shutdown_)
           return;
 
+        stats_.woken(LoopStats::Clock::now(), events.size());
         handleFds(std::move(events));
       }
     }
   }
 
   void run() override {
-    handlers_.forEachHandler([](const std::shared_ptr<Handler> handler) {
-      handler->context_.tid = std::this_thread::get_id();
-    });
+    {
+      std::lock_guard<std::mutex> guard(handlersLock_);
+      runner_ = std::this_thread::get_id();
+      handlers_.forEachHandler([](const std::shared_ptr<Handler> handler) {
+        handler->context_.tid = std::this_thread::get_id();
+      });
+    }
 
     while (!shutdown_)
       runOnce();
@@ -151,6 +183,10 @@ public:
     shutdownFd.notify();
   }
 
+  std::vector<LoopStats::Snapshot> loopStats() const override {
+    return {stats_.snapshot()};
+  }
+
   static constexpr size_t MaxHandlers() { return HandlerList::MaxHandlers; }
 
 private:
@@ -163,27 +199,48 @@ private:
     return HandlerList::decodeTag(tag);
   }
 
-  void handleFds(std::vector<Polling::Event> events) const {
+  Polling::Epoll &pollerOf(const Reactor::Key &key) {
+    const auto index = key.data();
+    return index == 0 ? poller : *pollers_.at(index);
+  }
+
+  // Times the callbacks of the handlers, which must not block the loop
+  void dispatch(const std::shared_ptr<Handler> &handler,
+                std::vector<Polling::Event> events) {
+    const auto start = LoopStats::Clock::now();
+    handler->onReady(FdSet(std::move(events)));
+    stats_.callback(std::chrono::duration_cast<std::chrono::microseconds>(
+        LoopStats::Clock::now() - start));
+  }
+
+  void handleFds(std::vector<Polling::Event> events) {
     // Fast-path: if we only have one handler, do not bother scanning the fds to
     // find the right handlers
     if (handlers_.size() == 1)
-      handlers_.at(0)->onReady(FdSet(std::move(events)));
+      dispatch(handlers_.at(0), std::move(events));
     else {
-      std::unordered_map<std::shared_ptr<Handler>, std::vector<Polling::Event>>
-          fdHandlers;
+      std::vector<Polling::Event> first;
+      std::vector<size_t> ready;
 
       for (auto &event : events) {
         size_t index;
         uint64_t value;
 
         std::tie(index, value) = decodeTag(event.tag);
-        auto handler_ = handlers_.at(index);
-        auto &evs = fdHandlers.at(handler_);
-        evs.push_back(std::move(event));
+        if (index == 0)
+          first.push_back(std::move(event));
+        else
+          ready.push_back(index);
       }
 
-      for (auto &data : fdHandlers) {
-        data.first->onReady(FdSet(std::move(data.second)));
+      if (!first.empty())
+        dispatch(handlers_.at(0), std::move(first));
+
+      // The poller of the handler is readable, it does not block
+      for (auto index : ready) {
+        std::vector<Polling::Event> evs;
+        if (pollers_.at(index)->poll(evs, std::chrono::milliseconds(0)) > 0)
+          dispatch(handlers_.at(index), std::move(evs));
       }
     }
   }
@@ -193,40 +250,50 @@ private:
     // We are using the highest 8 bits of the fd to encode the index of the
     // handler, which gives us a maximum of 2**8 - 1 handler, 255
     static constexpr size_t HandlerBits = 8;
-    static constexpr size_t HandlerShift = sizeof(uint64_t) - HandlerBits;
+    static constexpr size_t HandlerShift =
+        sizeof(uint64_t) * CHAR_BIT - HandlerBits;
     static constexpr uint64_t DataMask = uint64_t(-1) >> HandlerBits;
 
     static constexpr size_t MaxHandlers = (1 << HandlerBits) - 1;
 
-    HandlerList() : handlers(), index_() {
+    HandlerList() : handlers(), index_(0) {
       std::fill(std::begin(handlers), std::end(handlers), nullptr);
     }
 
     HandlerList(const HandlerList &other) = delete;
     HandlerList &operator=(const HandlerList &other) = delete;
 
-    HandlerList(HandlerList &&other) = default;
-    HandlerList &operator=(HandlerList &&other) = default;
+    HandlerList(HandlerList &&other)
+        : handlers(std::move(other.handlers)), index_(other.index_.load()) {}
+    HandlerList &operator=(HandlerList &&other) {
+      handlers = std::move(other.handlers);
+      index_.store(other.index_.load());
+      return *this;
+    }
 
     HandlerList clone() const {
       HandlerList list;
 
-      for (size_t i = 0; i < index_; ++i) {
+      const size_t count = index_.load();
+      for (size_t i = 0; i < count; ++i) {
         list.handlers.at(i) = handlers.at(i)->clone();
       }
-      list.index_ = index_;
+      list.index_.store(count);
 
       return list;
     }
 
+    // The handler is stored before it is counted, so that the thread polling
+    // never sees a handler that is not there yet
     Reactor::Key add(const std::shared_ptr<Handler> &handler) {
-      if (index_ == MaxHandlers)
+      const size_t index = index_.load();
+      if (index == MaxHandlers)
         throw std::runtime_error("Maximum handlers reached");
 
-      Reactor::Key key(index_);
-      handlers.at(index_++) = handler;
+      handlers.at(index) = handler;
+      index_.store(index + 1);
 
-      return key;
+      return Reactor::Key(index);
     }
 
     std::shared_ptr<Handler> operator[](size_t index) const {
@@ -234,15 +301,15 @@ private:
     }
 
     std::shared_ptr<Handler> at(size_t index) const {
-      if (index >= index_)
+      if (index >= index_.load())
         throw std::runtime_error("Attempting to retrieve invalid handler");
 
       return handlers.at(index);
     }
 
-    bool empty() const { return index_ == 0; }
+    bool empty() const { return index_.load() == 0; }
 
-    size_t size() const { return index_; }
+    size_t size() const { return index_.load(); }
 
     static Polling::Tag encodeTag(const Reactor::Key &key, uint64_t value) {
       auto index = key.data();
@@ -263,21 +330,30 @@ private:
     }
 
     template <typename Func> void forEachHandler(Func func) const {
-      for (size_t i = 0; i < index_; ++i)
+      const size_t count = index_.load();
+      for (size_t i = 0; i < count; ++i)
         func(handlers.at(i));
     }
 
   private:
     std::array<std::shared_ptr<Handler>, MaxHandlers> handlers;
-    size_t index_;
+    std::atomic<size_t> index_;
   };
 
   HandlerList handlers_;
+  // Pollers of the handlers but the first one
+  std::array<std::unique_ptr<Polling::Epoll>, HandlerList::MaxHandlers>
+      pollers_;
+
+  std::mutex handlersLock_;
+  std::thread::id runner_;
 
   std::atomic<bool> shutdown_;
   NotifyFd shutdownFd;
 
   Polling::Epoll poller;
+
+  LoopStats stats_;
 };
 
 /* Asynchronous implementation of the reactor that spawns a number N of threads
@@ -390,6 +466,14 @@ public:
       wrk->shutdown();
   }
 
+  std::vector<LoopStats::Snapshot> loopStats() const override {
+    std::vector<LoopStats::Snapshot> res;
+    res.reserve(workers_.size());
+    for (const auto &wrk : workers_)
+      res.push_back(wrk->sync->loopStats().front());
+    return res;
+  }
+
 private:
   static Reactor::Key encodeKey(const Reactor::Key &originalKey,
                                 uint32_t value) {
@@ -527,6 +611,10 @@ void Reactor::shutdown() {
 
 void Reactor::runOnce() { impl()->runOnce(); }
 
+std::vector<LoopStats::Snapshot> Reactor::loopStats() const {
+  return impl()->loopStats();
+}
+
 Reactor::Impl *Reactor::impl() const {
   if (!impl_)
     throw std::runtime_error(
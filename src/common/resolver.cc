@@ -0,0 +1,277 @@
+/* resolver.cc
+
+   Implementation of the asynchronous host name resolver
+*/
+
+#include <pistache/net.h>
+#include <pistache/resolver.h>
+
+#include <netdb.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace Pistache {
+
+namespace {
+// Expired entries are only swept once the cache grows past this size
+constexpr size_t PruneThreshold = 1024;
+
+DnsResolver::Answer toAnswer(const AddrInfo &info) {
+  DnsResolver::Answer answer;
+  for (const addrinfo *addr = info.get_info_ptr(); addr;
+       addr = addr->ai_next) {
+    answer.addresses.emplace_back(addr->ai_addr, addr->ai_addrlen);
+  }
+
+  return answer;
+}
+
+bool numericLookup(const std::string &host, const std::string &port,
+                   int family, DnsResolver::Answer &answer) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+  AddrInfo info;
+  if (info.invoke(host.c_str(), port.c_str(), &hints) != 0)
+    return false;
+
+  answer = toAnswer(info);
+  return !answer.addresses.empty();
+}
+} // namespace
+
+DnsResolver::ResolvedAddress::ResolvedAddress() : addr(), len(0) {}
+
+DnsResolver::ResolvedAddress::ResolvedAddress(const struct sockaddr *address,
+                                              socklen_t length)
+    : addr(), len(length) {
+  if (len > sizeof(addr))
+    throw std::invalid_argument("Invalid address length");
+
+  memcpy(&addr, address, len);
+}
+
+DnsResolver::Options::Options()
+    : threads_(1), defaultTtl_(30), negativeTtl_(5),
+      lookup_(&DnsResolver::systemLookup) {}
+
+DnsResolver::Options &DnsResolver::Options::threads(size_t val) {
+  threads_ = val;
+  return *this;
+}
+
+DnsResolver::Options &
+DnsResolver::Options::defaultTtl(std::chrono::seconds val) {
+  defaultTtl_ = val;
+  return *this;
+}
+
+DnsResolver::Options &
+DnsResolver::Options::negativeTtl(std::chrono::seconds val) {
+  negativeTtl_ = val;
+  return *this;
+}
+
+DnsResolver::Options &DnsResolver::Options::lookup(Lookup val) {
+  lookup_ = std::move(val);
+  return *this;
+}
+
+DnsResolver::DnsResolver(const Options &options)
+    : options_(options), lock_(), jobsCv_(), jobs_(), cache_(), lookups_(0),
+      stop_(false), threads_() {
+  if (options_.threads_ == 0)
+    throw std::invalid_argument("Invalid number of threads");
+  if (!options_.lookup_)
+    throw std::invalid_argument("Invalid lookup function");
+
+  for (size_t i = 0; i < options_.threads_; ++i)
+    threads_.emplace_back([this]() { run(); });
+}
+
+DnsResolver::~DnsResolver() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  jobsCv_.notify_all();
+
+  for (auto &thread : threads_)
+    thread.join();
+
+  // Do not leave callers hanging on lookups that will never run
+  for (auto &entry : cache_) {
+    for (auto &deferred : entry.second.pending)
+      deferred.reject(Error("Resolver has been shut down"));
+  }
+}
+
+std::shared_ptr<DnsResolver> DnsResolver::create(const Options &options) {
+  return std::make_shared<DnsResolver>(options);
+}
+
+Async::Promise<DnsResolver::Result>
+DnsResolver::resolve(const std::string &host, const std::string &port,
+                     int family) {
+  if (host.empty())
+    return Async::Promise<Result>::rejected(Error("Empty host name"));
+
+  Answer numeric;
+  if (numericLookup(host, port, family, numeric))
+    return Async::Promise<Result>::resolved(
+        Result(std::make_shared<Answer>(std::move(numeric))));
+
+  std::string key(host);
+  key += ':';
+  key += port;
+  key += '/';
+  key += std::to_string(family);
+
+  std::unique_lock<std::mutex> guard(lock_);
+
+  const auto now = Clock::now();
+  auto &entry = cache_[key];
+  if (entry.pending.empty() && entry.expires > now) {
+    if (entry.answer)
+      return Async::Promise<Result>::resolved(Result(entry.answer));
+
+    return Async::Promise<Result>::rejected(Error(entry.error));
+  }
+
+  const bool inFlight = !entry.pending.empty();
+  auto promise = Async::Promise<Result>([&](Async::Deferred<Result> deferred) {
+    entry.pending.push_back(std::move(deferred));
+  });
+
+  if (!inFlight) {
+    jobs_.push_back(Job{std::move(key), host, port, family});
+    guard.unlock();
+    jobsCv_.notify_one();
+  }
+
+  return promise;
+}
+
+void DnsResolver::clear() {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (it->second.pending.empty())
+      it = cache_.erase(it);
+    else
+      ++it;
+  }
+}
+
+size_t DnsResolver::cachedEntries() const {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  const auto now = Clock::now();
+  size_t count = 0;
+  for (const auto &entry : cache_) {
+    if (entry.second.pending.empty() && entry.second.expires > now)
+      ++count;
+  }
+
+  return count;
+}
+
+uint64_t DnsResolver::lookups() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return lookups_;
+}
+
+DnsResolver::Answer DnsResolver::systemLookup(const std::string &host,
+                                              const std::string &port,
+                                              int family) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = family;
+  hints.ai_socktype = SOCK_STREAM;
+
+  AddrInfo info;
+  const int res = info.invoke(host.c_str(), port.c_str(), &hints);
+  if (res == EAI_NONAME)
+    return Answer();
+
+  if (res != 0)
+    throw Error(gai_strerror(res));
+
+  return toAnswer(info);
+}
+
+void DnsResolver::run() {
+  for (;;) {
+    Job job;
+
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      jobsCv_.wait(guard, [this]() { return stop_ || !jobs_.empty(); });
+      if (stop_)
+        return;
+
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+      ++lookups_;
+    }
+
+    try {
+      auto answer = std::make_shared<Answer>(
+          options_.lookup_(job.host, job.port, job.family));
+      if (answer->addresses.empty())
+        complete(job, nullptr, "Could not resolve host " + job.host);
+      else
+        complete(job, std::move(answer), std::string());
+    } catch (const std::exception &e) {
+      complete(job, nullptr, e.what());
+    }
+  }
+}
+
+void DnsResolver::complete(const Job &job, Result answer, std::string error) {
+  std::vector<Async::Deferred<Result>> pending;
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    const auto now = Clock::now();
+    auto &entry = cache_[job.key];
+
+    auto ttl = options_.negativeTtl_;
+    if (answer) {
+      ttl = answer->ttl.count() >= 0 ? answer->ttl : options_.defaultTtl_;
+    }
+
+    entry.answer = answer;
+    entry.error = error;
+    entry.expires = now + ttl;
+    pending.swap(entry.pending);
+
+    if (cache_.size() > PruneThreshold)
+      prune(now);
+  }
+
+  // Callbacks might be chained to these promises, resolve them without
+  // holding the lock
+  for (auto &deferred : pending) {
+    if (answer)
+      deferred.resolve(Result(answer));
+    else
+      deferred.reject(Error(error));
+  }
+}
+
+void DnsResolver::prune(Clock::time_point now) {
+  for (auto it = cache_.begin(); it != cache_.end();) {
+    if (it->second.pending.empty() && it->second.expires <= now)
+      it = cache_.erase(it);
+    else
+      ++it;
+  }
+}
+
+} // namespace Pistache
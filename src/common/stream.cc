@@ -74,6 +74,15 @@ Fd FileBuffer::fd() const { return fd_; }
 
 size_t FileBuffer::size() const { return size_; }
 
+PipeBuffer::PipeBuffer(Fd fd, size_t size) : fd_(fd), size_(size) {
+  if (fd == -1)
+    throw std::runtime_error("Invalid pipe");
+}
+
+Fd PipeBuffer::fd() const { return fd_; }
+
+size_t PipeBuffer::size() const { return size_; }
+
 DynamicStreamBuf::DynamicStreamBuf(size_t size, size_t maxSize)
     : data_(), maxSize_(maxSize) {
   assert(size <= maxSize);
@@ -102,6 +111,10 @@ RawBuffer DynamicStreamBuf::buffer() const {
   return RawBuffer(data_.data(), pptr() - data_.data());
 }
 
+const char *DynamicStreamBuf::data() const { return data_.data(); }
+
+size_t DynamicStreamBuf::size() const { return pptr() - data_.data(); }
+
 size_t DynamicStreamBuf::maxSize() const { return maxSize_; }
 
 void DynamicStreamBuf::clear() {
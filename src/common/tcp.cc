@@ -26,5 +26,9 @@ void Handler::onDisconnection(const std::shared_ptr<Tcp::Peer> &peer) {
   UNUSED(peer)
 }
 
+void Handler::onResume(const std::shared_ptr<Tcp::Peer> &peer) {
+  UNUSED(peer)
+}
+
 } // namespace Tcp
 } // namespace Pistache
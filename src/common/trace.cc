@@ -0,0 +1,42 @@
+/* trace.cc
+
+   Implementation of the hooks of the tracepoints
+*/
+
+#include <pistache/trace.h>
+
+#include <mutex>
+#include <vector>
+
+namespace Pistache {
+namespace Trace {
+
+namespace detail {
+std::atomic<Hooks *> hooks(nullptr);
+}
+
+namespace {
+
+struct Installed {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<Hooks>> all;
+};
+
+Installed &installed() {
+  // Leaked: the points may fire while static objects are destroyed
+  static Installed *res = new Installed();
+  return *res;
+}
+
+} // namespace
+
+void setHooks(std::shared_ptr<Hooks> hooks) {
+  auto &res = installed();
+  std::lock_guard<std::mutex> guard(res.mutex);
+  if (hooks)
+    res.all.push_back(hooks);
+  detail::hooks.store(hooks.get(), std::memory_order_release);
+}
+
+} // namespace Trace
+} // namespace Pistache
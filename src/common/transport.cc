@@ -10,25 +10,28 @@
     #include <sys/types.h>
     #include <sys/socket.h>
     #include <sys/uio.h>
-    // getrusage
-    #include <sys/resource.h>
 
     #define TIMER_SET(fd, event) timer_set(kq, fd, event)
 #else
+    #include <fcntl.h>
     #include <sys/sendfile.h>
     #include <sys/time.h>
 
     #define TIMER_SET(fd, event) timer_set(fd, event)
 #endif
 
-#include <sys/resource.h>
-
+#include <pistache/common.h>
+#include <pistache/log.h>
+#include <pistache/metrics.h>
 #include <pistache/os.h>
 #include <pistache/peer.h>
 #include <pistache/tcp.h>
 #include <pistache/transport.h>
 #include <pistache/utils.h>
 #include <pistache/timer.h>
+#include <pistache/trace.h>
+
+#include <algorithm>
 
 namespace Pistache {
 
@@ -49,6 +52,14 @@ void Transport::init(const std::shared_ptr<Tcp::Handler> &handler) {
 #endif
 }
 
+Transport::~Transport() {
+  if (tcpInfoTimer_ != -1)
+    close(tcpInfoTimer_);
+#ifdef __MACH__
+  close(kq);
+#endif
+}
+
 std::shared_ptr<Aio::Handler> Transport::clone() const {
   return std::make_shared<Transport>(handler_->clone());
 }
@@ -57,7 +68,7 @@ void Transport::registerPoller(Polling::Epoll &poller) {
   writesQueue.bind(poller);
   timersQueue.bind(poller);
   peersQueue.bind(poller);
-  notifier.bind(poller);
+  resumesQueue.bind(poller);
 }
 
 void Transport::handleNewPeer(const std::shared_ptr<Tcp::Peer> &peer) {
@@ -78,27 +89,29 @@ void Transport::handleNewPeer(const std::shared_ptr<Tcp::Peer> &peer) {
   }
 }
 
+void Transport::resumeInput(const std::shared_ptr<Peer> &peer) {
+  if (std::this_thread::get_id() == context().thread())
+    handler_->onResume(peer);
+  else
+    resumesQueue.push(PeerEntry(peer));
+}
+
 void Transport::onReady(const Aio::FdSet &fds) {
   for (const auto &entry : fds) {
-    std::cout << "onReady()" << std::endl; // YOSHI
-//    printStacktrace();
-    
     if (entry.getTag() == writesQueue.tag()) {
-        std::cout << "  writeQueue" << std::endl;
       handleWriteQueue();
     } else if (entry.getTag() == timersQueue.tag()) {
       handleTimerQueue();
-        std::cout << "  timersQueue" << std::endl;
     } else if (entry.getTag() == peersQueue.tag()) {
       handlePeerQueue();
-        std::cout << "  peersQueue" << std::endl;
-    } else if (entry.getTag() == notifier.tag()) {
-      handleNotify();
-        std::cout << "  notify" << std::endl;
+    } else if (entry.getTag() == resumesQueue.tag()) {
+      handleResumeQueue();
+    } else if (tcpInfoTimer_ != -1 &&
+               entry.getTag() == Polling::Tag(tcpInfoTimer_)) {
+      handleTcpInfoTimer();
     }
 
     else if (entry.isReadable()) {
-        std::cout << "  is readable" << std::endl;
       auto tag = entry.getTag();
       if (isPeerFd(tag)) {
         auto &peer = getPeer(tag);
@@ -113,13 +126,12 @@ void Transport::onReady(const Aio::FdSet &fds) {
       }
 
     } else if (entry.isWritable()) {
-        std::cout << "  is writable" << std::endl;
       auto tag = entry.getTag();
       auto fd = static_cast<Fd>(tag.value());
+      PISTACHE_LOG_TRACE("fd %d is writable", fd);
 
       {
         Guard guard(toWriteLock);
-        std::cout << "Lookup Writedata " << fd << std::endl;
         auto it = toWrite.find(fd);
         if (it == std::end(toWrite)) {
           throw std::runtime_error(
@@ -130,7 +142,6 @@ void Transport::onReady(const Aio::FdSet &fds) {
       reactor()->modifyFd(key(), fd, NotifyOn::Read, Polling::Mode::Edge);
 
       // Try to drain the queue
-        std::cout << "  call asyncWrite" << std::endl;
       asyncWriteImpl(fd);
     }
   }
@@ -166,6 +177,9 @@ void Transport::handleIncoming(const std::shared_ptr<Peer> &peer) {
     }
 #endif /* PISTACHE_USE_SSL */
 
+    if (bytes > 0 && metrics_)
+      metrics_->bytesReceived(static_cast<size_t>(bytes));
+
     if (bytes == -1) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         if (totalBytes > 0) {
@@ -194,16 +208,21 @@ void Transport::handlePeerDisconnection(const std::shared_ptr<Peer> &peer) {
   handler_->onDisconnection(peer);
 
   int fd = peer->fd();
+  Trace::connectionClosed(fd);
   auto it = peers.find(fd);
   if (it == std::end(peers))
     throw std::runtime_error("Could not find peer to erase");
 
   peers.erase(it->first);
+  if (metrics_)
+    metrics_->connectionClosed();
 
   {
     // Clean up buffers
     Guard guard(toWriteLock);
     auto &wq = toWrite[fd];
+    if (metrics_)
+      metrics_->writesDone(wq.size());
     while (wq.size() > 0) {
       wq.pop_front();
     }
@@ -237,6 +256,8 @@ void Transport::asyncWriteImpl(Fd fd) {
 
     auto cleanUp = [&]() {
       wq.pop_front();
+      if (metrics_)
+        metrics_->writesDone(1);
       if (wq.size() == 0) {
         toWrite.erase(fd);
         reactor()->modifyFd(key(), fd, NotifyOn::Read, Polling::Mode::Edge);
@@ -269,6 +290,8 @@ void Transport::asyncWriteImpl(Fd fd) {
 #ifdef PISTACHE_USE_SSL
         }
 #endif /* PISTACHE_USE_SSL */
+      } else if (buffer.isPipe()) {
+        bytesWritten = splicePipe(fd, buffer.fd(), len, flags);
       } else {
         auto file = buffer.fd();
         off_t offset = totalWritten;
@@ -310,6 +333,8 @@ void Transport::asyncWriteImpl(Fd fd) {
         // an error, closes fd before the entire request is processed.
         // https://github.com/oktal/pistache/issues/501
         else if (errno == EBADF || errno == EPIPE || errno == ECONNRESET) {
+          if (metrics_)
+            metrics_->writesDone(wq.size());
           wq.pop_front();
           toWrite.erase(fd);
           stop = true;
@@ -319,8 +344,14 @@ void Transport::asyncWriteImpl(Fd fd) {
         }
         break;
       } else {
+        if (metrics_)
+          metrics_->bytesSent(static_cast<size_t>(bytesWritten));
+        // The offset of a buffer left by a partial write is kept
+        if (totalWritten == 0 && bytesWritten > 0)
+          Trace::writeStarted(fd);
         totalWritten += bytesWritten;
         if (totalWritten >= buffer.size()) {
+          Trace::writeDone(fd, totalWritten);
           if (buffer.isFile()) {
             // done with the file buffer, nothing else knows whether to
             // close it with the way the code is written.
@@ -339,6 +370,40 @@ void Transport::asyncWriteImpl(Fd fd) {
   }
 }
 
+ssize_t Transport::splicePipe(Fd fd, Fd pipe, size_t len, int flags) {
+#ifdef __MACH__
+  UNUSED(fd)
+  UNUSED(pipe)
+  UNUSED(len)
+  UNUSED(flags)
+  errno = ENOTSUP;
+  return -1;
+#else
+#ifdef PISTACHE_USE_SSL
+  // The bytes would have to go through user space to be encrypted
+  auto it = peers.find(fd);
+  if (it != std::end(peers) && it->second->ssl() != NULL) {
+    errno = EPROTONOSUPPORT;
+    return -1;
+  }
+#endif /* PISTACHE_USE_SSL */
+
+  unsigned int spliceFlags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+  if (flags & MSG_MORE)
+    spliceFlags |= SPLICE_F_MORE;
+
+  const ssize_t res = ::splice(pipe, nullptr, fd, nullptr, len, spliceFlags);
+
+  // The pipe was closed before it held the bytes it was meant to
+  if (res == 0 && len > 0) {
+    errno = EIO;
+    return -1;
+  }
+
+  return res;
+#endif // __MACH__
+}
+
 void Transport::armTimerMs(Fd fd, std::chrono::milliseconds value,
                            Async::Deferred<uint64_t> deferred) {
 
@@ -375,12 +440,11 @@ void Transport::armTimerMsImpl(TimerEntry entry) {
 void Transport::handleWriteQueue() {
   // Let's drain the queue
   for (;;) {
-      std::cout << "writesQueue.popSafe()" << std::endl; // YOSHI
     auto write = writesQueue.popSafe();
-    if (!write) {
-      std::cout << "BREAK" << std::endl; // YOSHI
+    if (!write)
       break;
-    }
+
+    recordQueueLag(write->queued);
 
     auto fd = write->peerFd;
     if (!isPeerFd(fd))
@@ -388,9 +452,11 @@ void Transport::handleWriteQueue() {
 
     {
       Guard guard(toWriteLock);
-      std::cout << "Adding write data for fd = " << fd << std::endl;
+      PISTACHE_LOG_TRACE("Queuing a write to fd %d", fd);
       toWrite[fd].push_back(std::move(*write));
     }
+    if (metrics_)
+      metrics_->writesQueued(1);
 
     reactor()->modifyFd(key(), fd, NotifyOn::Read | NotifyOn::Write,
                         Polling::Mode::Edge);
@@ -399,7 +465,6 @@ void Transport::handleWriteQueue() {
 
 void Transport::handleTimerQueue() {
   for (;;) {
-      std::cout << "timersQueue.popSafe()" << std::endl; // YOSHI
     auto timer = timersQueue.popSafe();
     if (!timer)
       break;
@@ -410,44 +475,41 @@ void Transport::handleTimerQueue() {
 
 void Transport::handlePeerQueue() {
   for (;;) {
-      std::cout << "handlePeerQueue" << std::endl; // YOSHI
     auto data = peersQueue.popSafe();
     if (!data)
       break;
+    recordQueueLag(data->queued);
     handlePeer(data->peer);
   }
 }
 
+void Transport::handleResumeQueue() {
+  for (;;) {
+    auto data = resumesQueue.popSafe();
+    if (!data)
+      break;
+    recordQueueLag(data->queued);
+
+    // The peer may have disconnected since
+    auto it = peers.find(data->peer->fd());
+    if (it != std::end(peers) && it->second == data->peer)
+      handler_->onResume(data->peer);
+  }
+}
+
 void Transport::handlePeer(const std::shared_ptr<Peer> &peer) {
   int fd = peer->fd();
   peers.insert(std::make_pair(fd, peer));
 
   peer->associateTransport(this);
+  if (metrics_)
+    metrics_->connectionOpened();
 
   handler_->onConnection(peer);
   reactor()->registerFd(key(), fd, NotifyOn::Read | NotifyOn::Shutdown,
                         Polling::Mode::Edge);
 }
 
-void Transport::handleNotify() {
-  while (this->notifier.tryRead())
-    ;
-
-  rusage now;
-    
-#ifdef __MACH__
-  auto res = getrusage(RUSAGE_SELF, &now);
-#else
-  auto res = getrusage(RUSAGE_THREAD, &now);
-#endif // __MACH__
-    
-  if (res == -1)
-    loadRequest_.reject(std::runtime_error("Could not compute usage"));
-
-  loadRequest_.resolve(now);
-  loadRequest_.clear();
-}
-
 void Transport::handleTimer(TimerEntry entry) {
   if (entry.isActive()) {
     uint64_t numWakeups;
@@ -470,6 +532,78 @@ void Transport::handleTimer(TimerEntry entry) {
   }
 }
 
+void Transport::setTcpInfoSampling(std::chrono::milliseconds interval,
+                                   size_t peers) {
+#ifdef __MACH__
+  (void)interval;
+  (void)peers;
+#else
+  // Closing it removes it from the poller
+  if (tcpInfoTimer_ != -1) {
+    close(tcpInfoTimer_);
+    tcpInfoTimer_ = -1;
+  }
+  if (interval.count() <= 0 || peers == 0)
+    return;
+
+  tcpInfoTimer_ = TRY_RET(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK));
+  tcpInfoPeers_ = peers;
+
+  itimerspec spec;
+  spec.it_interval.tv_sec =
+      std::chrono::duration_cast<std::chrono::seconds>(interval).count();
+  spec.it_interval.tv_nsec =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          interval % std::chrono::seconds(1))
+          .count();
+  spec.it_value = spec.it_interval;
+  TRY(timerfd_settime(tcpInfoTimer_, 0, &spec, nullptr));
+
+  reactor()->registerFd(key(), tcpInfoTimer_, NotifyOn::Read,
+                        Polling::Mode::Edge);
+#endif /* __MACH__ */
+}
+
+void Transport::handleTcpInfoTimer() {
+  uint64_t expirations;
+  if (::read(tcpInfoTimer_, &expirations, sizeof(expirations)) == -1)
+    return;
+  if (peers.empty())
+    return;
+
+  auto it = peers.find(tcpInfoNext_);
+  if (it == std::end(peers))
+    it = std::begin(peers);
+
+  const size_t count = std::min(tcpInfoPeers_, peers.size());
+  for (size_t i = 0; i < count; ++i) {
+    sampleTcpInfo(*it->second);
+    if (++it == std::end(peers))
+      it = std::begin(peers);
+  }
+  tcpInfoNext_ = it->first;
+}
+
+void Transport::sampleTcpInfo(Peer &peer) {
+  const auto previous = peer.tcpInfo();
+  if (!peer.sampleTcpInfo())
+    return;
+
+  if (metrics_) {
+    const auto info = peer.tcpInfo();
+    metrics_->tcpInfoSampled(info.rtt, info.rttVariance, info.cwnd,
+                             info.unacked,
+                             info.retransmits - previous.retransmits);
+  }
+}
+
+void Transport::recordQueueLag(std::chrono::steady_clock::time_point queued) {
+  auto *stats = loopStats();
+  if (stats)
+    stats->queueLag(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - queued));
+}
+
 bool Transport::isPeerFd(Fd fd) const {
   return peers.find(fd) != std::end(peers);
 }
@@ -0,0 +1,351 @@
+/* access_log.cc
+
+   Implementation of the access log
+*/
+
+#include <pistache/access_log.h>
+#include <pistache/log.h>
+#include <pistache/peer.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Pistache {
+namespace Http {
+
+namespace {
+
+void appendJsonString(std::string &out, const std::string &value) {
+  out += '"';
+  for (const char c : value) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x",
+                      static_cast<unsigned int>(c));
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+  }
+  out += '"';
+}
+
+} // namespace
+
+AccessLogEntry::AccessLogEntry()
+    : time(), method(Method::Get), version(Version::Http11), resource(),
+      code(Code::Ok), bytes(0), latency(0), peer(), headers() {}
+
+AccessLogRing::AccessLogRing(size_t capacity, std::vector<std::string> headers)
+    : headers_(std::move(headers)), slots_(std::max<size_t>(capacity, 1)),
+      head_(0), tail_(0), dropped_(0) {
+  for (auto &slot : slots_)
+    slot.headers.resize(headers_.size());
+}
+
+void AccessLogRing::prepare(AccessLogEntry &entry, const Request &request,
+                            const std::shared_ptr<Tcp::Peer> &peer) const {
+  entry.method = request.method();
+  entry.version = request.version();
+  entry.resource = request.resource();
+  if (peer)
+    entry.peer = peer->address().host();
+
+  entry.headers.resize(headers_.size());
+  const auto &requestHeaders = request.headers();
+  for (size_t i = 0; i < headers_.size(); ++i) {
+    const auto &raw = requestHeaders.rawList();
+    auto it = raw.find(headers_[i]);
+    if (it != raw.end()) {
+      entry.headers[i] = it->second.value();
+      continue;
+    }
+
+    auto header = requestHeaders.tryGet(headers_[i]);
+    if (header) {
+      std::ostringstream os;
+      header->write(os);
+      entry.headers[i] = os.str();
+    }
+  }
+}
+
+void AccessLogRing::record(const AccessLogEntry &entry) {
+  struct Pushing {
+    explicit Pushing(std::atomic_flag &flag_) : flag(flag_) {
+      while (flag.test_and_set(std::memory_order_acquire))
+        std::this_thread::yield();
+    }
+    ~Pushing() { flag.clear(std::memory_order_release); }
+    std::atomic_flag &flag;
+  } pushing(pushing_);
+
+  const auto head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) >= slots_.size()) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  // Assigned member by member, the strings of the slot keep their capacity
+  auto &slot = slots_[head % slots_.size()];
+  slot.time = std::chrono::system_clock::now();
+  slot.method = entry.method;
+  slot.version = entry.version;
+  slot.resource.assign(entry.resource);
+  slot.code = entry.code;
+  slot.bytes = entry.bytes;
+  slot.latency = entry.latency;
+  slot.peer.assign(entry.peer);
+  for (size_t i = 0; i < slot.headers.size(); ++i)
+    slot.headers[i].assign(entry.headers[i]);
+
+  head_.store(head + 1, std::memory_order_release);
+}
+
+PendingAccessLogEntry::PendingAccessLogEntry(
+    std::shared_ptr<AccessLogRing> ring, const Request &request, Code code,
+    const std::shared_ptr<Tcp::Peer> &peer,
+    std::chrono::steady_clock::time_point received)
+    : ring_(std::move(ring)), entry_(), received_(received) {
+  ring_->prepare(entry_, request, peer);
+  entry_.code = code;
+}
+
+PendingAccessLogEntry::~PendingAccessLogEntry() {
+  entry_.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - received_);
+  ring_->record(entry_);
+}
+
+constexpr size_t AccessLog::DefaultMaxFiles;
+constexpr size_t AccessLog::DefaultRingCapacity;
+constexpr std::chrono::milliseconds AccessLog::DefaultFlushInterval;
+
+AccessLog::Options::Options()
+    : path_(), maxFileSize_(0), maxFiles_(DefaultMaxFiles), headers_(),
+      ringCapacity_(DefaultRingCapacity),
+      flushInterval_(DefaultFlushInterval) {}
+
+AccessLog::Options &AccessLog::Options::path(std::string val) {
+  path_ = std::move(val);
+  return *this;
+}
+
+AccessLog::Options &AccessLog::Options::maxFileSize(size_t val) {
+  maxFileSize_ = val;
+  return *this;
+}
+
+AccessLog::Options &AccessLog::Options::maxFiles(size_t val) {
+  maxFiles_ = val;
+  return *this;
+}
+
+AccessLog::Options &AccessLog::Options::headers(std::vector<std::string> val) {
+  headers_ = std::move(val);
+  return *this;
+}
+
+AccessLog::Options &AccessLog::Options::ringCapacity(size_t val) {
+  ringCapacity_ = val;
+  return *this;
+}
+
+AccessLog::Options &
+AccessLog::Options::flushInterval(std::chrono::milliseconds val) {
+  flushInterval_ = val;
+  return *this;
+}
+
+AccessLog::AccessLog(const Options &options)
+    : options_(options), mutex_(), rings_(), fd_(-1), fileSize_(0), buffer_(),
+      written_(0),
+      drainThread_(mutex_, options_.flushInterval_, [this] { drainLocked(); }) {
+  open();
+  std::lock_guard<std::mutex> guard(mutex_);
+  drainThread_.start();
+}
+
+AccessLog::~AccessLog() {
+  drainThread_.stop();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  drainLocked();
+  if (fd_ != -1 && fd_ != STDOUT_FILENO)
+    ::close(fd_);
+}
+
+AccessLog::Options AccessLog::options() { return Options(); }
+
+void AccessLog::flush() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  drainLocked();
+}
+
+uint64_t AccessLog::dropped() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint64_t total = 0;
+  for (const auto &ring : rings_)
+    total += ring->dropped();
+  return total;
+}
+
+uint64_t AccessLog::written() const {
+  return written_.load(std::memory_order_relaxed);
+}
+
+std::vector<std::shared_ptr<AccessLogRing>>
+AccessLog::addWorkers(size_t count) {
+  std::vector<std::shared_ptr<AccessLogRing>> res;
+  res.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    res.push_back(std::make_shared<AccessLogRing>(options_.ringCapacity_,
+                                                  options_.headers_));
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  rings_.insert(rings_.end(), res.begin(), res.end());
+  return res;
+}
+
+void AccessLog::drainLocked() {
+  uint64_t count = 0;
+  for (const auto &ring : rings_)
+    ring->drain([&](const AccessLogEntry &entry) {
+      format(entry);
+      ++count;
+    });
+
+  if (count == 0)
+    return;
+
+  writeLocked();
+  written_.fetch_add(count, std::memory_order_relaxed);
+}
+
+void AccessLog::format(const AccessLogEntry &entry) {
+  buffer_ += "{\"time\":\"";
+  Log::appendTime(buffer_, entry.time);
+  buffer_ += "\",\"peer\":";
+  appendJsonString(buffer_, entry.peer);
+  buffer_ += ",\"method\":\"";
+  buffer_ += methodString(entry.method);
+  buffer_ += "\",\"resource\":";
+  appendJsonString(buffer_, entry.resource);
+  buffer_ += ",\"version\":\"";
+  buffer_ += versionString(entry.version);
+  buffer_ += "\",\"status\":";
+  buffer_ += std::to_string(static_cast<int>(entry.code));
+  buffer_ += ",\"bytes\":";
+  buffer_ += std::to_string(entry.bytes);
+  buffer_ += ",\"latency_us\":";
+  buffer_ += std::to_string(entry.latency.count());
+
+  if (!options_.headers_.empty()) {
+    buffer_ += ",\"headers\":{";
+    bool first = true;
+    for (size_t i = 0; i < options_.headers_.size(); ++i) {
+      if (entry.headers[i].empty())
+        continue;
+      if (!first)
+        buffer_ += ',';
+      first = false;
+      appendJsonString(buffer_, options_.headers_[i]);
+      buffer_ += ':';
+      appendJsonString(buffer_, entry.headers[i]);
+    }
+    buffer_ += '}';
+  }
+  buffer_ += "}\n";
+}
+
+void AccessLog::writeLocked() {
+  if (options_.maxFileSize_ > 0 && fileSize_ > 0 &&
+      fileSize_ + buffer_.size() > options_.maxFileSize_)
+    rotate();
+
+  const char *data = buffer_.data();
+  size_t remaining = buffer_.size();
+  while (fd_ != -1 && remaining > 0) {
+    const ssize_t bytes = ::write(fd_, data, remaining);
+    if (bytes < 0) {
+      if (errno == EINTR)
+        continue;
+      PISTACHE_LOG_ERROR("Could not write the access log: %s",
+                         strerror(errno));
+      break;
+    }
+    data += bytes;
+    remaining -= static_cast<size_t>(bytes);
+    fileSize_ += static_cast<size_t>(bytes);
+  }
+  buffer_.clear();
+}
+
+void AccessLog::open() {
+  if (options_.path_.empty()) {
+    fd_ = STDOUT_FILENO;
+    return;
+  }
+
+  fd_ = ::open(options_.path_.c_str(),
+               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ == -1)
+    throw Error::system("Could not open the access log");
+
+  struct stat st;
+  fileSize_ = ::fstat(fd_, &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+void AccessLog::rotate() {
+  if (fd_ == STDOUT_FILENO)
+    return;
+
+  if (fd_ != -1)
+    ::close(fd_);
+  fd_ = -1;
+  fileSize_ = 0;
+
+  const auto &path = options_.path_;
+  if (options_.maxFiles_ == 0) {
+    ::unlink(path.c_str());
+  } else {
+    for (size_t i = options_.maxFiles_ - 1; i > 0; --i)
+      ::rename((path + '.' + std::to_string(i)).c_str(),
+               (path + '.' + std::to_string(i + 1)).c_str());
+    ::rename(path.c_str(), (path + ".1").c_str());
+  }
+
+  try {
+    open();
+  } catch (const std::exception &e) {
+    PISTACHE_LOG_ERROR("%s", e.what());
+  }
+}
+
+} // namespace Http
+} // namespace Pistache
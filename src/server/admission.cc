@@ -0,0 +1,154 @@
+/* admission.cc
+
+   Implementation of the per-route admission controller
+*/
+
+#include <pistache/admission.h>
+
+namespace Pistache {
+namespace Rest {
+
+namespace {
+// A new latency sample weighs 1/8 in the smoothed latency, the same
+// smoothing factor TCP uses for its RTT estimation
+constexpr int64_t LatencySmoothingFactor = 8;
+} // namespace
+
+AdmissionController::Options::Options()
+    : maxInFlight_(0), latencyTarget_(0), retryAfter_(1) {}
+
+AdmissionController::Options &
+AdmissionController::Options::maxInFlight(size_t val) {
+  maxInFlight_ = val;
+  return *this;
+}
+
+AdmissionController::Options &
+AdmissionController::Options::latencyTarget(std::chrono::milliseconds val) {
+  latencyTarget_ = val;
+  return *this;
+}
+
+AdmissionController::Options &
+AdmissionController::Options::retryAfter(std::chrono::seconds val) {
+  retryAfter_ = val;
+  return *this;
+}
+
+AdmissionController::Ticket::Ticket(
+    std::shared_ptr<AdmissionController> controller, size_t shard)
+    : controller_(std::move(controller)), shard_(shard),
+      admittedAt_(Clock::now()) {}
+
+AdmissionController::Ticket::~Ticket() {
+  controller_->release(shard_, admittedAt_);
+}
+
+AdmissionController::AdmissionController(const Options &options)
+    : options_(options), shards_() {}
+
+std::shared_ptr<AdmissionController>
+AdmissionController::create(const Options &options) {
+  return std::make_shared<AdmissionController>(options);
+}
+
+std::shared_ptr<AdmissionController::Ticket> AdmissionController::tryAdmit() {
+  const auto index = shardIndex();
+  auto &shard = shards_[index];
+
+  // Take the slot first and then check the limits: two concurrent requests
+  // might both get rejected when racing for the last slot, but the limit can
+  // never be exceeded.
+  shard.inFlight.fetch_add(1, std::memory_order_acq_rel);
+  const size_t current = inFlight();
+
+  bool shed = false;
+  if (options_.maxInFlight_ > 0 && current > options_.maxInFlight_) {
+    shed = true;
+  } else if (options_.latencyTarget_.count() > 0 && current > 1) {
+    shed = latency() > options_.latencyTarget_;
+  }
+
+  if (shed) {
+    shard.inFlight.fetch_sub(1, std::memory_order_acq_rel);
+    shard.rejected.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  shard.admitted.fetch_add(1, std::memory_order_relaxed);
+  return std::shared_ptr<Ticket>(new Ticket(shared_from_this(), index));
+}
+
+size_t AdmissionController::inFlight() const {
+  int64_t total = 0;
+  for (const auto &shard : shards_)
+    total += shard.inFlight.load(std::memory_order_acquire);
+
+  return total > 0 ? static_cast<size_t>(total) : 0;
+}
+
+uint64_t AdmissionController::admitted() const {
+  uint64_t total = 0;
+  for (const auto &shard : shards_)
+    total += shard.admitted.load(std::memory_order_relaxed);
+
+  return total;
+}
+
+uint64_t AdmissionController::rejected() const {
+  uint64_t total = 0;
+  for (const auto &shard : shards_)
+    total += shard.rejected.load(std::memory_order_relaxed);
+
+  return total;
+}
+
+std::chrono::microseconds AdmissionController::latency() const {
+  int64_t total = 0;
+  int64_t samples = 0;
+  for (const auto &shard : shards_) {
+    auto value = shard.latencyUs.load(std::memory_order_relaxed);
+    if (value > 0) {
+      total += value;
+      ++samples;
+    }
+  }
+
+  if (samples == 0)
+    return std::chrono::microseconds(0);
+
+  return std::chrono::microseconds(total / samples);
+}
+
+size_t AdmissionController::shardIndex() {
+  static std::atomic<size_t> nextIndex(0);
+  thread_local size_t index =
+      nextIndex.fetch_add(1, std::memory_order_relaxed) % ShardsCount;
+
+  return index;
+}
+
+void AdmissionController::release(size_t shard,
+                                  Clock::time_point admittedAt) {
+  auto &target = shards_[shard];
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                           Clock::now() - admittedAt)
+                           .count();
+  const int64_t sample = elapsed > 0 ? elapsed : 1;
+
+  auto current = target.latencyUs.load(std::memory_order_relaxed);
+  int64_t smoothed;
+  do {
+    if (current == 0)
+      smoothed = sample;
+    else
+      smoothed = current + (sample - current) / LatencySmoothingFactor;
+  } while (!target.latencyUs.compare_exchange_weak(current, smoothed,
+                                                   std::memory_order_relaxed));
+
+  target.inFlight.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+} // namespace Rest
+} // namespace Pistache
@@ -0,0 +1,115 @@
+/* coalescer.cc
+
+   Implementation of the request coalescer
+*/
+
+#include <pistache/coalescer.h>
+#include <pistache/response_cache.h>
+
+namespace Pistache {
+namespace Rest {
+
+bool RequestCoalescer::SharedResponse::matches(
+    const Http::Request &request) const {
+  return ResponseCache::variantKey(std::string(), varyFields, request) ==
+         variant;
+}
+
+RequestCoalescer::Flight::Flight(std::shared_ptr<RequestCoalescer> coalescer,
+                                 std::string key)
+    : coalescer_(std::move(coalescer)), key_(std::move(key)), followers_(),
+      done_(false) {}
+
+RequestCoalescer::Flight::~Flight() { coalescer_->finish(this, Result()); }
+
+void RequestCoalescer::Flight::complete(const Http::Request &request,
+                                        const Http::Response &response,
+                                        const RawBuffer &wire) {
+  Result result;
+
+  if (ResponseCache::isShareable(response)) {
+    std::vector<std::string> fields;
+    bool shareable = true;
+
+    auto vary = response.headers().tryGet<Http::Header::Vary>();
+    if (vary) {
+      shareable = !vary->varyOnAll();
+      fields = vary->fields();
+    }
+
+    if (shareable) {
+      auto variant = ResponseCache::variantKey(std::string(), fields, request);
+      result = std::make_shared<SharedResponse>(
+          response.code(), wire, std::move(fields), std::move(variant));
+    }
+  }
+
+  coalescer_->finish(this, result);
+}
+
+RequestCoalescer::RequestCoalescer() : lock_(), flights_(), coalesced_(0) {}
+
+std::shared_ptr<RequestCoalescer> RequestCoalescer::create() {
+  return std::make_shared<RequestCoalescer>();
+}
+
+std::shared_ptr<RequestCoalescer::Flight>
+RequestCoalescer::lead(const std::string &key) {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  auto it = flights_.find(key);
+  if (it != std::end(flights_))
+    return nullptr;
+
+  std::shared_ptr<Flight> flight(new Flight(shared_from_this(), key));
+  flights_.insert(std::make_pair(key, flight.get()));
+
+  return flight;
+}
+
+Async::Promise<RequestCoalescer::Result>
+RequestCoalescer::follow(const std::string &key) {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  auto it = flights_.find(key);
+  if (it == std::end(flights_))
+    return Async::Promise<Result>::resolved(Result());
+
+  auto *flight = it->second;
+  coalesced_.fetch_add(1, std::memory_order_relaxed);
+
+  return Async::Promise<Result>([flight](Async::Deferred<Result> deferred) {
+    flight->followers_.push_back(std::move(deferred));
+  });
+}
+
+size_t RequestCoalescer::inFlight() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return flights_.size();
+}
+
+uint64_t RequestCoalescer::coalesced() const {
+  return coalesced_.load(std::memory_order_relaxed);
+}
+
+void RequestCoalescer::finish(Flight *flight, const Result &result) {
+  std::vector<Async::Deferred<Result>> followers;
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (flight->done_)
+      return;
+
+    flight->done_ = true;
+    flights_.erase(flight->key_);
+    followers.swap(flight->followers_);
+  }
+
+  // Followers might write their response or invoke the handler right away,
+  // do not hold the lock while resolving them
+  for (auto &follower : followers)
+    follower.resolve(Result(result));
+}
+
+} // namespace Rest
+} // namespace Pistache
@@ -15,7 +15,9 @@ namespace Http {
 Endpoint::Options::Options()
     : threads_(1), flags_(), backlog_(Const::MaxBacklog),
       maxRequestSize_(Const::DefaultMaxRequestSize),
-      maxResponseSize_(Const::DefaultMaxResponseSize) {}
+      maxResponseSize_(Const::DefaultMaxResponseSize),
+      slowRequestThreshold_(0), slowPhaseThreshold_(0), tcpInfoInterval_(0),
+      tcpInfoPeers_(0) {}
 
 Endpoint::Options &Endpoint::Options::threads(int val) {
   threads_ = val;
@@ -51,6 +53,26 @@ Endpoint::Options &Endpoint::Options::maxResponseSize(size_t val) {
   return *this;
 }
 
+Endpoint::Options &
+Endpoint::Options::slowRequestThreshold(std::chrono::milliseconds val) {
+  slowRequestThreshold_ = val;
+  return *this;
+}
+
+Endpoint::Options &
+Endpoint::Options::slowPhaseThreshold(std::chrono::milliseconds val) {
+  slowPhaseThreshold_ = val;
+  return *this;
+}
+
+Endpoint::Options &
+Endpoint::Options::tcpInfoSampling(std::chrono::milliseconds interval,
+                                   size_t peers) {
+  tcpInfoInterval_ = interval;
+  tcpInfoPeers_ = peers;
+  return *this;
+}
+
 Endpoint::Endpoint() {}
 
 Endpoint::Endpoint(const Address &addr) : listener(addr) {}
@@ -59,12 +81,18 @@ void Endpoint::init(const Endpoint::Options &options) {
   listener.init(options.threads_, options.flags_, options.threadsName_);
   maxRequestSize_ = options.maxRequestSize_;
   maxResponseSize_ = options.maxResponseSize_;
+  slowRequestThreshold_ = options.slowRequestThreshold_;
+  slowPhaseThreshold_ = options.slowPhaseThreshold_;
+  listener.setTcpInfoSampling(options.tcpInfoInterval_,
+                              options.tcpInfoPeers_);
 }
 
 void Endpoint::setHandler(const std::shared_ptr<Handler> &handler) {
   handler_ = handler;
   handler_->setMaxRequestSize(maxRequestSize_);
   handler_->setMaxResponseSize(maxResponseSize_);
+  handler_->setSlowRequestThreshold(slowRequestThreshold_);
+  handler_->setSlowPhaseThreshold(slowPhaseThreshold_);
 }
 
 void Endpoint::bind() { listener.bind(); }
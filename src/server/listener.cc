@@ -3,12 +3,16 @@
 
 */
 
+#include <pistache/access_log.h>
 #include <pistache/common.h>
 #include <pistache/errors.h>
 #include <pistache/listener.h>
+#include <pistache/log.h>
+#include <pistache/metrics.h>
 #include <pistache/os.h>
 #include <pistache/peer.h>
 #include <pistache/ssl_wrappers.h>
+#include <pistache/trace.h>
 #include <pistache/transport.h>
 
 #include <arpa/inet.h>
@@ -71,12 +75,14 @@ void setSocketOptions(Fd fd, Flags<Options> options) {
 Listener::Listener()
     : addr_(), listen_fd(-1), backlog_(Const::MaxBacklog), shutdownFd(),
       poller(), options_(), workers_(Const::DefaultWorkers), workersName_(),
-      reactor_(), transportKey() {}
+      reactor_(Aio::Reactor::create()), transportKey(),
+      metrics_(std::make_shared<Metrics::ServerMetrics>()) {}
 
 Listener::Listener(const Address &address)
     : addr_(address), listen_fd(-1), backlog_(Const::MaxBacklog), shutdownFd(),
       poller(), options_(), workers_(Const::DefaultWorkers), workersName_(),
-      reactor_(), transportKey() {}
+      reactor_(Aio::Reactor::create()), transportKey(),
+      metrics_(std::make_shared<Metrics::ServerMetrics>()) {}
 
 Listener::~Listener() {
   if (isBound())
@@ -93,7 +99,8 @@ Listener::~Listener() {
 void Listener::init(size_t workers, Flags<Options> options,
                     const std::string &workersName, int backlog) {
   if (workers > hardware_concurrency()) {
-    // Log::warning() << "More workers than available cores"
+    PISTACHE_LOG_WARN("More workers (%zu) than available cores (%u)",
+                      workers, hardware_concurrency());
   }
 
   options_ = options;
@@ -172,12 +179,38 @@ void Listener::bind(const Address &address) {
   make_non_blocking(fd);
   poller.addFd(fd, Flags<Polling::NotifyOn>(Polling::NotifyOn::Read),
                Polling::Tag(fd));
+
+  // Bound here rather than when running, so that a shutdown() racing with
+  // the start of the thread of runThreaded() still reaches the poller
+  if (!shutdownFd.isBound())
+    shutdownFd.bind(poller);
   listen_fd = fd;
 
   auto transport = std::make_shared<Transport>(handler_);
 
-  reactor_.init(Aio::AsyncContext(workers_, workersName_));
-  transportKey = reactor_.addHandler(transport);
+  reactor_->init(Aio::AsyncContext(workers_, workersName_));
+  transportKey = reactor_->addHandler(transport);
+
+  auto handlers = reactor_->handlers(transportKey);
+  metrics_->setWorkers(handlers.size());
+  metrics_->setReactor(reactor_);
+  for (size_t i = 0; i < handlers.size(); ++i) {
+    auto worker = std::static_pointer_cast<Transport>(handlers[i]);
+    worker->setMetrics(metrics_->sharedWorker(i));
+  }
+
+  if (accessLog_) {
+    auto rings = accessLog_->addWorkers(handlers.size());
+    for (size_t i = 0; i < handlers.size(); ++i)
+      std::static_pointer_cast<Transport>(handlers[i])
+          ->setAccessLog(rings[i]);
+  }
+
+  if (tcpInfoInterval_.count() > 0) {
+    for (const auto &handler : handlers)
+      std::static_pointer_cast<Transport>(handler)->setTcpInfoSampling(
+          tcpInfoInterval_, tcpInfoPeers_);
+  }
 }
 
 bool Listener::isBound() const { return listen_fd != -1; }
@@ -207,35 +240,33 @@ Port Listener::getPort() const {
 }
 
 void Listener::run() {
-  shutdownFd.bind(poller);
-  reactor_.run();
+  reactor_->run();
 
   for (;;) {
     std::vector<Polling::Event> events;
     int ready_fds = poller.poll(events);
     
     if (ready_fds == -1) {
-      throw Error::system("Polling"); // YOSHI
+      throw Error::system("Polling");
     }
     
     for (const auto &event : events) {
       if (event.tag == shutdownFd.tag()) {
-        std::cout << "SHUTDOWN" << std::endl; // YOSHI
+        PISTACHE_LOG_DEBUG("Listener shutting down");
         return;
       }
 
       if (event.flags.hasFlag(Polling::NotifyOn::Read)) {
         auto fd = event.tag.value();
-        std::cout << "fd=" << fd << ", listen_fd=" << listen_fd << std::endl; // YOSHI
         
         if (static_cast<ssize_t>(fd) == listen_fd) {
           try {
-            std::cout << "newConnection()" << std::endl;
+            PISTACHE_LOG_TRACE("New connection on fd %d", listen_fd);
             handleNewConnection();
           } catch (SocketError &ex) {
-            std::cerr << "Server: " << ex.what() << std::endl;
+            PISTACHE_LOG_ERROR("Server: %s", ex.what());
           } catch (ServerError &ex) {
-            std::cerr << "Server: " << ex.what() << std::endl;
+            PISTACHE_LOG_ERROR("Server: %s", ex.what());
             throw;
           }
         }
@@ -251,70 +282,60 @@ void Listener::runThreaded() {
 void Listener::shutdown() {
   if (shutdownFd.isBound())
     shutdownFd.notify();
-  reactor_.shutdown();
+  reactor_->shutdown();
 }
 
 Async::Promise<Listener::Load>
 Listener::requestLoad(const Listener::Load &old) {
-  auto handlers = reactor_.handlers(transportKey);
-
-  std::vector<Async::Promise<rusage>> loads;
-  for (const auto &handler : handlers) {
-    auto transport = std::static_pointer_cast<Transport>(handler);
-    loads.push_back(transport->load());
+  Load res;
+  res.raw = reactor_->loopStats();
+  res.tick = std::chrono::system_clock::now();
+  res.global = 0.0;
+
+  // From the start of the workers for a first request
+  for (size_t i = 0; i < res.raw.size(); ++i) {
+    const double utilization =
+        i < old.raw.size() ? res.raw[i].utilizationSince(old.raw[i])
+                           : res.raw[i].utilization();
+    res.workers.push_back(utilization * 100.0);
+    res.global += utilization * 100.0;
   }
 
-  return Async::whenAll(std::begin(loads), std::end(loads))
-      .then(
-          [=](const std::vector<rusage> &usages) {
-            Load res;
-            res.raw = usages;
-
-            if (old.raw.empty()) {
-              res.global = 0.0;
-              for (size_t i = 0; i < handlers.size(); ++i)
-                res.workers.push_back(0.0);
-            } else {
-
-              auto totalElapsed = [](rusage usage) {
-                return static_cast<double>((usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec) +
-                                           (usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec));
-              };
-
-              auto now = std::chrono::system_clock::now();
-              auto diff = now - old.tick;
-              auto tick =
-                  std::chrono::duration_cast<std::chrono::microseconds>(diff);
-              res.tick = now;
-
-              for (size_t i = 0; i < usages.size(); ++i) {
-                auto last = old.raw[i];
-                const auto &usage = usages[i];
-
-                auto nowElapsed = totalElapsed(usage);
-                auto timeElapsed = nowElapsed - totalElapsed(last);
-
-                auto loadPct = (timeElapsed * 100.0) / static_cast<double>(tick.count());
-                res.workers.push_back(loadPct);
-                res.global += loadPct;
-              }
-
-              res.global /= static_cast<double>(usages.size());
-            }
-
-            return res;
-          },
-          Async::Throw);
+  if (!res.raw.empty())
+    res.global /= static_cast<double>(res.raw.size());
+
+  return Async::Promise<Load>::resolved(std::move(res));
 }
 
 Address Listener::address() const { return addr_; }
 
+std::shared_ptr<Aio::Reactor> Listener::reactor() const { return reactor_; }
+
+std::shared_ptr<Metrics::ServerMetrics> Listener::metrics() const {
+  return metrics_;
+}
+
+void Listener::setAccessLog(std::shared_ptr<Http::AccessLog> accessLog) {
+  accessLog_ = std::move(accessLog);
+}
+
+std::shared_ptr<Http::AccessLog> Listener::accessLog() const {
+  return accessLog_;
+}
+
+void Listener::setTcpInfoSampling(std::chrono::milliseconds interval,
+                                  size_t peers) {
+  tcpInfoInterval_ = interval;
+  tcpInfoPeers_ = peers;
+}
+
 Options Listener::options() const { return options_; }
 
 void Listener::handleNewConnection() {
   struct sockaddr_in peer_addr;
   int client_fd = acceptConnection(peer_addr);
-  
+  Trace::connectionAccepted(client_fd);
+
   void *ssl = nullptr;
 
 #ifdef PISTACHE_USE_SSL
@@ -365,7 +386,7 @@ int Listener::acceptConnection(struct sockaddr_in &peer_addr) const {
 }
 
 void Listener::dispatchPeer(const std::shared_ptr<Peer> &peer) {
-  auto handlers = reactor_.handlers(transportKey);
+  auto handlers = reactor_->handlers(transportKey);
   auto idx = peer->fd() % handlers.size();
   auto transport = std::static_pointer_cast<Transport>(handlers[idx]);
   
@@ -0,0 +1,350 @@
+/* metrics.cc
+
+   Implementation of the metrics of the workers and of their exposition
+*/
+
+#include <pistache/metrics.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace Pistache {
+namespace Metrics {
+
+namespace {
+
+const char *const ClassNames[StatusClasses] = {"1xx", "2xx", "3xx", "4xx",
+                                               "5xx"};
+
+// Buckets exposed to Prometheus, whose bounds are 1, 2 or 5 times a power
+// of ten: finer buckets would only multiply the series
+bool isExposedBound(uint64_t bound) {
+  while (bound >= 10 && bound % 10 == 0)
+    bound /= 10;
+  return bound == 1 || bound == 2 || bound == 5;
+}
+
+// Microseconds written as seconds, exactly and without trailing zeros
+std::string seconds(uint64_t micros) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%llu.%06llu",
+                static_cast<unsigned long long>(micros / 1000000),
+                static_cast<unsigned long long>(micros % 1000000));
+
+  std::string res(buf);
+  res.erase(res.find_last_not_of('0') + 1);
+  if (res.back() == '.')
+    res.pop_back();
+  return res;
+}
+
+std::string plain(uint64_t value) { return std::to_string(value); }
+
+// Cumulative buckets of a histogram, of microseconds written in seconds by
+// default
+void writeHistogram(std::ostream &os, const char *name,
+                    const std::string &labels,
+                    const LatencyHistogram::Counts &counts,
+                    std::string (*format)(uint64_t) = seconds) {
+  const std::string prefix = labels.empty() ? "" : labels + ",";
+  const std::string set = labels.empty() ? "" : "{" + labels + "}";
+
+  uint64_t cumulative = 0;
+  for (size_t bucket = 0; bucket < LatencyHistogram::Buckets - 1; ++bucket) {
+    cumulative += counts.buckets[bucket];
+    const auto bound = LatencyHistogram::upperBound(bucket);
+    if (!isExposedBound(bound))
+      continue;
+
+    os << name << "_bucket{" << prefix << "le=\"" << format(bound) << "\"} "
+       << cumulative << '\n';
+  }
+  os << name << "_bucket{" << prefix << "le=\"+Inf\"} " << counts.count
+     << '\n';
+  os << name << "_sum" << set << ' ' << format(counts.sum) << '\n';
+  os << name << "_count" << set << ' ' << counts.count << '\n';
+}
+
+std::string seconds(std::chrono::microseconds duration) {
+  return seconds(static_cast<uint64_t>(duration.count()));
+}
+
+} // namespace
+
+Snapshot::Snapshot()
+    : requestsByClass(), latencies(), parseErrors(0), bytesReceived(0),
+      bytesSent(0), connectionsAccepted(0), activeConnections(0),
+      writeQueueDepth(0), tcpRtt(), tcpRttVariance(), tcpCwnd(),
+      tcpUnacked(), tcpRetransmits(0) {}
+
+Snapshot &Snapshot::operator+=(const Snapshot &other) {
+  for (size_t i = 0; i < StatusClasses; ++i) {
+    requestsByClass[i] += other.requestsByClass[i];
+    latencies[i] += other.latencies[i];
+  }
+  parseErrors += other.parseErrors;
+  bytesReceived += other.bytesReceived;
+  bytesSent += other.bytesSent;
+  connectionsAccepted += other.connectionsAccepted;
+  activeConnections += other.activeConnections;
+  writeQueueDepth += other.writeQueueDepth;
+  tcpRtt += other.tcpRtt;
+  tcpRttVariance += other.tcpRttVariance;
+  tcpCwnd += other.tcpCwnd;
+  tcpUnacked += other.tcpUnacked;
+  tcpRetransmits += other.tcpRetransmits;
+  return *this;
+}
+
+uint64_t Snapshot::requests() const {
+  uint64_t total = 0;
+  for (auto count : requestsByClass)
+    total += count;
+  return total;
+}
+
+Worker::Worker()
+    : requests_(), latencies_(), parseErrors_(0), bytesReceived_(0),
+      bytesSent_(0), connectionsAccepted_(0), activeConnections_(0),
+      writeQueueDepth_(0), tcpRtt_(), tcpRttVariance_(), tcpCwnd_(),
+      tcpUnacked_(), tcpRetransmits_(0), pad_() {
+  for (auto &count : requests_)
+    count.store(0, std::memory_order_relaxed);
+}
+
+Snapshot Worker::snapshot() const {
+  Snapshot res;
+  for (size_t i = 0; i < StatusClasses; ++i) {
+    res.requestsByClass[i] = requests_[i].load(std::memory_order_relaxed);
+    res.latencies[i] = latencies_[i].counts();
+  }
+  res.parseErrors = parseErrors_.load(std::memory_order_relaxed);
+  res.bytesReceived = bytesReceived_.load(std::memory_order_relaxed);
+  res.bytesSent = bytesSent_.load(std::memory_order_relaxed);
+  res.connectionsAccepted =
+      connectionsAccepted_.load(std::memory_order_relaxed);
+  res.activeConnections = activeConnections_.load(std::memory_order_relaxed);
+  res.writeQueueDepth = writeQueueDepth_.load(std::memory_order_relaxed);
+  res.tcpRtt = tcpRtt_.counts();
+  res.tcpRttVariance = tcpRttVariance_.counts();
+  res.tcpCwnd = tcpCwnd_.counts();
+  res.tcpUnacked = tcpUnacked_.counts();
+  res.tcpRetransmits = tcpRetransmits_.load(std::memory_order_relaxed);
+  return res;
+}
+
+ServerMetrics::ServerMetrics() : workers_(), reactor_() {}
+
+size_t ServerMetrics::workers() const { return workers_.size(); }
+
+Worker &ServerMetrics::worker(size_t index) {
+  if (index >= workers_.size())
+    throw std::out_of_range("No such worker");
+  return *workers_[index];
+}
+
+std::shared_ptr<Worker> ServerMetrics::sharedWorker(size_t index) {
+  if (index >= workers_.size())
+    throw std::out_of_range("No such worker");
+  return workers_[index];
+}
+
+Snapshot ServerMetrics::snapshot() const {
+  Snapshot res;
+  for (const auto &worker : workers_)
+    res += worker->snapshot();
+  return res;
+}
+
+Snapshot ServerMetrics::snapshot(size_t worker) const {
+  if (worker >= workers_.size())
+    throw std::out_of_range("No such worker");
+  return workers_[worker]->snapshot();
+}
+
+void ServerMetrics::writePrometheus(std::ostream &os) const {
+  std::vector<Snapshot> perWorker;
+  perWorker.reserve(workers_.size());
+  Snapshot total;
+  for (const auto &worker : workers_) {
+    perWorker.push_back(worker->snapshot());
+    total += perWorker.back();
+  }
+
+  os << "# HELP pistache_http_requests_total HTTP responses sent, by status "
+        "class.\n"
+     << "# TYPE pistache_http_requests_total counter\n";
+  for (size_t i = 0; i < StatusClasses; ++i)
+    os << "pistache_http_requests_total{code=\"" << ClassNames[i] << "\"} "
+       << total.requestsByClass[i] << '\n';
+
+  os << "# HELP pistache_http_request_duration_seconds Time from a request "
+        "being parsed to its response being sent.\n"
+     << "# TYPE pistache_http_request_duration_seconds histogram\n";
+  for (size_t i = 0; i < StatusClasses; ++i)
+    writeHistogram(os, "pistache_http_request_duration_seconds",
+                   std::string("code=\"") + ClassNames[i] + "\"",
+                   total.latencies[i]);
+
+  os << "# HELP pistache_http_parse_errors_total Requests rejected by the "
+        "parser.\n"
+     << "# TYPE pistache_http_parse_errors_total counter\n"
+     << "pistache_http_parse_errors_total " << total.parseErrors << '\n';
+
+  auto perWorkerSeries = [&](const char *name, const char *type,
+                             const char *help, int64_t (*value)(
+                                                   const Snapshot &)) {
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << ' ' << type << '\n';
+    for (size_t i = 0; i < perWorker.size(); ++i)
+      os << name << "{worker=\"" << i << "\"} " << value(perWorker[i])
+         << '\n';
+  };
+
+  perWorkerSeries("pistache_received_bytes_total", "counter",
+                  "Bytes read from the peers.", [](const Snapshot &s) {
+                    return static_cast<int64_t>(s.bytesReceived);
+                  });
+  perWorkerSeries("pistache_sent_bytes_total", "counter",
+                  "Bytes written to the peers.", [](const Snapshot &s) {
+                    return static_cast<int64_t>(s.bytesSent);
+                  });
+  perWorkerSeries("pistache_connections_accepted_total", "counter",
+                  "Connections handed to the worker.", [](const Snapshot &s) {
+                    return static_cast<int64_t>(s.connectionsAccepted);
+                  });
+  perWorkerSeries("pistache_connections_active", "gauge",
+                  "Connections currently open.",
+                  [](const Snapshot &s) { return s.activeConnections; });
+  perWorkerSeries("pistache_write_queue_depth", "gauge",
+                  "Writes waiting for their peer to be writable.",
+                  [](const Snapshot &s) { return s.writeQueueDepth; });
+
+  os << "# HELP pistache_tcp_rtt_seconds Smoothed round-trip time of the "
+        "sampled peers.\n"
+     << "# TYPE pistache_tcp_rtt_seconds histogram\n";
+  writeHistogram(os, "pistache_tcp_rtt_seconds", "", total.tcpRtt);
+  os << "# HELP pistache_tcp_rtt_variance_seconds Mean deviation of the "
+        "round-trip time of the sampled peers.\n"
+     << "# TYPE pistache_tcp_rtt_variance_seconds histogram\n";
+  writeHistogram(os, "pistache_tcp_rtt_variance_seconds", "",
+                 total.tcpRttVariance);
+  os << "# HELP pistache_tcp_congestion_window_segments Congestion window "
+        "of the sampled peers.\n"
+     << "# TYPE pistache_tcp_congestion_window_segments histogram\n";
+  writeHistogram(os, "pistache_tcp_congestion_window_segments", "",
+                 total.tcpCwnd, plain);
+  os << "# HELP pistache_tcp_unacked_segments Segments in flight to the "
+        "sampled peers.\n"
+     << "# TYPE pistache_tcp_unacked_segments histogram\n";
+  writeHistogram(os, "pistache_tcp_unacked_segments", "", total.tcpUnacked,
+                 plain);
+  perWorkerSeries("pistache_tcp_retransmits_total", "counter",
+                  "Segments retransmitted to the sampled peers.",
+                  [](const Snapshot &s) {
+                    return static_cast<int64_t>(s.tcpRetransmits);
+                  });
+
+  auto reactor = reactor_.lock();
+  if (reactor)
+    writeLoops(os, reactor->loopStats());
+}
+
+void ServerMetrics::writeLoops(
+    std::ostream &os, const std::vector<Aio::LoopStats::Snapshot> &loops) {
+  using Loop = Aio::LoopStats::Snapshot;
+
+  auto series = [&](const char *name, const char *type, const char *help,
+                    std::string (*value)(const Loop &)) {
+    os << "# HELP " << name << ' ' << help << '\n'
+       << "# TYPE " << name << ' ' << type << '\n';
+    for (size_t i = 0; i < loops.size(); ++i)
+      os << name << "{worker=\"" << i << "\"} " << value(loops[i]) << '\n';
+  };
+
+  series("pistache_event_loop_busy_seconds_total", "counter",
+         "Time spent handling events.",
+         [](const Loop &loop) { return seconds(loop.busy); });
+  series("pistache_event_loop_idle_seconds_total", "counter",
+         "Time spent waiting for events.",
+         [](const Loop &loop) { return seconds(loop.idle); });
+  series("pistache_event_loop_current_busy_seconds", "gauge",
+         "Time spent handling the events of the current wakeup.",
+         [](const Loop &loop) { return seconds(loop.currentBusy); });
+  series("pistache_event_loop_wakeups_total", "counter",
+         "Returns from the poller with events.",
+         [](const Loop &loop) { return std::to_string(loop.wakeups); });
+  series("pistache_event_loop_events_total", "counter",
+         "Events returned by the poller.",
+         [](const Loop &loop) { return std::to_string(loop.events); });
+  series("pistache_event_loop_longest_callback_seconds", "gauge",
+         "Longest callback of a handler so far.",
+         [](const Loop &loop) { return seconds(loop.longestCallback); });
+
+  os << "# HELP pistache_event_loop_callback_duration_seconds Callbacks of "
+        "the handlers.\n"
+     << "# TYPE pistache_event_loop_callback_duration_seconds histogram\n";
+  for (size_t i = 0; i < loops.size(); ++i)
+    writeHistogram(os, "pistache_event_loop_callback_duration_seconds",
+                   "worker=\"" + std::to_string(i) + "\"", loops[i].callbacks);
+
+  os << "# HELP pistache_event_loop_queue_lag_seconds Time writes and "
+        "connections waited in the queues of the worker.\n"
+     << "# TYPE pistache_event_loop_queue_lag_seconds histogram\n";
+  for (size_t i = 0; i < loops.size(); ++i)
+    writeHistogram(os, "pistache_event_loop_queue_lag_seconds",
+                   "worker=\"" + std::to_string(i) + "\"", loops[i].queueLag);
+}
+
+Rest::Route::Handler ServerMetrics::route() {
+  std::weak_ptr<ServerMetrics> weak = shared_from_this();
+  return [weak](const Rest::Request &, Http::ResponseWriter response) {
+    auto metrics = weak.lock();
+    if (!metrics) {
+      response.send(Http::Code::Service_Unavailable);
+      return Rest::Route::Result::Ok;
+    }
+
+    std::ostringstream os;
+    metrics->writePrometheus(os);
+    response.send(Http::Code::Ok, os.str(), contentType());
+    return Rest::Route::Result::Ok;
+  };
+}
+
+Http::Mime::MediaType ServerMetrics::contentType() {
+  return Http::Mime::MediaType::fromString("text/plain; version=0.0.4");
+}
+
+void ServerMetrics::setWorkers(size_t count) {
+  workers_.clear();
+  workers_.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    workers_.push_back(std::make_shared<Worker>());
+}
+
+void ServerMetrics::setReactor(const std::shared_ptr<Aio::Reactor> &reactor) {
+  reactor_ = reactor;
+}
+
+} // namespace Metrics
+
+namespace Http {
+
+MetricsHandler::MetricsHandler(
+    std::shared_ptr<const Metrics::ServerMetrics> metrics)
+    : metrics_(std::move(metrics)) {}
+
+void MetricsHandler::onRequest(const Request & /*request*/,
+                               ResponseWriter response) {
+  std::ostringstream os;
+  metrics_->writePrometheus(os);
+  response.send(Code::Ok, os.str(), Metrics::ServerMetrics::contentType());
+}
+
+} // namespace Http
+} // namespace Pistache
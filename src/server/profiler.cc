@@ -0,0 +1,391 @@
+/* profiler.cc
+
+   Implementation of the sampling profiler
+*/
+
+#include <pistache/log.h>
+#include <pistache/profiler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+#endif /* __linux__ */
+
+namespace Pistache {
+namespace Profiler {
+
+namespace {
+
+#ifdef __linux__
+
+constexpr int MaxDepth = 64;
+// The handler of the signal and the trampoline of the kernel
+constexpr int SkippedFrames = 2;
+
+struct Sample {
+  pid_t tid;
+  int depth;
+  void *frames[MaxDepth];
+};
+
+struct Samples {
+  explicit Samples(size_t count) : slots(count), next(0) {}
+
+  std::vector<Sample> slots;
+  std::atomic<size_t> next;
+};
+
+std::atomic<Samples *> current(nullptr);
+// Handlers running, waited for before the samples are read
+std::atomic<int> inFlight(0);
+
+void onSignal(int /*signo*/, siginfo_t * /*info*/, void * /*context*/) {
+  const int savedErrno = errno;
+  inFlight.fetch_add(1);
+
+  auto *samples = current.load();
+  if (samples) {
+    const auto index = samples->next.fetch_add(1, std::memory_order_relaxed);
+    if (index < samples->slots.size()) {
+      auto &sample = samples->slots[index];
+      sample.tid = static_cast<pid_t>(::syscall(SYS_gettid));
+      sample.depth = ::backtrace(sample.frames, MaxDepth);
+    }
+  }
+
+  inFlight.fetch_sub(1, std::memory_order_release);
+  errno = savedErrno;
+}
+
+void installHandler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    // Loads the unwinder, which backtrace() would otherwise do, allocating,
+    // on its first call from the handler
+    void *frames[1];
+    ::backtrace(frames, 1);
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = onSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(SIGPROF, &action, nullptr) != 0)
+      throw std::runtime_error("Could not handle SIGPROF");
+  });
+}
+
+// Threads of the process by tid, with their name
+std::unordered_map<pid_t, std::string> listThreads(const std::string &name) {
+  std::unordered_map<pid_t, std::string> res;
+  const auto self = static_cast<pid_t>(::syscall(SYS_gettid));
+  // Names are truncated by the kernel
+  const auto wanted = name.substr(0, 15);
+
+  DIR *dir = ::opendir("/proc/self/task");
+  if (!dir)
+    return res;
+
+  while (auto *entry = ::readdir(dir)) {
+    const pid_t tid = static_cast<pid_t>(std::atoi(entry->d_name));
+    if (tid <= 0 || tid == self)
+      continue;
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+    std::string comm;
+    if (FILE *file = std::fopen(path, "r")) {
+      char buf[32] = {0};
+      if (std::fgets(buf, sizeof(buf), file))
+        comm = buf;
+      std::fclose(file);
+    }
+    if (!comm.empty() && comm.back() == '\n')
+      comm.pop_back();
+
+    if (wanted.empty() || comm == wanted)
+      res.emplace(tid, comm);
+  }
+
+  ::closedir(dir);
+  return res;
+}
+
+// Of the CPU time of a thread of the process, as pthread_getcpuclockid()
+// computes it from the tid
+clockid_t threadClock(pid_t tid) {
+  return static_cast<clockid_t>((~static_cast<unsigned int>(tid) << 3) | 6);
+}
+
+std::string hex(uintptr_t value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "0x%lx", static_cast<unsigned long>(value));
+  return buf;
+}
+
+std::string symbolize(void *pc) {
+  Dl_info info;
+  if (::dladdr(pc, &info) == 0)
+    return hex(reinterpret_cast<uintptr_t>(pc));
+
+  std::string res;
+  if (info.dli_sname) {
+    int status = 0;
+    char *demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    res = status == 0 && demangled ? demangled : info.dli_sname;
+    std::free(demangled);
+  } else {
+    const char *module = info.dli_fname ? info.dli_fname : "";
+    const char *slash = std::strrchr(module, '/');
+    res = std::string(slash ? slash + 1 : module) + "+" +
+          hex(reinterpret_cast<uintptr_t>(pc) -
+              reinterpret_cast<uintptr_t>(info.dli_fbase));
+  }
+
+  // Separators of the folded format
+  std::replace(res.begin(), res.end(), ';', ':');
+  std::replace(res.begin(), res.end(), '\n', ' ');
+  return res;
+}
+
+#endif /* __linux__ */
+
+std::mutex running;
+
+} // namespace
+
+Options::Options()
+    : duration_(std::chrono::seconds(10)), frequency_(99), threadsName_(),
+      maxSamples_(65536) {}
+
+Options &Options::duration(std::chrono::milliseconds val) {
+  duration_ = val;
+  return *this;
+}
+
+Options &Options::frequency(unsigned int val) {
+  frequency_ = val;
+  return *this;
+}
+
+Options &Options::threadsName(std::string val) {
+  threadsName_ = std::move(val);
+  return *this;
+}
+
+Options &Options::maxSamples(size_t val) {
+  maxSamples_ = val;
+  return *this;
+}
+
+Profile::Profile() : stacks(), samples(0), dropped(0), threads(0) {}
+
+void Profile::writeFolded(std::ostream &os) const {
+  for (const auto &stack : stacks)
+    os << stack.first << ' ' << stack.second << '\n';
+}
+
+Options options() { return Options(); }
+
+Profile profile(const Options &options) {
+#ifndef __linux__
+  (void)options;
+  throw std::runtime_error("The profiler is only supported on Linux");
+#else
+  if (options.frequency_ == 0 || options.frequency_ > 10000)
+    throw std::invalid_argument("Invalid profiling frequency");
+
+  std::unique_lock<std::mutex> guard(running, std::try_to_lock);
+  if (!guard.owns_lock())
+    throw std::runtime_error("A profile is already running");
+
+  installHandler();
+
+  Profile res;
+  const auto threads = listThreads(options.threadsName_);
+  res.threads = threads.size();
+
+  // Enough for every thread to be busy all along, within the maximum
+  const auto expected =
+      (static_cast<size_t>(options.duration_.count()) * options.frequency_ /
+           1000 +
+       1) *
+      std::max<size_t>(threads.size(), 1);
+  Samples samples(std::min(expected, options.maxSamples_));
+  current.store(&samples);
+
+  const long interval = 1000000000L / options.frequency_;
+  std::vector<timer_t> timers;
+  timers.reserve(threads.size());
+  for (const auto &thread : threads) {
+    struct sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = thread.first;
+
+    timer_t timer;
+    // The thread may have exited since it was listed
+    if (::timer_create(threadClock(thread.first), &event, &timer) != 0)
+      continue;
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval / 1000000000L;
+    spec.it_interval.tv_nsec = interval % 1000000000L;
+    spec.it_value = spec.it_interval;
+    ::timer_settime(timer, 0, &spec, nullptr);
+    timers.push_back(timer);
+  }
+
+  std::this_thread::sleep_for(options.duration_);
+
+  for (auto timer : timers)
+    ::timer_delete(timer);
+
+  // Signals already sent may still be handled
+  current.store(nullptr);
+  while (inFlight.load(std::memory_order_acquire) > 0)
+    std::this_thread::yield();
+
+  const auto taken = samples.next.load(std::memory_order_relaxed);
+  const auto kept = std::min(taken, samples.slots.size());
+  res.samples = kept;
+  res.dropped = taken - kept;
+
+  std::unordered_map<void *, std::string> names;
+  auto name = [&](void *pc) -> const std::string & {
+    auto it = names.find(pc);
+    if (it == names.end())
+      it = names.emplace(pc, symbolize(pc)).first;
+    return it->second;
+  };
+
+  std::string stack;
+  for (size_t i = 0; i < kept; ++i) {
+    const auto &sample = samples.slots[i];
+    auto thread = threads.find(sample.tid);
+    stack = thread != threads.end() ? thread->second
+                                    : "thread-" + std::to_string(sample.tid);
+    std::replace(stack.begin(), stack.end(), ';', ':');
+
+    for (int frame = sample.depth - 1; frame >= SkippedFrames; --frame) {
+      // Return addresses follow the call, the first frame was interrupted
+      auto *pc = static_cast<char *>(sample.frames[frame]);
+      if (frame > SkippedFrames)
+        --pc;
+      stack += ';';
+      stack += name(pc);
+    }
+    ++res.stacks[stack];
+  }
+
+  return res;
+#endif /* __linux__ */
+}
+
+namespace {
+
+void serve(const Http::Request &request, Http::ResponseWriter response,
+           const std::string &threadsName) {
+  using Http::ProfilerHandler;
+
+  auto options = Profiler::options().threadsName(threadsName);
+  std::chrono::milliseconds duration = ProfilerHandler::DefaultDuration;
+  try {
+    const auto &query = request.query();
+    auto seconds = query.get("seconds");
+    if (!seconds.isEmpty())
+      duration = std::chrono::milliseconds(
+          static_cast<long>(std::stod(seconds.get()) * 1000));
+    auto hz = query.get("hz");
+    if (!hz.isEmpty())
+      options.frequency(static_cast<unsigned int>(std::stoul(hz.get())));
+    auto threads = query.get("threads");
+    if (!threads.isEmpty())
+      options.threadsName(threads.get());
+  } catch (const std::exception &) {
+    response.send(Http::Code::Bad_Request, "Invalid profiling parameters");
+    return;
+  }
+
+  if (duration.count() <= 0 || duration > ProfilerHandler::MaxDuration) {
+    response.send(Http::Code::Bad_Request, "Invalid profiling duration");
+    return;
+  }
+  options.duration(duration);
+
+  // The worker keeps serving while the profile runs
+  auto writer = std::make_shared<Http::ResponseWriter>(std::move(response));
+  std::thread([options, writer] {
+    std::ostringstream os;
+    auto code = Http::Code::Ok;
+    try {
+      profile(options).writeFolded(os);
+    } catch (const std::invalid_argument &e) {
+      code = Http::Code::Bad_Request;
+      os << e.what();
+    } catch (const std::exception &e) {
+      code = Http::Code::Conflict;
+      os << e.what();
+    }
+
+    try {
+      writer->send(code, os.str(), MIME(Text, Plain));
+    } catch (const std::exception &e) {
+      PISTACHE_LOG_WARN("Could not send the profile: %s", e.what());
+    }
+  }).detach();
+}
+
+} // namespace
+
+Rest::Route::Handler route(std::string threadsName) {
+  return [threadsName](const Rest::Request &request,
+                       Http::ResponseWriter response) {
+    serve(request, std::move(response), threadsName);
+    return Rest::Route::Result::Ok;
+  };
+}
+
+} // namespace Profiler
+
+namespace Http {
+
+constexpr std::chrono::seconds ProfilerHandler::DefaultDuration;
+constexpr std::chrono::seconds ProfilerHandler::MaxDuration;
+
+ProfilerHandler::ProfilerHandler(std::string threadsName)
+    : threadsName_(std::move(threadsName)) {}
+
+void ProfilerHandler::onRequest(const Request &request,
+                                ResponseWriter response) {
+  Profiler::serve(request, std::move(response), threadsName_);
+}
+
+} // namespace Http
+} // namespace Pistache
@@ -0,0 +1,427 @@
+/* proxy.cc
+
+   Implementation of the reverse proxy
+*/
+
+#include <pistache/peer.h>
+#include <pistache/proxy.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace Pistache {
+namespace Http {
+
+namespace {
+// Hop-by-hop headers of RFC 7230, along with Proxy-Connection which older
+// clients send in place of Connection
+const char *const HopByHopHeaders[] = {
+    "Connection",          "Keep-Alive", "Proxy-Authenticate",
+    "Proxy-Authorization", "Proxy-Connection", "TE",
+    "Trailer",             "Transfer-Encoding", "Upgrade"};
+
+using Field = std::pair<std::string, std::string>;
+
+bool equalsIgnoreCase(const std::string &lhs, const std::string &rhs) {
+  return lhs.size() == rhs.size() &&
+         std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char a, char b) {
+           return std::tolower(static_cast<unsigned char>(a)) ==
+                  std::tolower(static_cast<unsigned char>(b));
+         });
+}
+
+// Every header of a message as it came in, typed or not
+std::vector<Field> fieldsOf(const Header::Collection &headers) {
+  std::vector<Field> fields;
+
+  for (const auto &header : headers.list()) {
+    std::ostringstream os;
+    header->write(os);
+    fields.emplace_back(header->name(), os.str());
+  }
+
+  for (const auto &raw : headers.rawList())
+    fields.emplace_back(raw.second.name(), raw.second.value());
+
+  return fields;
+}
+
+const std::string *findField(const std::vector<Field> &fields,
+                             const std::string &name) {
+  for (const auto &field : fields) {
+    if (equalsIgnoreCase(field.first, name))
+      return &field.second;
+  }
+
+  return nullptr;
+}
+
+// Headers of a message but the hop-by-hop ones and the ones it lists in its
+// Connection header
+std::vector<Field> endToEnd(const Header::Collection &headers) {
+  auto fields = fieldsOf(headers);
+
+  std::vector<std::string> listed;
+  auto connection = headers.tryGet<Header::Connection>();
+  if (connection)
+    listed = connection->options();
+
+  auto isHopByHop = [&](const Field &field) {
+    if (ReverseProxy::isHopByHop(field.first))
+      return true;
+
+    return std::any_of(listed.begin(), listed.end(),
+                       [&](const std::string &name) {
+                         return equalsIgnoreCase(field.first, name);
+                       });
+  };
+
+  fields.erase(std::remove_if(fields.begin(), fields.end(), isHopByHop),
+               fields.end());
+  return fields;
+}
+
+// Appends a value to the one of a list header, if there is one
+std::string appendTo(const std::vector<Field> &fields, const std::string &name,
+                     const std::string &value) {
+  const auto *current = findField(fields, name);
+  if (!current || current->empty())
+    return value;
+
+  return *current + ", " + value;
+}
+
+bool usesTls(const ResponseWriter &writer) {
+  auto peer = writer.peer();
+  return peer && peer->ssl() != nullptr;
+}
+
+// Throws the bytes left in a pipe away
+void drainPipe(Fd fd) {
+  char buffer[Const::MaxBuffer];
+  while (::read(fd, buffer, sizeof(buffer)) > 0)
+    ;
+}
+} // namespace
+
+/* State of a request being forwarded, shared by the callbacks of the stream
+ * of the upstream response. They all run on the thread of the client
+ * transport, but the writes to the downstream peer complete on the one of
+ * the server transport.
+ */
+struct ProxyExchange : public std::enable_shared_from_this<ProxyExchange> {
+  ProxyExchange(std::shared_ptr<ReverseProxy> proxy_, ResponseWriter writer_,
+                std::string via_)
+      : proxy(std::move(proxy_)), writer(std::move(writer_)),
+        via(std::move(via_)), pipe{-1, -1}, code(Code::Ok), chunked(false),
+        headSent(false), broken(false) {}
+
+  ~ProxyExchange() {
+    if (pipe[0] != -1) {
+      ::close(pipe[0]);
+      ::close(pipe[1]);
+    }
+  }
+
+  bool openPipe() {
+#ifdef __MACH__
+    return false;
+#else
+    return ::pipe2(pipe, O_NONBLOCK | O_CLOEXEC) == 0;
+#endif // __MACH__
+  }
+
+  void sendHead(const Response &response) {
+    auto fields = endToEnd(response.headers());
+
+    code = response.code();
+    chunked = !response.headers().has<Header::ContentLength>() &&
+              response.headers().has<Header::TransferEncoding>();
+
+    std::ostringstream os;
+    os << response.version() << " " << static_cast<int>(code) << " " << code
+       << crlf;
+
+    for (const auto &field : fields) {
+      if (!equalsIgnoreCase(field.first, "Via"))
+        os << field.first << ": " << field.second << crlf;
+    }
+
+    for (const auto &cookie : response.cookies())
+      os << "Set-Cookie: " << cookie << crlf;
+
+    // The body gets framed again, the upstream chunks are gone by now
+    if (chunked)
+      os << "Transfer-Encoding: chunked" << crlf;
+
+    os << "Via: " << appendTo(fields, "Via", via) << crlf;
+    os << crlf;
+
+    headSent = true;
+    send(os.str());
+  }
+
+  void sendData(const char *data, size_t size) {
+    if (size == 0 || broken)
+      return;
+
+    proxy->copiedBytes_.fetch_add(size, std::memory_order_relaxed);
+
+    if (!chunked) {
+      send(std::string(data, size));
+      return;
+    }
+
+    std::ostringstream os;
+    os << std::hex << size << crlf;
+    os.write(data, static_cast<std::streamsize>(size));
+    os << crlf;
+    send(os.str());
+  }
+
+  // The stream is paused until the pipe has been drained
+  void sendSpliced(size_t size, std::shared_ptr<BodyStream> stream) {
+    if (broken) {
+      drainPipe(pipe[0]);
+      stream->resume();
+      return;
+    }
+
+    proxy->splicedBytes_.fetch_add(size, std::memory_order_relaxed);
+
+    // Writes that fail are not always rejected, the entry is dropped when the
+    // peer goes away. The guard then lets the rest of the body through.
+    struct Guard {
+      Guard(std::shared_ptr<ProxyExchange> exchange_,
+            std::shared_ptr<BodyStream> stream_)
+          : exchange(std::move(exchange_)), stream(std::move(stream_)),
+            sent(false) {}
+
+      ~Guard() {
+        if (!sent) {
+          exchange->broken = true;
+          drainPipe(exchange->pipe[0]);
+        }
+        stream->resume();
+      }
+
+      std::shared_ptr<ProxyExchange> exchange;
+      std::shared_ptr<BodyStream> stream;
+      bool sent;
+    };
+
+    auto guard =
+        std::make_shared<Guard>(shared_from_this(), std::move(stream));
+    writer.sendPipe(pipe[0], size)
+        .then([guard](ssize_t) { guard->sent = true; },
+              [](std::exception_ptr) {});
+  }
+
+  void finish() {
+    proxy->forwarded_.fetch_add(1, std::memory_order_relaxed);
+
+    if (chunked && !broken)
+      send("0\r\n\r\n");
+  }
+
+  void fail(std::exception_ptr exc) {
+    if (headSent)
+      return;
+
+    proxy->failed_.fetch_add(1, std::memory_order_relaxed);
+
+    auto status = Code::Bad_Gateway;
+    try {
+      std::rethrow_exception(exc);
+    } catch (const std::exception &e) {
+      if (std::string(e.what()) == "Timeout")
+        status = Code::Gateway_Timeout;
+    } catch (...) {
+    }
+
+    writer.send(status);
+  }
+
+  void send(std::string data) {
+    const auto size = data.size();
+    auto self = shared_from_this();
+    writer.sendSerialized(code, RawBuffer(std::move(data), size))
+        .then([](ssize_t) {},
+              [self](std::exception_ptr) { self->broken = true; });
+  }
+
+  std::shared_ptr<ReverseProxy> proxy;
+  ResponseWriter writer;
+  // Entry of the proxy in the Via header
+  std::string via;
+  Fd pipe[2];
+  Code code;
+  bool chunked;
+  std::atomic<bool> headSent;
+  // Set once a write to the downstream peer failed
+  std::atomic<bool> broken;
+};
+
+ReverseProxy::Options::Options()
+    : splice_(true), via_("pistache"), forwardedFor_(true), stripPrefix_(),
+      timeout_(std::chrono::seconds(30)) {}
+
+ReverseProxy::Options &ReverseProxy::Options::splice(bool val) {
+  splice_ = val;
+  return *this;
+}
+
+ReverseProxy::Options &ReverseProxy::Options::via(std::string name) {
+  via_ = std::move(name);
+  return *this;
+}
+
+ReverseProxy::Options &ReverseProxy::Options::forwardedFor(bool val) {
+  forwardedFor_ = val;
+  return *this;
+}
+
+ReverseProxy::Options &ReverseProxy::Options::stripPrefix(std::string prefix) {
+  stripPrefix_ = std::move(prefix);
+  return *this;
+}
+
+ReverseProxy::Options &
+ReverseProxy::Options::timeout(std::chrono::milliseconds val) {
+  timeout_ = val;
+  return *this;
+}
+
+ReverseProxy::ReverseProxy(std::shared_ptr<Client> client, std::string upstream,
+                           const Options &options)
+    : client_(std::move(client)), upstream_(std::move(upstream)),
+      options_(options), forwarded_(0), failed_(0), splicedBytes_(0),
+      copiedBytes_(0) {
+  if (!client_)
+    throw std::invalid_argument("Invalid client");
+
+  // The path of the requests comes with its own slash
+  while (!upstream_.empty() && upstream_.back() == '/')
+    upstream_.pop_back();
+}
+
+std::shared_ptr<ReverseProxy>
+ReverseProxy::create(std::shared_ptr<Client> client, std::string upstream,
+                     const Options &options) {
+  return std::make_shared<ReverseProxy>(std::move(client), std::move(upstream),
+                                        options);
+}
+
+void ReverseProxy::forward(const Request &request, ResponseWriter response) {
+  std::string path = request.resource();
+  const auto &prefix = options_.stripPrefix_;
+  if (!prefix.empty() && path.compare(0, prefix.size(), prefix) == 0)
+    path.erase(0, prefix.size());
+  if (path.empty() || path[0] != '/')
+    path.insert(path.begin(), '/');
+
+  const bool splice = options_.splice_ && !usesTls(response) &&
+                      upstream_.compare(0, 8, "https://") != 0;
+
+  const auto via = "1.1 " + options_.via_;
+  auto exchange = std::make_shared<ProxyExchange>(
+      shared_from_this(), std::move(response), via);
+
+  auto builder = client_->get(upstream_ + path);
+  builder.method(request.method())
+      .params(request.query())
+      .timeout(options_.timeout_);
+
+  // The client writes the Host and Content-Length headers of its own
+  auto fields = endToEnd(request.headers());
+  for (const auto &field : fields) {
+    if (equalsIgnoreCase(field.first, Header::Host::Name)) {
+      builder.header(Header::Raw("X-Forwarded-Host", field.second));
+    } else if (!equalsIgnoreCase(field.first, Header::ContentLength::Name) &&
+               !equalsIgnoreCase(field.first, "X-Forwarded-For") &&
+               !equalsIgnoreCase(field.first, "Via")) {
+      builder.header(Header::Raw(field.first, field.second));
+    }
+  }
+
+  if (options_.forwardedFor_) {
+    const auto client = request.address().host();
+    builder.header(
+        Header::Raw("X-Forwarded-For",
+                    appendTo(fields, "X-Forwarded-For", client)));
+  } else if (const auto *forwardedFor = findField(fields, "X-Forwarded-For")) {
+    builder.header(Header::Raw("X-Forwarded-For", *forwardedFor));
+  }
+
+  builder.header(Header::Raw("X-Forwarded-Proto",
+                             usesTls(exchange->writer) ? "https" : "http"));
+  builder.header(Header::Raw("Via", appendTo(fields, "Via", via)));
+
+  for (const auto &cookie : request.cookies())
+    builder.cookie(cookie);
+
+  // The server hands the body over once it is complete, it is sent as is
+  if (!request.body().empty())
+    builder.body(request.body());
+
+  auto stream = BodyStream::create(
+      [exchange](const char *data, size_t size) {
+        exchange->sendData(data, size);
+      },
+      [exchange](const Response &upstream) { exchange->sendHead(upstream); });
+
+  if (splice && exchange->openPipe()) {
+    std::weak_ptr<BodyStream> weakStream = stream;
+    stream->spliceTo(exchange->pipe[1], [exchange, weakStream](size_t size) {
+      auto stream = weakStream.lock();
+      if (stream)
+        exchange->sendSpliced(size, std::move(stream));
+    });
+  }
+
+  builder.stream(stream);
+  builder.send().then([exchange](Response) { exchange->finish(); },
+                      [exchange](std::exception_ptr exc) {
+                        exchange->fail(std::move(exc));
+                      });
+}
+
+Rest::Route::Handler ReverseProxy::route() {
+  auto self = shared_from_this();
+  return [self](const Rest::Request &request, ResponseWriter response) {
+    self->forward(request, std::move(response));
+    return Rest::Route::Result::Ok;
+  };
+}
+
+ReverseProxy::Stats ReverseProxy::stats() const {
+  Stats stats;
+  stats.forwarded = forwarded_.load();
+  stats.failed = failed_.load();
+  stats.splicedBytes = splicedBytes_.load();
+  stats.copiedBytes = copiedBytes_.load();
+  return stats;
+}
+
+bool ReverseProxy::isHopByHop(const std::string &name) {
+  return std::any_of(std::begin(HopByHopHeaders), std::end(HopByHopHeaders),
+                     [&](const char *header) {
+                       return equalsIgnoreCase(name, header);
+                     });
+}
+
+ProxyHandler::ProxyHandler(std::shared_ptr<ReverseProxy> proxy)
+    : proxy_(std::move(proxy)) {}
+
+void ProxyHandler::onRequest(const Request &request, ResponseWriter response) {
+  proxy_->forward(request, std::move(response));
+}
+
+} // namespace Http
+} // namespace Pistache
@@ -0,0 +1,350 @@
+/* response_cache.cc
+
+   Implementation of the in-memory response cache
+*/
+
+#include <pistache/response_cache.h>
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace Pistache {
+namespace Rest {
+
+namespace {
+// Rough bookkeeping cost of an entry on top of its key and wire bytes
+constexpr size_t EntryOverhead = 128;
+
+// Status codes that are cacheable by default (RFC 7231 6.1)
+bool isCacheableCode(Http::Code code) {
+  switch (code) {
+  case Http::Code::Ok:
+  case Http::Code::NonAuthoritative_Information:
+  case Http::Code::No_Content:
+  case Http::Code::Multiple_Choices:
+  case Http::Code::Moved_Permanently:
+  case Http::Code::Not_Found:
+  case Http::Code::Method_Not_Allowed:
+  case Http::Code::Gone:
+  case Http::Code::RequestURI_Too_Long:
+  case Http::Code::Not_Implemented:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Freshness lifetime granted by the Cache-Control header of a response,
+// zero if the response must not be stored
+std::chrono::seconds freshnessLifetime(const Http::Response &response) {
+  auto cc = response.headers().tryGet<Http::Header::CacheControl>();
+  if (!cc)
+    return std::chrono::seconds(0);
+
+  std::chrono::seconds maxAge(0);
+  std::chrono::seconds sMaxAge(0);
+  bool hasSMaxAge = false;
+
+  for (const auto &directive : cc->directives()) {
+    switch (directive.directive()) {
+    case Http::CacheDirective::NoStore:
+    case Http::CacheDirective::NoCache:
+    case Http::CacheDirective::Private:
+      return std::chrono::seconds(0);
+    case Http::CacheDirective::MaxAge:
+      maxAge = directive.delta();
+      break;
+    case Http::CacheDirective::SMaxAge:
+      sMaxAge = directive.delta();
+      hasSMaxAge = true;
+      break;
+    default:
+      break;
+    }
+  }
+
+  // We are a shared cache, s-maxage takes precedence over max-age
+  return hasSMaxAge ? sMaxAge : maxAge;
+}
+
+std::string headerValue(const Http::Header::Collection &headers,
+                        const std::string &name) {
+  auto header = headers.tryGet(name);
+  if (header) {
+    std::ostringstream oss;
+    header->write(oss);
+    return oss.str();
+  }
+
+  auto raw = headers.tryGetRaw(name);
+  if (!raw.isEmpty())
+    return raw.get().value();
+
+  return std::string();
+}
+} // namespace
+
+ResponseCache::Options::Options()
+    : maxBytes_(64 * 1024 * 1024), shards_(16), queryParameters_() {}
+
+ResponseCache::Options &ResponseCache::Options::maxBytes(size_t val) {
+  maxBytes_ = val;
+  return *this;
+}
+
+ResponseCache::Options &ResponseCache::Options::shards(size_t val) {
+  shards_ = val;
+  return *this;
+}
+
+ResponseCache::Options &
+ResponseCache::Options::queryParameters(std::vector<std::string> val) {
+  queryParameters_ = std::move(val);
+  return *this;
+}
+
+ResponseCache::ResponseCache(const Options &options)
+    : options_(options), shardBudget_(0), shards_(), hits_(0), misses_(0) {
+  if (options_.shards_ == 0)
+    throw std::invalid_argument("Invalid number of shards");
+
+  std::sort(options_.queryParameters_.begin(),
+            options_.queryParameters_.end());
+
+  shardBudget_ = options_.maxBytes_ / options_.shards_;
+  shards_.reset(new Shard[options_.shards_]);
+}
+
+std::shared_ptr<ResponseCache> ResponseCache::create(const Options &options) {
+  return std::make_shared<ResponseCache>(options);
+}
+
+bool ResponseCache::isCacheable(const Http::Request &request) {
+  return request.method() == Http::Method::Get ||
+         request.method() == Http::Method::Head;
+}
+
+bool ResponseCache::isShareable(const Http::Response &response) {
+  if (!isCacheableCode(response.code()))
+    return false;
+
+  // Never share a response that carries cookies
+  if (response.cookies().begin() != response.cookies().end())
+    return false;
+
+  auto cc = response.headers().tryGet<Http::Header::CacheControl>();
+  if (cc) {
+    for (const auto &directive : cc->directives()) {
+      if (directive.directive() == Http::CacheDirective::NoStore ||
+          directive.directive() == Http::CacheDirective::Private)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+std::string ResponseCache::requestKey(const Http::Request &request,
+                                      const std::string &path) const {
+  return requestKey(request, path, options_.queryParameters_);
+}
+
+std::string
+ResponseCache::requestKey(const Http::Request &request, const std::string &path,
+                          const std::vector<std::string> &queryParameters) {
+  std::string key(Http::methodString(request.method()));
+  key += ' ';
+  key += path;
+
+  const auto &query = request.query();
+  std::vector<std::pair<std::string, std::string>> params;
+  if (queryParameters.empty()) {
+    params.assign(query.parameters_begin(), query.parameters_end());
+    std::sort(params.begin(), params.end());
+  } else {
+    for (const auto &name : queryParameters) {
+      auto value = query.get(name);
+      if (!value.isEmpty())
+        params.emplace_back(name, value.get());
+    }
+  }
+
+  char sep = '?';
+  for (const auto &param : params) {
+    key += sep;
+    key += param.first;
+    key += '=';
+    key += param.second;
+    sep = '&';
+  }
+
+  return key;
+}
+
+std::shared_ptr<const ResponseCache::CachedResponse>
+ResponseCache::lookup(const std::string &key, const Http::Request &request) {
+  auto &shard = shardFor(key);
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  auto variants = shard.variants.find(key);
+  if (variants == std::end(shard.variants)) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  auto it = shard.index.find(variantKey(key, variants->second.fields, request));
+  if (it == std::end(shard.index)) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  auto entry = it->second;
+  if (entry->response->expires <= Clock::now()) {
+    evict(shard, entry);
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+
+  return entry->response;
+}
+
+bool ResponseCache::store(const std::string &key, const Http::Request &request,
+                          const Http::Response &response,
+                          const RawBuffer &wire) {
+  if (!isShareable(response))
+    return false;
+
+  const auto lifetime = freshnessLifetime(response);
+  if (lifetime.count() <= 0)
+    return false;
+
+  std::vector<std::string> fields;
+  auto vary = response.headers().tryGet<Http::Header::Vary>();
+  if (vary) {
+    if (vary->varyOnAll())
+      return false;
+
+    fields = vary->fields();
+    std::sort(fields.begin(), fields.end());
+  }
+
+  auto fullKey = variantKey(key, fields, request);
+  const size_t bytes = fullKey.size() + wire.size() + EntryOverhead;
+  if (bytes > shardBudget_)
+    return false;
+
+  auto cached = std::make_shared<CachedResponse>(response.code(), wire,
+                                                 Clock::now() + lifetime);
+
+  auto &shard = shardFor(key);
+  std::lock_guard<std::mutex> guard(shard.lock);
+
+  auto existing = shard.index.find(fullKey);
+  if (existing != std::end(shard.index))
+    evict(shard, existing->second);
+
+  // A response with different Vary fields replaces every stored variant
+  auto variants = shard.variants.find(key);
+  if (variants != std::end(shard.variants) &&
+      variants->second.fields != fields) {
+    for (auto it = shard.lru.begin(); it != shard.lru.end();) {
+      auto current = it++;
+      if (current->baseKey == key)
+        evict(shard, current);
+    }
+  }
+
+  while (shard.bytes + bytes > shardBudget_ && !shard.lru.empty())
+    evict(shard, std::prev(shard.lru.end()));
+
+  auto &entryVariants = shard.variants[key];
+  entryVariants.fields = std::move(fields);
+  ++entryVariants.entries;
+
+  shard.lru.push_front(Entry{fullKey, key, std::move(cached), bytes});
+  shard.index[std::move(fullKey)] = shard.lru.begin();
+  shard.bytes += bytes;
+
+  return true;
+}
+
+void ResponseCache::clear() {
+  for (size_t i = 0; i < options_.shards_; ++i) {
+    auto &shard = shards_[i];
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.lru.clear();
+    shard.index.clear();
+    shard.variants.clear();
+    shard.bytes = 0;
+  }
+}
+
+size_t ResponseCache::bytes() const {
+  size_t total = 0;
+  for (size_t i = 0; i < options_.shards_; ++i) {
+    auto &shard = shards_[i];
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    total += shard.bytes;
+  }
+
+  return total;
+}
+
+size_t ResponseCache::entries() const {
+  size_t total = 0;
+  for (size_t i = 0; i < options_.shards_; ++i) {
+    auto &shard = shards_[i];
+
+    std::lock_guard<std::mutex> guard(shard.lock);
+    total += shard.index.size();
+  }
+
+  return total;
+}
+
+uint64_t ResponseCache::hits() const {
+  return hits_.load(std::memory_order_relaxed);
+}
+
+uint64_t ResponseCache::misses() const {
+  return misses_.load(std::memory_order_relaxed);
+}
+
+std::string ResponseCache::variantKey(const std::string &key,
+                                      const std::vector<std::string> &fields,
+                                      const Http::Request &request) {
+  std::string fullKey(key);
+  for (const auto &field : fields) {
+    fullKey += '\n';
+    fullKey += headerValue(request.headers(), field);
+  }
+
+  return fullKey;
+}
+
+ResponseCache::Shard &ResponseCache::shardFor(const std::string &key) const {
+  // Variants of a same request key always live in the same shard
+  return shards_[std::hash<std::string>()(key) % options_.shards_];
+}
+
+void ResponseCache::evict(Shard &shard, std::list<Entry>::iterator it) {
+  auto variants = shard.variants.find(it->baseKey);
+  if (variants != std::end(shard.variants) && --variants->second.entries == 0)
+    shard.variants.erase(variants);
+
+  shard.bytes -= it->bytes;
+  shard.index.erase(it->key);
+  shard.lru.erase(it);
+}
+
+} // namespace Rest
+} // namespace Pistache
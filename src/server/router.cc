@@ -381,6 +381,82 @@ void Router::addCustomHandler(Route::Handler handler) {
   customHandlers.push_back(std::move(handler));
 }
 
+template <typename T>
+void Router::addResourcePrefix(ResourcePrefixes<T> &prefixes,
+                               const std::string &resource,
+                               std::shared_ptr<T> value) {
+  if (resource.empty())
+    throw std::runtime_error("Invalid zero-length URL.");
+
+  auto sanitized = SegmentTreeNode::sanitizeResource(resource);
+  if (!sanitized.empty() && sanitized.back() == '*') {
+    sanitized.pop_back();
+    if (!sanitized.empty() && sanitized.back() == '/')
+      sanitized.pop_back();
+  }
+
+  auto it = std::find_if(
+      prefixes.begin(), prefixes.end(),
+      [&](const std::pair<std::string, std::shared_ptr<T>> &entry) {
+        return entry.first == sanitized;
+      });
+  if (it != std::end(prefixes)) {
+    it->second = std::move(value);
+    return;
+  }
+
+  prefixes.emplace_back(std::move(sanitized), std::move(value));
+  std::stable_sort(prefixes.begin(), prefixes.end(),
+                   [](const std::pair<std::string, std::shared_ptr<T>> &lhs,
+                      const std::pair<std::string, std::shared_ptr<T>> &rhs) {
+                     return lhs.first.size() > rhs.first.size();
+                   });
+}
+
+template <typename T>
+std::shared_ptr<T>
+Router::findResourcePrefix(const ResourcePrefixes<T> &prefixes,
+                           const std::string &path) {
+  for (const auto &entry : prefixes) {
+    const auto &prefix = entry.first;
+    if (prefix.empty())
+      return entry.second;
+
+    if (path.compare(0, prefix.size(), prefix) != 0)
+      continue;
+
+    if (path.size() == prefix.size() || path[prefix.size()] == '/')
+      return entry.second;
+  }
+
+  return nullptr;
+}
+
+void Router::addAdmissionController(
+    const std::string &resource,
+    std::shared_ptr<AdmissionController> controller) {
+  if (!controller)
+    throw std::runtime_error("Invalid null admission controller.");
+
+  addResourcePrefix(admissionControllers, resource, std::move(controller));
+}
+
+void Router::addResponseCache(const std::string &resource,
+                              std::shared_ptr<ResponseCache> cache) {
+  if (!cache)
+    throw std::runtime_error("Invalid null response cache.");
+
+  addResourcePrefix(responseCaches, resource, std::move(cache));
+}
+
+void Router::addRequestCoalescer(const std::string &resource,
+                                 std::shared_ptr<RequestCoalescer> coalescer) {
+  if (!coalescer)
+    throw std::runtime_error("Invalid null request coalescer.");
+
+  addResourcePrefix(requestCoalescers, resource, std::move(coalescer));
+}
+
 void Router::addNotFoundHandler(Route::Handler handler) {
   notFoundHandler = std::move(handler);
 }
@@ -405,11 +481,9 @@ Route::Status Router::route(const Http::Request &req,
 
   auto route = std::get<0>(result);
   if (route != nullptr) {
-    auto params = std::get<1>(result);
-    auto splats = std::get<2>(result);
-    route->invokeHandler(Request(req, std::move(params), std::move(splats)),
-                         std::move(response));
-    return Route::Status::Match;
+    return invokeRoute(route, req, sanitized, std::move(std::get<1>(result)),
+                       std::move(std::get<2>(result)), std::move(response),
+                       true);
   }
 
   for (const auto &handler : customHandlers) {
@@ -453,6 +527,95 @@ Route::Status Router::route(const Http::Request &req,
   return Route::Status::NotFound;
 }
 
+Route::Status Router::invokeRoute(const std::shared_ptr<Route> &route,
+                                  const Http::Request &req,
+                                  const std::string &path,
+                                  std::vector<TypedParam> params,
+                                  std::vector<TypedParam> splats,
+                                  Http::ResponseWriter response,
+                                  bool coalesce) {
+  std::shared_ptr<ResponseCache> cache;
+  std::string cacheKey;
+  if (!responseCaches.empty() && ResponseCache::isCacheable(req)) {
+    cache = findResourcePrefix(responseCaches, path);
+    if (cache) {
+      cacheKey = cache->requestKey(req, path);
+      auto cached = cache->lookup(cacheKey, req);
+      if (cached) {
+        response.sendSerialized(cached->code, cached->wire);
+        return Route::Status::Match;
+      }
+    }
+  }
+
+  if (coalesce && !requestCoalescers.empty() &&
+      ResponseCache::isCacheable(req)) {
+    auto coalescer = findResourcePrefix(requestCoalescers, path);
+    if (coalescer) {
+      const auto key = cache ? cacheKey
+                             : ResponseCache::requestKey(
+                                   req, path, std::vector<std::string>());
+
+      auto flight = coalescer->lead(key);
+      if (!flight) {
+        // An identical request is already being handled, wait for its
+        // response. If it turns out that it can not be shared, handle the
+        // request as usual.
+        auto writer =
+            std::make_shared<Http::ResponseWriter>(std::move(response));
+        coalescer->follow(key).then(
+            [=](const RequestCoalescer::Result &shared) {
+              if (shared && shared->matches(req)) {
+                writer->sendSerialized(shared->code, shared->wire);
+                return;
+              }
+
+              invokeRoute(route, req, path, params, splats,
+                          std::move(*writer), false);
+            },
+            Async::IgnoreException);
+
+        return Route::Status::Match;
+      }
+
+      response.attach(flight);
+      response.observeWire([flight, req](const Http::Response &resp,
+                                         const RawBuffer &wire) {
+        flight->complete(req, resp, wire);
+      });
+    }
+  }
+
+  if (!admissionControllers.empty()) {
+    auto controller = findResourcePrefix(admissionControllers, path);
+    if (controller) {
+      auto ticket = controller->tryAdmit();
+      if (!ticket) {
+        response.headers().add<Http::Header::RetryAfter>(
+            controller->retryAfter());
+        response.send(Http::Code::Service_Unavailable,
+                      Http::codeString(Http::Code::Service_Unavailable));
+        return Route::Status::Rejected;
+      }
+
+      // The slot is released once the last copy of the writer is gone,
+      // which also covers handlers that answer asynchronously
+      response.attach(std::move(ticket));
+    }
+  }
+
+  if (cache) {
+    response.observeWire([cache, cacheKey, req](const Http::Response &resp,
+                                                const RawBuffer &wire) {
+      cache->store(cacheKey, req, resp, wire);
+    });
+  }
+
+  route->invokeHandler(Request(req, std::move(params), std::move(splats)),
+                       std::move(response));
+  return Route::Status::Match;
+}
+
 void Router::addRoute(Http::Method method, const std::string &resource,
                       Route::Handler handler) {
   if (resource.empty())
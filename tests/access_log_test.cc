@@ -0,0 +1,232 @@
+#include <pistache/access_log.h>
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+struct AccessLogTestHandler : public Http::Handler {
+  HTTP_PROTOTYPE(AccessLogTestHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() == "/ok") {
+      writer.send(Http::Code::Ok, "ok");
+    } else if (request.resource() == "/stream") {
+      auto stream = writer.stream(Http::Code::Ok);
+      stream << "first";
+      stream.flush();
+      stream << "second";
+      stream.ends();
+    } else {
+      writer.send(Http::Code::Not_Found);
+    }
+  }
+};
+
+std::shared_ptr<Http::Endpoint>
+serve(const std::shared_ptr<Http::AccessLog> &accessLog) {
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options().threads(2).flags(
+      Tcp::Options::ReuseAddr));
+  server->setHandler(Http::make_handler<AccessLogTestHandler>());
+  server->setAccessLog(accessLog);
+  server->serveThreaded();
+  return server;
+}
+
+using Tests::get;
+
+// Entries are recorded once their response is written, which may be right
+// after the client got it
+template <typename Pred> bool eventually(Pred pred) {
+  for (int i = 0; i < 200; ++i) {
+    if (pred())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return pred();
+}
+
+std::vector<std::string> readLines(const std::string &path) {
+  std::ifstream file(path);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(file, line))
+    lines.push_back(line);
+  return lines;
+}
+
+struct TempPath {
+  TempPath() {
+    char pattern[] = "/tmp/pistache-access-log-XXXXXX";
+    const int fd = ::mkstemp(pattern);
+    ::close(fd);
+    path = pattern;
+  }
+
+  ~TempPath() {
+    ::unlink(path.c_str());
+    for (int i = 1; i <= 5; ++i)
+      ::unlink((path + "." + std::to_string(i)).c_str());
+  }
+
+  bool exists(const std::string &suffix = "") const {
+    return ::access((path + suffix).c_str(), F_OK) == 0;
+  }
+
+  std::string path;
+};
+
+} // namespace
+
+TEST(access_log_test, records_responses) {
+  TempPath file;
+  auto accessLog = std::make_shared<Http::AccessLog>(
+      Http::AccessLog::options().path(file.path).headers(
+          {"User-Agent", "X-Request-Id", "Missing"}));
+  auto server = serve(accessLog);
+  const auto port = server->getPort();
+
+  const auto ok = get(port, "/ok",
+                      "User-Agent: access-log-test\r\n"
+                      "X-Request-Id: \"quoted\"\r\n");
+  ASSERT_NE(ok.find("200 OK"), std::string::npos);
+  ASSERT_NE(get(port, "/missing").find("404"), std::string::npos);
+
+  EXPECT_TRUE(eventually([&] {
+    accessLog->flush();
+    return accessLog->written() == 2;
+  }));
+  EXPECT_EQ(accessLog->dropped(), 0u);
+
+  // The workers are drained one after the other, not in the order of the
+  // requests
+  auto lines = readLines(file.path);
+  ASSERT_EQ(lines.size(), 2u);
+  if (lines[0].find("\"/ok\"") == std::string::npos)
+    std::swap(lines[0], lines[1]);
+
+  const auto &first = lines[0];
+  EXPECT_EQ(first.find("{\"time\":\""), 0u);
+  EXPECT_NE(first.find("\"peer\":\"127.0.0.1\""), std::string::npos);
+  EXPECT_NE(first.find("\"method\":\"GET\",\"resource\":\"/ok\","
+                       "\"version\":\"HTTP/1.1\",\"status\":200,"
+                       "\"bytes\":" +
+                       std::to_string(ok.size()) + ","),
+            std::string::npos);
+  EXPECT_NE(first.find("\"latency_us\":"), std::string::npos);
+  EXPECT_NE(first.find("\"headers\":{\"User-Agent\":\"access-log-test\","
+                       "\"X-Request-Id\":\"\\\"quoted\\\"\"}}"),
+            std::string::npos);
+
+  EXPECT_NE(lines[1].find("\"resource\":\"/missing\""), std::string::npos);
+  EXPECT_NE(lines[1].find("\"status\":404"), std::string::npos);
+  EXPECT_NE(lines[1].find("\"headers\":{}"), std::string::npos);
+
+  server->shutdown();
+}
+
+TEST(access_log_test, rotates_files) {
+  TempPath file;
+  auto accessLog = std::make_shared<Http::AccessLog>(
+      Http::AccessLog::options().path(file.path).maxFileSize(200).maxFiles(
+          2));
+  auto server = serve(accessLog);
+
+  // Every line is longer than half the maximum size, each flush rotates
+  for (uint64_t i = 0; i < 4; ++i) {
+    get(server->getPort(), "/ok");
+    EXPECT_TRUE(eventually([&] {
+      accessLog->flush();
+      return accessLog->written() == i + 1;
+    }));
+  }
+
+  EXPECT_TRUE(file.exists());
+  EXPECT_TRUE(file.exists(".1"));
+  EXPECT_TRUE(file.exists(".2"));
+  EXPECT_FALSE(file.exists(".3"));
+  EXPECT_EQ(readLines(file.path).size(), 1u);
+  EXPECT_EQ(readLines(file.path + ".1").size(), 1u);
+  EXPECT_EQ(accessLog->written(), 4u);
+
+  server->shutdown();
+}
+
+TEST(access_log_test, drops_entries_when_full) {
+  TempPath file;
+  // Nothing is written before the explicit flush
+  auto accessLog = std::make_shared<Http::AccessLog>(
+      Http::AccessLog::options()
+          .path(file.path)
+          .ringCapacity(2)
+          .flushInterval(std::chrono::hours(1)));
+
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options().threads(1).flags(
+      Tcp::Options::ReuseAddr));
+  server->setHandler(Http::make_handler<AccessLogTestHandler>());
+  server->setAccessLog(accessLog);
+  server->serveThreaded();
+
+  for (int i = 0; i < 5; ++i)
+    get(server->getPort(), "/ok");
+
+  EXPECT_TRUE(eventually([&] { return accessLog->dropped() == 3; }));
+  accessLog->flush();
+  EXPECT_EQ(readLines(file.path).size(), 2u);
+
+  // Once drained, the ring records again
+  get(server->getPort(), "/ok");
+  EXPECT_TRUE(eventually([&] {
+    accessLog->flush();
+    return readLines(file.path).size() == 3;
+  }));
+  EXPECT_EQ(accessLog->dropped(), 3u);
+
+  server->shutdown();
+}
+
+TEST(access_log_test, records_streamed_responses_once_written) {
+  TempPath file;
+  auto accessLog = std::make_shared<Http::AccessLog>(
+      Http::AccessLog::options().path(file.path));
+  auto server = serve(accessLog);
+
+  const auto response = get(server->getPort(), "/stream");
+  ASSERT_NE(response.find("first"), std::string::npos);
+  ASSERT_NE(response.find("second"), std::string::npos);
+
+  EXPECT_TRUE(eventually([&] {
+    accessLog->flush();
+    return accessLog->written() == 1;
+  }));
+
+  // Every chunk is counted, the terminating one too
+  const auto lines = readLines(file.path);
+  ASSERT_EQ(lines.size(), 1u);
+  EXPECT_NE(lines[0].find("\"bytes\":" + std::to_string(response.size()) +
+                          ","),
+            std::string::npos)
+      << lines[0];
+
+  server->shutdown();
+}
@@ -0,0 +1,176 @@
+/* coalescer_test.cc
+
+   Unit tests for the Rest router request coalescing
+*/
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pistache/coalescer.h>
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/router.h>
+
+#include "httplib.h"
+
+using namespace Pistache;
+using namespace Pistache::Rest;
+
+namespace {
+// Handler that holds the first request until released, and answers the
+// following ones right away
+class HeldHandler {
+public:
+  explicit HeldHandler(Http::CacheDirective::Directive directive)
+      : calls(0), directive_(directive), lock_(), held_() {}
+
+  Route::Result handle(const Rest::Request &, Http::ResponseWriter response) {
+    const int call = ++calls;
+    response.headers().add<Http::Header::CacheControl>(directive_);
+
+    if (call == 1) {
+      std::lock_guard<std::mutex> guard(lock_);
+      held_.reset(new Http::ResponseWriter(std::move(response)));
+    } else {
+      response.send(Http::Code::Ok, "call " + std::to_string(call));
+    }
+
+    return Route::Result::Ok;
+  }
+
+  bool isHolding() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return held_ != nullptr;
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> guard(lock_);
+    held_->send(Http::Code::Ok, "call 1");
+    held_.reset();
+  }
+
+  std::atomic<int> calls;
+
+private:
+  Http::CacheDirective::Directive directive_;
+  std::mutex lock_;
+  std::unique_ptr<Http::ResponseWriter> held_;
+};
+
+template <typename Predicate> bool waitFor(Predicate predicate) {
+  for (int i = 0; i < 500; ++i) {
+    if (predicate())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  return false;
+}
+
+std::vector<std::string>
+concurrentGets(HeldHandler &handler,
+               const std::shared_ptr<RequestCoalescer> &coalescer,
+               size_t count) {
+  Address addr(Ipv4::any(), 0);
+  auto endpoint = std::make_shared<Http::Endpoint>(addr);
+
+  auto opts = Http::Endpoint::options().threads(1).maxRequestSize(4096);
+  endpoint->init(opts);
+
+  Rest::Router router;
+  Routes::Get(router, "/catalog",
+              [&](const Rest::Request &request, Http::ResponseWriter response) {
+                return handler.handle(request, std::move(response));
+              });
+  router.addRequestCoalescer("/", coalescer);
+
+  endpoint->setHandler(router.handler());
+  endpoint->serveThreaded();
+  const auto bound_port = endpoint->getPort();
+
+  std::vector<std::string> bodies(count);
+  std::vector<std::thread> clients;
+  for (size_t i = 0; i < count; ++i) {
+    clients.emplace_back([&bodies, i, bound_port]() {
+      httplib::Client client("localhost", bound_port);
+      auto res = client.Get("/catalog");
+      if (res && res->status == 200)
+        bodies[i] = res->body;
+    });
+
+    // Make sure that the first request leads the flight
+    if (i == 0) {
+      EXPECT_TRUE(waitFor([&]() { return handler.isHolding(); }));
+    }
+  }
+
+  EXPECT_TRUE(waitFor([&]() { return coalescer->coalesced() == count - 1; }));
+  handler.release();
+
+  for (auto &client : clients)
+    client.join();
+
+  endpoint->shutdown();
+
+  return bodies;
+}
+} // namespace
+
+TEST(coalescer_test, followers_get_the_leader_response) {
+  HeldHandler handler(Http::CacheDirective::Public);
+  auto coalescer = RequestCoalescer::create();
+
+  auto bodies = concurrentGets(handler, coalescer, 4);
+
+  ASSERT_EQ(handler.calls, 1);
+  for (const auto &body : bodies)
+    ASSERT_EQ(body, "call 1");
+
+  ASSERT_EQ(coalescer->coalesced(), 3u);
+  ASSERT_EQ(coalescer->inFlight(), 0u);
+}
+
+TEST(coalescer_test, followers_handle_unshareable_responses) {
+  HeldHandler handler(Http::CacheDirective::NoStore);
+  auto coalescer = RequestCoalescer::create();
+
+  auto bodies = concurrentGets(handler, coalescer, 3);
+
+  ASSERT_EQ(handler.calls, 3);
+  ASSERT_EQ(bodies[0], "call 1");
+  ASSERT_NE(bodies[1], "call 1");
+  ASSERT_NE(bodies[2], "call 1");
+  ASSERT_FALSE(bodies[1].empty());
+  ASSERT_FALSE(bodies[2].empty());
+  ASSERT_EQ(coalescer->inFlight(), 0u);
+}
+
+TEST(coalescer_test, abandoned_flight_releases_followers) {
+  auto coalescer = RequestCoalescer::create();
+
+  auto flight = coalescer->lead("GET catalog");
+  ASSERT_NE(flight, nullptr);
+  ASSERT_EQ(coalescer->lead("GET catalog"), nullptr);
+  ASSERT_EQ(coalescer->inFlight(), 1u);
+
+  bool released = false;
+  coalescer->follow("GET catalog")
+      .then(
+          [&](const RequestCoalescer::Result &result) {
+            released = true;
+            ASSERT_EQ(result, nullptr);
+          },
+          Async::NoExcept);
+
+  ASSERT_FALSE(released);
+  flight.reset();
+  ASSERT_TRUE(released);
+  ASSERT_EQ(coalescer->inFlight(), 0u);
+}
@@ -0,0 +1,124 @@
+/* hdr_histogram_test.cc
+
+   Unit tests for the High Dynamic Range histogram
+*/
+
+#include "gtest/gtest.h"
+
+#include <pistache/hdr_histogram.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+using namespace Pistache;
+
+TEST(hdr_histogram_test, rejects_invalid_ranges) {
+  ASSERT_THROW(HdrHistogram(0, 1000, 3), std::invalid_argument);
+  ASSERT_THROW(HdrHistogram(10, 15, 3), std::invalid_argument);
+  ASSERT_THROW(HdrHistogram(1, 1000, 6), std::invalid_argument);
+}
+
+TEST(hdr_histogram_test, percentiles_keep_significant_digits) {
+  HdrHistogram histogram(1, 3600 * 1000 * 1000ULL, 3);
+  for (uint64_t value = 1; value <= 100000; ++value)
+    ASSERT_TRUE(histogram.record(value));
+
+  ASSERT_EQ(histogram.count(), 100000u);
+  ASSERT_EQ(histogram.min(), 1u);
+  ASSERT_TRUE(histogram.equivalent(histogram.max(), 100000));
+
+  // Three significant digits: within a thousandth of the exact value
+  const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+  for (double percentile : percentiles) {
+    const double expected = percentile * 1000.0;
+    const double value =
+        static_cast<double>(histogram.valueAtPercentile(percentile));
+    ASSERT_NEAR(value, expected, expected / 1000.0) << percentile;
+  }
+
+  ASSERT_NEAR(histogram.mean(), 50000.5, 50.0);
+  ASSERT_NEAR(histogram.stddev(), 28867.5, 30.0);
+}
+
+TEST(hdr_histogram_test, small_values_are_exact) {
+  HdrHistogram histogram;
+  histogram.record(1);
+  histogram.record(7, 2);
+  histogram.record(2000);
+
+  ASSERT_EQ(histogram.count(), 4u);
+  ASSERT_EQ(histogram.valueAtPercentile(25.0), 1u);
+  ASSERT_EQ(histogram.valueAtPercentile(75.0), 7u);
+  ASSERT_EQ(histogram.valueAtPercentile(100.0), 2000u);
+}
+
+TEST(hdr_histogram_test, values_out_of_range_are_not_recorded) {
+  HdrHistogram histogram(1, 1000, 2);
+  ASSERT_FALSE(histogram.record(1ULL << 40));
+  ASSERT_EQ(histogram.count(), 0u);
+  ASSERT_EQ(histogram.valueAtPercentile(99.0), 0u);
+}
+
+TEST(hdr_histogram_test, corrects_coordinated_omission) {
+  HdrHistogram histogram;
+  histogram.recordCorrected(1000, 100);
+
+  // The stall hid the requests due at 900, 800 ... 100
+  ASSERT_EQ(histogram.count(), 10u);
+  ASSERT_EQ(histogram.valueAtPercentile(10.0), 100u);
+  ASSERT_EQ(histogram.valueAtPercentile(100.0), 1000u);
+
+  HdrHistogram fast;
+  fast.recordCorrected(50, 100);
+  ASSERT_EQ(fast.count(), 1u);
+}
+
+TEST(hdr_histogram_test, histograms_add_up) {
+  HdrHistogram first;
+  HdrHistogram second;
+  for (uint64_t value = 1; value <= 100; ++value) {
+    first.record(value);
+    second.record(value + 100);
+  }
+
+  first.add(second);
+  ASSERT_EQ(first.count(), 200u);
+  ASSERT_EQ(first.min(), 1u);
+  ASSERT_EQ(first.max(), 200u);
+  ASSERT_EQ(first.valueAtPercentile(50.0), 100u);
+
+  first.reset();
+  ASSERT_EQ(first.count(), 0u);
+
+  HdrHistogram other(1, 1000, 2);
+  ASSERT_THROW(first.add(other), std::invalid_argument);
+}
+
+TEST(hdr_histogram_test, writes_percentile_distribution) {
+  HdrHistogram histogram;
+  for (uint64_t value = 1; value <= 1000; ++value)
+    histogram.record(value * 1000);
+
+  std::ostringstream os;
+  histogram.writePercentiles(os, 1000.0);
+  const auto output = os.str();
+
+  ASSERT_EQ(output.find("       Value     Percentile TotalCount "
+                        "1/(1-Percentile)\n\n"),
+            0u);
+  ASSERT_NE(output.find("       1.000 0.000000000000          1           "
+                        "1.00\n"),
+            std::string::npos)
+      << output;
+  ASSERT_NE(output.find(" 1.000000000000       1000\n"), std::string::npos)
+      << output;
+  ASSERT_NE(output.find("#[Max     =     1000.447, Total count    =         "
+                        "1000]\n"),
+            std::string::npos)
+      << output;
+  ASSERT_NE(output.find("#[Buckets =           22, SubBuckets     =         "
+                        "2048]\n"),
+            std::string::npos)
+      << output;
+}
@@ -4,8 +4,18 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace Pistache;
 
@@ -538,3 +548,952 @@ TEST(http_client_test, client_do_not_get_large_content) {
   ASSERT_FALSE(ok_flag);
   ASSERT_TRUE(exception_flag);
 }
+
+TEST(http_client_test, client_resolves_hosts_through_resolver) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.serveThreaded();
+
+  // Stand-in for the system resolver, backend.test points to the loopback
+  std::atomic<int> lookups(0);
+  auto resolver = DnsResolver::create(DnsResolver::Options().lookup(
+      [&lookups](const std::string &host, const std::string &port, int family) {
+        ++lookups;
+        if (host != "backend.test")
+          return DnsResolver::Answer();
+        return DnsResolver::systemLookup("127.0.0.1", port, family);
+      }));
+
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(1).resolver(
+      resolver));
+
+  const std::string server_address =
+      "backend.test:" + server.getPort().toString();
+
+  auto response = client.get(server_address).send();
+  std::string body;
+  response.then([&body](Http::Response rsp) { body = rsp.body(); },
+                Async::IgnoreException);
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  bool rejected = false;
+  auto unknown =
+      client.get("unknown.test:" + server.getPort().toString()).send();
+  unknown.then([](Http::Response) {},
+               [&rejected](std::exception_ptr) { rejected = true; });
+
+  Async::Barrier<Http::Response> unknownBarrier(unknown);
+  unknownBarrier.wait_for(std::chrono::seconds(5));
+
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(body, "Hello, World!");
+  ASSERT_TRUE(rejected);
+  ASSERT_EQ(lookups, 2);
+}
+
+TEST(http_client_test, pool_hands_out_each_connection_once) {
+  Http::ConnectionPool pool;
+  pool.init(4, Http::Default::MaxResponseSize);
+
+  auto host = pool.host("backend.test:8080");
+  ASSERT_EQ(pool.host("backend.test:8080"), host);
+  ASSERT_EQ(pool.idleConnections("backend.test:8080"), 4u);
+  ASSERT_EQ(pool.idleConnections("unknown.test"), 0u);
+
+  using Slot = Http::ConnectionPool::Host::Slot;
+
+  std::set<std::shared_ptr<Http::Connection>> acquired;
+  std::vector<Slot> slots;
+  for (int i = 0; i < 4; ++i) {
+    Slot slot;
+    auto conn = host->acquire(slot);
+    ASSERT_NE(conn, nullptr);
+    acquired.insert(conn);
+    slots.push_back(slot);
+  }
+
+  Slot slot;
+  ASSERT_EQ(acquired.size(), 4u);
+  ASSERT_EQ(host->acquire(slot), nullptr);
+  ASSERT_EQ(host->idleConnections(), 0u);
+
+  host->release(slots.front());
+  ASSERT_NE(host->acquire(slot), nullptr);
+  ASSERT_EQ(slot, slots.front());
+
+  for (auto s : slots)
+    host->release(s);
+  ASSERT_EQ(host->idleConnections(), 4u);
+}
+
+TEST(http_client_test, pool_pipelines_on_the_first_connections) {
+  Http::ConnectionPool pool;
+  pool.init(2, Http::Default::MaxResponseSize, 3);
+
+  auto host = pool.host("backend.test:8080");
+  ASSERT_EQ(host->idleConnections(), 6u);
+
+  std::vector<std::shared_ptr<Http::Connection>> acquired;
+  for (int i = 0; i < 6; ++i) {
+    Http::ConnectionPool::Host::Slot slot;
+    acquired.push_back(host->acquire(slot));
+    ASSERT_NE(acquired.back(), nullptr);
+  }
+
+  Http::ConnectionPool::Host::Slot slot;
+  ASSERT_EQ(host->acquire(slot), nullptr);
+
+  // The pipeline of the first connection is filled before the second one
+  // is used
+  ASSERT_EQ(acquired[0], acquired[1]);
+  ASSERT_EQ(acquired[0], acquired[2]);
+  ASSERT_NE(acquired[0], acquired[3]);
+  ASSERT_EQ(acquired[3], acquired[5]);
+}
+
+TEST(http_client_test, pool_survives_concurrent_acquire_and_release) {
+  Http::ConnectionPool pool;
+  pool.init(4, Http::Default::MaxResponseSize);
+  auto host = pool.host("backend.test:8080");
+
+  // Counts the owners of every slot, which must never exceed one
+  std::vector<std::atomic<int>> owners(4);
+  std::atomic<bool> shared(false);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 20000; ++i) {
+        Http::ConnectionPool::Host::Slot slot;
+        auto conn = host->acquire(slot);
+        if (!conn)
+          continue;
+
+        auto &count = owners[slot];
+        if (count.fetch_add(1) != 0)
+          shared = true;
+        count.fetch_sub(1);
+
+        host->release(slot);
+      }
+    });
+  }
+
+  for (auto &thread : threads)
+    thread.join();
+
+  ASSERT_FALSE(shared);
+  ASSERT_EQ(host->idleConnections(), 4u);
+}
+
+TEST(http_client_test, queued_requests_are_served_on_release) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  // A single connection, so that all but one request have to wait for it
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(1));
+
+  const int RESPONSE_SIZE = 10;
+  std::atomic<int> response_counter(0);
+  std::vector<Async::Promise<Http::Response>> responses;
+  for (int i = 0; i < RESPONSE_SIZE; ++i) {
+    auto response = client.get(server_address).send();
+    response.then(
+        [&response_counter](Http::Response rsp) {
+          if (rsp.code() == Http::Code::Ok)
+            ++response_counter;
+        },
+        Async::IgnoreException);
+    responses.push_back(std::move(response));
+  }
+
+  auto sync = Async::whenAll(responses.begin(), responses.end());
+  Async::Barrier<std::vector<Http::Response>> barrier(sync);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(response_counter, RESPONSE_SIZE);
+}
+
+namespace {
+// Echoes the resource so that responses can be matched with their request
+struct EchoHandler : public Http::Handler {
+  HTTP_PROTOTYPE(EchoHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    writer.send(Http::Code::Ok, request.resource());
+  }
+};
+} // namespace
+
+TEST(http_client_test, pipelined_batch_gets_responses_in_order) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<EchoHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(
+      Http::Client::options().maxConnectionsPerHost(2).pipelining(8));
+
+  const int BATCH_SIZE = 32;
+  std::vector<Http::RequestBuilder> requests;
+  for (int i = 0; i < BATCH_SIZE; ++i)
+    requests.push_back(
+        client.get(server_address + "/item/" + std::to_string(i)));
+
+  std::vector<std::string> bodies;
+  auto batch = client.sendBatch(requests);
+  batch.then(
+      [&bodies](const std::vector<Http::Response> &responses) {
+        for (const auto &response : responses)
+          bodies.push_back(response.body());
+      },
+      Async::IgnoreException);
+
+  Async::Barrier<std::vector<Http::Response>> barrier(batch);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(bodies.size(), static_cast<size_t>(BATCH_SIZE));
+  for (int i = 0; i < BATCH_SIZE; ++i)
+    ASSERT_EQ(bodies[i], "/item/" + std::to_string(i));
+}
+
+namespace {
+// Echoes the resource too, from another thread and late for /slow
+struct SlowFirstHandler : public Http::Handler {
+  HTTP_PROTOTYPE(SlowFirstHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() != "/slow") {
+      writer.send(Http::Code::Ok, request.resource());
+      return;
+    }
+
+    auto shared = std::make_shared<Http::ResponseWriter>(std::move(writer));
+    std::thread([shared] {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      shared->send(Http::Code::Ok, "/slow");
+    }).detach();
+  }
+};
+} // namespace
+
+TEST(http_client_test, pipelined_responses_keep_the_order_of_requests) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<SlowFirstHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(
+      Http::Client::options().maxConnectionsPerHost(1).pipelining(2));
+
+  // Both on the same connection, the second answered first by the handler
+  std::vector<Http::RequestBuilder> requests;
+  requests.push_back(client.get(server_address + "/slow"));
+  requests.push_back(client.get(server_address + "/fast"));
+
+  std::vector<std::string> bodies;
+  auto batch = client.sendBatch(requests);
+  batch.then(
+      [&bodies](const std::vector<Http::Response> &responses) {
+        for (const auto &response : responses)
+          bodies.push_back(response.body());
+      },
+      Async::IgnoreException);
+
+  Async::Barrier<std::vector<Http::Response>> barrier(batch);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(bodies.size(), 2u);
+  EXPECT_EQ(bodies[0], "/slow");
+  EXPECT_EQ(bodies[1], "/fast");
+}
+
+namespace {
+// Describes the request it got
+struct DescribeHandler : public Http::Handler {
+  HTTP_PROTOTYPE(DescribeHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    std::string mime;
+    auto contentType = request.headers().tryGet<Http::Header::ContentType>();
+    if (contentType)
+      mime = contentType->mime().toString();
+
+    writer.send(Http::Code::Ok, Http::methodString(request.method()) +
+                                    std::string(" ") + request.resource() +
+                                    " " + mime + " " + request.body());
+  }
+};
+} // namespace
+
+TEST(http_client_test, request_template_is_sent_many_times) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<DescribeHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(2));
+
+  auto tmpl = client.post(server_address + "/events")
+                  .header<Http::Header::ContentType>(MIME(Application, Json))
+                  .makeTemplate();
+
+  const int REQUESTS = 8;
+  std::vector<Async::Promise<Http::Response>> responses;
+  for (int i = 0; i < REQUESTS; ++i)
+    responses.push_back(tmpl.send("{\"id\":" + std::to_string(i) + "}"));
+  responses.push_back(tmpl.send());
+
+  std::vector<std::string> bodies;
+  auto sync = Async::whenAll(responses.begin(), responses.end());
+  sync.then(
+      [&bodies](const std::vector<Http::Response> &rsps) {
+        for (const auto &rsp : rsps)
+          bodies.push_back(rsp.body());
+      },
+      Async::IgnoreException);
+
+  Async::Barrier<std::vector<Http::Response>> barrier(sync);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(bodies.size(), static_cast<size_t>(REQUESTS + 1));
+  for (int i = 0; i < REQUESTS; ++i)
+    ASSERT_EQ(bodies[i], "POST /events application/json {\"id\":" +
+                             std::to_string(i) + "}");
+  ASSERT_EQ(bodies[REQUESTS], "POST /events application/json ");
+}
+
+TEST(http_client_test, retry_budget_is_bounded) {
+  Http::RetryBudget budget(0.5, 2);
+
+  ASSERT_TRUE(budget.withdraw());
+  ASSERT_TRUE(budget.withdraw());
+  ASSERT_FALSE(budget.withdraw());
+
+  budget.deposit();
+  ASSERT_FALSE(budget.withdraw());
+  budget.deposit();
+  ASSERT_TRUE(budget.withdraw());
+
+  for (int i = 0; i < 10; ++i)
+    budget.deposit();
+  ASSERT_DOUBLE_EQ(budget.tokens(), 2.0);
+}
+
+namespace {
+// The first request to /slow takes its time, as a bad replica would. Its
+// response is sent from another thread to leave the worker free.
+struct SlowOnceHandler : public Http::Handler {
+  HTTP_PROTOTYPE(SlowOnceHandler)
+
+  struct State {
+    std::atomic<int> slowHits{0};
+    std::thread delayed;
+  };
+
+  explicit SlowOnceHandler(std::shared_ptr<State> state)
+      : state_(std::move(state)) {}
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() == "/slow" && state_->slowHits.fetch_add(1) == 0) {
+      auto resource = request.resource();
+      auto delayed = std::make_shared<Http::ResponseWriter>(std::move(writer));
+      state_->delayed = std::thread([delayed, resource]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+        delayed->send(Http::Code::Ok, resource);
+      });
+      return;
+    }
+
+    writer.send(Http::Code::Ok, request.resource());
+  }
+
+  std::shared_ptr<State> state_;
+};
+} // namespace
+
+TEST(http_client_test, hedged_request_beats_slow_response) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  auto state = std::make_shared<SlowOnceHandler::State>();
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<SlowOnceHandler>(state));
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(2));
+
+  // Teach the client how fast the host usually is
+  for (uint64_t i = 0; i < Http::Default::HedgeMinSamples; ++i) {
+    auto response = client.get(server_address + "/fast").send();
+    Async::Barrier<Http::Response> barrier(response);
+    barrier.wait_for(std::chrono::seconds(5));
+  }
+
+  std::string body;
+  const auto start = std::chrono::steady_clock::now();
+  auto response = client.get(server_address + "/slow")
+                      .hedge(0.9)
+                      .timeout(std::chrono::seconds(5))
+                      .send();
+  response.then([&body](Http::Response rsp) { body = rsp.body(); },
+                Async::IgnoreException);
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(5));
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  state->delayed.join();
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(body, "/slow");
+  ASSERT_EQ(state->slowHits.load(), 2);
+  ASSERT_LT(elapsed, std::chrono::milliseconds(1000));
+}
+
+TEST(http_client_test, idempotent_requests_are_retried) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  auto state = std::make_shared<SlowOnceHandler::State>();
+  Http::Endpoint server(address);
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<SlowOnceHandler>(state));
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(2));
+
+  // Times out the first time, then succeeds
+  std::string body;
+  auto response = client.get(server_address + "/slow")
+                      .timeout(std::chrono::milliseconds(300))
+                      .retries(1)
+                      .send();
+  response.then([&body](Http::Response rsp) { body = rsp.body(); },
+                Async::IgnoreException);
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  // Nothing can tell whether a POST that timed out was applied or not
+  state->delayed.join();
+  state->slowHits.store(0);
+  bool rejected = false;
+  auto post = client.post(server_address + "/slow")
+                  .timeout(std::chrono::milliseconds(300))
+                  .retries(1)
+                  .send();
+  post.then([](Http::Response) {}, [&rejected](std::exception_ptr) {
+    rejected = true;
+  });
+  Async::Barrier<Http::Response> postBarrier(post);
+  postBarrier.wait_for(std::chrono::seconds(5));
+
+  state->delayed.join();
+  server.shutdown();
+  client.shutdown();
+
+  ASSERT_EQ(body, "/slow");
+  ASSERT_TRUE(rejected);
+  ASSERT_EQ(state->slowHits.load(), 1);
+}
+
+namespace {
+// Answers with its name, and with a 500 on /health when told to
+struct NamedHandler : public Http::Handler {
+  HTTP_PROTOTYPE(NamedHandler)
+
+  NamedHandler(std::string name, bool healthy)
+      : name_(std::move(name)), healthy_(healthy) {}
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() == "/health" && !healthy_) {
+      writer.send(Http::Code::Internal_Server_Error);
+      return;
+    }
+
+    writer.send(Http::Code::Ok, name_);
+  }
+
+  std::string name_;
+  bool healthy_;
+};
+
+struct Backends {
+  explicit Backends(const std::vector<bool> &healthy) {
+    for (size_t i = 0; i < healthy.size(); ++i) {
+      auto server = std::make_shared<Http::Endpoint>(
+          Pistache::Address("localhost", Pistache::Port(0)));
+      server->init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+      server->setHandler(
+          Http::make_handler<NamedHandler>(std::to_string(i), healthy[i]));
+      server->serveThreaded();
+
+      addresses.push_back("localhost:" + server->getPort().toString());
+      servers.push_back(std::move(server));
+    }
+  }
+
+  ~Backends() {
+    for (auto &server : servers)
+      server->shutdown();
+  }
+
+  std::vector<std::shared_ptr<Http::Endpoint>> servers;
+  std::vector<std::string> addresses;
+};
+
+// Sends the requests one after the other, returns the bodies of the
+// responses, or "error" for the requests that failed
+std::vector<std::string> getSequentially(Http::Client &client,
+                                         const std::string &url, int count) {
+  std::vector<std::string> bodies;
+  for (int i = 0; i < count; ++i) {
+    std::string body = "error";
+    auto response =
+        client.get(url).timeout(std::chrono::milliseconds(500)).send();
+    response.then([&body](Http::Response rsp) { body = rsp.body(); },
+                  Async::IgnoreException);
+
+    Async::Barrier<Http::Response> barrier(response);
+    barrier.wait_for(std::chrono::seconds(5));
+    bodies.push_back(body);
+  }
+
+  return bodies;
+}
+} // namespace
+
+TEST(http_client_test, upstream_balances_round_robin) {
+  Backends backends({true, true, true});
+
+  Http::Client client;
+  client.init();
+  client.addUpstream("app", backends.addresses);
+
+  auto bodies = getSequentially(client, "http://app/", 9);
+  client.shutdown();
+
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "0"), 3);
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "1"), 3);
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "2"), 3);
+}
+
+TEST(http_client_test, upstream_balancers_prefer_idle_backends) {
+  Http::Upstream upstream("app", {"a", "b"});
+
+  // Leaves two requests outstanding on the first backend
+  auto first = upstream.pick();
+  auto second = upstream.pick();
+  upstream.succeeded(*second);
+  ASSERT_EQ(upstream.pick(), first);
+  ASSERT_EQ(first->outstanding(), 2u);
+  ASSERT_EQ(second->outstanding(), 0u);
+
+  const std::vector<Http::Upstream::Backend *> candidates = {
+      upstream.backends()[0].get(), upstream.backends()[1].get()};
+
+  for (auto balancing : {Http::Upstream::Balancing::LeastOutstanding,
+                         Http::Upstream::Balancing::PowerOfTwoChoices}) {
+    auto balancer = Http::Upstream::Balancer::create(balancing);
+    for (int i = 0; i < 10; ++i)
+      ASSERT_EQ(balancer->pick(candidates), 1u);
+  }
+}
+
+TEST(http_client_test, upstream_ejects_failing_backends) {
+  Backends backends({true});
+
+  // Nothing listens on the second backend
+  Http::Endpoint closed(Pistache::Address("localhost", Pistache::Port(0)));
+  closed.init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  closed.setHandler(Http::make_handler<NamedHandler>("closed", true));
+  closed.serveThreaded();
+  const std::string closedAddress = "localhost:" + closed.getPort().toString();
+  closed.shutdown();
+
+  Http::Client client;
+  client.init();
+  auto upstream = client.addUpstream(
+      "app", {backends.addresses[0], closedAddress},
+      Http::Upstream::Options().ejectAfter(2).maxEjectionPercent(50));
+
+  auto bodies = getSequentially(client, "http://app/", 12);
+  client.shutdown();
+
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "error"), 2);
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "0"), 10);
+  ASSERT_TRUE(upstream->backends()[1]->isEjected());
+  ASSERT_FALSE(upstream->backends()[0]->isEjected());
+}
+
+TEST(http_client_test, upstream_health_checks_leave_out_unhealthy_backends) {
+  Backends backends({true, false});
+
+  Http::Client client;
+  client.init();
+  auto upstream = client.addUpstream(
+      "app", backends.addresses,
+      Http::Upstream::Options().healthCheck("/health",
+                                            std::chrono::milliseconds(50)));
+
+  for (int i = 0; i < 100 && upstream->backends()[1]->isHealthy(); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  auto bodies = getSequentially(client, "http://app/", 6);
+  client.shutdown();
+
+  ASSERT_TRUE(upstream->backends()[0]->isHealthy());
+  ASSERT_FALSE(upstream->backends()[1]->isHealthy());
+  ASSERT_EQ(std::count(bodies.begin(), bodies.end(), "0"), 6);
+}
+
+namespace {
+// Waits for the client to have that many connections open to the host
+bool waitForConnections(const Http::Client &client, const std::string &host,
+                        size_t count) {
+  for (int i = 0; i < 200; ++i) {
+    if (client.openConnections(host) == count)
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return false;
+}
+} // namespace
+
+TEST(http_client_test, pool_warms_up_connections) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  server.init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(Http::Client::options().maxConnectionsPerHost(4).idleTimeout(
+      std::chrono::milliseconds(50)));
+  client.warmUp(server_address, 2);
+
+  // Established before any request, and kept past the idle timeout
+  ASSERT_TRUE(waitForConnections(client, server_address, 2));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  ASSERT_EQ(client.openConnections(server_address), 2u);
+
+  auto bodies = getSequentially(client, server_address, 3);
+
+  client.shutdown();
+  server.shutdown();
+
+  ASSERT_EQ(bodies, std::vector<std::string>(3, "Hello, World!"));
+}
+
+TEST(http_client_test, pool_closes_idle_connections) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint server(address);
+  server.init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.serveThreaded();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+
+  Http::Client client;
+  client.init(Http::Client::options().idleTimeout(
+      std::chrono::milliseconds(100)));
+
+  auto first = getSequentially(client, server_address, 1);
+  ASSERT_EQ(client.openConnections(server_address), 1u);
+  ASSERT_TRUE(waitForConnections(client, server_address, 0));
+
+  // The next request establishes the connection again
+  auto second = getSequentially(client, server_address, 1);
+
+  client.shutdown();
+  server.shutdown();
+
+  ASSERT_EQ(first, std::vector<std::string>(1, "Hello, World!"));
+  ASSERT_EQ(second, std::vector<std::string>(1, "Hello, World!"));
+}
+
+namespace {
+// Answers a single request per connection, then closes it
+struct OneShotServer {
+  OneShotServer() : fd(::socket(AF_INET, SOCK_STREAM, 0)), port(0) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    ::listen(fd, 8);
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    port = ntohs(addr.sin_port);
+  }
+
+  ~OneShotServer() { ::close(fd); }
+
+  void serve(int connections) {
+    thread = std::thread([this, connections]() {
+      for (int i = 0; i < connections; ++i) {
+        int client = ::accept(fd, nullptr, nullptr);
+        if (client < 0)
+          return;
+
+        char buffer[1024];
+        ::recv(client, buffer, sizeof(buffer), 0);
+        const char response[] =
+            "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+        ::send(client, response, sizeof(response) - 1, 0);
+        ::close(client);
+      }
+    });
+  }
+
+  int fd;
+  uint16_t port;
+  std::thread thread;
+};
+} // namespace
+
+TEST(http_client_test, pool_reconnects_after_server_closed_connection) {
+  OneShotServer server;
+  server.serve(3);
+
+  const std::string server_address = "127.0.0.1:" + std::to_string(server.port);
+
+  Http::Client client;
+  client.init();
+
+  // Every response is followed by the server closing the connection
+  auto bodies = getSequentially(client, server_address, 3);
+
+  server.thread.join();
+  client.shutdown();
+
+  ASSERT_EQ(bodies, std::vector<std::string>(3, "ok"));
+}
+
+namespace {
+// Takes its time reading a request, then answers with the size of its body
+struct SlowReaderServer {
+  SlowReaderServer() : fd(::socket(AF_INET, SOCK_STREAM, 0)), port(0) {
+    // Inherited by the accepted socket, the client fills it up quickly
+    int size = 4096;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    ::listen(fd, 8);
+
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    port = ntohs(addr.sin_port);
+
+    thread = std::thread([this]() {
+      int client = ::accept(fd, nullptr, nullptr);
+      if (client < 0)
+        return;
+
+      // Long enough for the client to fill both socket buffers
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+      std::string request;
+      char buffer[65536];
+      size_t expected = std::string::npos;
+      for (int reads = 0;
+           expected == std::string::npos || request.size() < expected;
+           ++reads) {
+        if (reads % 64 == 0)
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const ssize_t bytes = ::recv(client, buffer, sizeof(buffer), 0);
+        if (bytes <= 0)
+          break;
+        request.append(buffer, static_cast<size_t>(bytes));
+
+        const auto end = request.find("\r\n\r\n");
+        const auto length = request.find("Content-Length: ");
+        if (expected == std::string::npos && end != std::string::npos &&
+            length != std::string::npos)
+          expected = end + 4 + std::stoul(request.substr(length + 16));
+      }
+
+      const auto body = request.substr(request.find("\r\n\r\n") + 4);
+      const auto size =
+          std::count(body.begin(), body.end(), 'x') ==
+                  static_cast<std::ptrdiff_t>(body.size())
+              ? std::to_string(body.size())
+              : "corrupted";
+      const std::string response = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                                   std::to_string(size.size()) + "\r\n\r\n" +
+                                   size;
+      ::send(client, response.data(), response.size(), 0);
+      ::close(client);
+    });
+  }
+
+  ~SlowReaderServer() {
+    thread.join();
+    ::close(fd);
+  }
+
+  int fd;
+  uint16_t port;
+  std::thread thread;
+};
+} // namespace
+
+TEST(http_client_test, body_larger_than_the_socket_buffer_is_sent_in_full) {
+  SlowReaderServer server;
+  const std::string server_address = "127.0.0.1:" + std::to_string(server.port);
+
+  Http::Client client;
+  client.init();
+
+  // Larger than what the socket buffers of both ends can hold
+  const size_t size = 16 * 1024 * 1024;
+  std::string body = "error";
+  auto response = client.post(server_address)
+                      .body(std::string(size, 'x'))
+                      .timeout(std::chrono::seconds(20))
+                      .send();
+  response.then([&body](Http::Response rsp) { body = rsp.body(); },
+                Async::IgnoreException);
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(20));
+  client.shutdown();
+
+  ASSERT_EQ(body, std::to_string(size));
+}
+
+namespace {
+// Calls out to another server from its handler, and tells whether the
+// response came back on the thread of the handler
+struct AggregatorHandler : public Http::Handler {
+  HTTP_PROTOTYPE(AggregatorHandler)
+
+  AggregatorHandler(Http::Client *client, std::string backend)
+      : client(client), backend(std::move(backend)) {}
+
+  void onRequest(const Http::Request & /*request*/,
+                 Http::ResponseWriter writer) override {
+    const auto worker = std::this_thread::get_id();
+    auto shared = std::make_shared<Http::ResponseWriter>(std::move(writer));
+
+    client->get(backend).send().then(
+        [worker, shared](Http::Response response) {
+          const bool sameThread = std::this_thread::get_id() == worker;
+          shared->send(Http::Code::Ok,
+                       response.body() + (sameThread ? ";same" : ";other"));
+        },
+        [shared](std::exception_ptr) {
+          shared->send(Http::Code::Bad_Gateway, "failed");
+        });
+  }
+
+  Http::Client *client;
+  std::string backend;
+};
+} // namespace
+
+TEST(http_client_test, client_runs_on_the_workers_of_an_endpoint) {
+  const Pistache::Address address("localhost", Pistache::Port(0));
+
+  Http::Endpoint backend(address);
+  backend.init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  backend.setHandler(Http::make_handler<HelloHandler>());
+  backend.serveThreaded();
+
+  Http::Client attached;
+  Http::Endpoint server(address);
+  server.init(
+      Http::Endpoint::options().threads(2).flags(Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<AggregatorHandler>(
+      &attached, "localhost:" + backend.getPort().toString()));
+  server.serveThreaded();
+
+  attached.init(Http::Client::options().reactor(server.reactor()));
+
+  Http::Client client;
+  client.init();
+
+  const std::string server_address = "localhost:" + server.getPort().toString();
+  auto bodies = getSequentially(client, server_address, 6);
+
+  client.shutdown();
+  attached.shutdown();
+  server.shutdown();
+  backend.shutdown();
+
+  ASSERT_EQ(bodies, std::vector<std::string>(6, "Hello, World!;same"));
+}
@@ -2,6 +2,7 @@
 #include <pistache/http.h>
 #include <pistache/stream.h>
 
+#include <cstring>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -68,6 +69,64 @@ TEST(http_parsing_test, parser_reset) {
   ASSERT_EQ(parser.request.body(), "");
 }
 
+TEST(http_parsing_test, chunks_split_over_packets) {
+  Http::ResponseParser parser(Const::DefaultMaxResponseSize);
+
+  auto feed = [&parser](const char *data) {
+    parser.feed(data, std::strlen(data));
+  };
+
+  feed("HTTP/1.1 200 OK\r\n");
+  feed("Transfer-Encoding: chunked\r\n");
+  feed("\r\n");
+  feed("5\r\nHEL");
+  ASSERT_EQ(parser.parse(), Http::Private::State::Again);
+
+  feed("LO\r\n3\r\n, W");
+  ASSERT_EQ(parser.parse(), Http::Private::State::Again);
+
+  feed("\r\n5\r\norld!\r\n0\r\n");
+  ASSERT_EQ(parser.parse(), Http::Private::State::Again);
+
+  feed("\r\n");
+  ASSERT_EQ(parser.parse(), Http::Private::State::Done);
+  ASSERT_EQ(parser.response.body(), "HELLO, World!");
+}
+
+TEST(http_parsing_test, streamed_body_is_not_buffered) {
+  // Only big enough for the headers and a bit of the body
+  Http::ResponseParser parser(64);
+
+  std::string streamed;
+  size_t pieces = 0;
+  parser.streamBody([&](const char *data, size_t size) {
+    streamed.append(data, size);
+    ++pieces;
+  });
+
+  auto feed = [&parser](const std::string &data) {
+    return parser.feed(data.data(), data.size());
+  };
+
+  ASSERT_TRUE(feed("HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n"));
+  ASSERT_EQ(parser.parse(), Http::Private::State::Again);
+  parser.compact();
+
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(feed(std::string(30, static_cast<char>('a' + i))));
+    ASSERT_EQ(parser.parse(), Http::Private::State::Again);
+    parser.compact();
+  }
+
+  ASSERT_TRUE(feed(std::string(10, 'd')));
+  ASSERT_EQ(parser.parse(), Http::Private::State::Done);
+
+  ASSERT_EQ(pieces, 4u);
+  ASSERT_EQ(streamed.size(), 100u);
+  ASSERT_EQ(streamed.substr(85), std::string(5, 'c') + std::string(10, 'd'));
+  ASSERT_TRUE(parser.response.body().empty());
+}
+
 TEST(http_parsing_test, succ_response_line_step) {
   Http::Response response;
   Http::Private::ResponseLineStep step(&response);
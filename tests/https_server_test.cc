@@ -1,4 +1,7 @@
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <vector>
 
 #include <pistache/client.h>
 #include <pistache/endpoint.h>
@@ -308,3 +311,125 @@ TEST(http_client_test, basic_tls_request_with_servefile) {
   ASSERT_EQ(res, CURLE_OK);
   ASSERT_EQ(buffer.rfind("-----BEGIN CERTIFICATE-----", 0), 0u);
 }
+
+TEST(http_client_test, client_tls_request) {
+  Http::Endpoint server(Address("localhost", Pistache::Port(0)));
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.useSSL("./certs/server.crt", "./certs/server.key");
+  server.serveThreaded();
+
+  Http::Client client;
+  /* The certificate of the server is not issued for localhost */
+  client.init(Http::Client::options()
+                  .caFile("./certs/rootCA.crt")
+                  .verifyHost(false)
+                  .alpn({"http/1.1"}));
+
+  auto response = client.get(getServerUrl(server)).send();
+
+  std::string body;
+  response.then([&](Http::Response rsp) { body = rsp.body(); },
+                Async::IgnoreException);
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  const auto stats = client.tlsStats();
+
+  client.shutdown();
+  server.shutdown();
+
+  ASSERT_EQ(body, "Hello, World!");
+  ASSERT_EQ(stats.fullHandshakes, 1u);
+}
+
+TEST(http_client_test, client_tls_rejects_unknown_authority) {
+  Http::Endpoint server(Address("localhost", Pistache::Port(0)));
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags);
+
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.useSSL("./certs/server.crt", "./certs/server.key");
+  server.serveThreaded();
+
+  // The root certificate of the tests is not one of the system
+  Http::Client client;
+  client.init(Http::Client::options().verifyHost(false));
+
+  auto response = client.get(getServerUrl(server)).send();
+
+  std::string error;
+  response.then([](Http::Response) {},
+                [&](std::exception_ptr exc) {
+                  try {
+                    std::rethrow_exception(exc);
+                  } catch (const std::exception &e) {
+                    error = e.what();
+                  }
+                });
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  client.shutdown();
+  server.shutdown();
+
+  ASSERT_NE(error.find("TLS handshake failed"), std::string::npos) << error;
+}
+
+TEST(http_client_test, client_tls_resumes_sessions) {
+  Http::Endpoint server(Address("localhost", Pistache::Port(0)));
+  auto flags = Tcp::Options::ReuseAddr;
+  auto server_opts = Http::Endpoint::options().flags(flags).threads(2);
+
+  server.init(server_opts);
+  server.setHandler(Http::make_handler<HelloHandler>());
+  server.useSSL("./certs/server.crt", "./certs/server.key");
+  server.serveThreaded();
+
+  Http::Client client;
+  client.init(Http::Client::options()
+                  .maxConnectionsPerHost(2)
+                  .caFile("./certs/rootCA.crt")
+                  .verifyHost(false));
+
+  const auto url = getServerUrl(server);
+
+  // The first connection makes a full handshake and gets a session
+  auto first = client.get(url).send();
+  Async::Barrier<Http::Response> firstBarrier(first);
+  firstBarrier.wait_for(std::chrono::seconds(5));
+
+  // The second one is opened for the request the first connection can not
+  // take, it resumes the session
+  std::vector<Async::Promise<Http::Response>> responses;
+  responses.push_back(client.get(url).send());
+  responses.push_back(client.get(url).send());
+
+  std::atomic<size_t> ok(0);
+  for (auto &response : responses)
+    response.then(
+        [&](Http::Response rsp) {
+          if (rsp.body() == "Hello, World!")
+            ++ok;
+        },
+        Async::IgnoreException);
+
+  auto sync = Async::whenAll(responses.begin(), responses.end());
+  Async::Barrier<std::vector<Http::Response>> barrier(sync);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  const auto stats = client.tlsStats();
+
+  client.shutdown();
+  server.shutdown();
+
+  ASSERT_EQ(ok, 2u);
+  ASSERT_EQ(stats.fullHandshakes, 1u);
+  ASSERT_EQ(stats.resumedHandshakes, 1u);
+}
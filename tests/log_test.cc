@@ -0,0 +1,188 @@
+#include <pistache/log.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace Pistache;
+
+namespace {
+
+struct RecordingSink : public Log::Sink {
+  void write(const Log::Record &record) override {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (blocked) {
+      entered = true;
+      changed.notify_all();
+      changed.wait(guard, [this] { return !blocked; });
+    }
+    levels.push_back(record.level);
+    messages.push_back(record.message);
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> guard(mutex);
+    ++flushes;
+  }
+
+  void block() {
+    std::lock_guard<std::mutex> guard(mutex);
+    blocked = true;
+  }
+
+  void waitUntilEntered() {
+    std::unique_lock<std::mutex> guard(mutex);
+    changed.wait(guard, [this] { return entered; });
+  }
+
+  void unblock() {
+    std::lock_guard<std::mutex> guard(mutex);
+    blocked = false;
+    changed.notify_all();
+  }
+
+  std::vector<std::string> takeMessages() {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto res = std::move(messages);
+    messages.clear();
+    return res;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  bool blocked = false;
+  bool entered = false;
+  std::vector<Log::Level> levels;
+  std::vector<std::string> messages;
+  int flushes = 0;
+};
+
+// Restores the default sink and level
+struct log_test : public ::testing::Test {
+  void SetUp() override {
+    sink = std::make_shared<RecordingSink>();
+    Log::setSink(sink);
+    Log::setLevel(Log::Level::Trace);
+  }
+
+  void TearDown() override {
+    Log::setSink(std::make_shared<Log::FdSink>(STDERR_FILENO));
+    Log::setLevel(Log::Level::Info);
+  }
+
+  std::shared_ptr<RecordingSink> sink;
+};
+
+int evaluated = 0;
+int sideEffect() { return ++evaluated; }
+
+} // namespace
+
+TEST_F(log_test, compile_time_level) {
+  // Tests are compiled with the default level, Info
+  PISTACHE_LOG_TRACE("trace %d", sideEffect());
+  PISTACHE_LOG_DEBUG("debug %d", sideEffect());
+  PISTACHE_LOG_INFO("info %d", sideEffect());
+  Log::flush();
+
+  EXPECT_EQ(evaluated, 1);
+  const auto messages = sink->takeMessages();
+  ASSERT_EQ(messages.size(), 1u);
+  EXPECT_EQ(messages[0], "info 1");
+}
+
+TEST_F(log_test, runtime_level) {
+  Log::setLevel(Log::Level::Warn);
+  EXPECT_EQ(Log::level(), Log::Level::Warn);
+
+  PISTACHE_LOG_INFO("filtered");
+  PISTACHE_LOG_WARN("warn %s", "kept");
+  PISTACHE_LOG_ERROR("error %d", 42);
+  Log::flush();
+
+  const auto messages = sink->takeMessages();
+  ASSERT_EQ(messages.size(), 2u);
+  EXPECT_EQ(messages[0], "warn kept");
+  EXPECT_EQ(messages[1], "error 42");
+  ASSERT_EQ(sink->levels.size(), 2u);
+  EXPECT_EQ(sink->levels[1], Log::Level::Error);
+  EXPECT_GE(sink->flushes, 1);
+}
+
+TEST_F(log_test, truncates_long_messages) {
+  const std::string longMessage(Log::Record::MaxMessage * 2, 'x');
+  PISTACHE_LOG_INFO("%s", longMessage.c_str());
+  Log::flush();
+
+  const auto messages = sink->takeMessages();
+  ASSERT_EQ(messages.size(), 1u);
+  EXPECT_EQ(messages[0].size(), Log::Record::MaxMessage - 1);
+}
+
+TEST_F(log_test, records_of_every_thread) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+    threads.emplace_back([i] {
+      for (int j = 0; j < 10; ++j)
+        PISTACHE_LOG_INFO("thread %d record %d", i, j);
+    });
+  for (auto &thread : threads)
+    thread.join();
+  Log::flush();
+
+  EXPECT_EQ(sink->takeMessages().size(), 40u);
+}
+
+TEST_F(log_test, drops_records_when_full) {
+  // Keeps the logging thread inside the sink, with the first record still
+  // in the ring
+  sink->block();
+  PISTACHE_LOG_INFO("first");
+  sink->waitUntilEntered();
+
+  const auto before = Log::dropped();
+  for (size_t i = 0; i < Log::RingCapacity + 10; ++i)
+    PISTACHE_LOG_INFO("record %zu", i);
+  EXPECT_GE(Log::dropped() - before, 11u);
+
+  sink->unblock();
+  Log::flush();
+  const auto messages = sink->takeMessages();
+  ASSERT_FALSE(messages.empty());
+  EXPECT_EQ(messages[0], "first");
+  EXPECT_LE(messages.size(), Log::RingCapacity);
+}
+
+TEST_F(log_test, fd_sink_format) {
+  int fds[2];
+  ASSERT_EQ(::pipe(fds), 0);
+
+  Log::FdSink sink(fds[1]);
+  Log::Record record;
+  record.level = Log::Level::Warn;
+  record.time = std::chrono::system_clock::time_point(
+      std::chrono::seconds(1600000000) + std::chrono::microseconds(42));
+  record.thread = 3;
+  record.file = "/path/to/transport.cc";
+  record.line = 12;
+  std::snprintf(record.message, sizeof(record.message), "hello");
+  sink.write(record);
+  sink.flush();
+  ::close(fds[1]);
+
+  char buffer[256];
+  const auto bytes = ::read(fds[0], buffer, sizeof(buffer));
+  ::close(fds[0]);
+  ASSERT_GT(bytes, 0);
+  EXPECT_EQ(std::string(buffer, static_cast<size_t>(bytes)),
+            "2020-09-13T12:26:40.000042Z WARN [3] transport.cc:12 hello\n");
+}
@@ -0,0 +1,270 @@
+#include <pistache/client.h>
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/metrics.h>
+#include <pistache/router.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+struct MetricsTestHandler : public Http::Handler {
+  HTTP_PROTOTYPE(MetricsTestHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() == "/ok") {
+      writer.send(Http::Code::Ok, "ok");
+    } else if (request.resource() == "/stream") {
+      auto stream = writer.stream(Http::Code::Ok);
+      stream << "chunk" << Http::ends;
+    } else if (request.resource() == "/fail") {
+      throw std::runtime_error("fail");
+    } else {
+      writer.send(Http::Code::Not_Found);
+    }
+  }
+};
+
+std::shared_ptr<Http::Endpoint> serve(std::shared_ptr<Http::Handler> handler,
+                                      int threads = 1) {
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options()
+                   .threads(threads)
+                   .flags(Tcp::Options::ReuseAddr));
+  server->setHandler(handler);
+  server->serveThreaded();
+  return server;
+}
+
+// Counters are updated by the workers, once they are done with a request
+bool eventually(const std::function<bool()> &predicate) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (predicate())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return predicate();
+}
+
+using Tests::bodyOf;
+using Tests::get;
+using Tests::roundTrip;
+
+} // namespace
+
+TEST(metrics_test, latency_buckets) {
+  using Metrics::LatencyHistogram;
+
+  EXPECT_EQ(LatencyHistogram::bucketOf(0), 0u);
+  EXPECT_EQ(LatencyHistogram::bucketOf(1), 0u);
+
+  // Every value is at most the upper bound of its bucket, and above the
+  // bound of the previous one
+  for (uint64_t value = 1; value <= 100000000; value = value * 3 / 2 + 1) {
+    const auto bucket = LatencyHistogram::bucketOf(value);
+    ASSERT_LT(bucket, LatencyHistogram::Buckets - 1);
+    ASSERT_LE(value, LatencyHistogram::upperBound(bucket));
+    if (bucket > 0) {
+      ASSERT_GT(value, LatencyHistogram::upperBound(bucket - 1));
+    }
+  }
+
+  EXPECT_EQ(LatencyHistogram::upperBound(LatencyHistogram::bucketOf(9)), 9u);
+  EXPECT_EQ(LatencyHistogram::upperBound(LatencyHistogram::bucketOf(10)), 10u);
+  EXPECT_EQ(LatencyHistogram::upperBound(LatencyHistogram::bucketOf(11)), 20u);
+  EXPECT_EQ(LatencyHistogram::upperBound(LatencyHistogram::bucketOf(4500)),
+            5000u);
+  EXPECT_EQ(LatencyHistogram::bucketOf(100000001),
+            LatencyHistogram::Buckets - 1);
+}
+
+TEST(metrics_test, latency_percentiles) {
+  Metrics::LatencyHistogram histogram;
+  for (uint64_t i = 1; i <= 100; ++i)
+    histogram.record(i * 100);
+
+  const auto counts = histogram.counts();
+  EXPECT_EQ(counts.count, 100u);
+  EXPECT_EQ(counts.sum, 505000u);
+  EXPECT_EQ(counts.valueAtPercentile(50), 5000u);
+  EXPECT_EQ(counts.valueAtPercentile(90), 9000u);
+  EXPECT_EQ(counts.valueAtPercentile(91), 10000u);
+
+  auto twice = counts;
+  twice += counts;
+  EXPECT_EQ(twice.count, 200u);
+  EXPECT_EQ(twice.valueAtPercentile(50), 5000u);
+}
+
+TEST(metrics_test, latency_decays) {
+  Metrics::LatencyHistogram histogram(100);
+  for (int i = 0; i < 99; ++i)
+    histogram.record(100);
+
+  // The hundredth record halves what came before it, itself included
+  histogram.record(10000);
+  auto counts = histogram.counts();
+  EXPECT_EQ(counts.count, 51u);
+  EXPECT_EQ(counts.sum, 9950u);
+
+  // Recent values weigh as much as the older ones, twice as many
+  for (int i = 0; i < 49; ++i)
+    histogram.record(10000);
+  counts = histogram.counts();
+  EXPECT_EQ(counts.count, 100u);
+  EXPECT_EQ(counts.valueAtPercentile(50), 100u);
+  EXPECT_EQ(counts.valueAtPercentile(60), 10000u);
+}
+
+TEST(metrics_test, counts_requests_connections_and_bytes) {
+  auto server = serve(Http::make_handler<MetricsTestHandler>(), 2);
+  auto metrics = server->metrics();
+  ASSERT_EQ(metrics->workers(), 2u);
+
+  const auto port = server->getPort();
+  EXPECT_NE(get(port, "/ok").find("200 OK"), std::string::npos);
+  EXPECT_NE(get(port, "/stream").find("200 OK"), std::string::npos);
+  EXPECT_NE(get(port, "/missing").find("404"), std::string::npos);
+  EXPECT_NE(get(port, "/fail").find("500"), std::string::npos);
+  EXPECT_NE(roundTrip(port, "NOT HTTP\r\n\r\n").find("400"),
+            std::string::npos);
+
+  ASSERT_TRUE(eventually([&] {
+    auto snapshot = metrics->snapshot();
+    return snapshot.requests() == 5 && snapshot.activeConnections == 0 &&
+           snapshot.writeQueueDepth == 0;
+  }));
+
+  const auto snapshot = metrics->snapshot();
+  EXPECT_EQ(snapshot.requestsByClass[1], 2u);
+  EXPECT_EQ(snapshot.requestsByClass[3], 2u);
+  EXPECT_EQ(snapshot.requestsByClass[4], 1u);
+  EXPECT_EQ(snapshot.latencies[1].count, 2u);
+  EXPECT_EQ(snapshot.parseErrors, 1u);
+  EXPECT_EQ(snapshot.connectionsAccepted, 5u);
+  EXPECT_GT(snapshot.bytesReceived, 0u);
+  EXPECT_GT(snapshot.bytesSent, 0u);
+
+  // Connections are spread over both workers
+  const auto first = metrics->snapshot(0);
+  const auto second = metrics->snapshot(1);
+  EXPECT_EQ(first.connectionsAccepted + second.connectionsAccepted, 5u);
+
+  server->shutdown();
+}
+
+TEST(metrics_test, prometheus_exposition) {
+  Rest::Router router;
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  Rest::Routes::Get(router, "/metrics", server->metrics()->route());
+  server->setHandler(router.handler());
+  server->serveThreaded();
+
+  const auto port = server->getPort();
+  get(port, "/metrics");
+  ASSERT_TRUE(eventually([&] {
+    return server->metrics()->snapshot().requestsByClass[1] == 1;
+  }));
+
+  const auto response = get(port, "/metrics");
+  EXPECT_NE(response.find("Content-Type: text/plain; version=0.0.4"),
+            std::string::npos);
+
+  const auto body = bodyOf(response);
+  EXPECT_NE(body.find("# TYPE pistache_http_requests_total counter\n"
+                      "pistache_http_requests_total{code=\"1xx\"} 0\n"
+                      "pistache_http_requests_total{code=\"2xx\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_http_request_duration_seconds_bucket{"
+                      "code=\"2xx\",le=\"0.000001\"}"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_http_request_duration_seconds_bucket{"
+                      "code=\"2xx\",le=\"100\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_http_request_duration_seconds_bucket{"
+                      "code=\"2xx\",le=\"+Inf\"} 1\n"),
+            std::string::npos);
+  // Only the 1, 2 and 5 bounds of every decade are exposed
+  EXPECT_EQ(body.find("le=\"0.000003\""), std::string::npos);
+  EXPECT_NE(body.find("pistache_http_request_duration_seconds_count{"
+                      "code=\"2xx\"} 1\n"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_http_parse_errors_total 0\n"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_connections_accepted_total{worker=\"0\"}"),
+            std::string::npos);
+  EXPECT_NE(body.find("# TYPE pistache_connections_active gauge\n"),
+            std::string::npos);
+  EXPECT_NE(body.find("pistache_event_loop_busy_seconds_total{worker=\"0\"}"),
+            std::string::npos);
+  EXPECT_NE(body.find("# TYPE pistache_event_loop_queue_lag_seconds "
+                      "histogram\n"),
+            std::string::npos);
+  EXPECT_EQ(body.find("pistache_event_loop_queue_lag_seconds_count{"
+                      "worker=\"0\"} 0\n"),
+            std::string::npos);
+
+  server->shutdown();
+}
+
+TEST(metrics_test, metrics_handler) {
+  auto upstream = serve(Http::make_handler<MetricsTestHandler>());
+  get(upstream->getPort(), "/ok");
+
+  auto server = serve(Http::make_handler<Http::MetricsHandler>(
+      std::const_pointer_cast<const Metrics::ServerMetrics>(
+          upstream->metrics())));
+
+  ASSERT_TRUE(eventually([&] {
+    return bodyOf(get(server->getPort(), "/")).find(
+               "pistache_http_requests_total{code=\"2xx\"} 1\n") !=
+           std::string::npos;
+  }));
+
+  server->shutdown();
+  upstream->shutdown();
+}
+
+TEST(metrics_test, load_from_event_loops) {
+  auto server = serve(Http::make_handler<MetricsTestHandler>(), 2);
+  get(server->getPort(), "/ok");
+
+  Tcp::Listener::Load first;
+  server->requestLoad(Tcp::Listener::Load())
+      .then([&](const Tcp::Listener::Load &load) { first = load; },
+            Async::NoExcept);
+  ASSERT_EQ(first.raw.size(), 2u);
+  ASSERT_EQ(first.workers.size(), 2u);
+  EXPECT_GE(first.raw[0].wakeups + first.raw[1].wakeups, 1u);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  Tcp::Listener::Load second;
+  server->requestLoad(first).then(
+      [&](const Tcp::Listener::Load &load) { second = load; },
+      Async::NoExcept);
+  ASSERT_EQ(second.workers.size(), 2u);
+  for (auto load : second.workers) {
+    EXPECT_GE(load, 0.0);
+    EXPECT_LE(load, 100.0);
+  }
+  EXPECT_GT(second.raw[0].idle, first.raw[0].idle);
+
+  server->shutdown();
+}
@@ -0,0 +1,121 @@
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/profiler.h>
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <pthread.h>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+// Keeps a thread of the given name busy on a CPU until destroyed
+class Spinner {
+public:
+  explicit Spinner(const std::string &name) : stop(false), thread([this] {
+    while (!stop.load(std::memory_order_relaxed))
+      ;
+  }) {
+    pthread_setname_np(thread.native_handle(), name.c_str());
+  }
+
+  ~Spinner() {
+    stop = true;
+    thread.join();
+  }
+
+private:
+  std::atomic<bool> stop;
+  std::thread thread;
+};
+
+using Tests::get;
+
+} // namespace
+
+TEST(profiler_test, samples_the_threads_of_a_name) {
+  Spinner spinner("prof-spinner");
+  Spinner other("prof-other");
+
+  const auto profile =
+      Profiler::profile(Profiler::options()
+                            .duration(std::chrono::milliseconds(300))
+                            .frequency(200)
+                            .threadsName("prof-spinner"));
+
+  EXPECT_EQ(profile.threads, 1u);
+  EXPECT_GT(profile.samples, 0u);
+  EXPECT_EQ(profile.dropped, 0u);
+  ASSERT_FALSE(profile.stacks.empty());
+
+  size_t samples = 0;
+  for (const auto &stack : profile.stacks) {
+    EXPECT_EQ(stack.first.find("prof-spinner;"), 0u) << stack.first;
+    samples += stack.second;
+  }
+  EXPECT_EQ(samples, profile.samples);
+
+  std::ostringstream os;
+  profile.writeFolded(os);
+  const auto folded = os.str();
+  EXPECT_EQ(folded.find("prof-other"), std::string::npos);
+  EXPECT_EQ(folded.back(), '\n');
+}
+
+TEST(profiler_test, drops_samples_past_the_maximum) {
+  Spinner spinner("prof-spinner");
+
+  const auto profile =
+      Profiler::profile(Profiler::options()
+                            .duration(std::chrono::milliseconds(200))
+                            .frequency(500)
+                            .threadsName("prof-spinner")
+                            .maxSamples(2));
+
+  EXPECT_EQ(profile.samples, 2u);
+  EXPECT_GT(profile.dropped, 0u);
+}
+
+TEST(profiler_test, runs_one_profile_at_a_time) {
+  auto first = std::async(std::launch::async, [] {
+    return Profiler::profile(
+        Profiler::options().duration(std::chrono::milliseconds(500)));
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_THROW(Profiler::profile(
+                   Profiler::options().duration(std::chrono::milliseconds(1))),
+               std::runtime_error);
+  first.get();
+}
+
+TEST(profiler_test, serves_folded_stacks) {
+  Spinner spinner("prof-spinner");
+
+  Http::Endpoint server(Pistache::Address("localhost", Pistache::Port(0)));
+  server.init(Http::Endpoint::options().threads(1).flags(
+      Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<Http::ProfilerHandler>("prof-spinner"));
+  server.serveThreaded();
+  const auto port = server.getPort();
+
+  const auto response = get(port, "/profile?seconds=0.2&hz=200");
+  ASSERT_NE(response.find("200 OK"), std::string::npos) << response;
+  EXPECT_NE(response.find("\r\n\r\nprof-spinner;"), std::string::npos);
+
+  EXPECT_NE(get(port, "/profile?seconds=abc").find("400"), std::string::npos);
+  EXPECT_NE(get(port, "/profile?seconds=3600").find("400"), std::string::npos);
+
+  server.shutdown();
+}
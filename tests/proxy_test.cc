@@ -0,0 +1,331 @@
+#include <pistache/client.h>
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/proxy.h>
+#include <pistache/router.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Pistache;
+
+namespace {
+// Large enough to go through the pipe many times over
+const size_t LargeBodySize = 4 * 1024 * 1024 + 17;
+
+std::string largeBody() {
+  std::string body(LargeBodySize, '\0');
+  for (size_t i = 0; i < body.size(); ++i)
+    body[i] = static_cast<char>('a' + i % 26);
+  return body;
+}
+
+std::string rawValue(const Http::Request &request, const std::string &name) {
+  auto raw = request.headers().tryGetRaw(name);
+  return raw.isEmpty() ? "-" : raw.get().value();
+}
+
+struct UpstreamHandler : public Http::Handler {
+  HTTP_PROTOTYPE(UpstreamHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    const auto &resource = request.resource();
+
+    if (resource == "/headers") {
+      writer.headers().addRaw(Http::Header::Raw("X-Upstream", "yes"));
+      writer.headers().addRaw(Http::Header::Raw("Keep-Alive", "timeout=5"));
+      writer.send(Http::Code::Ok,
+                  "xff=" + rawValue(request, "X-Forwarded-For") +
+                      ";via=" + rawValue(request, "Via") +
+                      ";custom=" + rawValue(request, "X-Custom") +
+                      ";hop=" + rawValue(request, "X-Hop") +
+                      ";host=" + rawValue(request, "X-Forwarded-Host"));
+    } else if (resource == "/large") {
+      writer.send(Http::Code::Ok, largeBody());
+    } else if (resource == "/chunked") {
+      auto stream = writer.stream(Http::Code::Ok);
+      for (int i = 0; i < 1000; ++i)
+        stream << "chunk";
+      stream << Http::ends;
+    } else if (resource == "/echo") {
+      writer.send(Http::Code::Created, request.body());
+    } else {
+      writer.send(Http::Code::Not_Found, resource);
+    }
+  }
+};
+
+std::shared_ptr<Http::Endpoint> serve(std::shared_ptr<Http::Handler> handler) {
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options()
+                   .flags(Tcp::Options::ReuseAddr)
+                   .maxRequestSize(1024 * 1024));
+  server->setHandler(handler);
+  server->serveThreaded();
+  return server;
+}
+
+std::string addressOf(const Http::Endpoint &server) {
+  return "localhost:" + server.getPort().toString();
+}
+
+// Upstream and proxy, along with the client the proxy forwards requests with
+struct ProxySetup {
+  explicit ProxySetup(const Http::ReverseProxy::Options &options =
+                          Http::ReverseProxy::Options())
+      : upstream(serve(Http::make_handler<UpstreamHandler>())),
+        upstreamClient(std::make_shared<Http::Client>()) {
+    upstreamClient->init();
+    proxy = Http::ReverseProxy::create(
+        upstreamClient, "http://" + addressOf(*upstream), options);
+    server = serve(Http::make_handler<Http::ProxyHandler>(proxy));
+  }
+
+  ~ProxySetup() {
+    server->shutdown();
+    upstreamClient->shutdown();
+    upstream->shutdown();
+  }
+
+  std::string url(const std::string &path) const {
+    return addressOf(*server) + path;
+  }
+
+  std::shared_ptr<Http::Endpoint> upstream;
+  std::shared_ptr<Http::Client> upstreamClient;
+  std::shared_ptr<Http::ReverseProxy> proxy;
+  std::shared_ptr<Http::Endpoint> server;
+};
+
+// Address nothing listens on
+std::string unusedAddress() {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ::bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+
+  socklen_t len = sizeof(addr);
+  ::getsockname(fd, reinterpret_cast<struct sockaddr *>(&addr), &len);
+  ::close(fd);
+
+  return "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+}
+
+bool wait(Async::Promise<Http::Response> &response, Http::Response &result) {
+  bool done = false;
+  response.then(
+      [&](Http::Response rsp) {
+        result = std::move(rsp);
+        done = true;
+      },
+      Async::IgnoreException);
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(10));
+  return done;
+}
+} // namespace
+
+TEST(proxy_test, hop_by_hop_headers) {
+  ASSERT_TRUE(Http::ReverseProxy::isHopByHop("connection"));
+  ASSERT_TRUE(Http::ReverseProxy::isHopByHop("Transfer-Encoding"));
+  ASSERT_TRUE(Http::ReverseProxy::isHopByHop("Keep-Alive"));
+  ASSERT_FALSE(Http::ReverseProxy::isHopByHop("Content-Type"));
+  ASSERT_FALSE(Http::ReverseProxy::isHopByHop("X-Forwarded-For"));
+}
+
+TEST(proxy_test, rewrites_hop_by_hop_headers) {
+  ProxySetup setup;
+
+  Http::Client client;
+  client.init();
+
+  auto response = client.get(setup.url("/headers"))
+                      .header(Http::Header::Raw("X-Custom", "kept"))
+                      .header(Http::Header::Raw("X-Hop", "dropped"))
+                      .header(Http::Header::Raw("X-Forwarded-For", "10.0.0.1"))
+                      .header(Http::Header::Raw("Connection",
+                                                "keep-alive, X-Hop"))
+                      .send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+  client.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(rsp.code(), Http::Code::Ok);
+
+  const auto &body = rsp.body();
+  ASSERT_NE(body.find("xff=10.0.0.1, 127.0.0.1;"), std::string::npos) << body;
+  ASSERT_NE(body.find("via=1.1 pistache;"), std::string::npos) << body;
+  ASSERT_NE(body.find("custom=kept;"), std::string::npos) << body;
+  ASSERT_NE(body.find("hop=-;"), std::string::npos) << body;
+  ASSERT_NE(body.find("host=localhost:"), std::string::npos) << body;
+
+  const auto &headers = rsp.headers();
+  ASSERT_FALSE(headers.tryGetRaw("X-Upstream").isEmpty());
+  ASSERT_TRUE(headers.tryGetRaw("Keep-Alive").isEmpty());
+  ASSERT_FALSE(headers.tryGetRaw("Via").isEmpty());
+}
+
+TEST(proxy_test, splices_large_bodies) {
+  ProxySetup setup;
+
+  Http::Client client;
+  client.init();
+
+  auto response = client.get(setup.url("/large"))
+                      .timeout(std::chrono::seconds(10))
+                      .send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+  client.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(rsp.code(), Http::Code::Ok);
+  ASSERT_EQ(rsp.body().size(), LargeBodySize);
+  ASSERT_TRUE(rsp.body() == largeBody());
+
+  const auto stats = setup.proxy->stats();
+  ASSERT_EQ(stats.forwarded, 1u);
+  ASSERT_GT(stats.splicedBytes, 0u);
+  ASSERT_EQ(stats.splicedBytes + stats.copiedBytes, LargeBodySize);
+}
+
+TEST(proxy_test, copies_bodies_when_splicing_is_disabled) {
+  ProxySetup setup(Http::ReverseProxy::Options().splice(false));
+
+  Http::Client client;
+  client.init();
+
+  auto response = client.get(setup.url("/large"))
+                      .timeout(std::chrono::seconds(10))
+                      .send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+  client.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_TRUE(rsp.body() == largeBody());
+
+  const auto stats = setup.proxy->stats();
+  ASSERT_EQ(stats.splicedBytes, 0u);
+  ASSERT_EQ(stats.copiedBytes, LargeBodySize);
+}
+
+TEST(proxy_test, chunked_responses_are_framed_again) {
+  ProxySetup setup;
+
+  Http::Client client;
+  client.init();
+
+  auto response = client.get(setup.url("/chunked")).send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+  client.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(rsp.code(), Http::Code::Ok);
+
+  std::string expected;
+  for (int i = 0; i < 1000; ++i)
+    expected += "chunk";
+  ASSERT_EQ(rsp.body(), expected);
+}
+
+TEST(proxy_test, request_bodies_are_forwarded) {
+  ProxySetup setup;
+
+  Http::Client client;
+  client.init();
+
+  const std::string payload(100 * 1024, 'p');
+  auto response = client.post(setup.url("/echo")).body(payload).send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+  client.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(rsp.code(), Http::Code::Created);
+  ASSERT_EQ(rsp.body(), payload);
+}
+
+TEST(proxy_test, route_strips_its_prefix) {
+  auto upstream = serve(Http::make_handler<UpstreamHandler>());
+  auto upstreamClient = std::make_shared<Http::Client>();
+  upstreamClient->init();
+
+  auto proxy = Http::ReverseProxy::create(
+      upstreamClient, "http://" + addressOf(*upstream) + "/",
+      Http::ReverseProxy::Options().stripPrefix("/api"));
+
+  Rest::Router router;
+  Rest::Routes::Post(router, "/api/*", proxy->route());
+
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(Http::Endpoint::options().flags(Tcp::Options::ReuseAddr));
+  server->setHandler(router.handler());
+  server->serveThreaded();
+
+  Http::Client client;
+  client.init();
+
+  auto response =
+      client.post(addressOf(*server) + "/api/echo").body("routed").send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+
+  client.shutdown();
+  server->shutdown();
+  upstreamClient->shutdown();
+  upstream->shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(rsp.code(), Http::Code::Created);
+  ASSERT_EQ(rsp.body(), "routed");
+}
+
+TEST(proxy_test, failing_upstream_is_a_bad_gateway) {
+  auto upstreamClient = std::make_shared<Http::Client>();
+  upstreamClient->init();
+
+  auto proxy = Http::ReverseProxy::create(
+      upstreamClient, "http://" + unusedAddress(),
+      Http::ReverseProxy::Options().timeout(std::chrono::milliseconds(500)));
+  auto server = serve(Http::make_handler<Http::ProxyHandler>(proxy));
+
+  Http::Client client;
+  client.init();
+
+  auto response = client.get(addressOf(*server) + "/headers").send();
+
+  Http::Response rsp;
+  const bool done = wait(response, rsp);
+
+  client.shutdown();
+  server->shutdown();
+  upstreamClient->shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_TRUE(rsp.code() == Http::Code::Bad_Gateway ||
+              rsp.code() == Http::Code::Gateway_Timeout);
+  ASSERT_EQ(proxy->stats().failed, 1u);
+}
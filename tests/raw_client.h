@@ -0,0 +1,130 @@
+/* raw_client.h
+
+   Plain socket client of the tests, for when the bytes on the wire matter:
+   malformed requests, requests sent in pieces, or several requests on the
+   same connection.
+*/
+
+#pragma once
+
+#include <pistache/net.h>
+
+#include <string>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace Pistache {
+namespace Tests {
+
+// Connection to a server on the loopback
+class RawClient {
+public:
+  explicit RawClient(Port port) : fd_(::socket(AF_INET, SOCK_STREAM, 0)) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd_, reinterpret_cast<struct sockaddr *>(&addr),
+                  sizeof(addr)) != 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  ~RawClient() {
+    if (fd_ != -1)
+      ::close(fd_);
+  }
+
+  RawClient(const RawClient &) = delete;
+  RawClient &operator=(const RawClient &) = delete;
+
+  bool connected() const { return fd_ != -1; }
+
+  void send(const std::string &data) {
+    if (fd_ != -1)
+      ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL);
+  }
+
+  // The next response, once whole: sized by its Content-Length or chunked.
+  // Whatever came before the server closed the connection otherwise
+  std::string receive() {
+    std::string response;
+    response.swap(pending_);
+
+    char buffer[4096];
+    for (;;) {
+      const auto size = responseSize(response);
+      if (size != std::string::npos) {
+        pending_ = response.substr(size);
+        response.resize(size);
+        return response;
+      }
+
+      const ssize_t bytes =
+          fd_ == -1 ? -1 : ::recv(fd_, buffer, sizeof(buffer), 0);
+      if (bytes <= 0)
+        return response;
+      response.append(buffer, static_cast<size_t>(bytes));
+    }
+  }
+
+  std::string roundTrip(const std::string &data) {
+    send(data);
+    return receive();
+  }
+
+  std::string get(const std::string &resource,
+                  const std::string &headers = "") {
+    return roundTrip("GET " + resource +
+                     " HTTP/1.1\r\nHost: localhost\r\n" + headers + "\r\n");
+  }
+
+private:
+  // Of the first response of data, npos until it is whole
+  static size_t responseSize(const std::string &data) {
+    const auto end = data.find("\r\n\r\n");
+    if (end == std::string::npos)
+      return std::string::npos;
+
+    const auto length = data.find("Content-Length: ");
+    if (length != std::string::npos && length < end) {
+      const auto size = end + 4 + std::stoul(data.substr(length + 16));
+      return data.size() >= size ? size : std::string::npos;
+    }
+
+    const auto chunked = data.find("Transfer-Encoding: chunked");
+    if (chunked == std::string::npos || chunked > end)
+      return end + 4;
+
+    const auto last = data.find("\r\n0\r\n\r\n", end);
+    return last == std::string::npos ? std::string::npos : last + 7;
+  }
+
+  int fd_;
+  // Received past the previous response
+  std::string pending_;
+};
+
+// Sends data on a connection of its own and returns the response
+inline std::string roundTrip(Port port, const std::string &data) {
+  RawClient client(port);
+  return client.roundTrip(data);
+}
+
+inline std::string get(Port port, const std::string &resource,
+                       const std::string &headers = "") {
+  RawClient client(port);
+  return client.get(resource, headers);
+}
+
+inline std::string bodyOf(const std::string &response) {
+  const auto pos = response.find("\r\n\r\n");
+  return pos == std::string::npos ? "" : response.substr(pos + 4);
+}
+
+} // namespace Tests
+} // namespace Pistache
@@ -83,3 +83,107 @@ TEST(reactor_test, reactor_exceed_max_threads) {
   ASSERT_THROW(reactor->init(Aio::AsyncContext(5 * MAX_SUPPORTED_THREADS + 1)),
                std::runtime_error);
 }
+
+TEST(reactor_test, handlers_share_the_workers) {
+  constexpr size_t NUM_THREADS = 2;
+  std::shared_ptr<Aio::Reactor> reactor = Aio::Reactor::create();
+  reactor->init(Aio::AsyncContext(NUM_THREADS));
+  auto firstKey = reactor->addHandler(std::make_shared<TransportMock>());
+  reactor->run();
+
+  // Added once the workers are running
+  auto secondKey = reactor->addHandler(std::make_shared<TransportMock>());
+
+  auto first = reactor->handlers(firstKey);
+  auto second = reactor->handlers(secondKey);
+  ASSERT_EQ(first.size(), NUM_THREADS);
+  ASSERT_EQ(second.size(), NUM_THREADS);
+
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    std::static_pointer_cast<TransportMock>(first[i])->push(1);
+    std::static_pointer_cast<TransportMock>(second[i])->push(2);
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  reactor->shutdown();
+
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    ASSERT_EQ(first[i]->context().thread(), second[i]->context().thread());
+
+    const auto &firstValues =
+        std::static_pointer_cast<TransportMock>(first[i])->values();
+    const auto &secondValues =
+        std::static_pointer_cast<TransportMock>(second[i])->values();
+    ASSERT_EQ(firstValues, std::unordered_set<int>({1}));
+    ASSERT_EQ(secondValues, std::unordered_set<int>({2}));
+  }
+}
+
+// Blocks its worker for as many milliseconds as it is pushed
+class BlockingMock : public Aio::Handler {
+  PROTOTYPE_OF(Aio::Handler, BlockingMock)
+
+public:
+  BlockingMock() : queue_() {}
+
+  BlockingMock(const BlockingMock &) : queue_() {}
+
+  void onReady(const Aio::FdSet & /*fds*/) override {
+    while (true) {
+      auto value = queue_.popSafe();
+      if (!value)
+        break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(*value));
+    }
+  }
+
+  void registerPoller(Polling::Epoll &poller) override { queue_.bind(poller); }
+
+  void push(int value) { queue_.push(value); }
+
+private:
+  PollableQueue<int> queue_;
+};
+
+TEST(reactor_test, loop_stats) {
+  using std::chrono::milliseconds;
+
+  constexpr size_t NUM_THREADS = 2;
+  std::shared_ptr<Aio::Reactor> reactor = Aio::Reactor::create();
+  reactor->init(Aio::AsyncContext(NUM_THREADS));
+  auto key = reactor->addHandler(std::make_shared<BlockingMock>());
+  reactor->run();
+
+  auto handlers = reactor->handlers(key);
+  ASSERT_NE(handlers[0]->loopStats(), nullptr);
+  ASSERT_NE(handlers[0]->loopStats(), handlers[1]->loopStats());
+
+  std::static_pointer_cast<BlockingMock>(handlers[0])->push(300);
+  std::this_thread::sleep_for(milliseconds(100));
+
+  // The blocked worker shows before its callback returns
+  auto stats = reactor->loopStats();
+  ASSERT_EQ(stats.size(), NUM_THREADS);
+  EXPECT_GE(stats[0].currentBusy, milliseconds(50));
+  EXPECT_EQ(stats[0].longestCallback.count(), 0);
+  EXPECT_EQ(stats[1].currentBusy.count(), 0);
+
+  std::this_thread::sleep_for(milliseconds(400));
+  auto later = reactor->loopStats();
+  reactor->shutdown();
+
+  EXPECT_EQ(later[0].currentBusy.count(), 0);
+  EXPECT_GE(later[0].longestCallback, milliseconds(300));
+  EXPECT_GE(later[0].busy, milliseconds(300));
+  EXPECT_GE(later[0].wakeups, 1u);
+  EXPECT_GE(later[0].events, later[0].wakeups);
+  EXPECT_EQ(later[0].eventsPerWakeup.count, later[0].wakeups);
+  EXPECT_GE(later[0].callbacks.count, 1u);
+  EXPECT_GE(later[0].callbacks.valueAtPercentile(100), 300000u);
+
+  EXPECT_GT(later[0].utilizationSince(stats[0]), 0.25);
+  EXPECT_LE(later[0].utilization(), 1.0);
+  EXPECT_EQ(later[1].busy.count(), 0);
+  EXPECT_EQ(later[1].utilization(), 0.0);
+}
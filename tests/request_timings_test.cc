@@ -0,0 +1,203 @@
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/log.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+// Timings seen by the handler
+struct Seen {
+  std::mutex mutex;
+  Http::RequestTimings request;
+  Http::RequestTimings response;
+};
+
+struct TimingsHandler : public Http::Handler {
+  HTTP_PROTOTYPE(TimingsHandler)
+
+  explicit TimingsHandler(std::shared_ptr<Seen> seen_)
+      : seen(std::move(seen_)) {}
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    if (request.resource() == "/slow")
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    writer.send(Http::Code::Ok, "done");
+
+    std::lock_guard<std::mutex> guard(seen->mutex);
+    seen->request = request.timings();
+    seen->response = writer.timings();
+  }
+
+  std::shared_ptr<Seen> seen;
+};
+
+struct RecordingSink : public Log::Sink {
+  void write(const Log::Record &record) override {
+    std::lock_guard<std::mutex> guard(mutex);
+    messages.push_back(record.message);
+    changed.notify_all();
+  }
+
+  // The first message containing text, empty if none came
+  std::string waitFor(const std::string &text) {
+    std::unique_lock<std::mutex> guard(mutex);
+    std::string res;
+    changed.wait_for(guard, std::chrono::seconds(5), [&] {
+      for (const auto &message : messages)
+        if (message.find(text) != std::string::npos) {
+          res = message;
+          return true;
+        }
+      return false;
+    });
+    return res;
+  }
+
+  std::vector<std::string> all() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return messages;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<std::string> messages;
+};
+
+// Sends the head of a request, then its body after a delay, and waits for
+// the response
+std::string request(Port port, const std::string &head,
+                    const std::string &body = "",
+                    std::chrono::milliseconds delay = {}) {
+  Tests::RawClient client(port);
+  client.send(head);
+  if (!body.empty()) {
+    std::this_thread::sleep_for(delay);
+    client.send(body);
+  }
+  return client.receive();
+}
+
+using Tests::get;
+
+// Posts a body of 4 bytes, sent once the headers were for delay
+std::string post(Port port, std::chrono::milliseconds delay) {
+  return request(port,
+                 "POST /upload HTTP/1.1\r\nHost: localhost\r\n"
+                 "Content-Length: 4\r\n\r\n",
+                 "data", delay);
+}
+
+double phaseMs(const std::string &message, const std::string &phase) {
+  const auto pos = message.find(" " + phase + "=");
+  double res = -1;
+  if (pos != std::string::npos)
+    std::sscanf(message.c_str() + pos + phase.size() + 2, "%lf", &res);
+  return res;
+}
+
+struct request_timings_test : public ::testing::Test {
+  void SetUp() override {
+    sink = std::make_shared<RecordingSink>();
+    Log::setSink(sink);
+    seen = std::make_shared<Seen>();
+  }
+
+  void TearDown() override {
+    if (server)
+      server->shutdown();
+    Log::setSink(std::make_shared<Log::FdSink>(STDERR_FILENO));
+  }
+
+  Port serve(Http::Endpoint::Options options) {
+    server = std::make_shared<Http::Endpoint>(
+        Pistache::Address("localhost", Pistache::Port(0)));
+    server->init(options.threads(1).flags(Tcp::Options::ReuseAddr));
+    server->setHandler(Http::make_handler<TimingsHandler>(seen));
+    server->serveThreaded();
+    return server->getPort();
+  }
+
+  std::shared_ptr<RecordingSink> sink;
+  std::shared_ptr<Seen> seen;
+  std::shared_ptr<Http::Endpoint> server;
+};
+
+} // namespace
+
+TEST_F(request_timings_test, records_the_phases_of_a_request) {
+  using Phase = Http::RequestTimings::Phase;
+  const auto port = serve(Http::Endpoint::options());
+
+  ASSERT_NE(post(port, std::chrono::milliseconds(30)).find("200 OK"),
+            std::string::npos);
+
+  std::lock_guard<std::mutex> guard(seen->mutex);
+  const auto &request = seen->request;
+  EXPECT_NE(request.firstByte, Http::RequestTimings::Clock::time_point());
+  EXPECT_LE(request.firstByte, request.headersParsed);
+  EXPECT_LE(request.headersParsed, request.bodyComplete);
+  EXPECT_LE(request.bodyComplete, request.handlerStart);
+  // Measured from the headers being parsed, after the client started waiting
+  EXPECT_GE(request.duration(Phase::Body), std::chrono::milliseconds(20));
+  // Not reached yet when the handler is called
+  EXPECT_EQ(request.responseQueued, Http::RequestTimings::Clock::time_point());
+  EXPECT_EQ(request.duration(Phase::Handler), std::chrono::microseconds(0));
+
+  const auto &response = seen->response;
+  EXPECT_EQ(response.firstByte, request.firstByte);
+  EXPECT_LE(response.handlerStart, response.responseQueued);
+  EXPECT_EQ(response.responseFlushed,
+            Http::RequestTimings::Clock::time_point());
+  EXPECT_GE(response.total(), request.duration(Phase::Body));
+
+  // Nothing is logged by default
+  EXPECT_TRUE(sink->all().empty());
+}
+
+TEST_F(request_timings_test, logs_slow_requests) {
+  const auto port = serve(Http::Endpoint::options().slowRequestThreshold(
+      std::chrono::milliseconds(20)));
+
+  // Handled in order by the single worker, the fast request would be logged
+  // before the slow one
+  ASSERT_NE(get(port, "/fast").find("200 OK"), std::string::npos);
+  ASSERT_NE(get(port, "/slow").find("200 OK"), std::string::npos);
+
+  const auto message = sink->waitFor("Slow request GET /slow");
+  ASSERT_FALSE(message.empty());
+  EXPECT_NE(message.find("from 127.0.0.1"), std::string::npos);
+  EXPECT_GE(phaseMs(message, "handler"), 50.0);
+  EXPECT_GE(phaseMs(message, "write"), 0.0);
+
+  for (const auto &other : sink->all())
+    EXPECT_EQ(other.find("/fast"), std::string::npos) << other;
+}
+
+TEST_F(request_timings_test, logs_requests_with_a_slow_phase) {
+  const auto port = serve(Http::Endpoint::options().slowPhaseThreshold(
+      std::chrono::milliseconds(20)));
+
+  ASSERT_NE(post(port, std::chrono::milliseconds(40)).find("200 OK"),
+            std::string::npos);
+
+  const auto message = sink->waitFor("Slow request POST /upload");
+  ASSERT_FALSE(message.empty());
+  EXPECT_GE(phaseMs(message, "body"), 20.0);
+  EXPECT_LT(phaseMs(message, "handler"), 20.0);
+}
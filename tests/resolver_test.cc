@@ -0,0 +1,152 @@
+/* resolver_test.cc
+
+   Unit tests for the asynchronous host name resolver
+*/
+
+#include "gtest/gtest.h"
+
+#include <pistache/resolver.h>
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace Pistache;
+
+namespace {
+using Result = std::shared_ptr<const DnsResolver::Answer>;
+
+// Waits for a resolution and returns its answer, or a null pointer if the
+// resolution was rejected
+Result wait(Async::Promise<Result> promise) {
+  Async::Barrier<Result> barrier(promise);
+  barrier.wait_for(std::chrono::seconds(5));
+
+  Result answer;
+  promise.then([&answer](const Result &result) { answer = result; },
+               Async::IgnoreException);
+
+  return answer;
+}
+
+uint16_t portOf(const DnsResolver::ResolvedAddress &addr) {
+  return ntohs(reinterpret_cast<const sockaddr_in *>(addr.get())->sin_port);
+}
+
+DnsResolver::Lookup loopbackLookup(std::atomic<int> &lookups,
+                                   std::chrono::seconds ttl) {
+  return [&lookups, ttl](const std::string &host, const std::string &port,
+                         int family) {
+    ++lookups;
+    if (host != "backend.test")
+      return DnsResolver::Answer();
+
+    auto answer = DnsResolver::systemLookup("127.0.0.1", port, family);
+    answer.ttl = ttl;
+    return answer;
+  };
+}
+} // namespace
+
+TEST(resolver_test, numeric_hosts_do_not_need_lookup) {
+  std::atomic<int> lookups(0);
+  DnsResolver resolver(DnsResolver::Options().lookup(
+      loopbackLookup(lookups, std::chrono::seconds(60))));
+
+  auto answer = wait(resolver.resolve("127.0.0.1", "8080", AF_INET));
+  ASSERT_NE(answer, nullptr);
+  ASSERT_EQ(answer->addresses.size(), 1u);
+  ASSERT_EQ(answer->addresses[0].family(), AF_INET);
+  ASSERT_EQ(portOf(answer->addresses[0]), 8080);
+
+  ASSERT_EQ(lookups, 0);
+  ASSERT_EQ(resolver.lookups(), 0u);
+}
+
+TEST(resolver_test, answers_are_cached) {
+  std::atomic<int> lookups(0);
+  DnsResolver resolver(DnsResolver::Options().lookup(
+      loopbackLookup(lookups, std::chrono::seconds(60))));
+
+  for (int i = 0; i < 3; ++i) {
+    auto answer = wait(resolver.resolve("backend.test", "80", AF_INET));
+    ASSERT_NE(answer, nullptr);
+    ASSERT_EQ(portOf(answer->addresses[0]), 80);
+  }
+
+  ASSERT_EQ(lookups, 1);
+  ASSERT_EQ(resolver.cachedEntries(), 1u);
+
+  // The port is part of the key
+  ASSERT_NE(wait(resolver.resolve("backend.test", "81", AF_INET)), nullptr);
+  ASSERT_EQ(lookups, 2);
+
+  resolver.clear();
+  ASSERT_NE(wait(resolver.resolve("backend.test", "80", AF_INET)), nullptr);
+  ASSERT_EQ(lookups, 3);
+}
+
+TEST(resolver_test, expired_answers_are_looked_up_again) {
+  std::atomic<int> lookups(0);
+  DnsResolver resolver(DnsResolver::Options().lookup(
+      loopbackLookup(lookups, std::chrono::seconds(0))));
+
+  ASSERT_NE(wait(resolver.resolve("backend.test", "80", AF_INET)), nullptr);
+  ASSERT_NE(wait(resolver.resolve("backend.test", "80", AF_INET)), nullptr);
+  ASSERT_EQ(lookups, 2);
+}
+
+TEST(resolver_test, failures_are_cached) {
+  std::atomic<int> lookups(0);
+  DnsResolver resolver(DnsResolver::Options()
+                           .lookup(loopbackLookup(lookups,
+                                                  std::chrono::seconds(60)))
+                           .negativeTtl(std::chrono::seconds(60)));
+
+  bool rejected = false;
+  auto promise = resolver.resolve("unknown.test", "80", AF_INET);
+  Async::Barrier<Result> barrier(promise);
+  barrier.wait_for(std::chrono::seconds(5));
+  promise.then([](const Result &) {},
+               [&rejected](std::exception_ptr) { rejected = true; });
+  ASSERT_TRUE(rejected);
+
+  ASSERT_EQ(wait(resolver.resolve("unknown.test", "80", AF_INET)), nullptr);
+  ASSERT_EQ(lookups, 1);
+}
+
+TEST(resolver_test, concurrent_lookups_are_merged) {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool released = false;
+  std::atomic<int> lookups(0);
+
+  // Blocks the lookup until all the resolutions have been requested
+  DnsResolver resolver(DnsResolver::Options().lookup(
+      [&](const std::string &, const std::string &port, int family) {
+        ++lookups;
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&]() { return released; });
+        return DnsResolver::systemLookup("127.0.0.1", port, family);
+      }));
+
+  auto first = resolver.resolve("backend.test", "80", AF_INET);
+  auto second = resolver.resolve("backend.test", "80", AF_INET);
+  auto third = resolver.resolve("backend.test", "80", AF_INET);
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    released = true;
+  }
+  cv.notify_all();
+
+  ASSERT_NE(wait(std::move(first)), nullptr);
+  ASSERT_NE(wait(std::move(second)), nullptr);
+  ASSERT_NE(wait(std::move(third)), nullptr);
+  ASSERT_EQ(lookups, 1);
+}
@@ -0,0 +1,217 @@
+/* response_cache_test.cc
+
+   Unit tests for the Rest router response cache
+*/
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/response_cache.h>
+#include <pistache/router.h>
+
+#include "httplib.h"
+
+using namespace Pistache;
+using namespace Pistache::Rest;
+
+namespace {
+Http::Request parseRequest(const char *data) {
+  Http::RequestParser parser(Const::DefaultMaxRequestSize);
+  parser.feed(data, std::strlen(data));
+  parser.parse();
+  return parser.request;
+}
+
+Http::Response parseResponse(const char *data) {
+  Http::ResponseParser parser(Const::DefaultMaxRequestSize);
+  parser.feed(data, std::strlen(data));
+  parser.parse();
+  return parser.response;
+}
+
+RawBuffer wireOf(const char *data) {
+  return RawBuffer(data, std::strlen(data));
+}
+} // namespace
+
+TEST(response_cache_test, key_selects_query_parameters) {
+  auto request =
+      parseRequest("GET /catalog?page=2&session=42&lang=fr HTTP/1.1\r\n"
+                   "Host: localhost\r\n\r\n");
+
+  auto all = ResponseCache::create();
+  ASSERT_EQ(all->requestKey(request, "catalog"),
+            "GET catalog?lang=fr&page=2&session=42");
+
+  auto selected = ResponseCache::create(
+      ResponseCache::Options().queryParameters({"page", "lang"}));
+  ASSERT_EQ(selected->requestKey(request, "catalog"),
+            "GET catalog?lang=fr&page=2");
+}
+
+TEST(response_cache_test, honors_cache_control) {
+  auto cache = ResponseCache::create();
+  auto request = parseRequest("GET /catalog HTTP/1.1\r\n\r\n");
+  const auto key = cache->requestKey(request, "catalog");
+
+  const char *noStore = "HTTP/1.1 200 OK\r\n"
+                        "Cache-Control: no-store\r\n"
+                        "Content-Length: 2\r\n\r\nok";
+  ASSERT_FALSE(
+      cache->store(key, request, parseResponse(noStore), wireOf(noStore)));
+
+  const char *noHeader = "HTTP/1.1 200 OK\r\n"
+                         "Content-Length: 2\r\n\r\nok";
+  ASSERT_FALSE(
+      cache->store(key, request, parseResponse(noHeader), wireOf(noHeader)));
+
+  const char *error = "HTTP/1.1 500 Internal Server Error\r\n"
+                      "Cache-Control: max-age=60\r\n"
+                      "Content-Length: 2\r\n\r\nko";
+  ASSERT_FALSE(cache->store(key, request, parseResponse(error), wireOf(error)));
+
+  ASSERT_EQ(cache->lookup(key, request), nullptr);
+
+  const char *sMaxAge = "HTTP/1.1 200 OK\r\n"
+                        "Cache-Control: max-age=0, s-maxage=60\r\n"
+                        "Content-Length: 2\r\n\r\nok";
+  ASSERT_TRUE(
+      cache->store(key, request, parseResponse(sMaxAge), wireOf(sMaxAge)));
+
+  auto cached = cache->lookup(key, request);
+  ASSERT_NE(cached, nullptr);
+  ASSERT_EQ(cached->code, Http::Code::Ok);
+  ASSERT_EQ(cached->wire.data(), sMaxAge);
+  ASSERT_EQ(cache->hits(), 1u);
+}
+
+TEST(response_cache_test, honors_vary) {
+  auto cache = ResponseCache::create();
+  auto english = parseRequest("GET /catalog HTTP/1.1\r\n"
+                              "Accept-Language: en\r\n\r\n");
+  auto french = parseRequest("GET /catalog HTTP/1.1\r\n"
+                             "Accept-Language: fr\r\n\r\n");
+  const auto key = cache->requestKey(english, "catalog");
+  ASSERT_EQ(key, cache->requestKey(french, "catalog"));
+
+  const char *response = "HTTP/1.1 200 OK\r\n"
+                         "Cache-Control: max-age=60\r\n"
+                         "Vary: Accept-Language\r\n"
+                         "Content-Length: 5\r\n\r\nhello";
+  ASSERT_TRUE(
+      cache->store(key, english, parseResponse(response), wireOf(response)));
+
+  ASSERT_NE(cache->lookup(key, english), nullptr);
+  ASSERT_EQ(cache->lookup(key, french), nullptr);
+
+  const char *varyAll = "HTTP/1.1 200 OK\r\n"
+                        "Cache-Control: max-age=60\r\n"
+                        "Vary: *\r\n"
+                        "Content-Length: 5\r\n\r\nhello";
+  ASSERT_FALSE(
+      cache->store(key, french, parseResponse(varyAll), wireOf(varyAll)));
+}
+
+TEST(response_cache_test, evicts_least_recently_used) {
+  const char *response = "HTTP/1.1 200 OK\r\n"
+                         "Cache-Control: max-age=60\r\n"
+                         "Content-Length: 2\r\n\r\nok";
+  // Wire bytes, key and bookkeeping overhead
+  const auto entrySize = std::strlen(response) + 16 + 128;
+
+  // A single shard fitting two entries
+  auto cache = ResponseCache::create(
+      ResponseCache::Options().shards(1).maxBytes(2 * entrySize));
+
+  auto first = parseRequest("GET /first HTTP/1.1\r\n\r\n");
+  auto second = parseRequest("GET /second HTTP/1.1\r\n\r\n");
+  auto third = parseRequest("GET /third HTTP/1.1\r\n\r\n");
+
+  ASSERT_TRUE(cache->store(cache->requestKey(first, "first"), first,
+                           parseResponse(response), wireOf(response)));
+  ASSERT_TRUE(cache->store(cache->requestKey(second, "second"), second,
+                           parseResponse(response), wireOf(response)));
+
+  // Touch the first entry so that the second one becomes the oldest
+  ASSERT_NE(cache->lookup(cache->requestKey(first, "first"), first), nullptr);
+
+  ASSERT_TRUE(cache->store(cache->requestKey(third, "third"), third,
+                           parseResponse(response), wireOf(response)));
+
+  ASSERT_EQ(cache->entries(), 2u);
+  ASSERT_LE(cache->bytes(), 2 * entrySize);
+  ASSERT_NE(cache->lookup(cache->requestKey(first, "first"), first), nullptr);
+  ASSERT_EQ(cache->lookup(cache->requestKey(second, "second"), second),
+            nullptr);
+  ASSERT_NE(cache->lookup(cache->requestKey(third, "third"), third), nullptr);
+}
+
+TEST(response_cache_test, serves_hits_without_invoking_handler) {
+  Address addr(Ipv4::any(), 0);
+  auto endpoint = std::make_shared<Http::Endpoint>(addr);
+
+  auto opts = Http::Endpoint::options().threads(1).maxRequestSize(4096);
+  endpoint->init(opts);
+
+  std::atomic<int> catalogCalls(0);
+  std::atomic<int> privateCalls(0);
+
+  Rest::Router router;
+  Routes::Get(router, "/catalog/:id",
+              [&](const Rest::Request &request, Http::ResponseWriter response) {
+                ++catalogCalls;
+                response.headers().add<Http::Header::CacheControl>(
+                    Http::CacheDirective(Http::CacheDirective::MaxAge,
+                                         std::chrono::seconds(60)));
+                response.send(Http::Code::Ok,
+                              "item " + request.param(":id").as<std::string>());
+                return Route::Result::Ok;
+              });
+  Routes::Get(router, "/catalog/:id/private",
+              [&](const Rest::Request &, Http::ResponseWriter response) {
+                ++privateCalls;
+                response.headers().add<Http::Header::CacheControl>(
+                    Http::CacheDirective::NoStore);
+                response.send(Http::Code::Ok, "private");
+                return Route::Result::Ok;
+              });
+
+  auto cache = ResponseCache::create();
+  router.addResponseCache("/catalog", cache);
+
+  endpoint->setHandler(router.handler());
+  endpoint->serveThreaded();
+  const auto bound_port = endpoint->getPort();
+  httplib::Client client("localhost", bound_port);
+
+  for (int i = 0; i < 3; ++i) {
+    auto res = client.Get("/catalog/1");
+    ASSERT_TRUE(res);
+    ASSERT_EQ(res->status, 200);
+    ASSERT_EQ(res->body, "item 1");
+    ASSERT_EQ(res->get_header_value("Cache-Control"), "max-age=60");
+  }
+  ASSERT_EQ(catalogCalls, 1);
+
+  auto other = client.Get("/catalog/2");
+  ASSERT_TRUE(other);
+  ASSERT_EQ(other->body, "item 2");
+  ASSERT_EQ(catalogCalls, 2);
+
+  for (int i = 0; i < 2; ++i) {
+    auto res = client.Get("/catalog/1/private");
+    ASSERT_TRUE(res);
+    ASSERT_EQ(res->body, "private");
+  }
+  ASSERT_EQ(privateCalls, 2);
+
+  ASSERT_EQ(cache->hits(), 2u);
+  ASSERT_EQ(cache->entries(), 2u);
+
+  endpoint->shutdown();
+}
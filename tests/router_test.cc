@@ -6,6 +6,9 @@
 
 #include "gtest/gtest.h"
 #include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include <pistache/endpoint.h>
 #include <pistache/http.h>
@@ -286,3 +289,100 @@ TEST(router_test, test_bind_shared_ptr) {
 
   endpoint->shutdown();
 }
+
+TEST(router_test, test_admission_controller_limits) {
+  auto controller = AdmissionController::create(
+      AdmissionController::Options().maxInFlight(2));
+
+  auto first = controller->tryAdmit();
+  auto second = controller->tryAdmit();
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  ASSERT_EQ(controller->inFlight(), 2u);
+
+  ASSERT_EQ(controller->tryAdmit(), nullptr);
+  ASSERT_EQ(controller->inFlight(), 2u);
+  ASSERT_EQ(controller->rejected(), 1u);
+
+  first.reset();
+  ASSERT_EQ(controller->inFlight(), 1u);
+  ASSERT_NE(controller->tryAdmit(), nullptr);
+
+  ASSERT_EQ(controller->admitted(), 3u);
+  ASSERT_EQ(controller->inFlight(), 1u);
+  ASSERT_GT(controller->latency().count(), 0);
+}
+
+TEST(router_test, test_admission_controller_sheds_load) {
+  Address addr(Ipv4::any(), 0);
+  auto endpoint = std::make_shared<Http::Endpoint>(addr);
+
+  auto opts = Http::Endpoint::options().threads(1).maxRequestSize(4096);
+  endpoint->init(opts);
+
+  auto controller = AdmissionController::create(
+      AdmissionController::Options().maxInFlight(1).retryAfter(
+          std::chrono::seconds(5)));
+
+  std::mutex pendingLock;
+  std::condition_variable pendingCv;
+  std::unique_ptr<Http::ResponseWriter> pending;
+
+  Rest::Router router;
+  Routes::Get(router, "/reports/:id",
+              [&](const Rest::Request &, Http::ResponseWriter response) {
+                // Keep the request in flight until the test releases it
+                std::lock_guard<std::mutex> guard(pendingLock);
+                pending.reset(new Http::ResponseWriter(std::move(response)));
+                pendingCv.notify_one();
+                return Route::Result::Ok;
+              });
+  Routes::Get(router, "/health",
+              [](const Rest::Request &, Http::ResponseWriter response) {
+                response.send(Http::Code::Ok, "ok");
+                return Route::Result::Ok;
+              });
+  router.addAdmissionController("/reports/*", controller);
+
+  endpoint->setHandler(router.handler());
+  endpoint->serveThreaded();
+  const auto bound_port = endpoint->getPort();
+
+  std::thread slowClient([bound_port]() {
+    httplib::Client client("localhost", bound_port);
+    auto res = client.Get("/reports/1");
+    ASSERT_TRUE(res);
+    ASSERT_EQ(res->status, 200);
+  });
+
+  {
+    std::unique_lock<std::mutex> guard(pendingLock);
+    ASSERT_TRUE(pendingCv.wait_for(guard, std::chrono::seconds(5),
+                                   [&]() { return pending != nullptr; }));
+  }
+  ASSERT_EQ(controller->inFlight(), 1u);
+
+  httplib::Client client("localhost", bound_port);
+  auto rejected = client.Get("/reports/2");
+  ASSERT_TRUE(rejected);
+  ASSERT_EQ(rejected->status, 503);
+  ASSERT_EQ(rejected->get_header_value("Retry-After"), "5");
+
+  // Routes outside of the guarded subtree are not affected
+  auto health = client.Get("/health");
+  ASSERT_TRUE(health);
+  ASSERT_EQ(health->status, 200);
+
+  {
+    std::lock_guard<std::mutex> guard(pendingLock);
+    pending->send(Http::Code::Ok, "done");
+    pending.reset();
+  }
+  slowClient.join();
+
+  ASSERT_EQ(controller->inFlight(), 0u);
+  ASSERT_EQ(controller->admitted(), 1u);
+  ASSERT_EQ(controller->rejected(), 1u);
+
+  endpoint->shutdown();
+}
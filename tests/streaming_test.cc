@@ -8,6 +8,8 @@
 #include <curl/curl.h>
 #include <curl/easy.h>
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -142,3 +144,77 @@ TEST(streaming, from_description) {
   ASSERT_EQ(res, CURLE_OK);
   ASSERT_EQ(ss.str().size(), SET_REPEATS * LETTER_REPEATS * N_LETTERS);
 }
+
+TEST(streaming, client_streams_the_body) {
+  Address addr(Ipv4::any(), Port(0));
+
+  Rest::Router router;
+  Rest::Routes::Get(router, "/", Rest::Routes::bind(&dumpData));
+
+  auto flags = Tcp::Options::ReuseAddr;
+  auto opts = Http::Endpoint::options().threads(2).flags(flags);
+
+  Http::Endpoint endpoint(addr);
+  endpoint.init(opts);
+  endpoint.setHandler(router.handler());
+  endpoint.serveThreaded();
+
+  // Far too small to hold the whole body
+  Http::Client client;
+  client.init(Http::Client::options().maxResponseSize(64 * 1024));
+
+  std::atomic<size_t> received(0);
+  std::atomic<size_t> pieces(0);
+  std::atomic<bool> gotHeaders(false);
+
+  std::shared_ptr<Http::BodyStream> stream;
+  stream = Http::BodyStream::create(
+      [&](const char * /*data*/, size_t size) {
+        received += size;
+        ++pieces;
+      },
+      [&](const Http::Response &response) {
+        ASSERT_EQ(response.code(), Http::Code::Ok);
+        gotHeaders = true;
+        stream->pause();
+      });
+
+  const auto port = endpoint.getPort();
+  auto response = client.get("http://localhost:" + port.toString() + "/")
+                      .stream(stream)
+                      .send();
+
+  Http::Response result;
+  std::atomic<bool> done(false);
+  response.then(
+      [&](Http::Response res) {
+        result = std::move(res);
+        done = true;
+      },
+      Async::IgnoreException);
+
+  for (int i = 0; i < 100 && !gotHeaders; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_TRUE(gotHeaders);
+
+  // Nothing is read while the stream is paused
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  const size_t whilePaused = received;
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  ASSERT_EQ(received, whilePaused);
+  ASSERT_LT(whilePaused, SET_REPEATS * LETTER_REPEATS * N_LETTERS);
+
+  stream->resume();
+
+  Async::Barrier<Http::Response> barrier(response);
+  barrier.wait_for(std::chrono::seconds(30));
+
+  client.shutdown();
+  endpoint.shutdown();
+
+  ASSERT_TRUE(done);
+  ASSERT_EQ(result.code(), Http::Code::Ok);
+  ASSERT_TRUE(result.body().empty());
+  ASSERT_EQ(received, SET_REPEATS * LETTER_REPEATS * N_LETTERS);
+  ASSERT_GT(pieces, 1u);
+}
@@ -0,0 +1,122 @@
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/metrics.h>
+#include <pistache/peer.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+// Writes the last TCP_INFO of the peer, sampled first on /sample
+struct TcpInfoTestHandler : public Http::Handler {
+  HTTP_PROTOTYPE(TcpInfoTestHandler)
+
+  void onRequest(const Http::Request &request,
+                 Http::ResponseWriter writer) override {
+    auto peer = writer.peer();
+    if (request.resource() == "/sample" && !peer->sampleTcpInfo()) {
+      writer.send(Http::Code::Internal_Server_Error);
+      return;
+    }
+
+    const auto info = peer->tcpInfo();
+    std::ostringstream os;
+    os << "sampled=" << (info.sampled.time_since_epoch().count() != 0)
+       << " rtt=" << info.rtt.count() << " cwnd=" << info.cwnd;
+    writer.send(Http::Code::Ok, os.str());
+  }
+};
+
+// Body of the response, on the same connection every time
+std::string get(Tests::RawClient &client, const std::string &resource) {
+  return Tests::bodyOf(client.get(resource));
+}
+
+std::shared_ptr<Http::Endpoint> serve(const Http::Endpoint::Options &opts) {
+  auto server = std::make_shared<Http::Endpoint>(
+      Pistache::Address("localhost", Pistache::Port(0)));
+  server->init(opts);
+  server->setHandler(Http::make_handler<TcpInfoTestHandler>());
+  server->serveThreaded();
+  return server;
+}
+
+} // namespace
+
+TEST(tcp_info_test, samples_peer_on_demand) {
+  auto server = serve(Http::Endpoint::options().threads(1).flags(
+      Tcp::Options::ReuseAddr));
+  Tests::RawClient connection(server->getPort());
+  ASSERT_TRUE(connection.connected());
+
+  // Never sampled without sampling enabled
+  EXPECT_EQ(get(connection, "/info"), "sampled=0 rtt=0 cwnd=0");
+
+  const auto body = get(connection, "/sample");
+  EXPECT_EQ(body.find("sampled=1 "), 0u) << body;
+  EXPECT_EQ(body.find("rtt=0 "), std::string::npos) << body;
+  EXPECT_EQ(body.find("cwnd=0"), std::string::npos) << body;
+
+  // Only sampling by the workers is recorded
+  EXPECT_EQ(server->metrics()->snapshot().tcpRtt.count, 0u);
+
+  server->shutdown();
+}
+
+TEST(tcp_info_test, samples_live_peers_periodically) {
+  auto server =
+      serve(Http::Endpoint::options()
+                .threads(2)
+                .flags(Tcp::Options::ReuseAddr)
+                .tcpInfoSampling(std::chrono::milliseconds(10), 1));
+  Tests::RawClient first(server->getPort());
+  Tests::RawClient second(server->getPort());
+  ASSERT_TRUE(first.connected());
+  ASSERT_TRUE(second.connected());
+  ASSERT_FALSE(get(first, "/info").empty());
+  ASSERT_FALSE(get(second, "/info").empty());
+
+  // One peer per tick, every peer is sampled in turn
+  std::string firstInfo, secondInfo;
+  for (int i = 0; i < 100; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    firstInfo = get(first, "/info");
+    secondInfo = get(second, "/info");
+    if (firstInfo.find("sampled=1") == 0 && secondInfo.find("sampled=1") == 0)
+      break;
+  }
+  EXPECT_EQ(firstInfo.find("sampled=1 "), 0u) << firstInfo;
+  EXPECT_EQ(secondInfo.find("sampled=1 "), 0u) << secondInfo;
+  EXPECT_EQ(firstInfo.find("cwnd=0"), std::string::npos) << firstInfo;
+
+  const auto snapshot = server->metrics()->snapshot();
+  EXPECT_GE(snapshot.tcpRtt.count, 2u);
+  EXPECT_EQ(snapshot.tcpCwnd.count, snapshot.tcpRtt.count);
+  EXPECT_GT(snapshot.tcpCwnd.sum, 0u);
+
+  std::ostringstream os;
+  server->metrics()->writePrometheus(os);
+  const auto text = os.str();
+  EXPECT_NE(text.find("# TYPE pistache_tcp_rtt_seconds histogram\n"
+                      "pistache_tcp_rtt_seconds_bucket{le=\"0.000001\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("pistache_tcp_rtt_seconds_count " +
+                      std::to_string(snapshot.tcpRtt.count)),
+            std::string::npos);
+  EXPECT_NE(text.find("pistache_tcp_congestion_window_segments_bucket{le="
+                      "\"10\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("pistache_tcp_retransmits_total{worker=\"1\"} "),
+            std::string::npos);
+
+  server->shutdown();
+}
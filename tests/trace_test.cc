@@ -0,0 +1,125 @@
+#include <pistache/endpoint.h>
+#include <pistache/http.h>
+#include <pistache/trace.h>
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "raw_client.h"
+
+using namespace Pistache;
+
+namespace {
+
+struct TraceTestHandler : public Http::Handler {
+  HTTP_PROTOTYPE(TraceTestHandler)
+
+  void onRequest(const Http::Request & /*request*/,
+                 Http::ResponseWriter writer) override {
+    writer.send(Http::Code::Ok, "pong");
+  }
+};
+
+// Points of every connection, in the order they were fired
+struct RecordingHooks : public Trace::Hooks {
+  void connectionAccepted(Fd fd) override { add(fd, "accepted"); }
+  void requestLineParsed(Fd fd, Http::Method method,
+                         const std::string &resource) override {
+    add(fd, std::string("request_line ") + Http::methodString(method) + " " +
+                resource);
+  }
+  void headersComplete(Fd fd) override { add(fd, "headers"); }
+  void handlerInvoked(Fd fd) override { add(fd, "invoked"); }
+  void handlerReturned(Fd fd) override { add(fd, "returned"); }
+  void writeQueued(Fd fd, size_t bytes) override {
+    add(fd, "write_queued " + std::to_string(bytes));
+  }
+  void writeStarted(Fd fd) override { add(fd, "write_started"); }
+  void writeDone(Fd fd, size_t bytes) override {
+    add(fd, "write_done " + std::to_string(bytes));
+  }
+  void connectionClosed(Fd fd) override { add(fd, "closed"); }
+
+  void add(Fd fd, std::string event) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (fd_ == -1)
+      fd_ = fd;
+    if (fd == fd_)
+      events.push_back(std::move(event));
+    changed.notify_all();
+  }
+
+  bool waitFor(const std::string &event) {
+    std::unique_lock<std::mutex> guard(mutex);
+    return changed.wait_for(guard, std::chrono::seconds(5), [&] {
+      return !events.empty() && events.back() == event;
+    });
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  Fd fd_ = -1;
+  std::vector<std::string> events;
+};
+
+// The connection is closed once answered, which fires the last point
+std::string ping(Port port) {
+  return Tests::get(port, "/ping", "Connection: close\r\n");
+}
+
+} // namespace
+
+TEST(trace_test, fires_the_points_of_a_request_in_order) {
+  auto hooks = std::make_shared<RecordingHooks>();
+  Trace::setHooks(hooks);
+
+  Http::Endpoint server(Pistache::Address("localhost", Pistache::Port(0)));
+  server.init(Http::Endpoint::options().threads(1).flags(
+      Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<TraceTestHandler>());
+  server.serveThreaded();
+
+  const auto response = ping(server.getPort());
+  ASSERT_NE(response.find("200 OK"), std::string::npos);
+  ASSERT_TRUE(hooks->waitFor("closed"));
+  server.shutdown();
+  Trace::setHooks(nullptr);
+
+  const auto size = std::to_string(response.size());
+  const std::vector<std::string> expected = {"accepted",
+                                             "request_line GET /ping",
+                                             "headers",
+                                             "invoked",
+                                             "write_queued " + size,
+                                             "returned",
+                                             "write_started",
+                                             "write_done " + size,
+                                             "closed"};
+  std::lock_guard<std::mutex> guard(hooks->mutex);
+  EXPECT_EQ(hooks->events, expected);
+}
+
+TEST(trace_test, fires_nothing_once_the_hooks_are_removed) {
+  auto hooks = std::make_shared<RecordingHooks>();
+  Trace::setHooks(hooks);
+  Trace::setHooks(nullptr);
+  EXPECT_EQ(Trace::hooks(), nullptr);
+
+  Http::Endpoint server(Pistache::Address("localhost", Pistache::Port(0)));
+  server.init(Http::Endpoint::options().threads(1).flags(
+      Tcp::Options::ReuseAddr));
+  server.setHandler(Http::make_handler<TraceTestHandler>());
+  server.serveThreaded();
+
+  ASSERT_NE(ping(server.getPort()).find("200 OK"), std::string::npos);
+  server.shutdown();
+
+  std::lock_guard<std::mutex> guard(hooks->mutex);
+  EXPECT_TRUE(hooks->events.empty());
+}
@@ -0,0 +1,548 @@
+/* pistache_bench.cc
+
+   HTTP load generator built on Http::Client, in the spirit of wrk.
+
+   In the default closed loop, every connection keeps as many requests in
+   flight as the pipelining depth allows, the next request being sent as soon
+   as a response comes back. With a rate, requests are sent on a constant
+   schedule instead, whether the server keeps up or not (open loop), and their
+   latency is measured from the time they were due: a server that stalls is
+   charged for the requests that piled up in the meantime, rather than having
+   the load generator hold them back (coordinated omission).
+
+   Latencies are recorded in an HdrHistogram, whose percentile distribution
+   can be written in the .hgrm format for plotting.
+*/
+
+#include <pistache/client.h>
+#include <pistache/hdr_histogram.h>
+#include <pistache/http.h>
+#include <pistache/net.h>
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace Pistache;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Settings {
+  size_t connections = 10;
+  int threads = 2;
+  std::chrono::milliseconds duration = std::chrono::seconds(10);
+  size_t pipeline = 1;
+  // Requests per second, closed loop when zero
+  double rate = 0.0;
+  std::chrono::milliseconds timeout = std::chrono::seconds(2);
+  std::string requestsFile;
+  std::vector<Http::Header::Raw> headers;
+  std::string hdrFile;
+  std::string url;
+};
+
+// One of the requests of the mix, sent weight times out of the total weight
+struct RequestSpec {
+  Http::Method method = Http::Method::Get;
+  std::string url;
+  std::string body;
+  size_t weight = 1;
+};
+
+void usage(std::ostream &os) {
+  os << "Usage: pistache-bench [options] <url>\n"
+        "\n"
+        "  -c, --connections <N>  connections to keep open (10)\n"
+        "  -t, --threads <N>      threads of the client (2)\n"
+        "  -d, --duration <T>     duration of the run, as 10s, 500ms, 2m "
+        "(10s)\n"
+        "  -p, --pipeline <N>     requests sent on a connection ahead of the "
+        "responses (1)\n"
+        "  -R, --rate <N>         requests per second on a constant schedule, "
+        "open loop\n"
+        "                         with latencies measured from the time the "
+        "requests\n"
+        "                         were due (closed loop when omitted)\n"
+        "  -f, --requests <file>  mix of requests, one per line:\n"
+        "                         [weight] METHOD path-or-url [body]\n"
+        "  -H, --header <H>       header sent with every request, as "
+        "'Name: value'\n"
+        "  -T, --timeout <T>      timeout of a request (2s)\n"
+        "      --hdr <file>       writes the latency distribution in the .hgrm "
+        "format of\n"
+        "                         HdrHistogram, in milliseconds, - for the "
+        "standard output\n"
+        "  -h, --help             prints this help\n";
+}
+
+std::chrono::milliseconds parseDuration(const std::string &text) {
+  size_t end = 0;
+  const double value = std::stod(text, &end);
+  const auto unit = text.substr(end);
+
+  double ms;
+  if (unit.empty() || unit == "s")
+    ms = value * 1000.0;
+  else if (unit == "ms")
+    ms = value;
+  else if (unit == "m")
+    ms = value * 60.0 * 1000.0;
+  else if (unit == "h")
+    ms = value * 3600.0 * 1000.0;
+  else
+    throw std::invalid_argument("Invalid duration: " + text);
+
+  return std::chrono::milliseconds(static_cast<int64_t>(ms));
+}
+
+size_t parseCount(const std::string &text, const char *what) {
+  const auto value = std::stoll(text);
+  if (value <= 0)
+    throw std::invalid_argument(std::string("Invalid number of ") + what);
+  return static_cast<size_t>(value);
+}
+
+Http::Header::Raw parseHeader(const std::string &text) {
+  const auto colon = text.find(':');
+  if (colon == std::string::npos || colon == 0)
+    throw std::invalid_argument("Invalid header: " + text);
+
+  auto value = text.substr(colon + 1);
+  value.erase(0, value.find_first_not_of(" \t"));
+  return Http::Header::Raw(text.substr(0, colon), value);
+}
+
+Http::Method parseMethod(const std::string &name) {
+#define METHOD(m, s)                                                           \
+  if (name == s)                                                               \
+    return Http::Method::m;
+  HTTP_METHODS
+#undef METHOD
+
+  throw std::invalid_argument("Unknown method: " + name);
+}
+
+// Paths of the mix are relative to the url of the command line
+std::string resolveUrl(const std::string &base, const std::string &target) {
+  if (target.empty() || target[0] != '/')
+    return target;
+
+  const auto scheme = base.find("://");
+  const auto hostStart = scheme == std::string::npos ? 0 : scheme + 3;
+  const auto pathStart = base.find('/', hostStart);
+  return base.substr(0, pathStart) + target;
+}
+
+std::vector<RequestSpec> readRequests(const std::string &path,
+                                      const std::string &base) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("Could not open " + path);
+
+  std::vector<RequestSpec> specs;
+  std::string line;
+  size_t number = 0;
+  while (std::getline(file, line)) {
+    ++number;
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+
+    std::istringstream is(line);
+    std::string token;
+    if (!(is >> token) || token[0] == '#')
+      continue;
+
+    RequestSpec spec;
+    if (std::isdigit(static_cast<unsigned char>(token[0]))) {
+      spec.weight = parseCount(token, "weight");
+      if (!(is >> token))
+        throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                    ": missing method");
+    }
+
+    spec.method = parseMethod(token);
+    std::string target;
+    if (!(is >> target))
+      throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                  ": missing url");
+    spec.url = resolveUrl(base, target);
+
+    // The body is the rest of the line
+    std::getline(is >> std::ws, spec.body);
+    specs.push_back(std::move(spec));
+  }
+
+  if (specs.empty())
+    throw std::invalid_argument(path + ": no request");
+
+  return specs;
+}
+
+Settings parseArguments(int argc, char *argv[]) {
+  enum { HdrOption = 256 };
+  static const struct option options[] = {
+      {"connections", required_argument, nullptr, 'c'},
+      {"threads", required_argument, nullptr, 't'},
+      {"duration", required_argument, nullptr, 'd'},
+      {"pipeline", required_argument, nullptr, 'p'},
+      {"rate", required_argument, nullptr, 'R'},
+      {"requests", required_argument, nullptr, 'f'},
+      {"header", required_argument, nullptr, 'H'},
+      {"timeout", required_argument, nullptr, 'T'},
+      {"hdr", required_argument, nullptr, HdrOption},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+
+  Settings settings;
+  int c;
+  while ((c = getopt_long(argc, argv, "c:t:d:p:R:f:H:T:h", options,
+                          nullptr)) != -1) {
+    switch (c) {
+    case 'c':
+      settings.connections = parseCount(optarg, "connections");
+      break;
+    case 't':
+      settings.threads = static_cast<int>(parseCount(optarg, "threads"));
+      break;
+    case 'd':
+      settings.duration = parseDuration(optarg);
+      break;
+    case 'p':
+      settings.pipeline = parseCount(optarg, "pipelined requests");
+      break;
+    case 'R':
+      settings.rate = std::stod(optarg);
+      if (settings.rate <= 0.0)
+        throw std::invalid_argument("Invalid rate");
+      break;
+    case 'f':
+      settings.requestsFile = optarg;
+      break;
+    case 'H':
+      settings.headers.push_back(parseHeader(optarg));
+      break;
+    case 'T':
+      settings.timeout = parseDuration(optarg);
+      break;
+    case HdrOption:
+      settings.hdrFile = optarg;
+      break;
+    case 'h':
+      usage(std::cout);
+      std::exit(0);
+    default:
+      usage(std::cerr);
+      std::exit(1);
+    }
+  }
+
+  if (optind != argc - 1) {
+    usage(std::cerr);
+    std::exit(1);
+  }
+  settings.url = argv[optind];
+
+  return settings;
+}
+
+std::string formatLatency(double us) {
+  char buffer[32];
+  if (us < 1000.0)
+    std::snprintf(buffer, sizeof(buffer), "%.2fus", us);
+  else if (us < 1000.0 * 1000.0)
+    std::snprintf(buffer, sizeof(buffer), "%.2fms", us / 1000.0);
+  else
+    std::snprintf(buffer, sizeof(buffer), "%.2fs", us / (1000.0 * 1000.0));
+  return buffer;
+}
+
+std::string formatBytes(double bytes) {
+  static const char *const Units[] = {"B", "KB", "MB", "GB", "TB"};
+  size_t unit = 0;
+  while (bytes >= 1024.0 && unit < 4) {
+    bytes /= 1024.0;
+    ++unit;
+  }
+
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.2f%s", bytes, Units[unit]);
+  return buffer;
+}
+
+class Bench {
+public:
+  Bench(Http::Client &client, const Settings &settings,
+        const std::vector<RequestSpec> &specs)
+      : settings_(settings), templates_(), bodies_(), weights_(),
+        totalWeight_(0), next_(0), running_(false), inFlight_(0), sent_(0),
+        lock_(), latencies_(), responses_(0), failedStatus_(0), bytes_(0),
+        errors_() {
+    for (const auto &spec : specs) {
+      auto builder = client.get(spec.url);
+      builder.method(spec.method).timeout(settings.timeout);
+      for (const auto &header : settings.headers)
+        builder.header(header);
+
+      templates_.push_back(builder.makeTemplate());
+      bodies_.push_back(spec.body);
+      totalWeight_ += spec.weight;
+      weights_.push_back(totalWeight_);
+    }
+  }
+
+  // Sends requests for the duration of the run, then waits for the ones in
+  // flight. Returns how long it took.
+  Clock::duration run() {
+    running_.store(true);
+    const auto start = Clock::now();
+    const auto deadline = start + settings_.duration;
+
+    if (settings_.rate > 0.0)
+      sendOnSchedule(start, deadline);
+    else
+      sendClosedLoop(deadline);
+
+    running_.store(false);
+
+    const auto drained = Clock::now() + settings_.timeout +
+                         std::chrono::seconds(1);
+    while (inFlight_.load() > 0 && Clock::now() < drained)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    return Clock::now() - start;
+  }
+
+  void report(std::ostream &os, Clock::duration elapsed) const {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    const double seconds =
+        std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+            .count();
+
+    os << "  Latency    mean " << formatLatency(latencies_.mean())
+       << ", stdev " << formatLatency(latencies_.stddev()) << ", max "
+       << formatLatency(static_cast<double>(latencies_.max())) << "\n";
+    os << "  Latency distribution\n";
+    const double percentiles[] = {50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 100.0};
+    for (double percentile : percentiles) {
+      char line[64];
+      std::snprintf(line, sizeof(line), "  %7.3f%%  %s\n", percentile,
+                    formatLatency(static_cast<double>(
+                                      latencies_.valueAtPercentile(percentile)))
+                        .c_str());
+      os << line;
+    }
+
+    os << "  " << responses_ << " responses in " << seconds << "s, "
+       << formatBytes(static_cast<double>(bytes_)) << " of bodies read\n";
+    if (failedStatus_ > 0)
+      os << "  Non-2xx or 3xx responses: " << failedStatus_ << "\n";
+    for (const auto &error : errors_)
+      os << "  Errors: " << error.second << " x " << error.first << "\n";
+
+    os << "Requests/sec: " << static_cast<double>(responses_) / seconds
+       << "\n";
+    os << "Body transfer/sec: "
+       << formatBytes(static_cast<double>(bytes_) / seconds) << "\n";
+  }
+
+  void writePercentiles(std::ostream &os) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    latencies_.writePercentiles(os, 1000.0);
+  }
+
+  uint64_t responses() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return responses_;
+  }
+
+private:
+  void sendClosedLoop(Clock::time_point deadline) {
+    const size_t depth = settings_.connections * settings_.pipeline;
+    for (size_t i = 0; i < depth; ++i)
+      send(Clock::now(), true);
+
+    std::this_thread::sleep_until(deadline);
+  }
+
+  void sendOnSchedule(Clock::time_point start, Clock::time_point deadline) {
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / settings_.rate));
+
+    // Every request is due at its own time, the ones that are late are sent
+    // right away and charged for the wait
+    uint64_t count = 0;
+    for (;;) {
+      const auto due = start + interval * count;
+      if (due >= deadline)
+        break;
+
+      const auto now = Clock::now();
+      if (due > now)
+        std::this_thread::sleep_until(due);
+
+      send(due, false);
+      ++count;
+    }
+  }
+
+  const Http::RequestTemplate &pick(size_t &index) {
+    const auto slot = next_.fetch_add(1) % totalWeight_;
+    index = static_cast<size_t>(
+        std::upper_bound(weights_.begin(), weights_.end(), slot) -
+        weights_.begin());
+    return templates_[index];
+  }
+
+  void send(Clock::time_point due, bool closedLoop) {
+    size_t index;
+    const auto &request = pick(index);
+
+    inFlight_.fetch_add(1);
+    sent_.fetch_add(1);
+
+    auto response =
+        bodies_[index].empty() ? request.send() : request.send(bodies_[index]);
+    response.then(
+        [this, due, closedLoop](Http::Response rsp) {
+          completed(due, rsp);
+          next(closedLoop);
+        },
+        [this, closedLoop](std::exception_ptr exc) {
+          failed(exc);
+          next(closedLoop);
+        });
+  }
+
+  // In the closed loop, every response makes way for the next request
+  void next(bool closedLoop) {
+    if (closedLoop && running_.load())
+      send(Clock::now(), true);
+    inFlight_.fetch_sub(1);
+  }
+
+  void completed(Clock::time_point due, const Http::Response &response) {
+    const auto latency =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              due);
+    const auto code = static_cast<int>(response.code());
+
+    std::lock_guard<std::mutex> guard(lock_);
+    latencies_.record(
+        static_cast<uint64_t>(std::max<int64_t>(latency.count(), 1)));
+    ++responses_;
+    bytes_ += response.body().size();
+    if (code < 200 || code >= 400)
+      ++failedStatus_;
+  }
+
+  void failed(std::exception_ptr exc) {
+    std::string what = "unknown error";
+    try {
+      std::rethrow_exception(exc);
+    } catch (const std::exception &e) {
+      what = e.what();
+    } catch (...) {
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+    ++errors_[what];
+  }
+
+  const Settings &settings_;
+
+  std::vector<Http::RequestTemplate> templates_;
+  std::vector<std::string> bodies_;
+  // Cumulated weights of the requests, to pick them in proportion
+  std::vector<size_t> weights_;
+  size_t totalWeight_;
+  std::atomic<size_t> next_;
+
+  std::atomic<bool> running_;
+  std::atomic<size_t> inFlight_;
+  std::atomic<uint64_t> sent_;
+
+  mutable std::mutex lock_;
+  HdrHistogram latencies_;
+  uint64_t responses_;
+  uint64_t failedStatus_;
+  uint64_t bytes_;
+  std::map<std::string, uint64_t> errors_;
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Settings settings;
+  std::vector<RequestSpec> specs;
+  try {
+    settings = parseArguments(argc, argv);
+    if (settings.requestsFile.empty()) {
+      RequestSpec spec;
+      spec.url = settings.url;
+      specs.push_back(spec);
+    } else {
+      specs = readRequests(settings.requestsFile, settings.url);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "pistache-bench: " << e.what() << std::endl;
+    return 1;
+  }
+
+  Http::Client client;
+  client.init(Http::Client::options()
+                  .threads(settings.threads)
+                  .maxConnectionsPerHost(
+                      static_cast<int>(settings.connections))
+                  .pipelining(settings.pipeline));
+
+  std::cout << "Running " << settings.duration.count() << "ms test @ "
+            << settings.url << "\n"
+            << "  " << settings.threads << " threads and "
+            << settings.connections << " connections, pipelining "
+            << settings.pipeline;
+  if (settings.rate > 0.0)
+    std::cout << ", " << settings.rate << " requests/sec";
+  std::cout << "\n";
+
+  Bench bench(client, settings, specs);
+  const auto elapsed = bench.run();
+
+  client.shutdown();
+
+  bench.report(std::cout, elapsed);
+
+  if (!settings.hdrFile.empty()) {
+    if (settings.hdrFile == "-") {
+      bench.writePercentiles(std::cout);
+    } else {
+      std::ofstream file(settings.hdrFile);
+      if (!file) {
+        std::cerr << "pistache-bench: could not write " << settings.hdrFile
+                  << std::endl;
+        return 1;
+      }
+      bench.writePercentiles(file);
+    }
+  }
+
+  return bench.responses() > 0 ? 0 : 1;
+}